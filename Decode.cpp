@@ -6,14 +6,20 @@
  * LICENSE file in the root directory of this source tree.
  */
 
+#include <algorithm>
 #include <cstdlib>
 #include <cstring>
 #include <fstream>
+#include <future>
 #include <iomanip>
+#include <limits>
+#include <memory>
 #include <mutex>
 #include <string>
 #include <vector>
 
+#include <sys/stat.h>
+
 #include <flashlight/flashlight.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
@@ -24,12 +30,16 @@
 #include "criterion/criterion.h"
 #include "data/Featurize.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/decoder/DecoderPool.h"
+#include "libraries/decoder/DecoderSweep.h"
 #include "libraries/decoder/LexiconFreeDecoder.h"
 #include "libraries/decoder/Seq2SeqDecoder.h"
 #include "libraries/decoder/TokenLMDecoder.h"
 #include "libraries/decoder/WordLMDecoder.h"
+#include "libraries/lm/CachingLM.h"
 #include "libraries/lm/ConvLM.h"
 #include "libraries/lm/KenLM.h"
+#include "libraries/lm/SharedCachingLM.h"
 #include "libraries/lm/ZeroLM.h"
 #include "module/module.h"
 #include "runtime/runtime.h"
@@ -66,6 +76,9 @@ int main(int argc, char** argv) {
   }
 
   EmissionSet emissionSet;
+  // Emission files are mapped and read one utterance at a time, legacy
+  // archives are loaded into `emissionSet`
+  std::unique_ptr<EmissionReader> emissionReader;
   std::shared_ptr<fl::Module> network;
   std::shared_ptr<SequenceCriterion> criterion;
   std::unordered_map<std::string, std::string> cfg;
@@ -76,7 +89,13 @@ int main(int argc, char** argv) {
     std::string loadPath =
         pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
     LOG(INFO) << "[Serialization] Loading file: " << loadPath;
-    W2lSerializer::load(loadPath, emissionSet);
+    if (EmissionReader::isEmissionFile(loadPath)) {
+      emissionReader.reset(new EmissionReader(loadPath));
+      emissionSet.transition = emissionReader->transition();
+      emissionSet.gflags = emissionReader->gflags();
+    } else {
+      W2lSerializer::load(loadPath, emissionSet);
+    }
     gflags::ReadFlagsFromString(emissionSet.gflags, gflags::GetArgv0(), true);
   }
 
@@ -134,10 +153,73 @@ int main(int argc, char** argv) {
 
   Dictionary wordDict;
   LexiconMap lexicon;
-  if (!FLAGS_lexicon.empty()) {
+  FlatTriePtr flatTrie = nullptr;
+  // Fingerprint (FNV-1a) of the inputs of the trie, stored in -lexicon_bin:
+  // an image built from other ones would silently give wrong words and
+  // scores. The lexicon and the LM are identified by path, size and
+  // modification time, so that starting up doesn't read them.
+  uint64_t trieFingerprint = 14695981039346656037ULL;
+  if (FLAGS_uselexicon && !FLAGS_lexicon_bin.empty()) {
+    auto addToFingerprint = [&trieFingerprint](const std::string& data) {
+      for (unsigned char c : data) {
+        trieFingerprint = (trieFingerprint ^ c) * 1099511628211ULL;
+      }
+      trieFingerprint = (trieFingerprint ^ 0xff) * 1099511628211ULL;
+    };
+    auto addFileToFingerprint = [&addToFingerprint](const std::string& path) {
+      struct stat fileStat = {};
+      stat(path.c_str(), &fileStat);
+      addToFingerprint(path);
+      addToFingerprint(std::to_string(fileStat.st_size));
+      addToFingerprint(std::to_string(fileStat.st_mtime));
+    };
+    for (int i = 0; i < tokenDict.indexSize(); i++) {
+      addToFingerprint(tokenDict.getEntry(i));
+    }
+    addFileToFingerprint(FLAGS_lexicon);
+    addToFingerprint(std::to_string(FLAGS_maxword));
+    addToFingerprint(FLAGS_wordseparator);
+    addToFingerprint(FLAGS_smearing);
+    addToFingerprint(FLAGS_decodertype);
+    if (FLAGS_decodertype == "wrd") {
+      addToFingerprint(FLAGS_lmtype);
+      addFileToFingerprint(FLAGS_lm);
+    }
+  }
+
+  bool loadTrie = FLAGS_uselexicon && !FLAGS_lexicon_bin.empty() &&
+      fileExists(FLAGS_lexicon_bin);
+  if (loadTrie) {
+    // The compiled trie comes with the word dictionary it was built with
+    flatTrie = FlatTrie::load(FLAGS_lexicon_bin);
+    if (!FLAGS_lexicon.empty() &&
+        flatTrie->getFingerprint() != trieFingerprint) {
+      LOG(WARNING) << "[Decoder] " << FLAGS_lexicon_bin
+                   << " was built from other inputs, rebuilding it";
+      flatTrie = nullptr;
+      loadTrie = false;
+    } else {
+      if (FLAGS_lexicon.empty()) {
+        // Nothing to rebuild it from: the image is used as is
+        LOG(INFO) << "[Decoder] No -lexicon, using " << FLAGS_lexicon_bin
+                  << " without checking that it matches the other inputs";
+      }
+      for (const auto& word : flatTrie->getWords()) {
+        wordDict.addEntry(word);
+      }
+      wordDict.setDefaultIndex(wordDict.getIndex(kUnkToken));
+      LOG(INFO) << "[Decoder] Trie loaded from " << FLAGS_lexicon_bin << " ("
+                << flatTrie->getNumNodes() << " nodes)";
+      LOG(INFO) << "Number of words: " << wordDict.indexSize();
+    }
+  }
+  // The lexicon is only needed to build the trie or to load the dataset
+  if (!FLAGS_lexicon.empty() && (!loadTrie || FLAGS_emission_dir.empty())) {
     lexicon = loadWords(FLAGS_lexicon, FLAGS_maxword);
-    wordDict = createWordDict(lexicon);
-    LOG(INFO) << "Number of words: " << wordDict.indexSize();
+    if (!loadTrie) {
+      wordDict = createWordDict(lexicon);
+      LOG(INFO) << "Number of words: " << wordDict.indexSize();
+    }
   }
 
   DictionaryMap dicts = {{kTargetIdx, tokenDict}, {kWordIdx, wordDict}};
@@ -194,25 +276,16 @@ int main(int argc, char** argv) {
     }
   }
 
-  int nSample = emissionSet.emissions.size();
+  int nSample = emissionReader ? emissionReader->size()
+                               : emissionSet.emissions.size();
   nSample = FLAGS_maxload > 0 ? std::min(nSample, FLAGS_maxload) : nSample;
-  int nSamplePerThread =
-      std::ceil(nSample / static_cast<float>(FLAGS_nthread_decoder));
-  LOG(INFO) << "[Dataset] Number of samples per thread: " << nSamplePerThread;
+  LOG(INFO) << "[Dataset] Number of samples: " << nSample;
 
   network.reset(); // AM is only used in running forward pass. So we will free
                    // the space of it on GPU or memory. network.use_count() will
                    // be 0 after this call.
   af::deviceGC();
   /* ===================== Decode ===================== */
-  // Prepare counters
-  std::vector<double> sliceWer(FLAGS_nthread_decoder);
-  std::vector<double> sliceLer(FLAGS_nthread_decoder);
-  std::vector<int> sliceNumWords(FLAGS_nthread_decoder, 0);
-  std::vector<int> sliceNumTokens(FLAGS_nthread_decoder, 0);
-  std::vector<int> sliceNumSamples(FLAGS_nthread_decoder, 0);
-  std::vector<double> sliceTime(FLAGS_nthread_decoder, 0);
-
   // Prepare criterion
   CriterionType criterionType = CriterionType::ASG;
   if (FLAGS_criterion == kCtcCriterion) {
@@ -235,24 +308,51 @@ int main(int argc, char** argv) {
       static_cast<float>(FLAGS_unkweight),
       FLAGS_logadd,
       static_cast<float>(FLAGS_silweight),
-      criterionType);
+      criterionType,
+      static_cast<float>(FLAGS_blankskipthreshold),
+      static_cast<float>(FLAGS_tokenmargin));
+
+  // A sweep decodes the test set once per configuration, sharing the
+  // emissions, the trie and the LM between configurations
+  bool sweeping = !FLAGS_sweep.empty();
+  DecoderSweep sweep;
+  if (sweeping) {
+    try {
+      sweep = parseDecoderSweep(
+          FLAGS_sweep, decoderOpt, FLAGS_sweep_samples, FLAGS_seed);
+    } catch (const std::exception& exc) {
+      LOG(FATAL) << "[Decoder] Invalid sweep: " << FLAGS_sweep << "\n"
+                 << exc.what();
+    }
+    LOG(INFO) << "[Decoder] Sweeping " << sweep.options.size()
+              << " configurations";
+  }
 
   // Prepare log writer
   std::mutex hypMutex, refMutex, logMutex;
-  std::ofstream hypStream, refStream, logStream;
+  std::ofstream hypStream, refStream, logStream, sweepStream;
   if (!FLAGS_sclite.empty()) {
     auto fileName = cleanFilepath(FLAGS_test);
-    auto hypPath = pathsConcat(FLAGS_sclite, fileName + ".hyp");
-    auto refPath = pathsConcat(FLAGS_sclite, fileName + ".ref");
     auto logPath = pathsConcat(FLAGS_sclite, fileName + ".log");
-    hypStream.open(hypPath);
-    refStream.open(refPath);
     logStream.open(logPath);
-    if (!hypStream.is_open() || !hypStream.good()) {
-      LOG(FATAL) << "Error opening hypothesis file: " << hypPath;
-    }
-    if (!refStream.is_open() || !refStream.good()) {
-      LOG(FATAL) << "Error opening reference file: " << refPath;
+    if (sweeping) {
+      // A sweep writes a WER table instead of the transcriptions
+      auto sweepPath = pathsConcat(FLAGS_sclite, fileName + ".sweep");
+      sweepStream.open(sweepPath);
+      if (!sweepStream.is_open() || !sweepStream.good()) {
+        LOG(FATAL) << "Error opening sweep file: " << sweepPath;
+      }
+    } else {
+      auto hypPath = pathsConcat(FLAGS_sclite, fileName + ".hyp");
+      auto refPath = pathsConcat(FLAGS_sclite, fileName + ".ref");
+      hypStream.open(hypPath);
+      refStream.open(refPath);
+      if (!hypStream.is_open() || !hypStream.good()) {
+        LOG(FATAL) << "Error opening hypothesis file: " << hypPath;
+      }
+      if (!refStream.is_open() || !refStream.good()) {
+        LOG(FATAL) << "Error opening reference file: " << refPath;
+      }
     }
     if (!logStream.is_open() || !logStream.good()) {
       LOG(FATAL) << "Error opening log file: " << logPath;
@@ -282,6 +382,18 @@ int main(int argc, char** argv) {
   }
 
   std::shared_ptr<LM> lm = std::make_shared<ZeroLM>();
+  // The cache has to hold the beam of every swept configuration
+  int maxBeamSize = FLAGS_beamsize;
+  for (const auto& opt : sweep.options) {
+    maxBeamSize = std::max(maxBeamSize, opt.beamSize);
+  }
+  int convLmCacheSize =
+      FLAGS_lm_conv_cache_size > 0 ? FLAGS_lm_conv_cache_size : maxBeamSize;
+  if (!FLAGS_lm.empty() && FLAGS_lmtype == "convlm" &&
+      convLmCacheSize < maxBeamSize) {
+    LOG(FATAL) << "[ConvLM] -lm_conv_cache_size " << convLmCacheSize
+               << " is smaller than the beam size " << maxBeamSize;
+  }
   if (!FLAGS_lm.empty()) {
     if (FLAGS_lmtype == "kenlm") {
       lm = std::make_shared<KenLM>(FLAGS_lm, usrDict);
@@ -296,12 +408,23 @@ int main(int argc, char** argv) {
       convLmModel->eval();
 
       auto getConvLmScoreFunc = buildGetConvLmScoreFunction(convLmModel);
-      lm = std::make_shared<ConvLM>(
+      auto convLm = std::make_shared<ConvLM>(
           getConvLmScoreFunc,
           FLAGS_lm_vocab,
           usrDict,
           FLAGS_lm_memory,
-          FLAGS_beamsize);
+          convLmCacheSize,
+          /* historySize = */ 49,
+          FLAGS_lm_conv_cache_topk);
+      if (FLAGS_lm_incremental) {
+        try {
+          convLm->setIncrementalScoreFunc(
+              buildGetConvLmIncrementalScoreFunction(convLmModel));
+        } catch (const std::exception& exc) {
+          LOG(FATAL) << "[ConvLM] Cannot score incrementally\n" << exc.what();
+        }
+      }
+      lm = convLm;
     } else {
       LOG(FATAL) << "[LM constructing] Invalid LM Type: " << FLAGS_lmtype;
     }
@@ -312,9 +435,8 @@ int main(int argc, char** argv) {
   int blankIdx =
       FLAGS_criterion == kCtcCriterion ? tokenDict.getIndex(kBlankToken) : -1;
   int silIdx = tokenDict.getIndex(FLAGS_wordseparator);
-  std::shared_ptr<Trie> trie = nullptr;
-  if (FLAGS_uselexicon) {
-    trie = std::make_shared<Trie>(tokenDict.indexSize(), silIdx);
+  if (FLAGS_uselexicon && !flatTrie) {
+    auto trie = std::make_shared<Trie>(tokenDict.indexSize(), silIdx);
     auto startState = lm->start(false);
 
     for (auto& it : lexicon) {
@@ -343,220 +465,386 @@ int main(int argc, char** argv) {
     }
     trie->smear(smear_mode);
     LOG(INFO) << "[Decoder] Trie smeared.\n";
+
+    // Compile the trie once: all the decoder threads share the flat layout
+    flatTrie = std::make_shared<FlatTrie>(*trie);
+    LOG(INFO) << "[Decoder] Trie compiled (" << flatTrie->getNumNodes()
+              << " nodes).\n";
+
+    if (!FLAGS_lexicon_bin.empty()) {
+      std::vector<std::string> words(wordDict.indexSize());
+      for (int i = 0; i < words.size(); ++i) {
+        words[i] = wordDict.getEntry(i);
+      }
+      flatTrie->save(FLAGS_lexicon_bin, words, trieFingerprint);
+      LOG(INFO) << "[Decoder] Trie saved to " << FLAGS_lexicon_bin;
+    }
   }
 
-  // Decoding
-  auto runDecoder = [&](int tid, int start, int end) {
-    try {
-      // Note: These 2 GPU-dependent models should be placed on different cards
-      // for different threads and nthread_decoder should not be greater than
-      // the number of GPUs.
-      std::shared_ptr<SequenceCriterion> localCriterion = criterion;
-      std::shared_ptr<LM> localLm = lm;
-      if (FLAGS_lmtype == "convlm" || criterionType == CriterionType::S2S) {
-        if (tid >= af::getDeviceCount()) {
-          LOG(FATAL)
-              << "FLAGS_nthread_decoder exceeds the number of visible GPUs";
-        }
-        af::setDevice(tid);
+  // Decoding: each thread of the pool builds its own decoder
+  std::vector<CachingLMPtr> cachingLms(FLAGS_nthread_decoder);
+  std::vector<std::shared_ptr<ConvLM>> convLms(FLAGS_nthread_decoder);
+  SharedCachingLMPtr sharedCachingLm;
+  if (sweeping && FLAGS_lm_cache_size > 0 && FLAGS_lmtype != "convlm") {
+    // The configurations of a sweep query the same LM states: the threads
+    // share one cache, keyed by state content
+    sharedCachingLm =
+        std::make_shared<SharedCachingLM>(lm, FLAGS_lm_cache_size);
+  }
+  auto buildDecoder = [&](int tid) {
+    // Note: These 2 GPU-dependent models should be placed on different cards
+    // for different threads and nthread_decoder should not be greater than
+    // the number of GPUs.
+    std::shared_ptr<SequenceCriterion> localCriterion = criterion;
+    std::shared_ptr<LM> localLm = lm;
+    if (FLAGS_lmtype == "convlm" || criterionType == CriterionType::S2S) {
+      if (tid >= af::getDeviceCount()) {
+        LOG(FATAL)
+            << "FLAGS_nthread_decoder exceeds the number of visible GPUs";
       }
+      af::setDevice(tid);
+    }
 
-      // Make a copy for non-main threads.
-      if (tid != 0) {
-        if (FLAGS_lmtype == "convlm") {
-          LOG(INFO) << "[ConvLM]: Loading LM from " << FLAGS_lm;
-          std::shared_ptr<fl::Module> convLmModel;
-          W2lSerializer::load(FLAGS_lm, convLmModel);
-          convLmModel->eval();
-
-          auto getConvLmScoreFunc = buildGetConvLmScoreFunction(convLmModel);
-          localLm = std::make_shared<ConvLM>(
-              getConvLmScoreFunc,
-              FLAGS_lm_vocab,
-              usrDict,
-              FLAGS_lm_memory,
-              FLAGS_beamsize);
+    // Make a copy for non-main threads.
+    if (tid != 0) {
+      if (FLAGS_lmtype == "convlm") {
+        LOG(INFO) << "[ConvLM]: Loading LM from " << FLAGS_lm;
+        std::shared_ptr<fl::Module> convLmModel;
+        W2lSerializer::load(FLAGS_lm, convLmModel);
+        convLmModel->eval();
+
+        auto getConvLmScoreFunc = buildGetConvLmScoreFunction(convLmModel);
+        auto convLm = std::make_shared<ConvLM>(
+            getConvLmScoreFunc,
+            FLAGS_lm_vocab,
+            usrDict,
+            FLAGS_lm_memory,
+            convLmCacheSize,
+            /* historySize = */ 49,
+            FLAGS_lm_conv_cache_topk);
+        if (FLAGS_lm_incremental) {
+          convLm->setIncrementalScoreFunc(
+              buildGetConvLmIncrementalScoreFunction(convLmModel));
         }
+        localLm = convLm;
+      }
 
-        if (criterionType == CriterionType::S2S) {
-          std::shared_ptr<fl::Module> dummyNetwork;
-          std::unordered_map<std::string, std::string> dummyCfg;
-          W2lSerializer::load(FLAGS_am, dummyCfg, dummyNetwork, localCriterion);
-          localCriterion->eval();
-        }
+      if (criterionType == CriterionType::S2S) {
+        std::shared_ptr<fl::Module> dummyNetwork;
+        std::unordered_map<std::string, std::string> dummyCfg;
+        W2lSerializer::load(FLAGS_am, dummyCfg, dummyNetwork, localCriterion);
+        localCriterion->eval();
       }
+    }
 
-      // Build Decoder
-      std::unique_ptr<Decoder> decoder;
-      if (FLAGS_decodertype == "wrd") {
-        decoder.reset(new WordLMDecoder(
+    convLms[tid] = std::dynamic_pointer_cast<ConvLM>(localLm);
+    if (sharedCachingLm) {
+      localLm = sharedCachingLm;
+    } else if (FLAGS_lm_cache_size > 0) {
+      cachingLms[tid] =
+          std::make_shared<CachingLM>(localLm, FLAGS_lm_cache_size);
+      localLm = cachingLms[tid];
+    }
+
+    // Build Decoder
+    std::unique_ptr<Decoder> decoder;
+    if (FLAGS_decodertype == "wrd") {
+      decoder.reset(new WordLMDecoder(
+          decoderOpt,
+          flatTrie,
+          localLm,
+          silIdx,
+          blankIdx,
+          unkWordIdx,
+          transition));
+      LOG(INFO) << "[Decoder] Decoder with word-LM loaded in thread: " << tid;
+    } else if (FLAGS_decodertype == "tkn") {
+      if (criterionType == CriterionType::S2S) {
+        auto amUpdateFunc = buildAmUpdateFunction(localCriterion);
+        int eosIdx = tokenDict.getIndex(kEosToken);
+
+        decoder.reset(new Seq2SeqDecoder(
             decoderOpt,
-            trie,
+            localLm,
+            eosIdx,
+            amUpdateFunc,
+            FLAGS_maxdecoderoutputlen,
+            static_cast<float>(FLAGS_hardselection),
+            static_cast<float>(FLAGS_softselection)));
+        LOG(INFO)
+            << "[Decoder] Seq2Seq decoder with token-LM loaded in thread: "
+            << tid;
+      } else if (FLAGS_uselexicon) {
+        decoder.reset(new TokenLMDecoder(
+            decoderOpt,
+            flatTrie,
             localLm,
             silIdx,
             blankIdx,
             unkWordIdx,
             transition));
-        LOG(INFO) << "[Decoder] Decoder with word-LM loaded in thread: " << tid;
-      } else if (FLAGS_decodertype == "tkn") {
-        if (criterionType == CriterionType::S2S) {
-          auto amUpdateFunc = buildAmUpdateFunction(localCriterion);
-          int eosIdx = tokenDict.getIndex(kEosToken);
-
-          decoder.reset(new Seq2SeqDecoder(
-              decoderOpt,
-              localLm,
-              eosIdx,
-              amUpdateFunc,
-              FLAGS_maxdecoderoutputlen,
-              static_cast<float>(FLAGS_hardselection),
-              static_cast<float>(FLAGS_softselection)));
-          LOG(INFO)
-              << "[Decoder] Seq2Seq decoder with token-LM loaded in thread: "
-              << tid;
-        } else if (FLAGS_uselexicon) {
-          decoder.reset(new TokenLMDecoder(
-              decoderOpt,
-              trie,
-              localLm,
-              silIdx,
-              blankIdx,
-              unkWordIdx,
-              transition));
-          LOG(INFO) << "[Decoder] Decoder with token-LM loaded in thread: "
-                    << tid;
-        } else {
-          decoder.reset(new LexiconFreeDecoder(
-              decoderOpt, localLm, silIdx, blankIdx, transition));
-          LOG(INFO)
-              << "[Decoder] Lexicon-free decoder with token-LM loaded in thread: "
-              << tid;
-        }
+        LOG(INFO) << "[Decoder] Decoder with token-LM loaded in thread: "
+                  << tid;
       } else {
-        LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
+        decoder.reset(new LexiconFreeDecoder(
+            decoderOpt, localLm, silIdx, blankIdx, transition));
+        LOG(INFO)
+            << "[Decoder] Lexicon-free decoder with token-LM loaded in thread: "
+            << tid;
       }
+    } else {
+      LOG(FATAL) << "Unsupported decoder type: " << FLAGS_decodertype;
+    }
+    return decoder;
+  };
 
-      // Get data and run decoder
-      TestMeters meters;
-      int sliceSize = end - start;
-      meters.timer.resume();
-      for (int s = start; s < end; s++) {
-        auto emission = emissionSet.emissions[s];
-        auto wordTarget = emissionSet.wordTargets[s];
-        auto tokenTarget = emissionSet.tokenTargets[s];
-        auto sampleId = emissionSet.sampleIds[s];
-        auto T = emissionSet.emissionT[s];
-        auto N = emissionSet.emissionN;
-
-        // DecodeResult
-        auto results = decoder->decode(emission.data(), T, N);
-
-        // Cleanup predictions
-        auto& rawWordPrediction = results[0].words;
-        auto& rawTokenPrediction = results[0].tokens;
+  if (FLAGS_nthread_decoder < 1) {
+    LOG(FATAL) << "Invalid nthread_decoder";
+  }
+  auto timer = fl::TimeMeter();
+  timer.resume();
+  std::unique_ptr<DecoderPool> decoderPool;
+  try {
+    decoderPool.reset(new DecoderPool(FLAGS_nthread_decoder, buildDecoder));
+  } catch (const std::exception& exc) {
+    LOG(FATAL) << "[Decoder] Failed to build decoders\n" << exc.what();
+  }
 
-        auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
-        auto letterPrediction =
-            tknPrediction2Ltr(rawTokenPrediction, tokenDict);
-        std::vector<std::string> wordPrediction;
-        if (FLAGS_uselexicon) {
-          rawWordPrediction =
-              validateIdx(rawWordPrediction, wordDict.getIndex(kUnkToken));
-          wordPrediction = wrdIdx2Wrd(rawWordPrediction, wordDict);
-        } else {
-          wordPrediction = tkn2Wrd(letterPrediction);
-        }
+  // Word and letter predictions of a hypothesis
+  auto cleanupPrediction = [&](DecodeResult& result) {
+    auto letterPrediction = tknPrediction2Ltr(result.tokens, tokenDict);
+    std::vector<std::string> wordPrediction;
+    if (FLAGS_uselexicon) {
+      result.words = validateIdx(result.words, wordDict.getIndex(kUnkToken));
+      wordPrediction = wrdIdx2Wrd(result.words, wordDict);
+    } else {
+      wordPrediction = tkn2Wrd(letterPrediction);
+    }
+    return std::make_pair(wordPrediction, letterPrediction);
+  };
 
-        // Update meters & print out predictions
-        meters.werSlice.add(wordPrediction, wordTarget);
-        meters.lerSlice.add(letterPrediction, letterTarget);
+  auto logCacheStats = [&]() {
+    if (sharedCachingLm) {
+      auto stats = sharedCachingLm->getStats();
+      LOG(INFO) << "[Decoder] Shared LM cache: " << stats.hits << " hits, "
+                << stats.misses << " misses (" << stats.hitRate() * 100
+                << "%)";
+    }
+    for (int tid = 0; tid < cachingLms.size(); tid++) {
+      if (cachingLms[tid]) {
+        auto stats = cachingLms[tid]->getStats();
+        LOG(INFO) << "[Decoder] LM cache in thread " << tid << ": "
+                  << stats.hits << " hits, " << stats.misses << " misses ("
+                  << stats.hitRate() * 100 << "%)";
+      }
+      if (convLms[tid]) {
+        auto stats = convLms[tid]->getStats();
+        LOG(INFO) << "[Decoder] ConvLM cache in thread " << tid << ": "
+                  << stats.hits << " hits, " << stats.misses << " misses ("
+                  << stats.hitRate() * 100 << "%)";
+      }
+    }
+  };
 
-        auto wordTargetStr = join(" ", wordTarget);
-        auto wordPredictionStr = join(" ", wordPrediction);
-        if (!FLAGS_sclite.empty()) {
-          std::string suffix = " (" + sampleId + ")\n";
-          writeHyp(wordPredictionStr + suffix);
-          writeRef(wordTargetStr + suffix);
-        }
+  // Tasks only keep the predictions of the best hypothesis: the pool runs the
+  // longest utterances first, while results are collected in data set order
+  using Prediction =
+      std::pair<std::vector<std::string>, std::vector<std::string>>;
+  using TimedPrediction = std::pair<Prediction, double>;
+
+  if (sweeping) {
+    // The configurations of an utterance are queued together, so that they
+    // run while its LM states are in the caches
+    int nConfig = sweep.options.size();
+    std::vector<std::vector<std::future<TimedPrediction>>> futurePredictions(
+        nConfig);
+    for (int s = 0; s < nSample; s++) {
+      auto T = emissionReader ? emissionReader->info(s).T
+                              : emissionSet.emissionT[s];
+      auto N = emissionReader ? emissionReader->N() : emissionSet.emissionN;
+      for (int c = 0; c < nConfig; c++) {
+        futurePredictions[c].push_back(decoderPool->enqueue(
+            T,
+            [&emissionSet, &emissionReader, &sweep, &cleanupPrediction, s, c,
+             T, N](Decoder& decoder) {
+              auto decodeTimer = fl::TimeMeter();
+              decodeTimer.resume();
+              std::vector<float> storedEmission;
+              if (emissionReader) {
+                storedEmission = emissionReader->emission(s);
+              }
+              const auto& emission =
+                  emissionReader ? storedEmission : emissionSet.emissions[s];
+              decoder.setOptions(sweep.options[c]);
+              auto results = decoder.decode(emission.data(), T, N);
+              decodeTimer.stop();
+              return std::make_pair(
+                  cleanupPrediction(results[0]), decodeTimer.value());
+            }));
+      }
+    }
 
-        if (FLAGS_show) {
-          meters.wer.reset();
-          meters.ler.reset();
-          meters.wer.add(wordPrediction, wordTarget);
-          meters.ler.add(letterPrediction, letterTarget);
-
-          std::stringstream buffer;
-          buffer << "|T|: " << wordTargetStr << std::endl;
-          buffer << "|P|: " << wordPredictionStr << std::endl;
-          if (FLAGS_showletters) {
-            buffer << "|t|: " << join(" ", letterTarget) << std::endl;
-            buffer << "|p|: " << join(" ", letterPrediction) << std::endl;
-          }
-          buffer << "[sample: " << sampleId
-                 << ", WER: " << meters.wer.value()[0]
-                 << "\%, LER: " << meters.ler.value()[0]
-                 << "\%, slice WER: " << meters.werSlice.value()[0]
-                 << "\%, slice LER: " << meters.lerSlice.value()[0]
-                 << "\%, progress (slice " << tid
-                 << "): " << static_cast<float>(s - start + 1) / sliceSize * 100
-                 << "\%]" << std::endl;
-
-          std::cout << buffer.str();
-          if (!FLAGS_sclite.empty()) {
-            writeLog(buffer.str());
-          }
+    std::stringstream table;
+    table << "config\t" << join("\t", sweep.names)
+          << "\tWER\tLER\ttime (s/sample)" << std::endl;
+    int bestConfig = 0;
+    double bestWer = std::numeric_limits<double>::infinity();
+    for (int c = 0; c < nConfig; c++) {
+      TestMeters configMeters;
+      double configTime = 0;
+      for (int s = 0; s < nSample; s++) {
+        auto wordTarget = emissionReader ? emissionReader->info(s).wordTarget
+                                         : emissionSet.wordTargets[s];
+        auto tokenTarget = emissionReader
+            ? emissionReader->info(s).tokenTarget
+            : emissionSet.tokenTargets[s];
+        TimedPrediction timedPrediction;
+        try {
+          timedPrediction = futurePredictions[c][s].get();
+        } catch (const std::exception& exc) {
+          auto sampleId = emissionReader ? emissionReader->info(s).sampleId
+                                         : emissionSet.sampleIds[s];
+          LOG(FATAL) << "Exception while decoding " << sampleId << " with "
+                     << sweep.describe(c) << "\n"
+                     << exc.what();
         }
+        configTime += timedPrediction.second;
+        auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
+        configMeters.werSlice.add(timedPrediction.first.first, wordTarget);
+        configMeters.lerSlice.add(timedPrediction.first.second, letterTarget);
+      }
 
-        // Update conters
-        sliceNumWords[tid] += wordTarget.size();
-        sliceNumTokens[tid] += letterTarget.size();
+      double configWer = configMeters.werSlice.value()[0];
+      double configLer = configMeters.lerSlice.value()[0];
+      if (configWer < bestWer) {
+        bestWer = configWer;
+        bestConfig = c;
+      }
+      LOG(INFO) << "[Sweep] " << sweep.describe(c) << " -- WER: " << configWer
+                << ", LER: " << configLer;
+      table << c;
+      for (auto value : sweep.values[c]) {
+        table << "\t" << value;
       }
-      meters.timer.stop();
-      sliceWer[tid] = meters.werSlice.value()[0];
-      sliceLer[tid] = meters.lerSlice.value()[0];
-      sliceNumSamples[tid] = sliceSize;
-      sliceTime[tid] = meters.timer.value();
+      table << "\t" << configWer << "\t" << configLer << "\t"
+            << configTime / nSample << std::endl;
+    }
+    decoderPool.reset();
+    timer.stop();
+    logCacheStats();
+
+    std::stringstream buffer;
+    buffer << "------\n";
+    buffer << "[Sweep " << FLAGS_test << " (" << nSample << " samples, "
+           << nConfig << " configurations) in " << timer.value()
+           << "s -- best: " << sweep.describe(bestConfig)
+           << ", WER: " << bestWer << "]" << std::endl;
+    LOG(INFO) << "[Sweep] WER per configuration\n" << table.str();
+    LOG(INFO) << buffer.str();
+    if (!FLAGS_sclite.empty()) {
+      sweepStream << table.str();
+      writeLog(table.str() + buffer.str());
+      sweepStream.close();
+      logStream.close();
+    }
+    return 0;
+  }
+
+  std::vector<std::future<TimedPrediction>> futurePredictions;
+  for (int s = 0; s < nSample; s++) {
+    auto T = emissionReader ? emissionReader->info(s).T
+                            : emissionSet.emissionT[s];
+    auto N = emissionReader ? emissionReader->N() : emissionSet.emissionN;
+    futurePredictions.push_back(decoderPool->enqueue(
+        T,
+        [&emissionSet, &emissionReader, &cleanupPrediction, s, T, N](
+            Decoder& decoder) {
+          auto decodeTimer = fl::TimeMeter();
+          decodeTimer.resume();
+          // Only the utterances being decoded are held in memory
+          std::vector<float> storedEmission;
+          if (emissionReader) {
+            storedEmission = emissionReader->emission(s);
+          }
+          const auto& emission =
+              emissionReader ? storedEmission : emissionSet.emissions[s];
+          auto results = decoder.decode(emission.data(), T, N);
+          decodeTimer.stop();
+          return std::make_pair(
+              cleanupPrediction(results[0]), decodeTimer.value());
+        }));
+  }
+
+  TestMeters meters;
+  double totalTime = 0;
+  for (int s = 0; s < nSample; s++) {
+    auto wordTarget = emissionReader ? emissionReader->info(s).wordTarget
+                                     : emissionSet.wordTargets[s];
+    auto tokenTarget = emissionReader ? emissionReader->info(s).tokenTarget
+                                      : emissionSet.tokenTargets[s];
+    auto sampleId = emissionReader ? emissionReader->info(s).sampleId
+                                   : emissionSet.sampleIds[s];
+
+    // Cleaned up predictions
+    std::vector<std::string> wordPrediction, letterPrediction;
+    try {
+      auto timedPrediction = futurePredictions[s].get();
+      std::tie(wordPrediction, letterPrediction) =
+          std::move(timedPrediction.first);
+      totalTime += timedPrediction.second;
     } catch (const std::exception& exc) {
-      LOG(FATAL) << "Exception in thread " << tid << "\n" << exc.what();
+      LOG(FATAL) << "Exception while decoding " << sampleId << "\n"
+                 << exc.what();
+    }
+    auto letterTarget = tknTarget2Ltr(tokenTarget, tokenDict);
+
+    // Update meters & print out predictions
+    meters.werSlice.add(wordPrediction, wordTarget);
+    meters.lerSlice.add(letterPrediction, letterTarget);
+
+    auto wordTargetStr = join(" ", wordTarget);
+    auto wordPredictionStr = join(" ", wordPrediction);
+    if (!FLAGS_sclite.empty()) {
+      std::string suffix = " (" + sampleId + ")\n";
+      writeHyp(wordPredictionStr + suffix);
+      writeRef(wordTargetStr + suffix);
     }
-  };
 
-  /* Spread threades */
-  auto startThreads = [&]() {
-    if (FLAGS_nthread_decoder == 1) {
-      runDecoder(0, 0, nSample);
-    } else if (FLAGS_nthread_decoder > 1) {
-      fl::ThreadPool threadPool(FLAGS_nthread_decoder);
-      for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-        int start = i * nSamplePerThread;
-        if (start >= nSample) {
-          break;
-        }
-        int end = std::min((i + 1) * nSamplePerThread, nSample);
-        threadPool.enqueue(runDecoder, i, start, end);
+    if (FLAGS_show) {
+      meters.wer.reset();
+      meters.ler.reset();
+      meters.wer.add(wordPrediction, wordTarget);
+      meters.ler.add(letterPrediction, letterTarget);
+
+      std::stringstream buffer;
+      buffer << "|T|: " << wordTargetStr << std::endl;
+      buffer << "|P|: " << wordPredictionStr << std::endl;
+      if (FLAGS_showletters) {
+        buffer << "|t|: " << join(" ", letterTarget) << std::endl;
+        buffer << "|p|: " << join(" ", letterPrediction) << std::endl;
+      }
+      buffer << "[sample: " << sampleId
+             << ", WER: " << meters.wer.value()[0]
+             << "\%, LER: " << meters.ler.value()[0]
+             << "\%, total WER: " << meters.werSlice.value()[0]
+             << "\%, total LER: " << meters.lerSlice.value()[0]
+             << "\%, progress: " << static_cast<float>(s + 1) / nSample * 100
+             << "\%]" << std::endl;
+
+      std::cout << buffer.str();
+      if (!FLAGS_sclite.empty()) {
+        writeLog(buffer.str());
       }
-    } else {
-      LOG(FATAL) << "Invalid nthread_decoder";
     }
-  };
-  auto timer = fl::TimeMeter();
-  timer.resume();
-  startThreads();
+  }
+  decoderPool.reset();
   timer.stop();
+  logCacheStats();
 
   /* Compute statistics */
-  int totalTokens = 0, totalWords = 0, totalSamples = 0;
-  for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-    totalTokens += sliceNumTokens[i];
-    totalWords += sliceNumWords[i];
-    totalSamples += sliceNumSamples[i];
-  }
-  double totalWer = 0, totalLer = 0, totalTime = 0;
-  for (int i = 0; i < FLAGS_nthread_decoder; i++) {
-    totalWer += sliceWer[i] * sliceNumWords[i] / totalWords;
-    totalLer += sliceLer[i] * sliceNumTokens[i] / totalTokens;
-    totalTime += sliceTime[i];
-  }
+  int totalSamples = nSample;
+  double totalWer = meters.werSlice.value()[0];
+  double totalLer = meters.lerSlice.value()[0];
 
   std::stringstream buffer;
   buffer << "------\n";
@@ -8,6 +8,7 @@
 
 #include <stdlib.h>
 #include <fstream>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -136,8 +137,20 @@ int main(int argc, char** argv) {
     }
   }
 
-  TestMeters meters;
+  // Emissions are written as they are produced, unless the legacy archive is
+  // requested
+  std::string cleanedTestPath = cleanFilepath(FLAGS_test);
+  std::string savePath =
+      pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
   EmissionSet emissionSet;
+  std::unique_ptr<EmissionWriter> emissionWriter;
+  if (FLAGS_emission_type != "cereal") {
+    LOG(INFO) << "[Serialization] Saving into file: " << savePath;
+    emissionWriter.reset(new EmissionWriter(
+        savePath, emissionTypeFromString(FLAGS_emission_type)));
+  }
+
+  TestMeters meters;
   meters.timer.resume();
   int cnt = 0;
   for (auto& sample : *ds) {
@@ -192,16 +205,20 @@ int main(int argc, char** argv) {
     /* Save emission and targets */
     int N = rawEmission.dims(0);
     int T = rawEmission.dims(1);
-    emissionSet.emissions.emplace_back(emission);
-    emissionSet.tokenTargets.emplace_back(tokenTarget);
-    emissionSet.wordTargets.emplace_back(wordTargetStr);
+    if (emissionWriter) {
+      emissionWriter->add(
+          sampleId, emission.data(), T, N, tokenTarget, wordTargetStr);
+    } else {
+      emissionSet.emissions.emplace_back(emission);
+      emissionSet.tokenTargets.emplace_back(tokenTarget);
+      emissionSet.wordTargets.emplace_back(wordTargetStr);
 
-    // while testing we use batchsize 1 and hence ds only has 1 sampleid
-    emissionSet.sampleIds.emplace_back(
-        readSampleIds(sample[kSampleIdx]).front());
+      // while testing we use batchsize 1 and hence ds only has 1 sampleid
+      emissionSet.sampleIds.emplace_back(sampleId);
 
-    emissionSet.emissionT.emplace_back(T);
-    emissionSet.emissionN = N;
+      emissionSet.emissionT.emplace_back(T);
+      emissionSet.emissionN = N;
+    }
 
     ++cnt;
     if (cnt == FLAGS_maxload) {
@@ -212,6 +229,9 @@ int main(int argc, char** argv) {
     emissionSet.transition = afToVector<float>(criterion->param(0).array());
   }
   emissionSet.gflags = serializeGflags();
+  if (emissionWriter) {
+    emissionWriter->close(emissionSet.transition, emissionSet.gflags);
+  }
 
   meters.timer.stop();
   std::cout << "---\n[total WER: " << meters.werSlice.value()[0]
@@ -219,11 +239,10 @@ int main(int argc, char** argv) {
             << "\%, time: " << meters.timer.value() << "s]" << std::endl;
 
   /* ====== Serialize emission and targets for decoding ====== */
-  std::string cleanedTestPath = cleanFilepath(FLAGS_test);
-  std::string savePath =
-      pathsConcat(FLAGS_emission_dir, cleanedTestPath + ".bin");
-  LOG(INFO) << "[Serialization] Saving into file: " << savePath;
-  W2lSerializer::save(savePath, emissionSet);
+  if (!emissionWriter) {
+    LOG(INFO) << "[Serialization] Saving into file: " << savePath;
+    W2lSerializer::save(savePath, emissionSet);
+  }
 
   return 0;
 }
@@ -352,6 +352,9 @@ int main(int argc, char** argv) {
   /* ===================== Create Dataset ===================== */
   auto trainds = createDataset(
       FLAGS_train, dicts, lexicon, FLAGS_batchsize, worldRank, worldSize);
+  if (FLAGS_maxbatchisz > 0) {
+    trainds->setMaxBatchInputSize(FLAGS_maxbatchisz);
+  }
 
   if (FLAGS_noresample) {
     LOG_MASTER(INFO) << "Shuffling trainset";
@@ -451,7 +454,7 @@ int main(int argc, char** argv) {
     fl::allReduceParameters(ntwrk);
     fl::allReduceParameters(crit);
 
-    auto resetTimeStatMeters = [&meters]() {
+    auto resetTimeStatMeters = [&meters, &trainset]() {
       meters.runtime.reset();
       meters.stats.reset();
       meters.sampletimer.reset();
@@ -460,6 +463,7 @@ int main(int argc, char** argv) {
       meters.bwdtimer.reset();
       meters.optimtimer.reset();
       meters.timer.reset();
+      trainset->resetPrefetchStats();
     };
     auto runValAndSaveModel = [&](int64_t epoch, double lr, double lrcrit) {
       meters.runtime.stop();
@@ -469,6 +473,16 @@ int main(int argc, char** argv) {
       meters.critfwdtimer.stop();
       meters.bwdtimer.stop();
       meters.optimtimer.stop();
+      auto prefetch = trainset->getPrefetchStats();
+      meters.loadstall.reset();
+      meters.prefetchdepth.reset();
+      if (prefetch.requests > 0) {
+        meters.loadstall.add(
+            prefetch.stallSec * 1000 / prefetch.requests, prefetch.requests);
+        meters.prefetchdepth.add(
+            static_cast<double>(prefetch.queueDepthSum) / prefetch.requests,
+            prefetch.requests);
+      }
 
       // valid
       for (auto& vds : validds) {
@@ -527,7 +541,8 @@ int main(int argc, char** argv) {
         af::sync();
         meters.timer.incUnit();
         meters.sampletimer.stopAndIncUnit();
-        meters.stats.add(sample[kInputIdx], sample[kTargetIdx]);
+        meters.stats.add(
+            sample[kInputIdx], sample[kTargetIdx], sample[kInputSizeIdx]);
         if (af::anyTrue<bool>(af::isNaN(sample[kInputIdx])) ||
             af::anyTrue<bool>(af::isNaN(sample[kTargetIdx]))) {
           LOG(FATAL) << "Sample has NaN values - "
@@ -572,11 +587,13 @@ int main(int argc, char** argv) {
         meters.optimtimer.resume();
 
         // scale down gradients by batchsize
+        auto batchSz = FLAGS_maxbatchisz > 0 ? sample[kInputIdx].dims(3)
+                                             : FLAGS_batchsize;
         for (const auto& p : ntwrk->params()) {
-          p.grad() = p.grad() / FLAGS_batchsize;
+          p.grad() = p.grad() / batchSz;
         }
         for (const auto& p : crit->params()) {
-          p.grad() = p.grad() / FLAGS_batchsize;
+          p.grad() = p.grad() / batchSz;
         }
 
         // clamp gradients
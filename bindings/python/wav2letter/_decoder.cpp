@@ -12,7 +12,9 @@
 #include "libraries/decoder/WordLMDecoder.h"
 
 #ifdef W2L_LIBRARIES_USE_KENLM
+#include "libraries/lm/CachingLM.h"
 #include "libraries/lm/KenLM.h"
+#include "libraries/lm/SharedCachingLM.h"
 #endif
 
 namespace py = pybind11;
@@ -62,6 +64,10 @@ class PyLM : public LM {
       const override {
     PYBIND11_OVERLOAD_PURE(int, LM, compareState, state1, state2);
   }
+
+  size_t stateHash(const LMStatePtr& state) const override {
+    PYBIND11_OVERLOAD_PURE(size_t, LM, stateHash, state);
+  }
 };
 
 void WordLMDecoder_decodeStep(
@@ -105,12 +111,30 @@ PYBIND11_MODULE(_decoder, m) {
       .def("search", &Trie::search, "indices"_a)
       .def("smear", &Trie::smear, "smear_mode"_a);
 
+  py::class_<FlatTrie, std::shared_ptr<FlatTrie>>(m, "FlatTrie")
+      .def(py::init<const Trie&>(), "trie"_a)
+      .def_static(
+          "load",
+          [](const std::string& path) {
+            // pybind11 holders can't be shared_ptr<const T>
+            return std::const_pointer_cast<FlatTrie>(FlatTrie::load(path));
+          },
+          "path"_a)
+      .def("save", &FlatTrie::save, "path"_a, "words"_a, "fingerprint"_a = 0)
+      .def("get_words", &FlatTrie::getWords)
+      .def("get_fingerprint", &FlatTrie::getFingerprint)
+      .def("get_root", &FlatTrie::getRoot)
+      .def("get_num_nodes", &FlatTrie::getNumNodes)
+      .def("search", &FlatTrie::search, "indices"_a)
+      .def("get_max_score", &FlatTrie::getMaxScore, "node"_a);
+
   py::class_<LM, LMPtr, PyLM>(m, "LM")
       .def(py::init<>())
       .def("start", &LM::start, "start_with_nothing"_a)
       .def("score", &LM::score, "state"_a, "usr_token_idx"_a)
       .def("finish", &LM::finish, "state"_a)
-      .def("compare_state", &LM::compareState, "state1"_a, "state2"_a);
+      .def("compare_state", &LM::compareState, "state1"_a, "state2"_a)
+      .def("state_hash", &LM::stateHash, "state"_a);
 
 #ifdef W2L_LIBRARIES_USE_KENLM
   py::class_<KenLM, KenLMPtr, LM>(m, "KenLM")
@@ -118,6 +142,19 @@ PYBIND11_MODULE(_decoder, m) {
           py::init<const std::string&, const Dictionary&>(),
           "path"_a,
           "usr_token_dict"_a);
+
+  py::class_<CachingLM::CacheStats>(m, "CacheStats")
+      .def_readonly("hits", &CachingLM::CacheStats::hits)
+      .def_readonly("misses", &CachingLM::CacheStats::misses)
+      .def("hit_rate", &CachingLM::CacheStats::hitRate);
+
+  py::class_<CachingLM, CachingLMPtr, LM>(m, "CachingLM")
+      .def(py::init<const LMPtr&, int>(), "lm"_a, "cache_size"_a)
+      .def("get_stats", &CachingLM::getStats);
+
+  py::class_<SharedCachingLM, SharedCachingLMPtr, LM>(m, "SharedCachingLM")
+      .def(py::init<const LMPtr&, int>(), "lm"_a, "cache_size"_a)
+      .def("get_stats", &SharedCachingLM::getStats);
 #endif
 
   py::enum_<CriterionType>(m, "CriterionType")
@@ -150,7 +187,10 @@ PYBIND11_MODULE(_decoder, m) {
       .def_readwrite("unk_score", &DecoderOptions::unkScore)
       .def_readwrite("log_add", &DecoderOptions::logAdd)
       .def_readwrite("sil_weight", &DecoderOptions::silWeight)
-      .def_readwrite("criterion_type", &DecoderOptions::criterionType);
+      .def_readwrite("criterion_type", &DecoderOptions::criterionType)
+      .def_readwrite(
+          "blank_skip_threshold", &DecoderOptions::blankSkipThreshold)
+      .def_readwrite("token_margin", &DecoderOptions::tokenMargin);
 
   py::class_<DecodeResult>(m, "DecodeResult")
       .def(py::init<int>(), "length"_a)
@@ -168,6 +208,14 @@ PYBIND11_MODULE(_decoder, m) {
            const int,
            const int,
            const std::vector<float>&>())
+      .def(py::init<
+           const DecoderOptions&,
+           const std::shared_ptr<FlatTrie>,
+           const LMPtr,
+           const int,
+           const int,
+           const int,
+           const std::vector<float>&>())
       .def("decode_begin", &WordLMDecoder::decodeBegin)
       .def(
           "decode_step", &WordLMDecoder_decodeStep, "emissions"_a, "T"_a, "N"_a)
@@ -178,5 +226,7 @@ PYBIND11_MODULE(_decoder, m) {
           "get_best_hypothesis",
           &WordLMDecoder::getBestHypothesis,
           "look_back"_a = 0)
-      .def("get_all_final_hypothesis", &WordLMDecoder::getAllFinalHypothesis);
+      .def("get_all_final_hypothesis", &WordLMDecoder::getAllFinalHypothesis)
+      .def("set_options", &WordLMDecoder::setOptions, "opt"_a)
+      .def("get_options", &WordLMDecoder::getOptions);
 }
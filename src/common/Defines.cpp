@@ -18,6 +18,12 @@ DEFINE_string(train, "", "comma-separated list of training data");
 DEFINE_string(valid, "", "comma-separated list of valid data");
 DEFINE_string(test, "", "comma-separated list of test data");
 DEFINE_int64(batchsize, 1, "batch size (per process in distributed training)");
+DEFINE_int64(
+    maxbatchisz,
+    0,
+    "if > 0, use training batches of variable size instead of -batchsize, "
+    "whose number of samples times max input size (in msec) is at most this "
+    "(per process)");
 DEFINE_string(input, "flac", "input feature");
 DEFINE_int64(samplerate, 16000, "sample rate (Hz)");
 DEFINE_int64(channels, 1, "number of input channels");
@@ -40,6 +46,10 @@ DEFINE_string(
 DEFINE_int64(inputbinsize, 100, "Bin size along audio length axis");
 DEFINE_int64(outputbinsize, 5, "Bin size along transcript length axis");
 DEFINE_bool(blobdata, false, "use blobs instead of folders as input data");
+DEFINE_bool(
+    packeddata,
+    false,
+    "use packed audio datasets (written by PackAudio) as input data");
 DEFINE_string(
     wordseparator,
     kSilToken,
@@ -48,6 +58,10 @@ DEFINE_double(
     sampletarget,
     0.0,
     "probability [0.0, 1.0] for randomly sampling targets from a lexicon if there are multiple mappings from a word");
+DEFINE_string(
+    featurecache,
+    "",
+    "path to a file caching the features of each audio file across epochs and runs (with -pow, -mfsc or -mfcc); utterances are featurized one by one and zero-padded in the feature domain");
 
 // FILTERING OPTIONS
 DEFINE_int64(minisz, 0, "min input size (in msec) allowed during training");
@@ -121,6 +135,10 @@ DEFINE_string(archdir, "", "arch root directory");
 DEFINE_string(flagsfile, "", "File specifying gflags");
 DEFINE_string(runname, "", "name of current run");
 DEFINE_int64(nthread, 1, "specify number of threads for data parallelization");
+DEFINE_int64(
+    prefetchdepth,
+    0,
+    "max number of batches loaded ahead by the data threads; -nthread if 0");
 DEFINE_string(
     tag,
     "",
@@ -155,8 +173,20 @@ DEFINE_bool(uselexicon, true, "use lexicon in decoding");
 DEFINE_string(smearing, "none", "none, max or logadd");
 DEFINE_string(lmtype, "kenlm", "kenlm, convlm");
 DEFINE_string(lexicon, "", "path/to/lexicon.txt");
+DEFINE_string(
+    lexicon_bin,
+    "",
+    "path/to/lexicon.bin, compiled trie and word list mapped by the decoder; "
+    "written from -lexicon and -lm on first use, and rewritten when they, "
+    "the tokens, -smearing or -decodertype change; used as is without "
+    "-lexicon");
 DEFINE_string(lm_vocab, "", "path/to/lm_vocab.txt");
 DEFINE_string(emission_dir, "", "path/to/emission_dir/");
+DEFINE_string(
+    emission_type,
+    "f32",
+    "storage of the emissions written by Test: f32, f16, u8 (8-bit, quantized "
+    "per frame) or cereal (single archive, loaded at once by Decode)");
 DEFINE_string(lm, "", "path/to/language_model");
 DEFINE_string(am, "", "path/to/acoustic_model");
 DEFINE_string(sclite, "", "path/to/sclite to be written");
@@ -170,6 +200,27 @@ DEFINE_double(
     -std::numeric_limits<float>::infinity(),
     "unknown word weight");
 DEFINE_double(beamthreshold, 25, "beam score threshold");
+DEFINE_double(
+    blankskipthreshold,
+    0,
+    "CTC frames where blank has a larger posterior only extend hypotheses "
+    "with blank, 0 to disable");
+DEFINE_double(
+    tokenmargin,
+    0,
+    "tokens with an emission lower than the best one of the frame by more "
+    "than this margin are not tried, 0 to disable");
+DEFINE_string(
+    sweep,
+    "",
+    "decoder options to sweep in one run, e.g. 'lmweight=1:2,wordscore=-1:0' "
+    "for a grid, or 'lmweight=0..4' with -sweep_samples; a WER is reported "
+    "for each configuration");
+DEFINE_int32(
+    sweep_samples,
+    0,
+    "number of configurations drawn at random (with -seed) from -sweep, 0 "
+    "for the grid");
 
 DEFINE_int32(maxload, -1, "max number of testing examples.");
 DEFINE_int32(maxword, -1, "maximum number of words to use");
@@ -180,6 +231,26 @@ DEFINE_int32(
     lm_memory,
     5000,
     "total memory size for batch during forward pass ");
+DEFINE_bool(
+    lm_incremental,
+    false,
+    "score ConvLM states from the activations of their parent, running one "
+    "new frame per layer instead of the whole history");
+DEFINE_int32(
+    lm_cache_size,
+    0,
+    "number of LM queries memoized by each decoding thread (by all of them "
+    "together with -sweep), 0 to disable");
+DEFINE_int32(
+    lm_conv_cache_size,
+    0,
+    "number of ConvLM distributions cached by each decoding thread, at least "
+    "the beam size (the largest swept one with -sweep), 0 for the beam size");
+DEFINE_int32(
+    lm_conv_cache_topk,
+    0,
+    "number of most likely tokens kept in each cached ConvLM distribution, "
+    "0 to keep the whole vocabulary");
 
 DEFINE_double(
     smoothingtemperature,
@@ -22,7 +22,8 @@ constexpr size_t kInputIdx = 0;
 constexpr size_t kTargetIdx = 1;
 constexpr size_t kWordIdx = 2;
 constexpr size_t kSampleIdx = 3;
-constexpr size_t kNumDataIdx = 4; // total number of dataset indices
+constexpr size_t kInputSizeIdx = 4; // unpadded input size of each sample
+constexpr size_t kNumDataIdx = 5; // total number of dataset indices
 
 // Various constants used in w2l
 constexpr const char* kTrainMode = "train";
@@ -57,6 +58,7 @@ DECLARE_string(train);
 DECLARE_string(valid);
 DECLARE_string(test);
 DECLARE_int64(batchsize);
+DECLARE_int64(maxbatchisz);
 DECLARE_string(input);
 DECLARE_int64(samplerate);
 DECLARE_int64(channels);
@@ -70,8 +72,10 @@ DECLARE_string(dataorder);
 DECLARE_int64(inputbinsize);
 DECLARE_int64(outputbinsize);
 DECLARE_bool(blobdata);
+DECLARE_bool(packeddata);
 DECLARE_string(wordseparator);
 DECLARE_double(sampletarget);
+DECLARE_string(featurecache);
 
 /* ========== FILTERING OPTIONS ========== */
 
@@ -134,6 +138,7 @@ DECLARE_string(archdir);
 DECLARE_string(flagsfile);
 DECLARE_string(runname);
 DECLARE_int64(nthread);
+DECLARE_int64(prefetchdepth);
 DECLARE_string(tag);
 DECLARE_int64(seed);
 DECLARE_int64(memstepsize);
@@ -156,8 +161,10 @@ DECLARE_bool(uselexicon);
 DECLARE_string(smearing);
 DECLARE_string(lmtype);
 DECLARE_string(lexicon);
+DECLARE_string(lexicon_bin);
 DECLARE_string(lm_vocab);
 DECLARE_string(emission_dir);
+DECLARE_string(emission_type);
 DECLARE_string(lm);
 DECLARE_string(am);
 DECLARE_string(sclite);
@@ -168,6 +175,10 @@ DECLARE_double(wordscore);
 DECLARE_double(silweight);
 DECLARE_double(unkweight);
 DECLARE_double(beamthreshold);
+DECLARE_double(blankskipthreshold);
+DECLARE_double(tokenmargin);
+DECLARE_string(sweep);
+DECLARE_int32(sweep_samples);
 
 DECLARE_int32(maxload);
 DECLARE_int32(maxword);
@@ -175,6 +186,10 @@ DECLARE_int32(beamsize);
 DECLARE_int32(beamsizetoken);
 DECLARE_int32(nthread_decoder);
 DECLARE_int32(lm_memory);
+DECLARE_bool(lm_incremental);
+DECLARE_int32(lm_cache_size);
+DECLARE_int32(lm_conv_cache_size);
+DECLARE_int32(lm_conv_cache_topk);
 
 // Seq2Seq
 DECLARE_double(smoothingtemperature);
@@ -10,6 +10,7 @@
 
 #include <algorithm>
 #include <cmath>
+#include <deque>
 #include <numeric>
 #include <stdexcept>
 #include <unordered_map>
@@ -56,6 +57,24 @@ void remapLabels(std::vector<T>& labels, const Dictionary& dict) {
   }
 };
 
+// Input: inRow x inCol (Row Major), Output: inCol x outStride (Row Major),
+// where only the first inRow elements of each output row are written
+// (outStride >= inRow), e.g. to write a shorter sample into a padded batch.
+template <typename T>
+void transpose2d(
+    const T* in,
+    T* out,
+    int64_t inRow,
+    int64_t inCol,
+    int64_t outStride) {
+  for (int64_t c = 0; c < inCol; ++c) {
+    T* y = out + c * outStride;
+    for (int64_t r = 0; r < inRow; ++r) {
+      y[r] = in[r * inCol + c];
+    }
+  }
+}
+
 // Input: B x inRow x inCol (Row Major), Output: B x inCol x inRow (Row Major)
 template <typename T>
 std::vector<T> transpose2d(
@@ -67,91 +86,212 @@ std::vector<T> transpose2d(
     throw std::invalid_argument("Invalid input size");
   }
   std::vector<T> out(in.size());
-  for (size_t b = 0; b < inBatch; ++b) {
+  for (int64_t b = 0; b < inBatch; ++b) {
     int64_t start = b * inRow * inCol;
-    for (size_t c = 0; c < inCol; ++c) {
-      for (size_t r = 0; r < inRow; ++r) {
-        out[start + c * inRow + r] = in[start + r * inCol + c];
-      }
-    }
+    transpose2d(in.data() + start, out.data() + start, inRow, inCol, inRow);
   }
   return out;
 }
 
+// Normalizes each frame to zero mean, unit variance using the statistics of
+// the frames in [t - leftCtxSize, t + rightCtxSize] over all features.
+// In place, Input, Output: FRAMES X FEAT X BATCHSZ (Col Major) of `size`
+// elements, frameSz is FRAMES
+// Runs in O(FRAMES * FEAT) for any context size using prefix sums.
 template <typename T>
-std::vector<T> localNormalize(
-    const std::vector<T>& in,
+void localNormalize(
+    T* in,
+    int64_t size,
     int64_t leftCtxSize,
     int64_t rightCtxSize,
     int64_t frameSz = 1,
     int64_t batchSz = 1,
     double threshold = 0.0) {
-  if (in.empty()) {
-    return {};
+  if (size == 0) {
+    return;
   }
-  int64_t perBatchSz = in.size() / batchSz;
+  int64_t perBatchSz = size / batchSz;
   int64_t perFrameSz = perBatchSz / frameSz;
-  auto out(in);
-  for (size_t b = 0; b < batchSz; ++b) {
-    std::vector<T> sum(frameSz, 0.0), sum2(frameSz, 0.0);
-    int64_t curFrame = 0;
-    // accumulate sum, sum^2 for computing mean, stddev
-    for (auto i = b * perBatchSz; i < (b + 1) * perBatchSz; ++i) {
-      auto start = std::max(curFrame - rightCtxSize, 0L);
-      auto end = std::min(curFrame + leftCtxSize, frameSz - 1);
-      for (int64_t j = start; j <= end; ++j) {
-        sum[j] += in[i];
-        sum2[j] += in[i] * in[i];
+  // sum[t + 1], sum2[t + 1] hold the sum, sum^2 over frames [0, t]
+  std::vector<double> sum(frameSz + 1), sum2(frameSz + 1);
+  std::vector<T> mean(frameSz), scale(frameSz);
+  for (int64_t b = 0; b < batchSz; ++b) {
+    T* batch = in + b * perBatchSz;
+    std::fill(sum.begin(), sum.end(), 0.0);
+    std::fill(sum2.begin(), sum2.end(), 0.0);
+    // frames are contiguous, so accumulate one feature at a time
+    for (int64_t f = 0; f < perFrameSz; ++f) {
+      const T* x = batch + f * frameSz;
+      for (int64_t t = 0; t < frameSz; ++t) {
+        double v = x[t];
+        sum[t + 1] += v;
+        sum2[t + 1] += v * v;
       }
-      curFrame = (curFrame + 1) % frameSz;
     }
+    std::partial_sum(sum.begin(), sum.end(), sum.begin());
+    std::partial_sum(sum2.begin(), sum2.end(), sum2.begin());
     // compute mean, stddev
-    for (auto j = 0; j < frameSz; ++j) {
-      int64_t N = (std::min(j + rightCtxSize, frameSz - 1) -
-                   std::max(j - leftCtxSize, 0L) + 1) *
-          perFrameSz;
-      sum[j] /= N;
-      sum2[j] /= N;
-      sum2[j] -= (sum[j] * sum[j]);
-      sum2[j] = std::sqrt(sum2[j]);
+    for (int64_t t = 0; t < frameSz; ++t) {
+      int64_t start = std::max<int64_t>(t - leftCtxSize, 0);
+      int64_t end = std::min<int64_t>(t + rightCtxSize, frameSz - 1) + 1;
+      double N = (end - start) * perFrameSz;
+      double m = (sum[end] - sum[start]) / N;
+      double var = (sum2[end] - sum2[start]) / N - m * m;
+      double stddev = std::sqrt(std::max(var, 0.0));
+      mean[t] = m;
+      scale[t] = (stddev > threshold) ? 1.0 / stddev : 1.0;
     }
     // perform local normalization
-    curFrame = 0;
-    for (auto i = b * perBatchSz; i < (b + 1) * perBatchSz; ++i) {
-      out[i] -= sum[curFrame];
-      if (sum2[curFrame] > threshold) {
-        out[i] /= sum2[curFrame];
+    for (int64_t f = 0; f < perFrameSz; ++f) {
+      T* x = batch + f * frameSz;
+      for (int64_t t = 0; t < frameSz; ++t) {
+        x[t] = (x[t] - mean[t]) * scale[t];
       }
-      curFrame = (curFrame + 1) % frameSz;
     }
   }
-  return out;
 }
 
+// Same as above on a vector. Works in place, so pass an rvalue to avoid
+// copying the input.
 template <typename T>
-std::vector<T> normalize(
-    const std::vector<T>& in,
+std::vector<T> localNormalize(
+    std::vector<T> in,
+    int64_t leftCtxSize,
+    int64_t rightCtxSize,
+    int64_t frameSz = 1,
     int64_t batchSz = 1,
     double threshold = 0.0) {
-  if (in.empty()) {
-    return {};
+  localNormalize(
+      in.data(),
+      in.size(),
+      leftCtxSize,
+      rightCtxSize,
+      frameSz,
+      batchSz,
+      threshold);
+  return in;
+}
+
+// Normalizes each batch of `in` (`size` elements) to zero mean, unit
+// variance, in place.
+template <typename T>
+void normalize(
+    T* in,
+    int64_t size,
+    int64_t batchSz = 1,
+    double threshold = 0.0) {
+  if (size == 0) {
+    return;
   }
-  auto out(in);
-  int64_t perBatchSz = out.size() / batchSz;
-  for (size_t b = 0; b < batchSz; ++b) {
-    auto start = out.begin() + b * perBatchSz;
-    T sum = std::accumulate(start, start + perBatchSz, 0.0);
-    T mean = sum / perBatchSz;
-    std::transform(
-        start, start + perBatchSz, start, [mean](T x) { return x - mean; });
-    T sq_sum = std::inner_product(start, start + perBatchSz, start, 0.0);
-    T stddev = std::sqrt(sq_sum / perBatchSz);
-    if (stddev > threshold) {
-      std::transform(start, start + perBatchSz, start, [stddev](T x) {
-        return x / stddev;
-      });
+  int64_t perBatchSz = size / batchSz;
+  for (int64_t b = 0; b < batchSz; ++b) {
+    T* x = in + b * perBatchSz;
+    double sum = 0.0, sum2 = 0.0;
+    for (int64_t i = 0; i < perBatchSz; ++i) {
+      double v = x[i];
+      sum += v;
+      sum2 += v * v;
+    }
+    double mean = sum / perBatchSz;
+    double stddev = std::sqrt(std::max(sum2 / perBatchSz - mean * mean, 0.0));
+    T shift = mean;
+    T scale = (stddev > threshold) ? 1.0 / stddev : 1.0;
+    for (int64_t i = 0; i < perBatchSz; ++i) {
+      x[i] = (x[i] - shift) * scale;
     }
   }
-  return out;
 }
+
+// Normalizes each batch to zero mean, unit variance. Works in place, so pass
+// an rvalue to avoid copying the input.
+template <typename T>
+std::vector<T> normalize(
+    std::vector<T> in,
+    int64_t batchSz = 1,
+    double threshold = 0.0) {
+  normalize(in.data(), in.size(), batchSz, threshold);
+  return in;
+}
+
+// Causal counterpart of localNormalize(in, leftCtxSize, 0, ...) for input
+// which arrives a few frames at a time, e.g. from FeatureStream. Each frame is
+// normalized with the statistics of itself and the `leftCtxSize` frames before
+// it (all frames seen so far if leftCtxSize < 0).
+// Input, Output: FEAT X FRAMES (Col Major)
+template <typename T>
+class RunningNormalizer {
+ public:
+  RunningNormalizer(
+      int64_t featSz,
+      int64_t leftCtxSize = -1,
+      double threshold = 0.0)
+      : featSz_(featSz), leftCtxSize_(leftCtxSize), threshold_(threshold) {
+    if (featSz_ <= 0) {
+      throw std::invalid_argument("RunningNormalizer: featSz must be positive");
+    }
+    reset();
+  }
+
+  std::vector<T> apply(const std::vector<T>& in) {
+    if (in.size() % featSz_ != 0) {
+      throw std::invalid_argument(
+          "RunningNormalizer: input size is not divisible by featSz");
+    }
+    std::vector<T> out(in.size());
+    int64_t numFrames = in.size() / featSz_;
+    for (int64_t t = 0; t < numFrames; ++t) {
+      const T* x = in.data() + t * featSz_;
+      T* y = out.data() + t * featSz_;
+      double frameSum = 0.0, frameSum2 = 0.0;
+      for (int64_t f = 0; f < featSz_; ++f) {
+        double v = x[f];
+        frameSum += v;
+        frameSum2 += v * v;
+      }
+      sum_ += frameSum;
+      sum2_ += frameSum2;
+      if (leftCtxSize_ >= 0) {
+        history_.emplace_back(frameSum, frameSum2);
+        if (history_.size() > leftCtxSize_ + 1) {
+          sum_ -= history_.front().first;
+          sum2_ -= history_.front().second;
+          history_.pop_front();
+        }
+        ++numFrames_;
+        numFrames_ = std::min(numFrames_, leftCtxSize_ + 1);
+      } else {
+        ++numFrames_;
+      }
+      double N = numFrames_ * featSz_;
+      double mean = sum_ / N;
+      double stddev = std::sqrt(std::max(sum2_ / N - mean * mean, 0.0));
+      T shift = mean;
+      T scale = (stddev > threshold_) ? 1.0 / stddev : 1.0;
+      for (int64_t f = 0; f < featSz_; ++f) {
+        y[f] = (x[f] - shift) * scale;
+      }
+    }
+    return out;
+  }
+
+  // Forgets all frames seen so far, e.g. at the start of an utterance
+  void reset() {
+    sum_ = 0.0;
+    sum2_ = 0.0;
+    numFrames_ = 0;
+    history_.clear();
+  }
+
+ private:
+  int64_t featSz_;
+  int64_t leftCtxSize_;
+  double threshold_;
+
+  // sum, sum^2 over the frames in the context and their number
+  double sum_;
+  double sum2_;
+  int64_t numFrames_;
+  // per frame sum, sum^2 of the frames in the context
+  std::deque<std::pair<double, double>> history_;
+};
 } // namespace w2l
@@ -12,6 +12,7 @@
 
 #include <future>
 #include <memory>
+#include <numeric>
 
 #include "common/FlashlightUtils.h"
 #include "common/Transforms.h"
@@ -314,6 +315,19 @@ TEST(W2lCommonTest, Transpose) {
   ASSERT_TRUE(af::allTrue<bool>(arrT - arr.T() == 0.0));
 }
 
+TEST(W2lCommonTest, TransposePadded) {
+  // 70 x 3 (Row Major) into 3 x 100 (Row Major)
+  std::vector<float> in(70 * 3);
+  std::iota(in.begin(), in.end(), 0.0);
+  std::vector<float> out(3 * 100, -1.0);
+  transpose2d<float>(in.data(), out.data(), 70, 3, 100);
+  for (int64_t c = 0; c < 3; ++c) {
+    for (int64_t r = 0; r < 100; ++r) {
+      ASSERT_EQ(out[c * 100 + r], r < 70 ? in[r * 3 + c] : -1.0);
+    }
+  }
+}
+
 TEST(W2lCommonTest, localNormalize) {
   auto afNormalize = [](const af::array& in, int64_t lw, int64_t rw) {
     auto out = in;
@@ -355,6 +369,35 @@ TEST(W2lCommonTest, localNormalize) {
   }
 }
 
+TEST(W2lCommonTest, RunningNormalizer) {
+  int64_t T = 53, F = 31;
+  auto arr = af::randu(F, T); // FEAT X FRAMES
+  std::vector<float> arrVec(arr.elements());
+  arr.host(arrVec.data());
+  auto arrVecT = transpose2d<float>(arrVec, T, F);
+
+  for (int64_t leftCtx : {0, 1, 7, 100, -1}) {
+    auto expected = transpose2d<float>(
+        localNormalize(arrVecT, leftCtx < 0 ? T : leftCtx, 0, T), F, T);
+    RunningNormalizer<float> normalizer(F, leftCtx);
+    for (int64_t chunk : {1L, 5L, T}) {
+      normalizer.reset();
+      std::vector<float> output;
+      for (int64_t t = 0; t < T; t += chunk) {
+        std::vector<float> in(
+            arrVec.begin() + t * F,
+            arrVec.begin() + std::min(t + chunk, T) * F);
+        auto out = normalizer.apply(in);
+        output.insert(output.end(), out.begin(), out.end());
+      }
+      ASSERT_EQ(output.size(), expected.size());
+      for (size_t i = 0; i < output.size(); ++i) {
+        ASSERT_NEAR(output[i], expected[i], 1E-4);
+      }
+    }
+  }
+}
+
 TEST(W2lCommonTest, AfMatrixToStrings) {
   std::vector<int> arr = {119, 97,  118, -1,  -1,  -1,  -1,  -1, -1, -1, -1,
                           -1,  108, 101, 116, 116, 101, 114, -1, -1, -1};
@@ -667,8 +667,10 @@ AMUpdateFunc buildAmUpdateFunction(
                           const std::vector<int>& rawY,
                           const std::vector<AMStatePtr>& rawPrevStates,
                           int& t) {
-    if (t == 0) {
+    // Online decoding feeds more emissions between steps
+    if (t == 0 || emissions != buf->inputData || T != buf->input.dims(1)) {
       buf->input = fl::Variable(af::array(N, T, emissions), false);
+      buf->inputData = emissions;
     }
     int batchSize = rawY.size();
     buf->prevStates.resize(0);
@@ -185,6 +185,7 @@ w2l::Seq2SeqCriterion buildSeq2Seq(int numClasses, int eosIdx);
 /* Decoder helpers */
 struct Seq2SeqDecoderBuffer {
   fl::Variable input;
+  const float* inputData; // Emissions `input` was built from
   Seq2SeqState dummyState;
   std::vector<fl::Variable> ys;
   std::vector<Seq2SeqState*> prevStates;
@@ -196,7 +197,8 @@ struct Seq2SeqDecoderBuffer {
       int beamSize,
       int attnThre,
       int smootTemp)
-      : dummyState(nAttnRound),
+      : inputData(nullptr),
+        dummyState(nAttnRound),
         attentionThreshold(attnThre),
         smoothingTemperature(smootTemp) {
     ys.reserve(beamSize);
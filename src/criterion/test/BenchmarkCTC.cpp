@@ -8,17 +8,133 @@
 
 #include <flashlight/flashlight.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iomanip>
 #include <iostream>
+#include <limits>
+#include <vector>
 
 #include <arrayfire.h>
 #include <array>
 
+#include "common/FlashlightUtils.h"
 #include "criterion/criterion.h"
+#include "libraries/criterion/cpu/ConnectionistTemporalClassificationCriterion.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
 
 using namespace fl;
 using namespace w2l;
 
+namespace {
+
+const double kNegInf = -std::numeric_limits<double>::infinity();
+
+double logSumExp(double a, double b) {
+  double maxValue = std::max(a, b);
+  if (maxValue == kNegInf) {
+    return kNegInf;
+  }
+  return maxValue + std::log(std::exp(a - maxValue) + std::exp(b - maxValue));
+}
+
+/**
+ * Reference CTC for one sample, in double and without any pruning: the
+ * log-softmax, alphas over all T x S states, and the chain rule through each
+ * logsumexp, as the backend computed it before the workspace kernel. Targets
+ * are truncated with the same heuristic. Returns the loss and writes the
+ * gradient of `gradOutput` * loss to `inputGrad`.
+ */
+double referenceCtc(
+    const float* input,
+    const int* target,
+    int targetSize,
+    int T,
+    int N,
+    float gradOutput,
+    float* inputGrad) {
+  int L = std::min(targetSize, T);
+  int R = w2l::countRepeats(target, L);
+  L = std::min(L + R, T) - R;
+  const int S = 2 * L + 1;
+  auto label = [&](int s) { return (s & 1) ? target[s / 2] : N - 1; };
+  auto canSkip = [&](int s) {
+    return (s & 1) && s > 1 && target[s / 2] != target[s / 2 - 1];
+  };
+
+  std::vector<double> logProb(T * N);
+  for (int t = 0; t < T; ++t) {
+    double lse = kNegInf;
+    for (int n = 0; n < N; ++n) {
+      lse = logSumExp(lse, input[t * N + n]);
+    }
+    for (int n = 0; n < N; ++n) {
+      logProb[t * N + n] = input[t * N + n] - lse;
+    }
+  }
+
+  // alpha[t * S + s] = prev[t * S + s] + logProb of the label of s
+  std::vector<double> alpha(T * S, kNegInf), prev(T * S, kNegInf);
+  prev[0] = 0;
+  for (int t = 0; t < T; ++t) {
+    for (int s = 0; s < S; ++s) {
+      if (t > 0) {
+        double p = alpha[(t - 1) * S + s];
+        if (s > 0) {
+          p = logSumExp(p, alpha[(t - 1) * S + s - 1]);
+        }
+        if (canSkip(s)) {
+          p = logSumExp(p, alpha[(t - 1) * S + s - 2]);
+        }
+        prev[t * S + s] = p;
+      } else if (s == 1) {
+        prev[s] = 0;
+      }
+      alpha[t * S + s] = prev[t * S + s] + logProb[t * N + label(s)];
+    }
+  }
+  double a = alpha[T * S - 1];
+  double c = S == 1 ? kNegInf : alpha[T * S - 2];
+  double logLikelihood = logSumExp(a, c);
+
+  std::fill(inputGrad, inputGrad + T * N, 0);
+  if (logLikelihood == kNegInf) {
+    return -logLikelihood;
+  }
+  std::vector<double> alphaGrad(T * S, 0);
+  alphaGrad[T * S - 1] = -std::exp(a - logLikelihood);
+  if (S != 1) {
+    alphaGrad[T * S - 2] = -std::exp(c - logLikelihood);
+  }
+  std::vector<double> logProbGrad(N);
+  for (int t = T - 1; t >= 0; --t) {
+    std::fill(logProbGrad.begin(), logProbGrad.end(), 0);
+    for (int s = 0; s < S; ++s) {
+      double g = alphaGrad[t * S + s];
+      logProbGrad[label(s)] += g;
+      double p = prev[t * S + s];
+      if (t == 0 || p == kNegInf) {
+        continue;
+      }
+      for (int k = 0; k <= (canSkip(s) ? 2 : std::min(s, 1)); ++k) {
+        double q = alpha[(t - 1) * S + s - k];
+        alphaGrad[(t - 1) * S + s - k] += g * std::exp(q - p);
+      }
+    }
+    double sumGrad = 0;
+    for (int n = 0; n < N; ++n) {
+      sumGrad += logProbGrad[n];
+    }
+    for (int n = 0; n < N; ++n) {
+      double g = logProbGrad[n] - std::exp(logProb[t * N + n]) * sumGrad;
+      inputGrad[t * N + n] = g * gradOutput;
+    }
+  }
+  return -logLikelihood;
+}
+
+} // namespace
+
 int main() {
   af::info();
   af::setDevice(1);
@@ -54,5 +170,78 @@ int main() {
   auto e = af::timer::stop(s);
   std::cout << "Total time (fwd+bwd pass) " << std::setprecision(5)
             << e * 1000.0 / ntimes << " msec" << std::endl;
+
+  // Host-side kernels only, on the same data
+  using CpuCTC = w2l::cpu::ConnectionistTemporalClassificationCriterion<float>;
+  auto inputVec = afToVector<float>(input);
+  auto targetVec = afToVector<int>(target);
+  auto gradVec = afToVector<float>(gradoutput);
+  std::vector<int> targetSizeVec(B);
+  w2l::cpu::CriterionUtils<float>::batchTargetSize(
+      B, L, L, targetVec.data(), targetSizeVec.data());
+  std::vector<float> lossVec(B), inputGradVec(N * T * B);
+  std::vector<uint8_t> workspace(CpuCTC::getWorkspaceSize(B, T, N, L));
+
+  s = af::timer::start();
+  for (int i = 0; i < ntimes; ++i) {
+    CpuCTC::forward(
+        B,
+        T,
+        N,
+        L,
+        CriterionScaleMode::NONE,
+        inputVec.data(),
+        targetVec.data(),
+        targetSizeVec.data(),
+        lossVec.data(),
+        workspace.data());
+    CpuCTC::backward(
+        B,
+        T,
+        N,
+        L,
+        targetVec.data(),
+        gradVec.data(),
+        inputGradVec.data(),
+        workspace.data());
+  }
+  e = af::timer::stop(s);
+  std::cout << "w2l cpu kernel (fwd+bwd pass) " << std::setprecision(5)
+            << e * 1000.0 / ntimes << " msec" << std::endl;
+
+  // Check the kernel against the reference on the same data
+  std::vector<float> refLossVec(B), refInputGradVec(N * T * B);
+  s = af::timer::start();
+  for (int i = 0; i < ntimes; ++i) {
+    for (int b = 0; b < B; ++b) {
+      refLossVec[b] = referenceCtc(
+          inputVec.data() + b * T * N,
+          targetVec.data() + b * L,
+          targetSizeVec[b],
+          T,
+          N,
+          gradVec[b],
+          refInputGradVec.data() + b * T * N);
+    }
+  }
+  e = af::timer::stop(s);
+  std::cout << "reference (fwd+bwd pass) " << std::setprecision(5)
+            << e * 1000.0 / ntimes << " msec" << std::endl;
+
+  double lossDiff = 0, gradDiff = 0;
+  for (int b = 0; b < B; ++b) {
+    lossDiff = std::max(
+        lossDiff, std::abs(lossVec[b] - refLossVec[b]) / refLossVec[b]);
+  }
+  for (int i = 0; i < N * T * B; ++i) {
+    gradDiff = std::max<double>(
+        gradDiff, std::abs(inputGradVec[i] - refInputGradVec[i]));
+  }
+  std::cout << "max relative loss diff vs reference " << lossDiff
+            << ", max grad diff " << gradDiff << std::endl;
+  if (!(lossDiff < 1e-5 && gradDiff < 1e-4)) {
+    std::cerr << "w2l cpu kernel disagrees with the reference" << std::endl;
+    return 1;
+  }
   return 0;
 }
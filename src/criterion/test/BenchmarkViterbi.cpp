@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <flashlight/flashlight.h>
+
+#include <iomanip>
+#include <iostream>
+
+#include <arrayfire.h>
+
+#include "criterion/criterion.h"
+
+using namespace fl;
+using namespace w2l;
+
+int main() {
+  int T = 487;
+  int ntimes = 20;
+
+  for (int B : {1, 20}) {
+    for (int N : {30, 100, 300, 1000, 3000}) {
+      auto input = af::randu(N, T, B) * 2 - 1;
+      auto trans = af::randu(N, N) * 2 - 1;
+
+      for (int i = 0; i < 2; ++i) {
+        viterbiPath(input, trans);
+      }
+      af::sync();
+      auto s = af::timer::start();
+      for (int i = 0; i < ntimes; ++i) {
+        viterbiPath(input, trans);
+      }
+      af::sync();
+      auto e = af::timer::stop(s);
+      std::cout << "B " << B << " N " << std::setw(4) << N
+                << " Viterbi path " << std::setprecision(5)
+                << e * 1000.0 / ntimes << " msec, " << std::setprecision(6)
+                << ntimes * T * B / e << " frames/sec" << std::endl;
+    }
+  }
+  return 0;
+}
@@ -104,6 +104,24 @@ TEST(CriterionTest, CTCCost) {
   ASSERT_NEAR(loss2.scalar<float>(), -log(0.25 * 0.25 * 0.25 * 5), kEpsilon);
 }
 
+TEST(CriterionTest, CTCImpossibleTarget) {
+  // Label 0 can't be emitted in any frame
+  auto neginf = -std::numeric_limits<float>::infinity();
+  std::array<float, 6> input = {neginf, 0.0, 0.0, neginf, 0.0, 0.0};
+  std::array<int, 1> target = {0};
+  const int N = 3, L = 1, T = 2;
+
+  auto ctc = ConnectionistTemporalClassificationCriterion();
+  auto inputaf = Variable(af::array(N, T, input.data()), true);
+  auto targetaf = Variable(af::array(L, target.data()), false);
+
+  auto loss = ctc({inputaf, targetaf}).front();
+  ASSERT_EQ(loss.scalar<float>(), -neginf);
+  loss.backward();
+  ASSERT_FALSE(af::anyTrue<bool>(af::isNaN(inputaf.grad().array())));
+  checkZero(inputaf.grad().array());
+}
+
 TEST(CriterionTest, CTCJacobian) {
   int N = 30, T = 80, L = 20;
   auto in = Variable(af::log(af::randu(N, T)), true);
@@ -0,0 +1,250 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace w2l {
+
+// Counters of a BatchPrefetcher, accumulated since the last `resetStats()`
+struct PrefetchStats {
+  int64_t requests{0}; // calls to `get()`
+  int64_t ready{0}; // batches which were loaded when requested
+  int64_t waited{0}; // batches which were being loaded when requested
+  int64_t direct{0}; // batches not started yet, loaded by the caller
+  int64_t queueDepthSum{0}; // sum over requests of the batches in the queue
+  double stallSec{0.0}; // time spent in `get()` waiting for / loading batches
+};
+
+// Loads batches [0, size) ahead of their use on a fixed set of worker threads.
+//
+// Every `get(idx)` (re)fills the queue with the batches idx + 1, idx + 2, ...
+// which are not queued yet, keeping at most `depth` batches queued, being
+// loaded or loaded but not consumed (backpressure). Workers always start on
+// the lowest queued batch, and batches complete in any order. Queued batches
+// far from the last requested one (more than `depth` away, e.g. after a jump)
+// are dropped.
+//
+// `get()` is thread-safe: several consumers can request batches concurrently
+// and in any order. A requested batch which is not queued, or queued but not
+// started yet, is loaded by the caller; one being loaded is waited for. Each
+// queued batch is handed out once.
+template <typename T>
+class BatchPrefetcher {
+ public:
+  using LoadFunction = std::function<T(int64_t)>;
+
+  // numWorkers - no batch is prefetched if 0
+  // depth - maximum number of batches in the queue
+  BatchPrefetcher(LoadFunction load, int64_t numWorkers, int64_t depth)
+      : load_(std::move(load)),
+        depth_(numWorkers > 0 ? std::max<int64_t>(depth, 0) : 0),
+        size_(0),
+        stop_(false) {
+    if (numWorkers < 0) {
+      throw std::invalid_argument("BatchPrefetcher: invalid number of workers");
+    }
+    for (int64_t i = 0; i < numWorkers; ++i) {
+      workers_.emplace_back([this]() { work(); });
+    }
+  }
+
+  BatchPrefetcher(const BatchPrefetcher&) = delete;
+  BatchPrefetcher& operator=(const BatchPrefetcher&) = delete;
+
+  // Waits for batches being loaded and joins the workers
+  ~BatchPrefetcher() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    workCv_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  // Drops all queued batches and sets the number of batches. Must be called
+  // whenever the batches returned by the load function change.
+  void reset(int64_t size) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.clear();
+    size_ = size;
+  }
+
+  T get(int64_t idx) {
+    auto start = std::chrono::steady_clock::now();
+    std::shared_ptr<Slot> slot;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++stats_.requests;
+      stats_.queueDepthSum += queue_.size();
+      for (auto it = queue_.begin(); it != queue_.end();) {
+        if (it->first < idx - depth_ || it->first > idx + depth_) {
+          // A worker loading it only keeps its slot alive
+          it = queue_.erase(it);
+        } else {
+          ++it;
+        }
+      }
+      auto it = queue_.find(idx);
+      if (it != queue_.end()) {
+        slot = it->second;
+        queue_.erase(it);
+      }
+      enqueue(idx + 1);
+
+      if (slot && slot->state == SlotState::QUEUED) {
+        slot = nullptr;
+      }
+      if (slot) {
+        if (slot->state == SlotState::READY) {
+          ++stats_.ready;
+        } else {
+          ++stats_.waited;
+          readyCv_.wait(
+              lock, [&slot]() { return slot->state == SlotState::READY; });
+        }
+      } else {
+        ++stats_.direct;
+      }
+    }
+
+    if (!slot) {
+      // Loaded here rather than waiting behind the queue
+      std::exception_ptr error;
+      T value;
+      try {
+        value = load_(idx);
+      } catch (...) {
+        error = std::current_exception();
+      }
+      addStallTime(start);
+      if (error) {
+        std::rethrow_exception(error);
+      }
+      return value;
+    }
+    addStallTime(start);
+    if (slot->error) {
+      std::rethrow_exception(slot->error);
+    }
+    return std::move(slot->value);
+  }
+
+  PrefetchStats stats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+  }
+
+  void resetStats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_ = PrefetchStats();
+  }
+
+ private:
+  enum class SlotState { QUEUED, LOADING, READY };
+
+  struct Slot {
+    SlotState state{SlotState::QUEUED};
+    T value;
+    std::exception_ptr error;
+  };
+
+  LoadFunction load_;
+  int64_t depth_;
+  std::vector<std::thread> workers_;
+
+  mutable std::mutex mutex_;
+  std::condition_variable workCv_; // batches queued or stopping
+  std::condition_variable readyCv_; // batches loaded
+  // Queued, being loaded and loaded batches, by index
+  std::map<int64_t, std::shared_ptr<Slot>> queue_;
+  int64_t size_;
+  bool stop_;
+  PrefetchStats stats_;
+
+  // Queues the batches from `idx` on which are not queued yet, as long as
+  // the queue has room. Called with `mutex_` held.
+  void enqueue(int64_t idx) {
+    int64_t end = std::min(idx + depth_, size_);
+    bool added = false;
+    for (int64_t i = idx;
+         i < end && static_cast<int64_t>(queue_.size()) < depth_;
+         ++i) {
+      if (queue_.find(i) == queue_.end()) {
+        queue_.emplace(i, std::make_shared<Slot>());
+        added = true;
+      }
+    }
+    if (added) {
+      workCv_.notify_all();
+    }
+  }
+
+  // Returns the lowest queued batch not being loaded yet, or end. Called with
+  // `mutex_` held.
+  typename std::map<int64_t, std::shared_ptr<Slot>>::iterator nextQueued() {
+    return std::find_if(queue_.begin(), queue_.end(), [](
+        const std::pair<const int64_t, std::shared_ptr<Slot>>& entry) {
+      return entry.second->state == SlotState::QUEUED;
+    });
+  }
+
+  void work() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+      workCv_.wait(
+          lock, [this]() { return stop_ || nextQueued() != queue_.end(); });
+      if (stop_) {
+        return;
+      }
+      auto it = nextQueued();
+      int64_t idx = it->first;
+      auto slot = it->second;
+      slot->state = SlotState::LOADING;
+      lock.unlock();
+
+      T value;
+      std::exception_ptr error;
+      try {
+        value = load_(idx);
+      } catch (...) {
+        error = std::current_exception();
+      }
+
+      lock.lock();
+      slot->value = std::move(value);
+      slot->error = error;
+      slot->state = SlotState::READY;
+      readyCv_.notify_all();
+    }
+  }
+
+  void addStallTime(std::chrono::steady_clock::time_point start) {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats_.stallSec += elapsed.count();
+  }
+};
+
+} // namespace w2l
@@ -0,0 +1,236 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/FeatureCache.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+constexpr uint64_t kRecordMagic = 0x31454843465f4c57; // "WL_FCHE1"
+
+int64_t alignUp(int64_t size) {
+  return (size + 7) & ~int64_t(7);
+}
+
+std::runtime_error cacheError(
+    const std::string& msg,
+    const std::string& path) {
+  return std::runtime_error(
+      "FeatureCache: " + msg + " '" + path + "': " + strerror(errno));
+}
+
+// Holds an exclusive flock on `fd` for its lifetime
+class FileLock {
+ public:
+  FileLock(int fd, const std::string& path) : fd_(fd) {
+    while (flock(fd_, LOCK_EX) != 0) {
+      if (errno != EINTR) {
+        throw cacheError("cannot lock", path);
+      }
+    }
+  }
+
+  ~FileLock() {
+    flock(fd_, LOCK_UN);
+  }
+
+ private:
+  int fd_;
+};
+
+int64_t fileSize(int fd, const std::string& path) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    throw cacheError("cannot stat", path);
+  }
+  return st.st_size;
+}
+
+} // namespace
+
+FeatureCache::FeatureCache(const std::string& path, uint64_t paramsHash)
+    : path_(path), paramsHash_(paramsHash), scannedSize_(0) {
+  fd_ = open(path_.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    throw cacheError("cannot open", path_);
+  }
+  FileLock lock(fd_, path_);
+  scan(true);
+}
+
+FeatureCache::~FeatureCache() {
+  for (auto& mapping : mappings_) {
+    munmap(mapping.first, mapping.second);
+  }
+  close(fd_);
+}
+
+bool FeatureCache::find(const std::string& key, Entry& entry) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  auto it = index_.find(key);
+  if (it == index_.end()) {
+    // Another process may have added it
+    scan(false);
+    it = index_.find(key);
+    if (it == index_.end()) {
+      return false;
+    }
+  }
+  int64_t offset = it->second.first;
+  entry = it->second.second;
+  auto base = map(offset + entry.size() * sizeof(float));
+  entry.data = reinterpret_cast<const float*>(base + offset);
+  return true;
+}
+
+void FeatureCache::insert(const std::string& key, const Entry& entry) {
+  RecordHeader header;
+  header.magic = kRecordMagic;
+  header.paramsHash = paramsHash_;
+  header.keySize = key.size();
+  header.featSz = entry.featSz;
+  header.numFrames = entry.numFrames;
+  header.numChannels = entry.numChannels;
+  int64_t keyOffset = sizeof(RecordHeader);
+  int64_t dataOffset = keyOffset + alignUp(key.size());
+  int64_t dataSize = entry.size() * sizeof(float);
+  std::vector<char> record(dataOffset + alignUp(dataSize), 0);
+  memcpy(record.data(), &header, sizeof(RecordHeader));
+  memcpy(record.data() + keyOffset, key.data(), key.size());
+  if (dataSize > 0) {
+    memcpy(record.data() + dataOffset, entry.data, dataSize);
+  }
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  FileLock lock(fd_, path_);
+  scan(true);
+  if (index_.find(key) != index_.end()) {
+    return;
+  }
+  // The file ends at `scannedSize_` while we hold the lock
+  int64_t recordOffset = scannedSize_;
+  size_t written = 0;
+  while (written < record.size()) {
+    auto n = write(fd_, record.data() + written, record.size() - written);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      auto error = cacheError("cannot write", path_);
+      // Do not leave a partial record behind
+      if (ftruncate(fd_, recordOffset) != 0) {
+        throw cacheError("cannot truncate", path_);
+      }
+      throw error;
+    }
+    written += n;
+  }
+  Entry indexed = entry;
+  indexed.data = nullptr;
+  index_.emplace(key, std::make_pair(recordOffset + dataOffset, indexed));
+  scannedSize_ += record.size();
+}
+
+uint64_t FeatureCache::hash(const std::string& str) {
+  uint64_t h = 0xcbf29ce484222325;
+  for (unsigned char c : str) {
+    h ^= c;
+    h *= 0x100000001b3;
+  }
+  return h;
+}
+
+std::string FeatureCache::fileKey(const std::string& path) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return "";
+  }
+  return path + "\t" + std::to_string(static_cast<int64_t>(st.st_size)) +
+      "\t" + std::to_string(static_cast<int64_t>(st.st_mtime));
+}
+
+void FeatureCache::scan(bool truncate) {
+  int64_t size = fileSize(fd_, path_);
+  std::string key;
+  while (scannedSize_ + static_cast<int64_t>(sizeof(RecordHeader)) <= size) {
+    RecordHeader header;
+    if (pread(fd_, &header, sizeof(RecordHeader), scannedSize_) !=
+        sizeof(RecordHeader)) {
+      throw cacheError("cannot read", path_);
+    }
+    Entry entry;
+    entry.featSz = header.featSz;
+    entry.numFrames = header.numFrames;
+    entry.numChannels = header.numChannels;
+    if (header.magic != kRecordMagic || header.keySize < 0 ||
+        entry.featSz < 0 || entry.numFrames < 0 || entry.numChannels < 0) {
+      if (!truncate) {
+        // May be a record being written
+        break;
+      }
+      throw std::runtime_error(
+          "FeatureCache: invalid record in '" + path_ + "' at offset " +
+          std::to_string(scannedSize_));
+    }
+    int64_t dataOffset = sizeof(RecordHeader) + alignUp(header.keySize);
+    int64_t recordSize = dataOffset + alignUp(entry.size() * sizeof(float));
+    if (scannedSize_ + recordSize > size) {
+      break;
+    }
+    if (header.paramsHash == paramsHash_) {
+      key.resize(header.keySize);
+      if (pread(
+              fd_,
+              &key[0],
+              header.keySize,
+              scannedSize_ + sizeof(RecordHeader)) != header.keySize) {
+        throw cacheError("cannot read", path_);
+      }
+      index_.emplace(key, std::make_pair(scannedSize_ + dataOffset, entry));
+    }
+    scannedSize_ += recordSize;
+  }
+  if (truncate && scannedSize_ < size) {
+    if (ftruncate(fd_, scannedSize_) != 0) {
+      throw cacheError("cannot truncate", path_);
+    }
+  }
+}
+
+const char* FeatureCache::map(int64_t end) {
+  if (mappings_.empty() ||
+      static_cast<int64_t>(mappings_.back().second) < end) {
+    // Map past the end of the file, which is only read once records are
+    // appended there: the total size of the mappings stays within twice
+    // that of the last one.
+    size_t size = fileSize(fd_, path_);
+    if (!mappings_.empty()) {
+      size = std::max(size, 2 * mappings_.back().second);
+    }
+    void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd_, 0);
+    if (addr == MAP_FAILED) {
+      throw cacheError("cannot mmap", path_);
+    }
+    mappings_.emplace_back(addr, size);
+  }
+  return static_cast<const char*>(mappings_.back().first);
+}
+
+} // namespace w2l
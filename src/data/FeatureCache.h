@@ -0,0 +1,101 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace w2l {
+
+// Append-only file of per-utterance features, which are read back through a
+// memory mapping of the file without any copy or decoding.
+//
+// Each record holds the features of one utterance, the key it is stored under
+// (e.g. the audio path) and a hash of the parameters used to compute them
+// (see `hash()`). Only records written with the same parameters hash are
+// visible, so one file can be shared by runs with different features.
+// Records are appended under an exclusive `flock`, so several processes can
+// share a cache file; records written by others are picked up on lookup.
+//
+// Record layout (native endianness, 8-byte aligned):
+//   RecordHeader | key (padded to 8 bytes) | float data (padded to 8 bytes)
+class FeatureCache {
+ public:
+  // Features of one utterance (Col Major : FEAT X FRAMES X CHANNELS)
+  struct Entry {
+    const float* data{nullptr};
+    int64_t featSz{0};
+    int64_t numFrames{0};
+    int64_t numChannels{0};
+
+    int64_t size() const {
+      return featSz * numFrames * numChannels;
+    }
+  };
+
+  FeatureCache(const std::string& path, uint64_t paramsHash);
+
+  FeatureCache(const FeatureCache&) = delete;
+  FeatureCache& operator=(const FeatureCache&) = delete;
+
+  ~FeatureCache();
+
+  // Returns true and fills `entry` if features for `key` are in the cache.
+  // `entry.data` points into the file mapping and stays valid for the lifetime
+  // of the cache.
+  bool find(const std::string& key, Entry& entry);
+
+  // Appends the features `entry` for `key`, unless the key is already cached
+  void insert(const std::string& key, const Entry& entry);
+
+  // 64-bit FNV-1a, stable across runs and platforms
+  static uint64_t hash(const std::string& str);
+
+  // Key for the features of the audio file `path`: the path, size and
+  // modification time of the file, so that a file which changed is not
+  // matched with stale features. Empty if the file cannot be stat'ed.
+  static std::string fileKey(const std::string& path);
+
+ private:
+  struct RecordHeader {
+    uint64_t magic;
+    uint64_t paramsHash;
+    int64_t keySize;
+    int64_t featSz;
+    int64_t numFrames;
+    int64_t numChannels;
+  };
+
+  std::string path_;
+  uint64_t paramsHash_;
+  int fd_;
+
+  std::mutex mutex_;
+  // Offset of the float data and dimensions of each visible record
+  std::unordered_map<std::string, std::pair<int64_t, Entry>> index_;
+  // Size of the file prefix made of complete records, all indexed
+  int64_t scannedSize_;
+
+  // Mappings of the file, grown geometrically on demand. Older ones are kept
+  // until destruction, so that entries returned by `find()` stay valid.
+  std::vector<std::pair<void*, size_t>> mappings_;
+
+  // Indexes the records appended since the last scan. If `truncate`, the
+  // caller holds the file lock, and an incomplete record at the end (left by
+  // a writer which died) is removed.
+  void scan(bool truncate);
+
+  // Returns the address of file offset 0 in a mapping covering [0, end)
+  const char* map(int64_t end);
+};
+} // namespace w2l
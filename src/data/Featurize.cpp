@@ -10,6 +10,8 @@
 
 #include <math.h>
 #include <fstream>
+#include <memory>
+#include <sstream>
 #include <vector>
 
 #include <glog/logging.h>
@@ -40,8 +42,124 @@ PowerSpectrum<float>& getPowerSpectrum() {
   return powspec;
 }
 
+PowerSpectrum<float>& getFeaturizer() {
+  if (FLAGS_mfcc) {
+    return getMfcc();
+  } else if (FLAGS_mfsc) {
+    return getMfsc();
+  }
+  return getPowerSpectrum();
+}
+
+// Features of each utterance computed on its own, or read from the cache.
+// Returns FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major), where shorter
+// utterances are padded with zero frames.
+FeatureBuffer featurizeCachedInput(
+    const std::vector<W2lLoaderData>& data,
+    FeatureCache& featureCache,
+    af::dim4& inputDims,
+    std::vector<int>& inputSizes) {
+  int64_t batchSz = data.size();
+  int64_t featSz = getSpeechFeatureSize();
+  std::vector<FeatureCache::Entry> entries(batchSz);
+  std::vector<std::vector<float>> computed(batchSz);
+  int64_t T = 0;
+  for (int64_t b = 0; b < batchSz; ++b) {
+    const auto& d = data[b];
+    auto& entry = entries[b];
+    if (d.featureCacheKey.empty() ||
+        !featureCache.find(d.featureCacheKey, entry)) {
+      int64_t inSz = d.input.size() / FLAGS_channels;
+      if (inSz > 0 && FLAGS_channels == 1) {
+        computed[b] = getFeaturizer().batchApply(d.input, FLAGS_channels);
+      } else if (inSz > 0) {
+        // T X CHANNELS (Col Major)
+        auto in = transpose2d<float>(d.input, inSz, FLAGS_channels);
+        computed[b] = getFeaturizer().batchApply(in, FLAGS_channels);
+      }
+      entry.data = computed[b].data();
+      entry.featSz = featSz;
+      entry.numFrames = computed[b].size() / (featSz * FLAGS_channels);
+      entry.numChannels = FLAGS_channels;
+      if (!d.featureCacheKey.empty()) {
+        featureCache.insert(d.featureCacheKey, entry);
+      }
+    }
+    if (entry.featSz != featSz || entry.numChannels != FLAGS_channels) {
+      LOG(FATAL) << "Cached features of '" << d.featureCacheKey
+                 << "' have wrong dimensions";
+    }
+    T = std::max(T, entry.numFrames);
+    inputSizes[b] = entry.numFrames;
+  }
+
+  // FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major), transposed straight
+  // from each entry (FEAT X FRAMES X CHANNELS)
+  FeatureBuffer inFeat(T * featSz * FLAGS_channels * batchSz);
+  std::fill(inFeat.data(), inFeat.data() + inFeat.size(), 0.0);
+  for (int64_t b = 0; b < batchSz; ++b) {
+    const auto& entry = entries[b];
+    int64_t channelSz = featSz * entry.numFrames;
+    for (int64_t c = 0; c < FLAGS_channels; ++c) {
+      transpose2d<float>(
+          entry.data + c * channelSz,
+          inFeat.data() + (b * FLAGS_channels + c) * featSz * T,
+          entry.numFrames,
+          featSz,
+          T);
+    }
+  }
+  inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
+  return inFeat;
+}
+
+void freeHostBuffer(float* ptr) {
+  delete[] ptr;
+}
+
+void freeArrayFireBuffer(float* ptr) {
+  af::free(ptr);
+}
+
 } // namespace
 
+FeatureBuffer::FeatureBuffer() : FeatureBuffer(0) {}
+
+FeatureBuffer::FeatureBuffer(size_t size)
+    : data_(nullptr, freeHostBuffer), size_(size) {
+  if (size_ == 0) {
+    return;
+  }
+  // CPU "device" memory is host memory
+  if (af::getActiveBackend() == AF_BACKEND_CPU) {
+    data_ = std::unique_ptr<float, void (*)(float*)>(
+        static_cast<float*>(af::alloc(size_, f32)), freeArrayFireBuffer);
+  } else {
+    data_ = std::unique_ptr<float, void (*)(float*)>(
+        new float[size_], freeHostBuffer);
+  }
+}
+
+af::array FeatureBuffer::toArray(const af::dim4& dims) {
+  if (static_cast<size_t>(dims.elements()) != size_) {
+    LOG(FATAL) << "Feature buffer of size " << size_
+               << " does not match dimensions " << dims;
+  }
+  if (size_ == 0) {
+    return af::array(dims);
+  }
+  af::array arr;
+  if (data_.get_deleter() == freeArrayFireBuffer) {
+    // The array takes ownership of the memory
+    arr = af::array(dims, data_.release(), afDevice);
+  } else {
+    arr = af::array(dims, data_.get());
+    data_.reset();
+  }
+  size_ = 0;
+  return arr;
+}
+
 W2lFeatureData featurize(
     const std::vector<W2lLoaderData>& data,
     const DictionaryMap& dicts) {
@@ -52,62 +170,102 @@ W2lFeatureData featurize(
   W2lFeatureData feat;
   std::vector<std::string> sampleIds;
 
-  // Featurize Input
-  size_t maxInSize = 0;
-  for (const auto& d : data) {
-    maxInSize = std::max(maxInSize, d.input.size());
+  if ((FLAGS_mfcc && FLAGS_mfsc) || (FLAGS_pow && FLAGS_mfsc) ||
+      (FLAGS_mfcc && FLAGS_pow)) {
+    LOG(FATAL) << "Only one of -mfsc, -mfcc, -pow options can set to true";
   }
-  int64_t T = maxInSize / FLAGS_channels;
 
-  // CHANNELS X T X BATCHSZ (Col Major)
-  std::vector<float> mergedInput(maxInSize * batchSz, 0.0);
-  // Batch into a single array
-  for (size_t b = 0; b < batchSz; ++b) {
-    if (data[b].input.empty()) {
-      continue;
-    }
-    std::copy(
-        data[b].input.begin(),
-        data[b].input.end(),
-        mergedInput.begin() + b * maxInSize);
-  }
-  // T X CHANNELS X BATCHSZ (Col Major)
-  auto inFeat =
-      transpose2d<float>(std::move(mergedInput), T, FLAGS_channels, batchSz);
-  feat.inputDims = af::dim4(T, FLAGS_channels, 1, batchSz);
-  if (FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc) {
-    if ((FLAGS_mfcc && FLAGS_mfsc) || (FLAGS_pow && FLAGS_mfsc) ||
-        (FLAGS_mfcc && FLAGS_pow)) {
-      LOG(FATAL) << "Only one of -mfsc, -mfcc, -pow options can set to true";
+  // Featurize Input, written in place into `feat.input` by the last step
+  int64_t T;
+  feat.inputSizes.resize(batchSz);
+  auto featureCache = getFeatureCache();
+  if (featureCache &&
+      std::any_of(data.begin(), data.end(), [](const W2lLoaderData& d) {
+        return !d.featureCacheKey.empty();
+      })) {
+    feat.input = featurizeCachedInput(
+        data, *featureCache, feat.inputDims, feat.inputSizes);
+    T = feat.inputDims[0];
+  } else {
+    size_t maxInSize = 0;
+    for (const auto& d : data) {
+      maxInSize = std::max(maxInSize, d.input.size());
     }
-    int64_t featSz = 1;
-    if (FLAGS_mfcc) {
-      auto& mfcc = getMfcc();
-      featSz = mfcc.getFeatureParams().mfccFeatSz();
-      inFeat = mfcc.batchApply(inFeat, FLAGS_channels * batchSz);
+    T = maxInSize / FLAGS_channels;
+    bool computeFeatures = FLAGS_pow || FLAGS_mfsc || FLAGS_mfcc;
+
+    // T X CHANNELS X BATCHSZ (Col Major), each input (CHANNELS X T) is
+    // transposed straight into place
+    std::vector<float> rawInput;
+    float* in;
+    if (computeFeatures) {
+      rawInput.resize(maxInSize * batchSz, 0.0);
+      in = rawInput.data();
+    } else {
+      feat.input = FeatureBuffer(maxInSize * batchSz);
+      in = feat.input.data();
+      std::fill(in, in + feat.input.size(), 0.0);
     }
-    if (FLAGS_mfsc) {
-      auto& mfsc = getMfsc();
-      featSz = mfsc.getFeatureParams().mfscFeatSz();
-      inFeat = mfsc.batchApply(inFeat, FLAGS_channels * batchSz);
+    for (size_t b = 0; b < batchSz; ++b) {
+      int64_t inSz = data[b].input.size() / FLAGS_channels;
+      feat.inputSizes[b] = inSz;
+      if (FLAGS_channels == 1) {
+        std::copy(
+            data[b].input.begin(), data[b].input.end(), in + b * maxInSize);
+      } else {
+        transpose2d<float>(
+            data[b].input.data(), in + b * maxInSize, inSz, FLAGS_channels, T);
+      }
     }
-    if (FLAGS_pow) {
-      auto& powspec = getPowerSpectrum();
-      featSz = powspec.getFeatureParams().powSpecFeatSz();
-      inFeat = powspec.batchApply(inFeat, FLAGS_channels * batchSz);
+    feat.inputDims = af::dim4(T, FLAGS_channels, 1, batchSz);
+    if (computeFeatures) {
+      int64_t featSz = 1;
+      auto featParams = getFeaturizer().getFeatureParams();
+      for (auto& inSz : feat.inputSizes) {
+        inSz = featParams.numFrames(inSz);
+      }
+      std::vector<float> outFeat;
+      if (FLAGS_mfcc) {
+        auto& mfcc = getMfcc();
+        featSz = mfcc.getFeatureParams().mfccFeatSz();
+        outFeat = mfcc.batchApply(rawInput, FLAGS_channels * batchSz);
+      }
+      if (FLAGS_mfsc) {
+        auto& mfsc = getMfsc();
+        featSz = mfsc.getFeatureParams().mfscFeatSz();
+        outFeat = mfsc.batchApply(rawInput, FLAGS_channels * batchSz);
+      }
+      if (FLAGS_pow) {
+        auto& powspec = getPowerSpectrum();
+        featSz = powspec.getFeatureParams().powSpecFeatSz();
+        outFeat = powspec.batchApply(rawInput, FLAGS_channels * batchSz);
+      }
+      T = outFeat.size() / (FLAGS_channels * batchSz * featSz);
+      // Before: FEAT X FRAMES X CHANNELS X BATCHSIZE (Col Major)
+      feat.input = FeatureBuffer(outFeat.size());
+      for (size_t i = 0; i < FLAGS_channels * batchSz; ++i) {
+        transpose2d<float>(
+            outFeat.data() + i * featSz * T,
+            feat.input.data() + i * featSz * T,
+            T,
+            featSz,
+            T);
+      }
+      // After: FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major)
+      feat.inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
     }
-    T = inFeat.size() / (FLAGS_channels * batchSz * featSz);
-    // Before: FEAT X FRAMES X CHANNELS X BATCHSIZE (Col Major)
-    inFeat = transpose2d<float>(inFeat, T, featSz, FLAGS_channels * batchSz);
-    // After: FRAMES X FEAT X CHANNELS X BATCHSIZE (Col Major)
-    feat.inputDims = af::dim4(T, featSz, FLAGS_channels, batchSz);
   }
 
   if (FLAGS_localnrmlleftctx > 0 || FLAGS_localnrmlrightctx > 0) {
-    feat.input = localNormalize(
-        inFeat, FLAGS_localnrmlleftctx, FLAGS_localnrmlrightctx, T, batchSz);
+    localNormalize(
+        feat.input.data(),
+        feat.input.size(),
+        FLAGS_localnrmlleftctx,
+        FLAGS_localnrmlrightctx,
+        T,
+        batchSz);
   } else {
-    feat.input = normalize(inFeat, batchSz);
+    normalize(feat.input.data(), feat.input.size(), batchSz);
   }
 
   // Featurize Target
@@ -235,6 +393,36 @@ FeatureParams defineSpeechFeatureParams() {
   return params;
 }
 
+FeatureCache* getFeatureCache() {
+  static std::unique_ptr<FeatureCache> featureCache = []() {
+    if (FLAGS_featurecache.empty()) {
+      return std::unique_ptr<FeatureCache>();
+    }
+    if (!FLAGS_pow && !FLAGS_mfsc && !FLAGS_mfcc) {
+      LOG(WARNING) << "-featurecache requires -pow, -mfsc or -mfcc, ignored";
+      return std::unique_ptr<FeatureCache>();
+    }
+    // Everything the features depend on
+    auto params = defineSpeechFeatureParams();
+    std::ostringstream desc;
+    desc << (FLAGS_mfcc ? "mfcc" : (FLAGS_mfsc ? "mfsc" : "pow")) << " "
+         << FLAGS_channels << " " << params.samplingFreq << " "
+         << params.frameSizeMs << " " << params.frameStrideMs << " "
+         << params.numFilterbankChans << " " << params.lowFreqFilterbank
+         << " " << params.highFreqFilterbank << " "
+         << params.numCepstralCoeffs << " " << params.lifterParam << " "
+         << params.deltaWindow << " " << params.accWindow << " "
+         << params.preemCoef << " " << params.melFloor << " "
+         << params.ditherVal << " " << params.usePower << " "
+         << params.useEnergy << " " << params.rawEnergy << " "
+         << params.zeroMeanFrame << " " << static_cast<int>(params.windowType);
+    LOG(INFO) << "Using feature cache " << FLAGS_featurecache;
+    return std::unique_ptr<FeatureCache>(new FeatureCache(
+        FLAGS_featurecache, FeatureCache::hash(desc.str())));
+  }();
+  return featureCache.get();
+}
+
 int64_t getSpeechFeatureSize() {
   int64_t numFeatures = FLAGS_channels;
   auto featparams = defineSpeechFeatureParams();
@@ -9,8 +9,10 @@
 #pragma once
 
 #include <arrayfire.h>
+#include <memory>
 #include <unordered_map>
 
+#include "data/FeatureCache.h"
 #include "data/Sound.h"
 #include "libraries/common/Dictionary.h"
 #include "libraries/feature/FeatureParams.h"
@@ -20,10 +22,48 @@ namespace w2l {
 typedef std::unordered_map<int, af::dim4> DimsMap;
 typedef std::unordered_map<int, std::vector<int>> TargetFeatMap;
 
+// Input features of a batch, written in place by featurize(). With the CPU
+// backend of ArrayFire the memory is allocated by ArrayFire, so that toArray()
+// hands it over to the array without a copy. Other backends keep it in host
+// memory, which toArray() uploads.
+class FeatureBuffer {
+ public:
+  FeatureBuffer();
+
+  // Uninitialized buffer of `size` elements
+  explicit FeatureBuffer(size_t size);
+
+  float* data() {
+    return data_.get();
+  }
+
+  const float* data() const {
+    return data_.get();
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  bool empty() const {
+    return size_ == 0;
+  }
+
+  // Returns an array of dimensions `dims` holding the features; the buffer is
+  // empty afterwards
+  af::array toArray(const af::dim4& dims);
+
+ private:
+  std::unique_ptr<float, void (*)(float*)> data_;
+  size_t size_;
+};
+
 struct W2lFeatureData {
-  std::vector<float> input;
+  FeatureBuffer input;
   TargetFeatMap targets;
   af::dim4 inputDims;
+  // Number of input frames of each sample before padding
+  std::vector<int> inputSizes;
   DimsMap targetDims;
   std::vector<int> sampleIds;
   af::dim4 sampleIdsDims;
@@ -34,6 +74,9 @@ struct W2lLoaderData {
   std::vector<float> input;
   TargetMap targets;
   std::string sampleId;
+  // If not empty, the input features are read from or added to the feature
+  // cache under this key, and `input` is only loaded if they were not cached
+  std::string featureCacheKey;
 };
 
 W2lFeatureData featurize(
@@ -42,6 +85,9 @@ W2lFeatureData featurize(
 
 FeatureParams defineSpeechFeatureParams();
 
+// Returns the cache given by -featurecache, or nullptr if there is none
+FeatureCache* getFeatureCache();
+
 int64_t getSpeechFeatureSize();
 
 } // namespace w2l
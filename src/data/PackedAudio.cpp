@@ -0,0 +1,296 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "data/PackedAudio.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <glog/logging.h>
+
+namespace w2l {
+
+namespace {
+
+constexpr const char* kPackedAudioMagic = "W2LPACKED";
+constexpr int kPackedAudioVersion = 1;
+
+int64_t bytesPerSample(PackedAudioType type) {
+  return type == PackedAudioType::INT16 ? sizeof(int16_t) : sizeof(float);
+}
+
+std::string typeName(PackedAudioType type) {
+  return type == PackedAudioType::INT16 ? "int16" : "float32";
+}
+
+} // namespace
+
+std::string packedAudioShardPath(const std::string& path, int64_t shard) {
+  std::ostringstream ss;
+  ss << path << "." << std::setw(5) << std::setfill('0') << shard;
+  return ss.str();
+}
+
+PackedAudioWriter::PackedAudioWriter(
+    const std::string& path,
+    PackedAudioType type,
+    int64_t samplerate,
+    int64_t channels,
+    int64_t maxShardBytes)
+    : path_(path),
+      type_(type),
+      samplerate_(samplerate),
+      channels_(channels),
+      maxShardBytes_(maxShardBytes),
+      shardIdx_(-1),
+      shardBytes_(0),
+      closed_(false) {
+  if (samplerate_ <= 0 || channels_ <= 0 || maxShardBytes_ <= 0) {
+    throw std::invalid_argument("PackedAudioWriter: invalid arguments");
+  }
+}
+
+PackedAudioWriter::~PackedAudioWriter() {
+  if (!closed_) {
+    try {
+      close();
+    } catch (const std::exception& ex) {
+      LOG(ERROR) << ex.what();
+    }
+  }
+}
+
+void PackedAudioWriter::add(
+    const std::string& id,
+    const std::vector<float>& input,
+    const std::vector<std::string>& transcript) {
+  int64_t frames = input.size() / channels_;
+  if (type_ == PackedAudioType::FLOAT32) {
+    addBytes(
+        id,
+        reinterpret_cast<const char*>(input.data()),
+        input.size() * sizeof(float),
+        frames,
+        transcript);
+    return;
+  }
+  std::vector<int16_t> pcm(input.size());
+  std::transform(input.begin(), input.end(), pcm.begin(), [](float x) {
+    return static_cast<int16_t>(
+        std::max(-32768.0f, std::min(32767.0f, std::round(x * 32768.0f))));
+  });
+  addBytes(
+      id,
+      reinterpret_cast<const char*>(pcm.data()),
+      pcm.size() * sizeof(int16_t),
+      frames,
+      transcript);
+}
+
+void PackedAudioWriter::add(
+    const std::string& id,
+    const std::vector<short>& input,
+    const std::vector<std::string>& transcript) {
+  int64_t frames = input.size() / channels_;
+  if (type_ == PackedAudioType::INT16) {
+    addBytes(
+        id,
+        reinterpret_cast<const char*>(input.data()),
+        input.size() * sizeof(short),
+        frames,
+        transcript);
+    return;
+  }
+  std::vector<float> pcm(input.size());
+  std::transform(input.begin(), input.end(), pcm.begin(), [](short x) {
+    return x / 32768.0f;
+  });
+  add(id, pcm, transcript);
+}
+
+void PackedAudioWriter::addBytes(
+    const std::string& id,
+    const char* data,
+    int64_t bytes,
+    int64_t frames,
+    const std::vector<std::string>& transcript) {
+  if (closed_) {
+    throw std::logic_error("PackedAudioWriter: add() called after close()");
+  }
+  if (id.empty() || id.find_first_of(" \t\n") != std::string::npos) {
+    throw std::invalid_argument(
+        "PackedAudioWriter: invalid utterance id '" + id + "'");
+  }
+  if (shardIdx_ < 0 ||
+      (shardBytes_ > 0 && shardBytes_ + bytes > maxShardBytes_)) {
+    closeShard();
+    ++shardIdx_;
+    shardBytes_ = 0;
+    auto shardPath = packedAudioShardPath(path_, shardIdx_);
+    shard_.open(shardPath, std::ios::binary | std::ios::trunc);
+    if (!shard_.is_open()) {
+      throw std::runtime_error(
+          "PackedAudioWriter: could not open file " + shardPath);
+    }
+  }
+  shard_.write(data, bytes);
+  if (!shard_) {
+    throw std::runtime_error("PackedAudioWriter: write failed");
+  }
+  samples_.push_back({id, shardIdx_, shardBytes_, frames, transcript});
+  shardBytes_ += bytes;
+}
+
+void PackedAudioWriter::closeShard() {
+  if (!shard_.is_open()) {
+    return;
+  }
+  // Flushes the last buffered samples
+  shard_.close();
+  if (!shard_) {
+    throw std::runtime_error(
+        "PackedAudioWriter: write failed for " +
+        packedAudioShardPath(path_, shardIdx_));
+  }
+}
+
+void PackedAudioWriter::close() {
+  closed_ = true;
+  closeShard();
+  std::ofstream index(path_, std::ios::trunc);
+  if (!index.is_open()) {
+    throw std::runtime_error("PackedAudioWriter: could not open file " + path_);
+  }
+  index << kPackedAudioMagic << " " << kPackedAudioVersion << " "
+        << typeName(type_) << " " << samplerate_ << " " << channels_ << "\n";
+  for (const auto& s : samples_) {
+    index << s.id << " " << s.shard << " " << s.offset << " " << s.frames;
+    for (const auto& word : s.transcript) {
+      index << " " << word;
+    }
+    index << "\n";
+  }
+  if (!index) {
+    throw std::runtime_error("PackedAudioWriter: write failed for " + path_);
+  }
+}
+
+PackedAudioReader::PackedAudioReader(const std::string& path) {
+  std::ifstream index(path);
+  if (!index.is_open()) {
+    throw std::runtime_error("PackedAudioReader: could not open file " + path);
+  }
+  std::string line, magic, type;
+  int version = 0;
+  std::getline(index, line);
+  std::istringstream header(line);
+  header >> magic >> version >> type >> samplerate_ >> channels_;
+  if (!header || magic != kPackedAudioMagic ||
+      version != kPackedAudioVersion ||
+      (type != "int16" && type != "float32")) {
+    throw std::runtime_error(
+        "PackedAudioReader: invalid packed audio index " + path);
+  }
+  type_ = (type == "int16") ? PackedAudioType::INT16 : PackedAudioType::FLOAT32;
+
+  int64_t numShards = 0;
+  while (std::getline(index, line)) {
+    std::istringstream ss(line);
+    PackedAudioSample sample;
+    if (!(ss >> sample.id >> sample.shard >> sample.offset >> sample.frames) ||
+        sample.shard < 0 || sample.offset < 0 || sample.frames < 0) {
+      throw std::runtime_error(
+          "PackedAudioReader: cannot parse '" + line + "' in " + path);
+    }
+    std::string word;
+    while (ss >> word) {
+      sample.transcript.push_back(word);
+    }
+    numShards = std::max(numShards, sample.shard + 1);
+    samples_.push_back(std::move(sample));
+  }
+
+  try {
+    for (int64_t i = 0; i < numShards; ++i) {
+      auto shardPath = packedAudioShardPath(path, i);
+      int fd = open(shardPath.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      void* addr = MAP_FAILED;
+      if (fd >= 0 && fstat(fd, &st) == 0) {
+        addr = (st.st_size > 0)
+            ? mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0)
+            : nullptr;
+      }
+      std::string reason = strerror(errno);
+      if (fd >= 0) {
+        ::close(fd);
+      }
+      if (addr == MAP_FAILED) {
+        throw std::runtime_error(
+            "PackedAudioReader: could not map file " + shardPath + ": " +
+            reason);
+      }
+      shards_.emplace_back(addr, st.st_size);
+    }
+    for (const auto& s : samples_) {
+      int64_t end = s.offset + s.frames * channels_ * bytesPerSample(type_);
+      if (end > static_cast<int64_t>(shards_[s.shard].second)) {
+        throw std::runtime_error(
+            "PackedAudioReader: utterance " + s.id + " is out of bounds in " +
+            packedAudioShardPath(path, s.shard));
+      }
+    }
+  } catch (...) {
+    // The destructor won't run
+    unmapShards();
+    throw;
+  }
+}
+
+PackedAudioReader::~PackedAudioReader() {
+  unmapShards();
+}
+
+void PackedAudioReader::unmapShards() {
+  for (auto& shard : shards_) {
+    if (shard.first) {
+      munmap(shard.first, shard.second);
+    }
+  }
+  shards_.clear();
+}
+
+std::vector<float> PackedAudioReader::loadSound(int64_t idx) const {
+  const auto& s = samples_.at(idx);
+  const char* data = static_cast<const char*>(shards_[s.shard].first);
+  std::vector<float> out(s.frames * channels_);
+  if (out.empty()) {
+    return out;
+  }
+  if (type_ == PackedAudioType::FLOAT32) {
+    memcpy(out.data(), data + s.offset, out.size() * sizeof(float));
+  } else {
+    auto pcm = reinterpret_cast<const int16_t*>(data + s.offset);
+    for (size_t i = 0; i < out.size(); ++i) {
+      out[i] = pcm[i] * (1.0f / 32768.0f);
+    }
+  }
+  return out;
+}
+
+} // namespace w2l
@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace w2l {
+
+// Packed audio datasets store the raw PCM of many utterances in a few large
+// shard files, so that reading an utterance needs neither a file open nor
+// audio decoding. A packed dataset `path` consists of
+//  - the index `path`, a text file:
+//      W2LPACKED <version> <int16|float32> <samplerate> <channels>
+//      [utterance id] [shard] [offset] [frames] [word transcripts]
+//    with one line per utterance. `offset` is the position in bytes of its
+//    interleaved samples in shard `shard`, and `frames` is their number per
+//    channel;
+//  - the shards `path`.00000, `path`.00001, ..., holding the samples in
+//    native byte order. int16 samples are stored as round(x * 32768).
+
+enum class PackedAudioType { INT16, FLOAT32 };
+
+struct PackedAudioSample {
+  std::string id;
+  int64_t shard;
+  int64_t offset;
+  int64_t frames;
+  std::vector<std::string> transcript;
+};
+
+class PackedAudioWriter {
+ public:
+  // maxShardBytes - a new shard is started when the current one would grow
+  //   beyond this size
+  PackedAudioWriter(
+      const std::string& path,
+      PackedAudioType type,
+      int64_t samplerate,
+      int64_t channels,
+      int64_t maxShardBytes);
+
+  ~PackedAudioWriter();
+
+  // input - interleaved samples in [-1, 1] (Col Major : CHANNELS X FRAMES)
+  void add(
+      const std::string& id,
+      const std::vector<float>& input,
+      const std::vector<std::string>& transcript);
+
+  // Same, for samples read as int16 (stored without any rounding if
+  // the type is INT16)
+  void add(
+      const std::string& id,
+      const std::vector<short>& input,
+      const std::vector<std::string>& transcript);
+
+  // Writes the index. Called by the destructor if needed, which only logs
+  // errors: call it explicitly to get them as exceptions.
+  void close();
+
+ private:
+  std::string path_;
+  PackedAudioType type_;
+  int64_t samplerate_;
+  int64_t channels_;
+  int64_t maxShardBytes_;
+
+  std::vector<PackedAudioSample> samples_;
+  std::ofstream shard_;
+  int64_t shardIdx_;
+  int64_t shardBytes_;
+  bool closed_;
+
+  // Closes the current shard, if any, checking that it was fully written
+  void closeShard();
+
+  // Appends `bytes` bytes for utterance `id`
+  void addBytes(
+      const std::string& id,
+      const char* data,
+      int64_t bytes,
+      int64_t frames,
+      const std::vector<std::string>& transcript);
+};
+
+class PackedAudioReader {
+ public:
+  explicit PackedAudioReader(const std::string& path);
+
+  PackedAudioReader(const PackedAudioReader&) = delete;
+  PackedAudioReader& operator=(const PackedAudioReader&) = delete;
+
+  ~PackedAudioReader();
+
+  int64_t size() const {
+    return samples_.size();
+  }
+
+  const PackedAudioSample& sample(int64_t idx) const {
+    return samples_.at(idx);
+  }
+
+  PackedAudioType type() const {
+    return type_;
+  }
+
+  int64_t samplerate() const {
+    return samplerate_;
+  }
+
+  int64_t channels() const {
+    return channels_;
+  }
+
+  // Returns - interleaved samples of utterance `idx`, converted straight from
+  //   the shard mapping (Col Major : CHANNELS X FRAMES)
+  std::vector<float> loadSound(int64_t idx) const;
+
+ private:
+  PackedAudioType type_;
+  int64_t samplerate_;
+  int64_t channels_;
+  std::vector<PackedAudioSample> samples_;
+  // Read-only mappings of the shards
+  std::vector<std::pair<void*, size_t>> shards_;
+
+  void unmapShards();
+};
+
+// Name of shard `shard` of the packed dataset `path`
+std::string packedAudioShardPath(const std::string& path, int64_t shard);
+
+} // namespace w2l
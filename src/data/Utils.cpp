@@ -8,6 +8,8 @@
 
 #include "data/Utils.h"
 
+#include <unordered_map>
+
 namespace w2l {
 
 std::vector<int64_t> sortSamples(
@@ -80,6 +82,21 @@ std::vector<int64_t> sortSamples(
   }
   return sortedSampleIndices;
 }
+
+std::vector<double> getSortedInputSizes(
+    const std::vector<SpeechSampleMetaInfo>& samples,
+    const std::vector<int64_t>& sortedSampleIndices) {
+  std::unordered_map<int64_t, double> inputSizes;
+  for (const auto& sample : samples) {
+    inputSizes[sample.index()] = sample.audiolength();
+  }
+  std::vector<double> sortedInputSizes(sortedSampleIndices.size());
+  for (size_t i = 0; i < sortedSampleIndices.size(); ++i) {
+    sortedInputSizes[i] = inputSizes.at(sortedSampleIndices[i]);
+  }
+  return sortedInputSizes;
+}
+
 void filterSamples(
     std::vector<SpeechSampleMetaInfo>& samples,
     const int64_t minInputSz,
@@ -91,6 +91,12 @@ std::vector<int64_t> sortSamples(
     const int64_t inputbinsize,
     const int64_t outputbinsize);
 
+// Returns the input sizes of `samples` in the order `sortedSampleIndices`
+// returned by sortSamples()
+std::vector<double> getSortedInputSizes(
+    const std::vector<SpeechSampleMetaInfo>& samples,
+    const std::vector<int64_t>& sortedSampleIndices);
+
 void filterSamples(
     std::vector<SpeechSampleMetaInfo>& samples,
     const int64_t minInputSz,
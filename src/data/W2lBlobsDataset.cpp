@@ -58,13 +58,14 @@ W2lBlobsDataset::W2lBlobsDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  sampleSizes_ = getSortedInputSizes(speechSamplesMetaInfo, sampleSizeOrder_);
 
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
 }
 
 W2lBlobsDataset::~W2lBlobsDataset() {
-  threadpool_ = nullptr; // join all threads
+  prefetcher_ = nullptr; // join all threads
 }
 
 std::vector<W2lLoaderData> W2lBlobsDataset::getLoaderData(
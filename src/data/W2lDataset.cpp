@@ -8,6 +8,7 @@
 
 #include "W2lDataset.h"
 
+#include <algorithm>
 #include <functional>
 #include <numeric>
 
@@ -25,13 +26,17 @@ W2lDataset::W2lDataset(
     int worldsize /* = 1 */)
     : dicts_(dicts),
       batchSize_(batchsize),
+      maxBatchInputSize_(0),
       worldRank_(worldrank),
-      worldSize_(worldsize),
-      threadpool_(fl::cpp::make_unique<fl::ThreadPool>(FLAGS_nthread)) {
+      worldSize_(worldsize) {
   if (batchSize_ < 1 || worldRank_ < 0 || worldSize_ < 1 ||
       worldRank_ >= worldSize_) {
     LOG(FATAL) << "Invalid arguments!";
   }
+  prefetcher_ = fl::cpp::make_unique<BatchPrefetcher<W2lFeatureData>>(
+      [this](int64_t idx) { return this->getFeatureData(idx); },
+      FLAGS_nthread,
+      FLAGS_prefetchdepth > 0 ? FLAGS_prefetchdepth : FLAGS_nthread);
 }
 
 int64_t W2lDataset::size() const {
@@ -41,19 +46,12 @@ int64_t W2lDataset::size() const {
 std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   checkIndexBounds(idx);
 
-  W2lFeatureData feat;
-  if (FLAGS_nthread > 0) {
-    feat = getFeatureDataAndPrefetch(idx);
-  } else {
-    feat = getFeatureData(idx);
-  }
+  auto feat = getFeatureDataAndPrefetch(idx);
   std::vector<af::array> result(kNumDataIdx);
-  result[kInputIdx] = feat.input.empty()
-      ? af::array(feat.inputDims)
-      : af::array(feat.inputDims, feat.input.data());
+  result[kInputIdx] = feat.input.toArray(feat.inputDims);
   for (const auto& target : feat.targets) {
     auto targetType = target.first;
-    auto targetData = target.second;
+    const auto& targetData = target.second;
     auto targetDims = feat.targetDims[targetType];
     result[targetType] = targetData.empty()
         ? af::array(targetDims)
@@ -62,11 +60,18 @@ std::vector<af::array> W2lDataset::get(const int64_t idx) const {
   result[kSampleIdx] = feat.sampleIds.empty()
       ? af::array(feat.sampleIdsDims)
       : af::array(feat.sampleIdsDims, feat.sampleIds.data());
+  result[kInputSizeIdx] = feat.inputSizes.empty()
+      ? af::array(af::dim4(0), s32)
+      : af::array(feat.inputSizes.size(), feat.inputSizes.data());
   return result;
 }
 
 int64_t W2lDataset::getGlobalBatchIdx(const int64_t idx) {
-  return sampleBatches_[idx][0] / (worldSize_ * batchSize_);
+  // Batches are made of consecutive samples, and the batches of all processes
+  // with the same index cover the same range
+  return std::lower_bound(
+             batchStarts_.begin(), batchStarts_.end(), sampleBatches_[idx][0]) -
+      batchStarts_.begin();
 }
 
 W2lFeatureData W2lDataset::getFeatureData(const int64_t idx) const {
@@ -75,45 +80,42 @@ W2lFeatureData W2lDataset::getFeatureData(const int64_t idx) const {
 }
 
 W2lFeatureData W2lDataset::getFeatureDataAndPrefetch(const int64_t idx) const {
-  W2lFeatureData feat;
-  // check cache
-  auto cachedata = prefetchCache_.find(idx);
-  if (cachedata != prefetchCache_.end()) {
-    feat = cachedata->second.get();
-    prefetchCache_.erase(idx);
-  } else {
-    feat = getFeatureData(idx);
-  }
+  return prefetcher_->get(idx);
+}
 
-  int64_t prefetchSize = FLAGS_nthread;
-  // remove from cache (if necessary)
-  for (auto it = prefetchCache_.begin(); it != prefetchCache_.end();) {
-    if (it->first < idx || it->first > idx + prefetchSize) {
-      it = prefetchCache_.erase(it);
-      continue;
-    } else {
-      ++it;
+void W2lDataset::shuffle(int seed) {
+  // We shuffle such that calling `get(idx)` from different mpi jobs with same
+  // `idx` would return similar length samples
+  if (maxBatchInputSize_ > 0) {
+    if (static_cast<int64_t>(sampleSizes_.size()) != sampleCount_) {
+      LOG(FATAL) << "-maxbatchisz is not supported by this dataset";
     }
+    DynamicBatchPacker shuffler(
+        sampleSizes_, maxBatchInputSize_, worldSize_, worldRank_);
+    sampleBatches_ = shuffler.getBatches(sampleCount_, seed);
+  } else {
+    RoundRobinBatchPacker shuffler(batchSize_, worldSize_, worldRank_);
+    sampleBatches_ = shuffler.getBatches(sampleCount_, seed);
   }
-
-  // add to cache
-  for (int64_t i = idx + 1; i < std::min(idx + 1 + prefetchSize, size()); ++i) {
-    if (prefetchCache_.find(i) == prefetchCache_.end()) {
-      prefetchCache_.emplace(
-          i,
-          threadpool_->enqueue(
-              [this](int64_t j) { return this->getFeatureData(j); }, i));
-    }
+  batchStarts_.clear();
+  for (const auto& batch : sampleBatches_) {
+    batchStarts_.push_back(batch[0]);
   }
-  return feat;
+  std::sort(batchStarts_.begin(), batchStarts_.end());
+  prefetcher_->reset(size());
 }
 
-void W2lDataset::shuffle(int seed) {
-  prefetchCache_.clear();
-  RoundRobinBatchPacker shuffler(batchSize_, worldSize_, worldRank_);
-  // We shuffle such that calling `get(idx)` from different mpi jobs with same
-  // `idx` would return similar length samples
-  sampleBatches_ = shuffler.getBatches(sampleCount_, seed);
+void W2lDataset::setMaxBatchInputSize(double maxBatchInputSize) {
+  maxBatchInputSize_ = maxBatchInputSize;
+  shuffle(-1);
+}
+
+PrefetchStats W2lDataset::getPrefetchStats() const {
+  return prefetcher_->stats();
+}
+
+void W2lDataset::resetPrefetchStats() {
+  prefetcher_->resetStats();
 }
 
 std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
@@ -165,4 +167,51 @@ std::vector<std::vector<int64_t>> RoundRobinBatchPacker::getBatches(
   return batches;
 }
 
+std::vector<std::vector<int64_t>> DynamicBatchPacker::getBatches(
+    int64_t nSamples,
+    int64_t seed) const {
+  if (nSamples != static_cast<int64_t>(sampleSizes_.size())) {
+    LOG(FATAL) << "DynamicBatchPacker: expected " << sampleSizes_.size()
+               << " samples, got " << nSamples;
+  }
+  // Global batches as (first sample, number of samples per process), in the
+  // order of the samples
+  std::vector<std::pair<int64_t, int64_t>> globalBatches;
+  int64_t offset = 0;
+  while (nSamples - offset >= worldSize_) {
+    auto maxSize = *std::max_element(
+        sampleSizes_.begin() + offset,
+        sampleSizes_.begin() + offset + worldSize_);
+    int64_t nCurSamples = 1;
+    while (offset + (nCurSamples + 1) * worldSize_ <= nSamples) {
+      auto next = sampleSizes_.begin() + offset + nCurSamples * worldSize_;
+      auto size =
+          std::max(maxSize, *std::max_element(next, next + worldSize_));
+      if ((nCurSamples + 1) * size > maxBatchInputSize_) {
+        break;
+      }
+      maxSize = size;
+      ++nCurSamples;
+    }
+    globalBatches.emplace_back(offset, nCurSamples);
+    offset += nCurSamples * worldSize_;
+  }
+
+  if (seed >= 0) {
+    auto rng = std::default_random_engine(seed);
+    std::shuffle(globalBatches.begin(), globalBatches.end(), rng);
+  }
+
+  std::vector<std::vector<int64_t>> batches(globalBatches.size());
+  for (size_t i = 0; i < globalBatches.size(); ++i) {
+    auto nCurSamples = globalBatches[i].second;
+    batches[i].resize(nCurSamples);
+    std::iota(
+        batches[i].begin(),
+        batches[i].end(),
+        globalBatches[i].first + nCurSamples * worldRank_);
+  }
+  return batches;
+}
+
 } // namespace w2l
@@ -8,11 +8,12 @@
 
 #pragma once
 
-#include <unordered_map>
+#include <memory>
 #include <vector>
 
 #include <flashlight/flashlight.h>
 
+#include "data/BatchPrefetcher.h"
 #include "data/Featurize.h"
 #include "libraries/common/Dictionary.h"
 
@@ -28,9 +29,9 @@ class W2lDataset : public fl::Dataset {
 
   int64_t size() const override;
 
-  // NB: get() is thread-hostile if FLAGS_nthread > 0: it must be called
-  // from only one thread. In this case, it also expects calls to be sequential,
-  // or else samples will be loaded into cache unnecessarily and discarded.
+  // get() is thread-safe. If FLAGS_nthread > 0, the batches following `idx`
+  // are loaded in the background (see BatchPrefetcher), which pays off when
+  // they are requested in order.
   std::vector<af::array> get(const int64_t idx) const override;
 
   virtual std::vector<W2lLoaderData> getLoaderData(const int64_t idx) const = 0;
@@ -43,22 +44,35 @@ class W2lDataset : public fl::Dataset {
 
   void shuffle(int seed);
 
+  // If `maxBatchInputSize` > 0, packs batches of variable size within this
+  // input size budget instead of batches of `batchsize` samples (see
+  // DynamicBatchPacker). Batches are re-packed in the unshuffled order.
+  void setMaxBatchInputSize(double maxBatchInputSize);
+
+  PrefetchStats getPrefetchStats() const;
+
+  void resetPrefetchStats();
+
  protected:
   DictionaryMap dicts_;
 
   int64_t sampleCount_; // Num individual samples in the dataset before batching
   int64_t batchSize_;
+  double maxBatchInputSize_; // See setMaxBatchInputSize()
+  // Input size of each sample, in the order samples are packed into batches.
+  // Required for maxBatchInputSize_ > 0.
+  std::vector<double> sampleSizes_;
 
   // Note, if worldSize = N, then worldRank should be in [0, N)
   int64_t worldRank_; // The GPU id for which this Dataset is being used
   int64_t worldSize_; // Total number of parallel GPUs/ CPUs used in training
 
-  // used if FLAGS_nthread > 1
-  std::unique_ptr<fl::ThreadPool> threadpool_;
-  mutable std::unordered_map<int64_t, std::future<W2lFeatureData>>
-      prefetchCache_;
+  // FLAGS_nthread workers, FLAGS_prefetchdepth batches ahead
+  std::unique_ptr<BatchPrefetcher<W2lFeatureData>> prefetcher_;
 
   std::vector<std::vector<int64_t>> sampleBatches_;
+  // First sample of each batch, sorted
+  std::vector<int64_t> batchStarts_;
 };
 
 // Abstract class which defines an interface to pack samples
@@ -88,4 +102,36 @@ class RoundRobinBatchPacker : public BatchPacker {
   int64_t worldSize_;
   int64_t worldRank_;
 };
+
+// Implementation which packs consecutive samples into batches of variable
+// size, such that the number of samples in a batch times their max input size
+// is at most `maxBatchInputSize`. Samples are expected in order of size (see
+// sortSamples()) to keep the padding low. Each global batch is split into
+// equal parts for all the processes, which thus get the same number of
+// batches; at most worldSize - 1 samples at the end are left out. A single
+// sample larger than `maxBatchInputSize` makes a batch on its own.
+class DynamicBatchPacker : public BatchPacker {
+ public:
+  // sampleSizes - input size of each sample
+  DynamicBatchPacker(
+      std::vector<double> sampleSizes,
+      double maxBatchInputSize,
+      int64_t worldSize,
+      int64_t worldRank)
+      : sampleSizes_(std::move(sampleSizes)),
+        maxBatchInputSize_(maxBatchInputSize),
+        worldSize_(worldSize),
+        worldRank_(worldRank) {}
+
+  // Use seed < 0, for no shuffling of the batches
+  virtual std::vector<std::vector<int64_t>> getBatches(
+      int64_t numSamples,
+      int64_t seed) const override;
+
+ private:
+  std::vector<double> sampleSizes_;
+  double maxBatchInputSize_;
+  int64_t worldSize_;
+  int64_t worldRank_;
+};
 } // namespace w2l
@@ -57,18 +57,20 @@ W2lListFilesDataset::W2lListFilesDataset(
       FLAGS_dataorder,
       FLAGS_inputbinsize,
       FLAGS_outputbinsize);
+  sampleSizes_ = getSortedInputSizes(speechSamplesMetaInfo, sampleSizeOrder_);
 
   shuffle(-1);
   LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
 }
 
 W2lListFilesDataset::~W2lListFilesDataset() {
-  threadpool_ = nullptr; // join all threads
+  prefetcher_ = nullptr; // join all threads
 }
 
 std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
     const int64_t idx) const {
   std::vector<W2lLoaderData> data(sampleBatches_[idx].size(), W2lLoaderData());
+  auto featureCache = getFeatureCache();
   for (int64_t id = 0; id < sampleBatches_[idx].size(); ++id) {
     auto i = sampleSizeOrder_[sampleBatches_[idx][id]];
 
@@ -78,7 +80,15 @@ std::vector<W2lLoaderData> W2lListFilesDataset::getLoaderData(
     }
 
     data[id].sampleId = data_[i].getSampleId();
-    data[id].input = loadSound(data_[i].getAudioFile());
+    auto audioFile = data_[i].getAudioFile();
+    FeatureCache::Entry cached;
+    if (featureCache) {
+      data[id].featureCacheKey = FeatureCache::fileKey(audioFile);
+    }
+    if (data[id].featureCacheKey.empty() ||
+        !featureCache->find(data[id].featureCacheKey, cached)) {
+      data[id].input = loadSound(audioFile);
+    }
     data[id].targets[kTargetIdx] = wrd2Target(
         data_[i].getTranscript(),
         lexicon_,
@@ -0,0 +1,136 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "data/W2lPackedDataset.h"
+
+namespace w2l {
+
+W2lPackedDataset::W2lPackedDataset(
+    const std::string& filenames,
+    const DictionaryMap& dicts,
+    const LexiconMap& lexicon,
+    int64_t batchSize /* = 1 */,
+    int worldRank /* = 0 */,
+    int worldSize /* = 1 */,
+    bool fallback2Ltr /* = false */,
+    bool skipUnk /* = false */,
+    const std::string& rootdir /* = "" */)
+    : W2lDataset(dicts, batchSize, worldRank, worldSize),
+      lexicon_(lexicon),
+      fallback2Ltr_(fallback2Ltr),
+      skipUnk_(skipUnk) {
+  includeWrd_ = (dicts.find(kWordIdx) != dicts.end());
+
+  LOG_IF(FATAL, dicts.find(kTargetIdx) == dicts.end())
+      << "Target dictionary does not exist";
+
+  auto filesVec = split(',', filenames);
+  std::vector<SpeechSampleMetaInfo> speechSamplesMetaInfo;
+  for (const auto& f : filesVec) {
+    auto fullpath = pathsConcat(rootdir, trim(f));
+    auto fileSampleInfo = loadPack(fullpath);
+    speechSamplesMetaInfo.insert(
+        speechSamplesMetaInfo.end(),
+        fileSampleInfo.begin(),
+        fileSampleInfo.end());
+  }
+
+  filterSamples(
+      speechSamplesMetaInfo,
+      FLAGS_minisz,
+      FLAGS_maxisz,
+      FLAGS_mintsz,
+      FLAGS_maxtsz);
+  sampleCount_ = speechSamplesMetaInfo.size();
+  sampleSizeOrder_ = sortSamples(
+      speechSamplesMetaInfo,
+      FLAGS_dataorder,
+      FLAGS_inputbinsize,
+      FLAGS_outputbinsize);
+  sampleSizes_ = getSortedInputSizes(speechSamplesMetaInfo, sampleSizeOrder_);
+
+  shuffle(-1);
+  LOG(INFO) << "Total batches (i.e. iters): " << sampleBatches_.size();
+}
+
+W2lPackedDataset::~W2lPackedDataset() {
+  prefetcher_ = nullptr; // join all threads
+}
+
+std::vector<W2lLoaderData> W2lPackedDataset::getLoaderData(
+    const int64_t idx) const {
+  std::vector<W2lLoaderData> data(sampleBatches_[idx].size(), W2lLoaderData());
+  for (int64_t id = 0; id < sampleBatches_[idx].size(); ++id) {
+    auto i = sampleSizeOrder_[sampleBatches_[idx][id]];
+
+    if (!(i >= 0 && i < sampleIndex_.size())) {
+      throw std::out_of_range(
+          "W2lPackedDataset::getLoaderData idx out of range");
+    }
+
+    const auto& pack = *packs_[packIndex_[i]];
+    const auto& sample = pack.sample(sampleIndex_[i]);
+    data[id].sampleId = sample.id;
+    data[id].input = pack.loadSound(sampleIndex_[i]);
+    data[id].targets[kTargetIdx] = wrd2Target(
+        sample.transcript,
+        lexicon_,
+        dicts_.at(kTargetIdx),
+        fallback2Ltr_,
+        skipUnk_);
+
+    if (includeWrd_) {
+      data[id].targets[kWordIdx] = sample.transcript;
+    }
+  }
+  return data;
+}
+
+std::vector<SpeechSampleMetaInfo> W2lPackedDataset::loadPack(
+    const std::string& filename) {
+  auto pack = fl::cpp::make_unique<PackedAudioReader>(filename);
+
+  LOG_IF(FATAL, pack->samplerate() != FLAGS_samplerate)
+      << "Sample rate of '" << filename << "' is " << pack->samplerate()
+      << ", expected " << FLAGS_samplerate;
+  LOG_IF(FATAL, pack->channels() != FLAGS_channels)
+      << "Number of channels of '" << filename << "' is " << pack->channels()
+      << ", expected " << FLAGS_channels;
+
+  std::vector<SpeechSampleMetaInfo> samplesMetaInfo;
+  auto curDataSize = packIndex_.size();
+  int64_t idx = curDataSize;
+  for (int64_t s = 0; s < pack->size(); s++) {
+    const auto& sample = pack->sample(s);
+
+    packIndex_.emplace_back(packs_.size());
+    sampleIndex_.emplace_back(s);
+
+    auto targets = wrd2Target(
+        sample.transcript,
+        lexicon_,
+        dicts_.at(kTargetIdx),
+        fallback2Ltr_,
+        skipUnk_);
+    double durationMs = sample.frames * 1000.0 / pack->samplerate();
+    samplesMetaInfo.emplace_back(
+        SpeechSampleMetaInfo(durationMs, targets.size(), idx));
+
+    ++idx;
+  }
+
+  packs_.push_back(std::move(pack));
+
+  LOG(INFO) << samplesMetaInfo.size() << " files found. ";
+
+  return samplesMetaInfo;
+}
+} // namespace w2l
@@ -0,0 +1,140 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "data/BatchPrefetcher.h"
+
+using namespace w2l;
+
+namespace {
+
+std::vector<int64_t> loadBatch(int64_t idx) {
+  return std::vector<int64_t>(idx % 7 + 1, idx);
+}
+
+} // namespace
+
+TEST(BatchPrefetcherTest, Sequential) {
+  std::atomic<int64_t> numLoads(0);
+  BatchPrefetcher<std::vector<int64_t>> prefetcher(
+      [&numLoads](int64_t idx) {
+        ++numLoads;
+        std::this_thread::sleep_for(std::chrono::milliseconds(idx % 3));
+        return loadBatch(idx);
+      },
+      3,
+      4);
+  const int64_t size = 50;
+  prefetcher.reset(size);
+  for (int64_t i = 0; i < size; ++i) {
+    ASSERT_EQ(prefetcher.get(i), loadBatch(i));
+  }
+  auto stats = prefetcher.stats();
+  ASSERT_EQ(stats.requests, size);
+  ASSERT_EQ(stats.ready + stats.waited + stats.direct, size);
+  // Only the first batch must be loaded by the caller
+  ASSERT_GE(stats.ready + stats.waited, size / 2);
+  ASSERT_LE(stats.queueDepthSum, 4 * size);
+  ASSERT_LE(numLoads, size + 4);
+
+  prefetcher.resetStats();
+  ASSERT_EQ(prefetcher.stats().requests, 0);
+}
+
+TEST(BatchPrefetcherTest, RandomAccess) {
+  BatchPrefetcher<std::vector<int64_t>> prefetcher(loadBatch, 2, 8);
+  prefetcher.reset(100);
+  for (int64_t i : {5, 90, 6, 7, 0, 99, 98, 50, 51, 52, 53, 3}) {
+    ASSERT_EQ(prefetcher.get(i), loadBatch(i));
+  }
+  // Batches are handed out again after a reset
+  prefetcher.reset(20);
+  for (int64_t i = 0; i < 20; ++i) {
+    ASSERT_EQ(prefetcher.get(i), loadBatch(i));
+  }
+  ASSERT_EQ(prefetcher.get(19), loadBatch(19));
+}
+
+TEST(BatchPrefetcherTest, ConcurrentConsumers) {
+  std::atomic<int64_t> inFlight(0), maxInFlight(0);
+  BatchPrefetcher<std::vector<int64_t>> prefetcher(
+      [&](int64_t idx) {
+        int64_t n = ++inFlight;
+        int64_t prev = maxInFlight;
+        while (n > prev && !maxInFlight.compare_exchange_weak(prev, n)) {
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(200));
+        --inFlight;
+        return loadBatch(idx);
+      },
+      4,
+      6);
+  const int64_t size = 400, numConsumers = 4;
+  prefetcher.reset(size);
+  std::atomic<int64_t> next(0), errors(0);
+  std::vector<std::thread> consumers;
+  for (int64_t c = 0; c < numConsumers; ++c) {
+    consumers.emplace_back([&]() {
+      int64_t i;
+      while ((i = next++) < size) {
+        if (prefetcher.get(i) != loadBatch(i)) {
+          ++errors;
+        }
+      }
+    });
+  }
+  for (auto& consumer : consumers) {
+    consumer.join();
+  }
+  ASSERT_EQ(errors, 0);
+  ASSERT_EQ(prefetcher.stats().requests, size);
+  // Workers plus consumers loading directly
+  ASSERT_LE(maxInFlight, 4 + numConsumers);
+}
+
+TEST(BatchPrefetcherTest, Errors) {
+  BatchPrefetcher<std::vector<int64_t>> prefetcher(
+      [](int64_t idx) {
+        if (idx % 2 == 1) {
+          throw std::runtime_error("bad batch");
+        }
+        return loadBatch(idx);
+      },
+      2,
+      2);
+  prefetcher.reset(10);
+  for (int64_t i = 0; i < 10; ++i) {
+    if (i % 2 == 1) {
+      ASSERT_THROW(prefetcher.get(i), std::runtime_error);
+    } else {
+      ASSERT_EQ(prefetcher.get(i), loadBatch(i));
+    }
+  }
+}
+
+TEST(BatchPrefetcherTest, NoWorkers) {
+  BatchPrefetcher<std::vector<int64_t>> prefetcher(loadBatch, 0, 4);
+  prefetcher.reset(10);
+  for (int64_t i = 0; i < 10; ++i) {
+    ASSERT_EQ(prefetcher.get(i), loadBatch(i));
+  }
+  auto stats = prefetcher.stats();
+  ASSERT_EQ(stats.direct, 10);
+  ASSERT_EQ(stats.queueDepthSum, 0);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
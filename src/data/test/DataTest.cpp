@@ -60,7 +60,7 @@ TEST(DataTest, inputFeaturizer) {
     dicts.insert({kTargetIdx, d});
 
     auto feat = featurize(data, dicts);
-    return af::array(feat.inputDims, feat.input.data());
+    return feat.input.toArray(feat.inputDims);
   };
 
   std::vector<std::vector<float>> inputs;
@@ -193,6 +193,24 @@ TEST(DataTest, W2lListDataset) {
     ASSERT_EQ(target(i).scalar<int>(), expectedTarget[i]);
   }
   ASSERT_EQ(input.dims(), af::dim4(24000));
+
+  // -maxbatchisz only applies to datasets it is explicitly set on
+  {
+    // Restores the flag on scope exit, also when an assertion returns early
+    struct MaxBatchInputSizeGuard {
+      int64_t saved = w2l::FLAGS_maxbatchisz;
+      ~MaxBatchInputSizeGuard() {
+        w2l::FLAGS_maxbatchisz = saved;
+      }
+    } guard;
+    w2l::FLAGS_maxbatchisz = 1e9;
+    ds.shuffle(0);
+    ASSERT_EQ(ds.size(), 3);
+    ds.setMaxBatchInputSize(1e9);
+    ASSERT_EQ(ds.size(), 1);
+    ds.setMaxBatchInputSize(0);
+    ASSERT_EQ(ds.size(), 3);
+  }
 }
 
 TEST(RoundRobinBatchShufflerTest, params) {
@@ -235,6 +253,49 @@ TEST(RoundRobinBatchShufflerTest, params) {
   ASSERT_THAT(batches[1], ::testing::ElementsAre(4, 5));
 }
 
+TEST(DynamicBatchPackerTest, params) {
+  std::vector<double> sizes = {1, 1, 1, 1, 2, 2, 2, 3, 3, 5, 6};
+  auto packer = DynamicBatchPacker(sizes, 4, 1, 0);
+  auto batches = packer.getBatches(11, -1);
+  EXPECT_EQ(batches.size(), 7);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(0, 1, 2, 3));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(4, 5));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(6));
+  ASSERT_THAT(batches[3], ::testing::ElementsAre(7));
+  ASSERT_THAT(batches[4], ::testing::ElementsAre(8));
+  // Larger than the budget on their own
+  ASSERT_THAT(batches[5], ::testing::ElementsAre(9));
+  ASSERT_THAT(batches[6], ::testing::ElementsAre(10));
+
+  // Same number of samples for both processes; the budget applies to the
+  // max size over all of them
+  packer = DynamicBatchPacker(sizes, 4, 2, 0);
+  batches = packer.getBatches(11, -1);
+  EXPECT_EQ(batches.size(), 4);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(0, 1));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(4));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(6));
+  ASSERT_THAT(batches[3], ::testing::ElementsAre(8));
+
+  // The last sample is left out
+  packer = DynamicBatchPacker(sizes, 4, 2, 1);
+  batches = packer.getBatches(11, -1);
+  EXPECT_EQ(batches.size(), 4);
+  ASSERT_THAT(batches[0], ::testing::ElementsAre(2, 3));
+  ASSERT_THAT(batches[1], ::testing::ElementsAre(5));
+  ASSERT_THAT(batches[2], ::testing::ElementsAre(7));
+  ASSERT_THAT(batches[3], ::testing::ElementsAre(9));
+
+  // Shuffling keeps the global batches together
+  auto shuffled0 = DynamicBatchPacker(sizes, 4, 2, 0).getBatches(11, 3);
+  auto shuffled1 = DynamicBatchPacker(sizes, 4, 2, 1).getBatches(11, 3);
+  ASSERT_EQ(shuffled0.size(), 4);
+  for (size_t i = 0; i < shuffled0.size(); ++i) {
+    ASSERT_EQ(shuffled0[i].size(), shuffled1[i].size());
+    ASSERT_EQ(shuffled0[i][0] + shuffled0[i].size(), shuffled1[i][0]);
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
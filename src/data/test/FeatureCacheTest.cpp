@@ -0,0 +1,205 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <iterator>
+#include <numeric>
+
+#include <gtest/gtest.h>
+
+#include "data/FeatureCache.h"
+
+using namespace w2l;
+
+namespace {
+
+std::string cachePath() {
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  return "/tmp/" + userstr + "_test_featurecache.bin";
+}
+
+FeatureCache::Entry makeEntry(
+    const std::vector<float>& data,
+    int64_t featSz,
+    int64_t numChannels) {
+  FeatureCache::Entry entry;
+  entry.data = data.data();
+  entry.featSz = featSz;
+  entry.numFrames = data.size() / (featSz * numChannels);
+  entry.numChannels = numChannels;
+  return entry;
+}
+
+std::vector<float> entryData(const FeatureCache::Entry& entry) {
+  return std::vector<float>(entry.data, entry.data + entry.size());
+}
+
+} // namespace
+
+TEST(FeatureCacheTest, InsertFind) {
+  auto path = cachePath();
+  remove(path.c_str());
+  std::vector<float> feat1(3 * 7 * 2), feat2(5 * 11);
+  std::iota(feat1.begin(), feat1.end(), 0.0);
+  std::iota(feat2.begin(), feat2.end(), -100.0);
+
+  FeatureCache::Entry entry;
+  {
+    FeatureCache cache(path, 1);
+    ASSERT_FALSE(cache.find("a.flac", entry));
+    cache.insert("a.flac", makeEntry(feat1, 3, 2));
+    cache.insert("bb.flac", makeEntry(feat2, 5, 1));
+    cache.insert("empty.flac", makeEntry({}, 5, 1));
+    // Already cached: ignored
+    cache.insert("a.flac", makeEntry(feat2, 5, 1));
+
+    ASSERT_TRUE(cache.find("a.flac", entry));
+    ASSERT_EQ(entry.featSz, 3);
+    ASSERT_EQ(entry.numFrames, 7);
+    ASSERT_EQ(entry.numChannels, 2);
+    ASSERT_EQ(entryData(entry), feat1);
+    ASSERT_TRUE(cache.find("bb.flac", entry));
+    ASSERT_EQ(entryData(entry), feat2);
+    ASSERT_TRUE(cache.find("empty.flac", entry));
+    ASSERT_EQ(entry.size(), 0);
+  }
+
+  // Persistent across instances, separate for different parameters
+  FeatureCache cache(path, 1);
+  ASSERT_TRUE(cache.find("bb.flac", entry));
+  ASSERT_EQ(entryData(entry), feat2);
+  FeatureCache::Entry entry1;
+  ASSERT_TRUE(cache.find("a.flac", entry1));
+  ASSERT_EQ(entryData(entry1), feat1);
+  // Entries stay valid while the file grows
+  cache.insert("c.flac", makeEntry(std::vector<float>(1 << 16, 1.0), 4, 1));
+  ASSERT_TRUE(cache.find("c.flac", entry));
+  ASSERT_EQ(entry.numFrames, 1 << 14);
+  ASSERT_EQ(entryData(entry1), feat1);
+
+  FeatureCache other(path, 2);
+  ASSERT_FALSE(other.find("a.flac", entry));
+  other.insert("a.flac", makeEntry(feat2, 5, 1));
+  ASSERT_TRUE(other.find("a.flac", entry));
+  ASSERT_EQ(entryData(entry), feat2);
+  ASSERT_TRUE(cache.find("a.flac", entry));
+  ASSERT_EQ(entryData(entry), feat1);
+  remove(path.c_str());
+}
+
+TEST(FeatureCacheTest, SharedFile) {
+  auto path = cachePath();
+  remove(path.c_str());
+  std::vector<float> feat(40, 2.0);
+  FeatureCache::Entry entry;
+  FeatureCache cache1(path, 1);
+  FeatureCache cache2(path, 1);
+  cache1.insert("a.flac", makeEntry(feat, 4, 1));
+  ASSERT_TRUE(cache2.find("a.flac", entry));
+  ASSERT_EQ(entryData(entry), feat);
+  cache2.insert("b.flac", makeEntry(feat, 4, 1));
+  ASSERT_TRUE(cache1.find("b.flac", entry));
+  remove(path.c_str());
+}
+
+TEST(FeatureCacheTest, TruncatedRecord) {
+  auto path = cachePath();
+  remove(path.c_str());
+  std::vector<float> feat(40, 2.0);
+  {
+    FeatureCache cache(path, 1);
+    cache.insert("a.flac", makeEntry(feat, 4, 1));
+    cache.insert("b.flac", makeEntry(feat, 4, 1));
+  }
+  // Simulate a writer which died while appending "b.flac"
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::string content(
+        (std::istreambuf_iterator<char>(in)),
+        std::istreambuf_iterator<char>());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(content.data(), content.size() - 10);
+  }
+  FeatureCache::Entry entry;
+  FeatureCache cache(path, 1);
+  ASSERT_TRUE(cache.find("a.flac", entry));
+  ASSERT_EQ(entryData(entry), feat);
+  ASSERT_FALSE(cache.find("b.flac", entry));
+  cache.insert("b.flac", makeEntry(feat, 4, 1));
+  ASSERT_TRUE(cache.find("b.flac", entry));
+  ASSERT_EQ(entryData(entry), feat);
+
+  FeatureCache reopened(path, 1);
+  ASSERT_TRUE(reopened.find("b.flac", entry));
+  ASSERT_EQ(entryData(entry), feat);
+  remove(path.c_str());
+}
+
+TEST(FeatureCacheTest, GrowingFile) {
+  auto path = cachePath();
+  remove(path.c_str());
+  FeatureCache cache(path, 1);
+  std::vector<std::vector<float>> feats;
+  std::vector<FeatureCache::Entry> entries;
+  for (int i = 0; i < 200; ++i) {
+    feats.emplace_back(16 * (i % 37 + 1));
+    std::iota(feats.back().begin(), feats.back().end(), i * 1000.0);
+    auto key = std::to_string(i) + ".flac";
+    cache.insert(key, makeEntry(feats.back(), 16, 1));
+    // Records appended past the end of a mapping are read through it
+    entries.emplace_back();
+    ASSERT_TRUE(cache.find(key, entries.back()));
+    ASSERT_EQ(entryData(entries.back()), feats.back());
+  }
+  // Entries found before the file grew stay valid
+  for (int i = 0; i < entries.size(); ++i) {
+    ASSERT_EQ(entryData(entries[i]), feats[i]);
+  }
+  remove(path.c_str());
+}
+
+TEST(FeatureCacheTest, InvalidFile) {
+  auto path = cachePath();
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "this is not a feature cache, but long enough to hold a header";
+  }
+  EXPECT_THROW(FeatureCache(path, 1), std::runtime_error);
+  remove(path.c_str());
+}
+
+TEST(FeatureCacheTest, FileKey) {
+  auto path = cachePath() + ".wav";
+  remove(path.c_str());
+  ASSERT_EQ(FeatureCache::fileKey(path), "");
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "some audio";
+  }
+  auto key = FeatureCache::fileKey(path);
+  ASSERT_EQ(key.compare(0, path.size(), path), 0);
+  ASSERT_EQ(FeatureCache::fileKey(path), key);
+  {
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out << "some other audio";
+  }
+  // Features of the old file are not matched
+  ASSERT_NE(FeatureCache::fileKey(path), key);
+  remove(path.c_str());
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
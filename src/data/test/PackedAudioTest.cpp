@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "data/PackedAudio.h"
+
+using namespace w2l;
+
+namespace {
+
+std::string packPath() {
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  return "/tmp/" + userstr + "_test_packed.idx";
+}
+
+void removePack(const std::string& path, int64_t numShards) {
+  remove(path.c_str());
+  for (int64_t i = 0; i < numShards; ++i) {
+    remove(packedAudioShardPath(path, i).c_str());
+  }
+}
+
+std::vector<std::vector<float>> testAudio(int64_t channels) {
+  std::vector<std::vector<float>> audio;
+  for (int64_t len : {1000, 0, 1, 4000, 2500}) {
+    std::vector<float> a(len * channels);
+    for (size_t i = 0; i < a.size(); ++i) {
+      // multiples of 1/32768, exactly representable as int16
+      a[i] = static_cast<int16_t>((i * 7919 + len) % 65536 - 32768) / 32768.0f;
+    }
+    audio.push_back(a);
+  }
+  return audio;
+}
+
+// Whether `path` is mapped in this process
+bool isMapped(const std::string& path) {
+  std::ifstream maps("/proc/self/maps");
+  std::string line;
+  while (std::getline(maps, line)) {
+    if (line.size() >= path.size() &&
+        line.compare(line.size() - path.size(), path.size(), path) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+} // namespace
+
+TEST(PackedAudioTest, WriteRead) {
+  auto path = packPath();
+  for (auto type : {PackedAudioType::INT16, PackedAudioType::FLOAT32}) {
+    for (int64_t channels : {1, 2}) {
+      auto audio = testAudio(channels);
+      std::vector<std::vector<std::string>> transcripts = {
+          {"hello", "world"}, {}, {"a"}, {"b", "c", "d"}, {"e"}};
+      {
+        // small shards, several utterances per shard
+        PackedAudioWriter writer(path, type, 16000, channels, 8000);
+        for (size_t i = 0; i < audio.size(); ++i) {
+          writer.add("utt" + std::to_string(i), audio[i], transcripts[i]);
+        }
+        writer.close();
+      }
+      PackedAudioReader reader(path);
+      ASSERT_EQ(reader.type(), type);
+      ASSERT_EQ(reader.samplerate(), 16000);
+      ASSERT_EQ(reader.channels(), channels);
+      ASSERT_EQ(reader.size(), audio.size());
+      int64_t numShards = 0;
+      for (size_t i = 0; i < audio.size(); ++i) {
+        const auto& sample = reader.sample(i);
+        ASSERT_EQ(sample.id, "utt" + std::to_string(i));
+        ASSERT_EQ(sample.frames, audio[i].size() / channels);
+        ASSERT_EQ(sample.transcript, transcripts[i]);
+        ASSERT_EQ(reader.loadSound(i), audio[i]);
+        numShards = std::max(numShards, sample.shard + 1);
+      }
+      ASSERT_GT(numShards, 1);
+      removePack(path, numShards);
+    }
+  }
+}
+
+TEST(PackedAudioTest, Int16Input) {
+  auto path = packPath();
+  std::vector<short> pcm = {0, 1, -1, 32767, -32768, 1234};
+  std::vector<float> expected;
+  for (auto x : pcm) {
+    expected.push_back(x / 32768.0f);
+  }
+  for (auto type : {PackedAudioType::INT16, PackedAudioType::FLOAT32}) {
+    {
+      PackedAudioWriter writer(path, type, 8000, 1, 1 << 20);
+      writer.add("a", pcm, {"x"});
+      // float input is rounded to int16 and clipped
+      writer.add("b", std::vector<float>{0.5f, 2.0f, -2.0f}, {"y"});
+      writer.close();
+    }
+    PackedAudioReader reader(path);
+    ASSERT_EQ(reader.loadSound(0), expected);
+    if (type == PackedAudioType::INT16) {
+      std::vector<float> clipped = {0.5f, 32767 / 32768.0f, -1.0f};
+      ASSERT_EQ(reader.loadSound(1), clipped);
+    } else {
+      ASSERT_EQ(reader.loadSound(1), (std::vector<float>{0.5f, 2.0f, -2.0f}));
+    }
+    removePack(path, 1);
+  }
+}
+
+TEST(PackedAudioTest, InvalidIndex) {
+  auto path = packPath();
+  {
+    std::ofstream out(path);
+    out << "W2LPACKED 1 int16 16000 1\n";
+    out << "utt0 0 0 100 hello\n";
+  }
+  // missing shard
+  EXPECT_THROW(PackedAudioReader reader(path), std::runtime_error);
+  {
+    std::ofstream out(packedAudioShardPath(path, 0));
+    out << "too short";
+  }
+  EXPECT_THROW(PackedAudioReader reader(path), std::runtime_error);
+  // Shards mapped before the error are released
+  EXPECT_FALSE(isMapped(packedAudioShardPath(path, 0)));
+  {
+    std::ofstream out(path);
+    out << "not an index\n";
+  }
+  EXPECT_THROW(PackedAudioReader reader(path), std::runtime_error);
+  removePack(path, 1);
+}
+
+TEST(PackedAudioTest, CloseError) {
+  auto path = packPath() + ".missing/pack";
+  // The destructor logs the error instead of throwing
+  EXPECT_NO_THROW(
+      PackedAudioWriter(path, PackedAudioType::INT16, 16000, 1, 1 << 20));
+  PackedAudioWriter writer(path, PackedAudioType::INT16, 16000, 1, 1 << 20);
+  EXPECT_THROW(writer.close(), std::runtime_error);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,7 +7,13 @@
  */
 
 #include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 #include <fstream>
+#include <functional>
+#include <random>
+#include <sstream>
 #include <string>
 #include <vector>
 
@@ -19,9 +25,18 @@
 #include "common/Transforms.h"
 #include "criterion/criterion.h"
 #include "libraries/common/Dictionary.h"
+#include "libraries/decoder/DecoderPool.h"
+#include "libraries/decoder/DecoderSweep.h"
+#include "libraries/decoder/FlatTrie.h"
+#include "libraries/decoder/LexiconFreeDecoder.h"
+#include "libraries/decoder/Seq2SeqDecoder.h"
 #include "libraries/decoder/Trie.h"
 #include "libraries/decoder/WordLMDecoder.h"
+#include "libraries/lm/ConvLM.h"
 #include "libraries/lm/KenLM.h"
+#include "libraries/lm/CachingLM.h"
+#include "libraries/lm/SharedCachingLM.h"
+#include "libraries/lm/ZeroLM.h"
 #include "module/module.h"
 #include "runtime/runtime.h"
 
@@ -156,9 +171,65 @@ TEST(DecoderTest, run) {
     ASSERT_NEAR(node->maxScore, trieScoreTarget[i], 1e-5);
   }
 
+  // Compiled trie should give the same scores
+  auto flatTrie = std::make_shared<FlatTrie>(*trie);
+  for (int i = 0; i < sentence.size(); i++) {
+    auto wordTensor = tokens2Tensor(sentence[i], tokenDict);
+    int node = flatTrie->search(wordTensor);
+    ASSERT_GE(node, 0);
+    ASSERT_NEAR(flatTrie->getMaxScore(node), trieScoreTarget[i], 1e-5);
+  }
+
+  // ... and so should its mapped image
+  char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  const std::string triePath = "/tmp/" + userstr + "_lexicon.bin";
+  std::vector<std::string> words(wordDict.indexSize());
+  for (int i = 0; i < words.size(); i++) {
+    words[i] = wordDict.getEntry(i);
+  }
+  flatTrie->save(triePath, words, /* fingerprint = */ 42);
+  auto loadedTrie = FlatTrie::load(triePath);
+  ASSERT_EQ(loadedTrie->getNumNodes(), flatTrie->getNumNodes());
+  ASSERT_EQ(loadedTrie->getWords(), words);
+  ASSERT_EQ(loadedTrie->getFingerprint(), 42);
+  for (int i = 0; i < sentence.size(); i++) {
+    auto wordTensor = tokens2Tensor(sentence[i], tokenDict);
+    int node = loadedTrie->search(wordTensor);
+    ASSERT_GE(node, 0);
+    ASSERT_NEAR(loadedTrie->getMaxScore(node), trieScoreTarget[i], 1e-5);
+  }
+
+  // Truncated or corrupted images are rejected
+  std::ifstream imageStream(triePath, std::ios::binary);
+  std::string image(
+      (std::istreambuf_iterator<char>(imageStream)),
+      std::istreambuf_iterator<char>());
+  imageStream.close();
+  const std::string badTriePath = triePath + ".bad";
+  auto writeImage = [&](const std::string& badImage) {
+    std::ofstream badStream(badTriePath, std::ios::binary);
+    badStream.write(badImage.data(), badImage.size());
+  };
+  writeImage(image.substr(0, image.size() / 2));
+  ASSERT_THROW(FlatTrie::load(badTriePath), std::runtime_error);
+  // Child offsets follow the 56-byte header and the tokens and scores of the
+  // nodes, all sections being 8-byte aligned
+  size_t nNodes = flatTrie->getNumNodes();
+  size_t childOffsetsPos = 56 + 2 * ((nNodes * 4 + 7) & ~size_t(7));
+  std::string badImage = image;
+  int badOffset = nNodes + 1;
+  std::memcpy(&badImage[childOffsetsPos + 4], &badOffset, sizeof(int));
+  writeImage(badImage);
+  ASSERT_THROW(FlatTrie::load(badTriePath), std::runtime_error);
+
   /* -------- Build Decoder --------*/
   DecoderOptions decoderOpt(
       2500, // FLAGS_beamsize
+      25000, // FLAGS_beamsizetoken
       100.0, // FLAGS_beamthreshold
       2.0, // FLAGS_lmweight
       2.0, // FLAGS_lexiconcore
@@ -168,7 +239,7 @@ TEST(DecoderTest, run) {
       CriterionType::ASG);
 
   WordLMDecoder decoder(
-      decoderOpt, trie, lm, silIdx, blankIdx, unkIdx, transitions);
+      decoderOpt, flatTrie, lm, silIdx, blankIdx, unkIdx, transitions);
   LOG(INFO) << "[Decoder] Decoder constructed.\n";
 
   /* -------- Run --------*/
@@ -192,6 +263,529 @@ TEST(DecoderTest, run) {
   for (int i = 0; i < 5; i++) {
     ASSERT_NEAR(results[i].score, hypScoreTarget[i], 1e-3);
   }
+
+  /* -------- Run in a pool --------*/
+  DecoderPool pool(2, [&](int /* unused */) {
+    return std::unique_ptr<Decoder>(new WordLMDecoder(
+        decoderOpt, flatTrie, lm, silIdx, blankIdx, unkIdx, transitions));
+  });
+  std::vector<std::future<std::vector<DecodeResult>>> poolResults;
+  for (int i = 0; i < 3; i++) {
+    poolResults.push_back(pool.decode(emission.data(), T, N));
+  }
+  for (auto& poolResult : poolResults) {
+    auto poolHyps = poolResult.get();
+    ASSERT_EQ(poolHyps.size(), n_hyp);
+    ASSERT_NEAR(poolHyps[0].score, hypScoreTarget[0], 1e-3);
+  }
+
+  /* -------- Run with an LM cache kept across sentences --------*/
+  auto cachingLm = std::make_shared<CachingLM>(lm, 1 << 16);
+  WordLMDecoder cachingDecoder(
+      decoderOpt, flatTrie, cachingLm, silIdx, blankIdx, unkIdx, transitions);
+  int64_t firstMisses = 0;
+  for (int round = 0; round < 2; round++) {
+    auto cachedHyps = cachingDecoder.decode(emission.data(), T, N);
+    ASSERT_EQ(cachedHyps.size(), n_hyp);
+    ASSERT_NEAR(cachedHyps[0].score, hypScoreTarget[0], 1e-3);
+    if (round == 0) {
+      firstMisses = cachingLm->getStats().misses;
+    }
+  }
+  // The second sentence reaches the same states as new objects
+  ASSERT_LT(cachingLm->getStats().misses - firstMisses, firstMisses);
+
+  /* -------- Sweep with a shared LM cache --------*/
+  auto sweep = parseDecoderSweep("lmweight=1:2,wordscore=2", decoderOpt);
+  ASSERT_EQ(sweep.options.size(), 2);
+  ASSERT_EQ(sweep.describe(1), "lmweight=2 wordscore=2");
+  auto sharedLm = std::make_shared<SharedCachingLM>(lm, 1 << 16);
+  DecoderPool sweepPool(2, [&](int /* unused */) {
+    return std::unique_ptr<Decoder>(new WordLMDecoder(
+        decoderOpt, flatTrie, sharedLm, silIdx, blankIdx, unkIdx, transitions));
+  });
+  std::vector<std::future<std::vector<DecodeResult>>> sweepResults;
+  for (int round = 0; round < 2; round++) {
+    for (const auto& opt : sweep.options) {
+      sweepResults.push_back(sweepPool.enqueue(T, [&](Decoder& poolDecoder) {
+        poolDecoder.setOptions(opt);
+        return poolDecoder.decode(emission.data(), T, N);
+      }));
+    }
+  }
+  for (int c = 0; c < sweep.options.size(); c++) {
+    WordLMDecoder configDecoder(
+        sweep.options[c], flatTrie, lm, silIdx, blankIdx, unkIdx, transitions);
+    auto expected = configDecoder.decode(emission.data(), T, N);
+    if (c == 1) {
+      ASSERT_NEAR(expected[0].score, hypScoreTarget[0], 1e-3);
+    }
+    for (int round = 0; round < 2; round++) {
+      auto sweepHyps = sweepResults[round * sweep.options.size() + c].get();
+      ASSERT_EQ(sweepHyps.size(), expected.size());
+      ASSERT_NEAR(sweepHyps[0].score, expected[0].score, 1e-3);
+      ASSERT_EQ(sweepHyps[0].words, expected[0].words);
+    }
+  }
+  ASSERT_GT(sharedLm->getStats().hits, 0);
+
+  ASSERT_THROW(
+      parseDecoderSweep("lmweight=1..2", decoderOpt), std::invalid_argument);
+  auto randomSweep =
+      parseDecoderSweep("lmweight=1..2,beamsize=10:20", decoderOpt, 5);
+  ASSERT_EQ(randomSweep.options.size(), 5);
+  for (const auto& opt : randomSweep.options) {
+    ASSERT_GE(opt.lmWeight, 1);
+    ASSERT_LE(opt.lmWeight, 2);
+    ASSERT_TRUE(opt.beamSize == 10 || opt.beamSize == 20);
+  }
+}
+
+TEST(DecoderTest, ctcFrameSkipping) {
+  std::string dataDir = "";
+#ifdef DECODER_TEST_DATADIR
+  dataDir = DECODER_TEST_DATADIR;
+#endif
+  std::ifstream tnStream(pathsConcat(dataDir, "TN.bin"), std::ios::binary);
+  std::vector<int> tnArray(2);
+  tnStream.read((char*)tnArray.data(), 2 * sizeof(int));
+  int T = tnArray[0], N = tnArray[1];
+  std::vector<float> emission(T * N);
+  std::ifstream emStream(
+      pathsConcat(dataDir, "emission.bin"), std::ios::binary);
+  emStream.read((char*)emission.data(), T * N * sizeof(float));
+
+  // CTC emissions with a blank token, each frame of the test emissions being
+  // followed by two confident blank frames
+  const int blankIdx = N, nCtcTokens = N + 1, nCtcFrames = 3 * T;
+  std::vector<float> ctcEmission;
+  for (int t = 0; t < T; t++) {
+    float maxScore = *std::max_element(
+        emission.begin() + t * N, emission.begin() + (t + 1) * N);
+    double norm = std::exp(-6.0 - maxScore);
+    for (int n = 0; n < N; n++) {
+      norm += std::exp(emission[t * N + n] - maxScore);
+    }
+    for (int n = 0; n < N; n++) {
+      ctcEmission.push_back(emission[t * N + n] - maxScore - std::log(norm));
+    }
+    ctcEmission.push_back(-6.0 - maxScore - std::log(norm));
+    for (int k = 0; k < 2; k++) {
+      ctcEmission.insert(ctcEmission.end(), N, std::log(5e-4 / N));
+      ctcEmission.push_back(std::log(1 - 5e-4));
+    }
+  }
+
+  auto lm = std::make_shared<ZeroLM>();
+  auto decode = [&](float blankSkipThreshold, float tokenMargin) {
+    DecoderOptions decoderOpt(
+        500, // FLAGS_beamsize
+        25000, // FLAGS_beamsizetoken
+        25.0, // FLAGS_beamthreshold
+        1.0, // FLAGS_lmweight
+        0.5, // FLAGS_wordscore
+        -std::numeric_limits<float>::infinity(), // FLAGS_unkweight
+        false, // FLAGS_logadd
+        0, // FLAGS_silweight
+        CriterionType::CTC,
+        blankSkipThreshold,
+        tokenMargin);
+    LexiconFreeDecoder decoder(decoderOpt, lm, 0, blankIdx, {});
+    auto timer = fl::TimeMeter();
+    timer.resume();
+    auto results = decoder.decode(ctcEmission.data(), nCtcFrames, nCtcTokens);
+    timer.stop();
+    LOG(INFO) << "[Decoder] Blank skip threshold " << blankSkipThreshold
+              << ", token margin " << tokenMargin << ": "
+              << timer.value() * 1000 << " ms";
+    return results.front();
+  };
+
+  auto expected = decode(0, 0);
+  for (auto options : std::vector<std::pair<float, float>>{
+           {0.999, 0}, {0, 8}, {0.999, 8}}) {
+    auto result = decode(options.first, options.second);
+    ASSERT_NEAR(result.score, expected.score, 1e-3);
+    // Frames skipped as blank may have kept repeating the previous token
+    std::vector<int> tokens, expectedTokens;
+    for (int t = 0; t < result.tokens.size(); t++) {
+      if (result.tokens[t] != blankIdx &&
+          (t == 0 || result.tokens[t] != result.tokens[t - 1])) {
+        tokens.push_back(result.tokens[t]);
+      }
+      if (expected.tokens[t] != blankIdx &&
+          (t == 0 || expected.tokens[t] != expected.tokens[t - 1])) {
+        expectedTokens.push_back(expected.tokens[t]);
+      }
+    }
+    ASSERT_EQ(tokens, expectedTokens);
+  }
+}
+
+TEST(DecoderTest, seq2seqOnline) {
+  // Toy AM: output step t reads input frame t, and favours the token
+  // following the previous one
+  const int T = 30, N = 6, eosIdx = N - 1;
+  std::mt19937 rng(0);
+  std::normal_distribution<float> normal;
+  std::vector<float> emission(T * N);
+  for (int t = 0; t < T; t++) {
+    for (int n = 0; n < N; n++) {
+      emission[t * N + n] = normal(rng) + (n == eosIdx ? t - T + 3 : 0);
+    }
+  }
+  AMUpdateFunc amUpdateFunc = [](const float* emissions,
+                                 const int N,
+                                 const int T,
+                                 const std::vector<int>& rawY,
+                                 const std::vector<AMStatePtr>& rawPrevStates,
+                                 int& t) {
+    std::vector<std::vector<float>> amScores;
+    std::vector<AMStatePtr> outStates;
+    for (int i = 0; i < rawY.size(); i++) {
+      std::vector<float> scores(emissions + t * N, emissions + (t + 1) * N);
+      if (rawY[i] >= 0) {
+        scores[(rawY[i] + 1) % N] += 1;
+      }
+      float maxScore = *std::max_element(scores.begin(), scores.end());
+      double norm = 0;
+      for (auto score : scores) {
+        norm += std::exp(score - maxScore);
+      }
+      for (auto& score : scores) {
+        score -= maxScore + std::log(norm);
+      }
+      amScores.push_back(scores);
+      outStates.push_back(std::make_shared<int>(t));
+    }
+    return std::make_pair(amScores, outStates);
+  };
+
+  auto lm = std::make_shared<ZeroLM>();
+  DecoderOptions decoderOpt(
+      10, // FLAGS_beamsize
+      N, // FLAGS_beamsizetoken
+      25.0, // FLAGS_beamthreshold
+      0, // FLAGS_lmweight
+      0, // FLAGS_wordscore
+      -std::numeric_limits<float>::infinity(), // FLAGS_unkweight
+      false, // FLAGS_logadd
+      0, // FLAGS_silweight
+      CriterionType::S2S);
+  auto buildDecoder = [&](int framesPerStep) {
+    return Seq2SeqDecoder(
+        decoderOpt, lm, eosIdx, amUpdateFunc, T, 1.5, 10.0, framesPerStep);
+  };
+
+  auto offlineDecoder = buildDecoder(0);
+  auto expected = offlineDecoder.decode(emission.data(), T, N).front();
+
+  // Online steps go up to the maximum output length before decodeEnd()
+  auto onlineDecoder = buildDecoder(1);
+  onlineDecoder.decodeBegin();
+  for (int t = 0; t < T; t += 7) {
+    int chunk = std::min(7, T - t);
+    onlineDecoder.decodeStep(emission.data() + t * N, chunk, N);
+    ASSERT_EQ(onlineDecoder.nDecodedFramesInBuffer(), t + chunk + 1);
+  }
+  onlineDecoder.decodeEnd();
+  auto result = onlineDecoder.getBestHypothesis();
+
+  ASSERT_NEAR(result.score, expected.score, 1e-4);
+  ASSERT_EQ(result.tokens, expected.tokens);
+  ASSERT_NE(
+      std::find(result.tokens.begin(), result.tokens.end(), eosIdx),
+      result.tokens.end());
+
+  // Pruning in the middle of the utterance: the tokens committed before each
+  // prune() followed by the final hypothesis are the offline ones, and the
+  // completed hypotheses keep the offline differences of scores
+  const int lookBack = 3;
+  auto prunedDecoder = buildDecoder(1);
+  prunedDecoder.decodeBegin();
+  std::vector<int> tokens;
+  for (int t = 0; t < T; t += 7) {
+    int chunk = std::min(7, T - t);
+    prunedDecoder.decodeStep(emission.data() + t * N, chunk, N);
+    auto partial = prunedDecoder.getBestHypothesis(lookBack);
+    prunedDecoder.prune(lookBack);
+    // The last frame of the partial hypothesis stays in the buffer
+    if (!partial.tokens.empty()) {
+      tokens.insert(
+          tokens.end(), partial.tokens.begin(), partial.tokens.end() - 1);
+    }
+  }
+  ASSERT_EQ(prunedDecoder.nDecodedFramesInBuffer(), lookBack + 1);
+  prunedDecoder.decodeEnd();
+  result = prunedDecoder.getBestHypothesis();
+  tokens.insert(tokens.end(), result.tokens.begin(), result.tokens.end());
+
+  auto isPadding = [](int token) { return token < 0; };
+  tokens.erase(
+      std::remove_if(tokens.begin(), tokens.end(), isPadding), tokens.end());
+  auto expectedTokens = expected.tokens;
+  expectedTokens.erase(
+      std::remove_if(expectedTokens.begin(), expectedTokens.end(), isPadding),
+      expectedTokens.end());
+  ASSERT_EQ(tokens, expectedTokens);
+
+  auto prunedResults = prunedDecoder.getAllFinalHypothesis();
+  auto expectedResults = offlineDecoder.getAllFinalHypothesis();
+  ASSERT_EQ(prunedResults.size(), expectedResults.size());
+  ASSERT_GT(prunedResults.size(), 1);
+  for (int i = 1; i < prunedResults.size(); i++) {
+    ASSERT_NEAR(
+        prunedResults[i].score - prunedResults[0].score,
+        expectedResults[i].score - expectedResults[0].score,
+        1e-4);
+  }
+}
+
+namespace {
+
+// Toy ConvLM over the tokens a-d whose distributions depend on the whole
+// history, through a hash of it which the incremental function carries in
+// the activations
+std::string toyConvLmVocab() {
+  char* user = getenv("USER");
+  std::string userstr = user != nullptr ? std::string(user) : "unknown";
+  const std::string path = "/tmp/" + userstr + "_convlm_vocab.txt";
+  std::ofstream vocab(path);
+  vocab << "<fairseq_style>\n<pad>\n</s>\n<unk>\na\nb\nc\nd\n";
+  return path;
+}
+
+Dictionary toyConvLmUsrDict() {
+  std::istringstream tokens("a\nb\nc\nd\n");
+  return Dictionary(tokens);
+}
+
+uint64_t toyConvLmHash(uint64_t history, int token) {
+  return history * 1000003 + token + 1;
+}
+
+std::vector<float> toyConvLmProbs(uint64_t history) {
+  std::vector<float> probs(8);
+  double norm = 0;
+  for (int i = 0; i < probs.size(); i++) {
+    probs[i] = std::sin(0.37 * (history % 1013) + 1.3 * i);
+    norm += std::exp(probs[i]);
+  }
+  for (auto& prob : probs) {
+    prob -= std::log(norm);
+  }
+  return probs;
+}
+
+GetConvLmScoreFunc toyConvLmScoreFunc(int& nCalls) {
+  return [&nCalls](
+             const std::vector<int>& tokens,
+             const std::vector<int>& lastTokenPositions,
+             int sampleSize,
+             int batchSize) {
+    ++nCalls;
+    std::vector<std::vector<float>> probs;
+    for (int b = 0; b < batchSize; b++) {
+      uint64_t history = 0;
+      for (int i = 0; i <= lastTokenPositions[b]; i++) {
+        history = toyConvLmHash(history, tokens[b * sampleSize + i]);
+      }
+      probs.push_back(toyConvLmProbs(history));
+    }
+    return probs;
+  };
+}
+
+GetConvLmIncrementalScoreFunc toyConvLmIncrementalScoreFunc(int& nCalls) {
+  return [&nCalls](
+             const std::vector<std::shared_ptr<void>>& prevActivations,
+             const std::vector<int>& tokens,
+             std::vector<std::shared_ptr<void>>& activations) {
+    ++nCalls;
+    std::vector<std::vector<float>> probs;
+    activations.clear();
+    for (int b = 0; b < tokens.size(); b++) {
+      auto prev = static_cast<uint64_t*>(prevActivations[b].get());
+      auto history = std::make_shared<uint64_t>(
+          toyConvLmHash(prev ? *prev : 0, tokens[b]));
+      probs.push_back(toyConvLmProbs(*history));
+      activations.push_back(history);
+    }
+    return probs;
+  };
+}
+
+} // namespace
+
+TEST(DecoderTest, convLmCacheEviction) {
+  int nCalls = 0;
+  ConvLM lm(
+      toyConvLmScoreFunc(nCalls),
+      toyConvLmVocab(),
+      toyConvLmUsrDict(),
+      1000,
+      3);
+  auto start = lm.start(false);
+  std::vector<LMStatePtr> states;
+  for (int i = 0; i < 4; i++) {
+    states.push_back(lm.score(start, i).first);
+  }
+  ASSERT_EQ(nCalls, 1);
+  auto &a = states[0], &b = states[1], &c = states[2], &d = states[3];
+
+  // Rows: start, a, b
+  lm.updateCache({a, b});
+  ASSERT_EQ(nCalls, 2);
+  // The hand clears all the reference bits, and start goes
+  lm.updateCache({c});
+  ASSERT_EQ(nCalls, 3);
+  // a is pinned by the batch: b and c go although a is older
+  auto e = lm.score(a, 0).first;
+  lm.updateCache({a, d, e});
+  ASSERT_EQ(nCalls, 4);
+  lm.score(a, 1);
+  lm.score(d, 1);
+  lm.score(e, 1);
+  ASSERT_EQ(nCalls, 4);
+  lm.score(c, 1);
+  ASSERT_EQ(nCalls, 5);
+
+  // All the rows can't be pinned at once
+  ASSERT_THROW(lm.updateCache({a, b, c, d}), std::invalid_argument);
+}
+
+TEST(DecoderTest, convLmSharedHistory) {
+  int nCalls = 0;
+  ConvLM lm(
+      toyConvLmScoreFunc(nCalls),
+      toyConvLmVocab(),
+      toyConvLmUsrDict(),
+      1000,
+      10);
+  auto start = lm.start(false);
+  auto a1 = lm.score(start, 0).first;
+  auto a2 = lm.score(start, 0).first;
+  ASSERT_NE(a1, a2);
+  ASSERT_EQ(lm.compareState(a1, a2), 0);
+  ASSERT_EQ(lm.stateHash(a1), lm.stateHash(a2));
+
+  auto hits = lm.getStats().hits;
+  auto score1 = lm.score(a1, 1).second;
+  ASSERT_EQ(nCalls, 2);
+  // The row of a1 serves a2
+  auto score2 = lm.score(a2, 1).second;
+  ASSERT_EQ(nCalls, 2);
+  ASSERT_EQ(score1, score2);
+  ASSERT_EQ(lm.getStats().hits, hits + 1);
+}
+
+TEST(DecoderTest, convLmTopK) {
+  int nCalls = 0;
+  const int topK = 2;
+  ConvLM lm(
+      toyConvLmScoreFunc(nCalls),
+      toyConvLmVocab(),
+      toyConvLmUsrDict(),
+      1000,
+      10,
+      49,
+      topK);
+  auto start = lm.start(false);
+  const int eosIdx = 2;
+  auto probs = toyConvLmProbs(toyConvLmHash(0, eosIdx));
+  auto sorted = probs;
+  std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+  double restScore = std::log(
+      (1.0 - std::exp(sorted[0]) - std::exp(sorted[1])) /
+      (probs.size() - topK));
+
+  // The user tokens a-d are tokens 4-7 of the LM
+  for (int i = 0; i < 4; i++) {
+    auto expected = probs[i + 4] >= sorted[topK - 1] ? probs[i + 4] : restScore;
+    ASSERT_NEAR(lm.score(start, i).second, expected, 1e-5);
+  }
+  auto expected = probs[eosIdx] >= sorted[topK - 1] ? probs[eosIdx] : restScore;
+  ASSERT_NEAR(lm.finish(start).second, expected, 1e-5);
+  ASSERT_EQ(nCalls, 1);
+}
+
+TEST(DecoderTest, convLmIncremental) {
+  int nFullCalls = 0, nIncrementalFullCalls = 0, nIncrementalCalls = 0;
+  auto vocabPath = toyConvLmVocab();
+  auto usrDict = toyConvLmUsrDict();
+  ConvLM fullLm(toyConvLmScoreFunc(nFullCalls), vocabPath, usrDict, 1000, 64);
+  // Histories are not truncated to `historySize` tokens when incremental
+  ConvLM incrementalLm(
+      toyConvLmScoreFunc(nIncrementalFullCalls),
+      vocabPath,
+      usrDict,
+      1000,
+      64,
+      4);
+  incrementalLm.setIncrementalScoreFunc(
+      toyConvLmIncrementalScoreFunc(nIncrementalCalls));
+
+  // Two sentences sharing the cache, through beams of the same hypotheses:
+  // rows are often read by states which are not the ones which filled them
+  std::mt19937 gen(0);
+  for (int sentence = 0; sentence < 2; sentence++) {
+    std::vector<LMStatePtr> fullBeam = {fullLm.start(false)};
+    std::vector<LMStatePtr> incrementalBeam = {incrementalLm.start(false)};
+    for (int step = 0; step < 12; step++) {
+      std::vector<LMStatePtr> fullStates, incrementalStates;
+      std::vector<int> tokens;
+      for (int i = 0; i < fullBeam.size(); i++) {
+        for (int j = 0; j < 3; j++) {
+          fullStates.push_back(fullBeam[i]);
+          incrementalStates.push_back(incrementalBeam[i]);
+          tokens.push_back(gen() % 4);
+        }
+      }
+      std::vector<LMStatePtr> fullOut, incrementalOut;
+      std::vector<float> fullScores, incrementalScores;
+      if (step % 2 == 0) {
+        fullLm.scoreBatch(fullStates, tokens, fullOut, fullScores);
+        incrementalLm.scoreBatch(
+            incrementalStates, tokens, incrementalOut, incrementalScores);
+      } else {
+        for (int i = 0; i < tokens.size(); i++) {
+          auto full = fullLm.score(fullStates[i], tokens[i]);
+          auto incremental =
+              incrementalLm.score(incrementalStates[i], tokens[i]);
+          fullOut.push_back(full.first);
+          fullScores.push_back(full.second);
+          incrementalOut.push_back(incremental.first);
+          incrementalScores.push_back(incremental.second);
+        }
+      }
+      for (int i = 0; i < fullScores.size(); i++) {
+        ASSERT_NEAR(incrementalScores[i], fullScores[i], 1e-6);
+      }
+
+      fullBeam.clear();
+      incrementalBeam.clear();
+      for (int i = 0; i < fullOut.size() && fullBeam.size() < 4; i++) {
+        if (gen() % 2 == 0) {
+          fullBeam.push_back(fullOut[i]);
+          incrementalBeam.push_back(incrementalOut[i]);
+        }
+      }
+      if (fullBeam.empty()) {
+        fullBeam.push_back(fullOut[0]);
+        incrementalBeam.push_back(incrementalOut[0]);
+      }
+      fullLm.updateCache(fullBeam);
+      incrementalLm.updateCache(incrementalBeam);
+    }
+    ASSERT_NEAR(
+        incrementalLm.finish(incrementalBeam[0]).second,
+        fullLm.finish(fullBeam[0]).second,
+        1e-6);
+  }
+  // No history went through the whole network
+  ASSERT_GT(nIncrementalCalls, 0);
+  ASSERT_EQ(nIncrementalFullCalls, 0);
+  ASSERT_GT(nFullCalls, 0);
 }
 
 int main(int argc, char** argv) {
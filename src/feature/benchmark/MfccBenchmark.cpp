@@ -10,6 +10,7 @@
 #include <chrono>
 #include <iomanip>
 #include <iostream>
+#include <thread>
 #include <utility>
 
 #include "libraries/feature/Mfcc.h"
@@ -56,5 +57,32 @@ int main() {
               << std::setprecision(5) << total_time / ntimes << " msec"
               << std::endl;
   }
+
+  // batchApply() featurizes each utterance of the batch on its own thread
+  int64_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+  int64_t uttSec = 10, nIters = 20;
+  int64_t uttSz = uttSec * params.samplingFreq;
+  int64_t framesPerUtt = params.numFrames(uttSz);
+
+  std::cout << "Benchmark MFCC batchApply (" << uttSec << " sec utterances)"
+            << std::endl;
+  for (int64_t nThreads = 1; nThreads <= maxThreads; ++nThreads) {
+    std::vector<float> input(uttSz * nThreads);
+    std::generate(input.begin(), input.end(), []() {
+      return (rand() * 1.0 / RAND_MAX);
+    });
+    double total_time = 0.0;
+    for (int64_t M = 0; M < nIters; M++) {
+      auto start = std::chrono::system_clock::now();
+      auto output = mfcc.batchApply(input, nThreads);
+      auto end = std::chrono::system_clock::now();
+      total_time +=
+          (std::chrono::duration_cast<std::chrono::microseconds>(end - start))
+              .count();
+    }
+    double framesPerSec = framesPerUtt * nThreads * nIters / total_time * 1e6;
+    std::cout << "| Threads : " << nThreads << " , " << std::setprecision(5)
+              << framesPerSec << " frames/sec" << std::endl;
+  }
   return 0;
 }
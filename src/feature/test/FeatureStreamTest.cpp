@@ -0,0 +1,127 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <gtest/gtest.h>
+#include <algorithm>
+
+#include "TestUtils.h"
+#include "libraries/feature/FeatureParams.h"
+#include "libraries/feature/FeatureStream.h"
+#include "libraries/feature/Mfcc.h"
+#include "libraries/feature/Mfsc.h"
+#include "libraries/feature/PowerSpectrum.h"
+
+using namespace w2l;
+
+namespace {
+
+std::vector<double> streamApply(
+    FeatureStream<double>& stream,
+    const std::vector<double>& input,
+    const std::vector<size_t>& chunkSizes) {
+  std::vector<double> output;
+  size_t start = 0;
+  for (size_t c = 0; start < input.size(); ++c) {
+    auto end =
+        std::min(input.size(), start + chunkSizes[c % chunkSizes.size()]);
+    std::vector<double> chunk(input.begin() + start, input.begin() + end);
+    auto feat = stream.push(chunk);
+    EXPECT_EQ(feat.size() % stream.outputFeatSz(), 0);
+    output.insert(output.end(), feat.begin(), feat.end());
+    start = end;
+  }
+  auto feat = stream.finish();
+  output.insert(output.end(), feat.begin(), feat.end());
+  return output;
+}
+
+FeatureParams testParams() {
+  FeatureParams params;
+  params.samplingFreq = 16000;
+  params.frameSizeMs = 25;
+  params.frameStrideMs = 10;
+  params.numFilterbankChans = 20;
+  params.lowFreqFilterbank = 0;
+  params.highFreqFilterbank = 8000;
+  params.numCepstralCoeffs = 13;
+  params.deltaWindow = 2;
+  params.accWindow = 3;
+  params.useEnergy = true;
+  return params;
+}
+
+const std::vector<std::vector<size_t>> kChunkSizes = {{1},
+                                                      {7},
+                                                      {160},
+                                                      {399, 1, 401},
+                                                      {1000, 3, 2500},
+                                                      {100000}};
+
+void checkStream(PowerSpectrum<double>& featurizer, int64_t numSamples) {
+  auto input = randVec<double>(numSamples);
+  auto expected = featurizer.apply(input);
+  FeatureStream<double> stream(featurizer);
+  for (const auto& chunkSizes : kChunkSizes) {
+    auto output = streamApply(stream, input, chunkSizes);
+    ASSERT_EQ(output, expected);
+  }
+}
+
+} // namespace
+
+TEST(FeatureStreamTest, powerSpectrumTest) {
+  auto params = testParams();
+  PowerSpectrum<double> powspec(params);
+  for (auto numSamples : {100, 400, 4000, 16000}) {
+    checkStream(powspec, numSamples);
+  }
+}
+
+TEST(FeatureStreamTest, mfscTest) {
+  auto params = testParams();
+  for (int64_t deltaWindow : {0, 2, 9}) {
+    for (int64_t accWindow : {0, 1, 3}) {
+      params.deltaWindow = deltaWindow;
+      params.accWindow = accWindow;
+      Mfsc<double> mfsc(params);
+      for (auto numSamples : {100, 400, 560, 1200, 4000, 16000}) {
+        checkStream(mfsc, numSamples);
+      }
+    }
+  }
+}
+
+TEST(FeatureStreamTest, mfccTest) {
+  auto params = testParams();
+  for (bool rawEnergy : {false, true}) {
+    params.rawEnergy = rawEnergy;
+    Mfcc<double> mfcc(params);
+    for (auto numSamples : {100, 400, 560, 1200, 4000, 16000}) {
+      checkStream(mfcc, numSamples);
+    }
+  }
+}
+
+TEST(FeatureStreamTest, reuseTest) {
+  auto params = testParams();
+  Mfcc<double> mfcc(params);
+  FeatureStream<double> stream(mfcc);
+  auto input = randVec<double>(3000);
+  // An unfinished utterance is dropped by reset()
+  stream.push(randVec<double>(1234));
+  stream.reset();
+  auto first = streamApply(stream, input, {320});
+  auto second = streamApply(stream, input, {320});
+  ASSERT_EQ(first, mfcc.apply(input));
+  ASSERT_EQ(second, first);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
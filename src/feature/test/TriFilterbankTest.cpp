@@ -76,6 +76,21 @@ TEST(TriFilterbankTest, batchingTest) {
   }
 }
 
+TEST(TriFilterbankTest, sparseMatchesDenseTest) {
+  int B = 7;
+  for (auto scale :
+       {FrequencyScale::MEL, FrequencyScale::LINEAR, FrequencyScale::LOG10}) {
+    for (int numFilters : {10, 40, 80}) {
+      auto triflt =
+          TriFilterbank<double>(numFilters, 257, 16000, 20, 7600, scale);
+      auto input = randVec<double>(257 * B);
+      auto output = triflt.apply(input, 1E-4);
+      auto expOutput = triflt.applyDense(input, 1E-4);
+      ASSERT_TRUE(compareVec<double>(output, expOutput, 1E-10));
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -0,0 +1,332 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/criterion/cpu/ConnectionistTemporalClassificationCriterion.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "libraries/common/Utils.h"
+#include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+
+/*
+ * States s = 0 .. S - 1 (S = 2L + 1) alternate blank / target label. Each row
+ * of alphas has two leading -inf pads so that the recursion
+ *
+ *   alpha_t[s] = logsumexp(alpha_{t-1}[s], alpha_{t-1}[s - 1],
+ *                          skip[s] ? alpha_{t-1}[s - 2] : -inf)
+ *                + logprob_t[label[s]]
+ *
+ * is a branch-free loop over s. The backward pass gathers each
+ * d alpha_{t-1}[s] from states s, s + 1 and s + 2 of frame t rather than
+ * scattering, which keeps that loop branch-free as well.
+ */
+
+namespace {
+
+template <class Float>
+struct WorkspacePtrs {
+  explicit WorkspacePtrs(void* workspace, int B, int T, int N, int L) {
+    maxS = 2 * std::min(L, T) + 1;
+    stride = maxS + 2;
+    w2l::Workspace<> ws(workspace);
+    ws.request(&scale, B);
+    ws.request(&targetLength, B);
+    ws.request(&label, B, stride);
+    ws.request(&skip, B, stride);
+    ws.request(&logProb, B, T, N);
+    ws.request(&alpha, B, T, stride);
+    ws.request(&alphaGrad, B, 2, stride);
+    ws.request(&alphaNorm, B, stride);
+    requiredSize = ws.requiredSize();
+  }
+
+  Float* scale;
+  int* targetLength;
+  int* label;
+  int* skip;
+  Float* logProb;
+  double* alpha;
+  double* alphaGrad;
+  double* alphaNorm;
+  int maxS;
+  int stride;
+  size_t requiredSize;
+};
+
+int countRepeats(const int* target, int L) {
+  int r = 0;
+  for (int i = 1; i < L; ++i) {
+    if (target[i] == target[i - 1]) {
+      ++r;
+    }
+  }
+  return r;
+}
+
+template <class Float>
+void logSoftmax(const Float* input, Float* output, int N) {
+  Float maxValue = input[0];
+  for (int n = 1; n < N; ++n) {
+    maxValue = input[n] > maxValue ? input[n] : maxValue;
+  }
+  Float sumValue = 0;
+#pragma omp simd reduction(+ : sumValue)
+  for (int n = 0; n < N; ++n) {
+    sumValue += std::exp(input[n] - maxValue);
+  }
+  Float lse = maxValue + std::log(sumValue);
+#pragma omp simd
+  for (int n = 0; n < N; ++n) {
+    output[n] = input[n] - lse;
+  }
+}
+
+// alphaCur[s] for s in [start, end); alphaPrev[-2] and alphaPrev[-1] are -inf
+template <class Float>
+void alphaStep(
+    int start,
+    int end,
+    const double* alphaPrev,
+    const Float* logProb,
+    const int* label,
+    const int* skip,
+    double* alphaCur) {
+#pragma omp simd
+  for (int s = start; s < end; ++s) {
+    double a = alphaPrev[s];
+    double b = alphaPrev[s - 1];
+    double c = skip[s] ? alphaPrev[s - 2] : -INFINITY;
+    double maxValue = std::max(a, std::max(b, c));
+    // All -inf: shift by 0 so that the sum is 0 and its log -inf
+    maxValue = maxValue > -INFINITY ? maxValue : 0;
+    double sumValue = std::exp(a - maxValue) + std::exp(b - maxValue) +
+        std::exp(c - maxValue);
+    alphaCur[s] = maxValue + std::log(sumValue) + logProb[label[s]];
+  }
+}
+
+// alphaPrevGrad[s] for s in [0, S); alphaCurGrad and alphaNorm are 0 at S and
+// S + 1, and alphaNorm[s] = alpha_t[s] - logprob_t[label[s]]
+void alphaGradStep(
+    int S,
+    const double* alphaPrev,
+    const double* alphaCurGrad,
+    const double* alphaNorm,
+    const int* skip,
+    double* alphaPrevGrad) {
+#pragma omp simd
+  for (int s = 0; s < S; ++s) {
+    double a = alphaPrev[s];
+    double d = alphaCurGrad[s] * std::exp(a - alphaNorm[s]) +
+        alphaCurGrad[s + 1] * std::exp(a - alphaNorm[s + 1]);
+    if (skip[s + 2]) {
+      d += alphaCurGrad[s + 2] * std::exp(a - alphaNorm[s + 2]);
+    }
+    alphaPrevGrad[s] = d;
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+size_t ConnectionistTemporalClassificationCriterion<Float>::getWorkspaceSize(
+    int B,
+    int T,
+    int N,
+    int L) {
+  return WorkspacePtrs<Float>(nullptr, B, T, N, L).requiredSize;
+}
+
+template <class Float>
+void ConnectionistTemporalClassificationCriterion<Float>::forward(
+    int B,
+    int T,
+    int N,
+    int _L,
+    CriterionScaleMode scaleMode,
+    const Float* _input,
+    const int* _target,
+    const int* targetSize,
+    Float* loss,
+    void* workspace) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, _L);
+  CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
+  const int stride = ws.stride;
+
+#pragma omp parallel for num_threads(B)
+  for (int b = 0; b < B; ++b) {
+    const auto* input = &_input[b * T * N];
+    const auto* target = &_target[b * _L];
+    auto* logProb = &ws.logProb[b * T * N];
+    auto* alpha = &ws.alpha[b * T * stride];
+    auto* label = &ws.label[b * stride];
+    auto* skip = &ws.skip[b * stride];
+
+    // A heuristic to modify target length to be able to compute CTC loss
+    int L = std::min(targetSize[b], T);
+    int R = countRepeats(target, L);
+    L = std::min(L + R, T) - R;
+    R = countRepeats(target, L);
+    const int S = 2 * L + 1;
+    ws.targetLength[b] = L;
+
+    for (int s = 0; s < stride; ++s) {
+      bool isLabel = s < S && (s & 1);
+      label[s] = isLabel ? target[s / 2] : N - 1;
+      skip[s] = isLabel && s > 1 && target[s / 2] != target[s / 2 - 1];
+    }
+
+    int start = (T - (L + R)) > 0 ? 0 : 1;
+    int end = (S == 1) ? 1 : 2;
+
+    for (int t = 0; t < T; ++t) {
+      auto* alphaCur = &alpha[t * stride + 2];
+      auto* logProbCur = &logProb[t * N];
+
+      logSoftmax(&input[t * N], logProbCur, N);
+      std::fill(alphaCur - 2, alphaCur + S, -INFINITY);
+
+      if (t == 0) {
+        // base case
+        alphaCur[0] = (start == 0) ? logProbCur[N - 1] : -INFINITY;
+        if (S != 1) {
+          alphaCur[1] = logProbCur[target[0]];
+        }
+        continue;
+      }
+
+      // At each time frame t, only few states can be reached depending
+      // on the labels, their ordering and the current time frame.
+      if (T - t <= L + R) {
+        if (start & 1 && target[start / 2] != target[start / 2 + 1]) {
+          ++start;
+        }
+        ++start;
+      }
+      if (t <= L + R) {
+        if (end % 2 == 0 && end < 2 * L &&
+            (target[end / 2 - 1] != target[end / 2])) {
+          ++end;
+        }
+        ++end;
+      }
+      const auto* alphaPrev = &alpha[(t - 1) * stride + 2];
+      alphaStep(start, end, alphaPrev, logProbCur, label, skip, alphaCur);
+    }
+
+    const auto* alphaLast = &alpha[(T - 1) * stride + 2];
+    double a = alphaLast[S - 1];
+    double c = (S == 1) ? -INFINITY : alphaLast[S - 2];
+    double lse = c > -INFINITY
+        ? std::max(a, c) + std::log1p(std::exp(-std::abs(a - c)))
+        : a;
+    loss[b] = -lse * ws.scale[b];
+  }
+}
+
+template <class Float>
+void ConnectionistTemporalClassificationCriterion<Float>::backward(
+    int B,
+    int T,
+    int N,
+    int _L,
+    const int* /* target */,
+    const Float* grad,
+    Float* _inputGrad,
+    void* workspace) {
+  WorkspacePtrs<Float> ws(workspace, B, T, N, _L);
+  setZero(_inputGrad, B * T * N);
+  const int stride = ws.stride;
+
+#pragma omp parallel for num_threads(B)
+  for (int b = 0; b < B; ++b) {
+    auto* inputGrad = &_inputGrad[b * T * N];
+    const auto* logProb = &ws.logProb[b * T * N];
+    const auto* alpha = &ws.alpha[b * T * stride];
+    const auto* label = &ws.label[b * stride];
+    const auto* skip = &ws.skip[b * stride];
+    auto* alphaCurGrad = &ws.alphaGrad[b * 2 * stride];
+    auto* alphaPrevGrad = &ws.alphaGrad[b * 2 * stride + stride];
+    auto* alphaNorm = &ws.alphaNorm[b * stride];
+
+    const int S = 2 * ws.targetLength[b] + 1;
+    const double gradScale = grad[b] * ws.scale[b];
+
+    std::fill(alphaCurGrad, alphaCurGrad + stride, 0);
+    std::fill(alphaPrevGrad, alphaPrevGrad + stride, 0);
+    std::fill(alphaNorm, alphaNorm + stride, 0);
+
+    // Gradient of -logsumexp over the two final states. If neither is
+    // reachable the target is impossible: the loss is inf and the gradient 0.
+    const auto* alphaLast = &alpha[(T - 1) * stride + 2];
+    if (S == 1) {
+      alphaCurGrad[0] = alphaLast[0] > -INFINITY ? -1 : 0;
+    } else {
+      double a = alphaLast[S - 2];
+      double c = alphaLast[S - 1];
+      double maxValue = std::max(a, c);
+      if (maxValue > -INFINITY) {
+        double ea = std::exp(a - maxValue);
+        double ec = std::exp(c - maxValue);
+        alphaCurGrad[S - 2] = -ea / (ea + ec);
+        alphaCurGrad[S - 1] = -ec / (ea + ec);
+      }
+    }
+
+    for (int t = T - 1; t >= 0; --t) {
+      const auto* alphaCur = &alpha[t * stride + 2];
+      const auto* logProbCur = &logProb[t * N];
+      auto* inputGradCur = &inputGrad[t * N];
+
+      for (int s = 0; s < S; ++s) {
+        inputGradCur[label[s]] += alphaCurGrad[s] * gradScale;
+      }
+
+      // Back through the log-softmax
+      Float sumGrad = 0;
+      for (int n = 0; n < N; ++n) {
+        sumGrad += inputGradCur[n];
+      }
+#pragma omp simd
+      for (int n = 0; n < N; ++n) {
+        inputGradCur[n] -= std::exp(logProbCur[n]) * sumGrad;
+      }
+
+      if (t == 0) {
+        break;
+      }
+
+      // Unreachable states contribute nothing; give them a finite norm
+      for (int s = 0; s < S; ++s) {
+        bool reachable = alphaCur[s] > -INFINITY;
+        alphaNorm[s] = reachable ? alphaCur[s] - logProbCur[label[s]] : 0;
+        alphaCurGrad[s] = reachable ? alphaCurGrad[s] : 0;
+      }
+
+      alphaGradStep(
+          S,
+          &alpha[(t - 1) * stride + 2],
+          alphaCurGrad,
+          alphaNorm,
+          skip,
+          alphaPrevGrad);
+      std::swap(alphaCurGrad, alphaPrevGrad);
+    }
+  }
+}
+
+template struct ConnectionistTemporalClassificationCriterion<float>;
+template struct ConnectionistTemporalClassificationCriterion<double>;
+
+} // namespace cpu
+} // namespace w2l
@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+
+#include "libraries/criterion/Defines.h"
+
+namespace w2l {
+namespace cpu {
+
+/**
+ * CTC loss with the blank as the last class (N - 1).
+ *
+ * `input` holds unnormalized scores of shape B x T x N (N fastest); the
+ * log-softmax is fused into the forward recursion, and `inputGrad` is the
+ * gradient with respect to these raw scores. `target` is B x L, padded with
+ * -1, and `targetSize` gives each target's length. Targets that don't fit in
+ * T frames (including the blanks needed between repeats) are truncated.
+ *
+ * All intermediate storage lives in `workspace`, which must be at least
+ * getWorkspaceSize(B, T, N, L) bytes and must be passed unchanged from
+ * forward() to backward(). It can be reused across calls with the same or
+ * smaller sizes.
+ */
+template <class Float>
+struct ConnectionistTemporalClassificationCriterion {
+  static size_t getWorkspaceSize(int B, int T, int N, int L);
+
+  static void forward(
+      int B,
+      int T,
+      int N,
+      int L,
+      CriterionScaleMode scaleMode,
+      const Float* input,
+      const int* target,
+      const int* targetSize,
+      Float* loss,
+      void* workspace);
+
+  static void backward(
+      int B,
+      int T,
+      int N,
+      int L,
+      const int* target,
+      const Float* grad,
+      Float* inputGrad,
+      void* workspace);
+};
+
+} // namespace cpu
+} // namespace w2l
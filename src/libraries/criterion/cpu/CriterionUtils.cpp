@@ -12,6 +12,16 @@
 #include <cmath>
 #include <vector>
 
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace {
+
+constexpr int kMinSplitStates = 128;
+
+} // namespace
+
 namespace w2l {
 namespace cpu {
 
@@ -63,6 +73,14 @@ void CriterionUtils<Float>::computeScale(
   }
 }
 
+bool splitOverStates(int B, int N) {
+#ifdef _OPENMP
+  return N >= kMinSplitStates && B < omp_get_max_threads();
+#else
+  return false;
+#endif
+}
+
 template struct CriterionUtils<float>;
 template struct CriterionUtils<double>;
 
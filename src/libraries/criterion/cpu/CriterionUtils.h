@@ -10,6 +10,15 @@
 
 #include "libraries/criterion/Defines.h"
 
+// Build hot loops for each x86 vector extension and pick one at load time
+#if defined(__GNUC__) && !defined(__clang__) && defined(__x86_64__) && \
+    defined(__linux__)
+#define W2L_VECTOR_CLONES \
+  __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define W2L_VECTOR_CLONES
+#endif
+
 namespace w2l {
 namespace cpu {
 
@@ -32,5 +41,11 @@ struct CriterionUtils {
       Float* scale);
 };
 
+/// Whether to split each frame's N x N work over the N states instead of
+/// running one thread per batch element: true when there are fewer batch
+/// elements than OpenMP threads and N is large enough to amortize the
+/// per-frame fork/join.
+bool splitOverStates(int B, int N);
+
 } // namespace cpu
 } // namespace w2l
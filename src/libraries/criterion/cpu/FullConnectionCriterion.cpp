@@ -8,12 +8,26 @@
 
 #include "libraries/criterion/cpu/FullConnectionCriterion.h"
 
+#include <cfloat>
 #include <cmath>
 
 #include "libraries/common/Utils.h"
 #include "libraries/common/Workspace.h"
 #include "libraries/criterion/cpu/CriterionUtils.h"
 
+/*
+ * The recursion alpha_t[m] = logsumexp_n(alpha_{t-1}[n] + trans[m][n]) is
+ * evaluated as
+ *
+ *   log(sum_n exp(alpha_{t-1}[n] - A) * exp(trans[m][n] - M_m)) + A + M_m
+ *
+ * with A = max_n alpha_{t-1}[n] and M_m = max_n trans[m][n]. exp(trans - M)
+ * is computed once per call, so each frame only needs N exponentials and an
+ * N x N matrix-vector product, whose rows are plain dot products that
+ * vectorize. Rows whose sum comes too close to underflow fall back to the
+ * exact per-element log-sum-exp.
+ */
+
 namespace {
 
 template <class Float>
@@ -25,6 +39,12 @@ struct WorkspacePtrs {
     ws.request(&alphaGrad, B, T, N);
     ws.request(&transBatchGrad, B, N, N);
     ws.request(&transBuf, B, N, N);
+    ws.request(&transMax, N);
+    ws.request(&transExp, N, N);
+    ws.request(&transExpT, N, N);
+    ws.request(&alphaExp, B, N);
+    ws.request(&rowWeight, B, N);
+    ws.request(&rowExact, B, N);
     requiredSize = ws.requiredSize();
   }
 
@@ -33,9 +53,91 @@ struct WorkspacePtrs {
   double* alphaGrad;
   double* transBatchGrad;
   double* transBuf;
+  double* transMax;
+  double* transExp;
+  double* transExpT;
+  double* alphaExp;
+  double* rowWeight;
+  int* rowExact;
   size_t requiredSize;
 };
 
+// Smallest row sum for which the terms lost to underflow are below rounding
+double minRowSum(int N) {
+  return N * DBL_MIN / DBL_EPSILON;
+}
+
+W2L_VECTOR_CLONES
+double dot(const double* x, const double* y, int n) {
+  double sum = 0;
+#pragma omp simd reduction(+ : sum)
+  for (int i = 0; i < n; ++i) {
+    sum += x[i] * y[i];
+  }
+  return sum;
+}
+
+W2L_VECTOR_CLONES
+void addScaledProduct(
+    double* out,
+    double a,
+    const double* x,
+    const double* y,
+    int n) {
+#pragma omp simd
+  for (int i = 0; i < n; ++i) {
+    out[i] += a * x[i] * y[i];
+  }
+}
+
+// out[i] = exp(in[i] - max(in)), returns max(in)
+double expShifted(double* out, const double* in, int n) {
+  double maxValue = -INFINITY;
+  for (int i = 0; i < n; ++i) {
+    maxValue = in[i] > maxValue ? in[i] : maxValue;
+  }
+  for (int i = 0; i < n; ++i) {
+    out[i] = exp(in[i] - maxValue);
+  }
+  return maxValue;
+}
+
+// out[i] = exp(alpha[i] + trans[i] - max) / sum, returns log(sum) + max
+template <class Float>
+double logSumExp(double* out, const double* alpha, const Float* trans, int n) {
+  double maxValue = -INFINITY;
+  for (int i = 0; i < n; ++i) {
+    double val = out[i] = alpha[i] + trans[i];
+    maxValue = val > maxValue ? val : maxValue;
+  }
+  double sumValue = 0;
+  for (int i = 0; i < n; ++i) {
+    out[i] = exp(out[i] - maxValue);
+    sumValue += out[i];
+  }
+  for (int i = 0; i < n; ++i) {
+    out[i] /= sumValue;
+  }
+  return log(sumValue) + maxValue;
+}
+
+template <class Float>
+void computeTransExp(int N, const Float* trans, WorkspacePtrs<Float>& ws) {
+#pragma omp parallel for
+  for (int m = 0; m < N; ++m) {
+    double maxValue = -INFINITY;
+    for (int n = 0; n < N; ++n) {
+      double val = trans[m * N + n];
+      maxValue = val > maxValue ? val : maxValue;
+    }
+    ws.transMax[m] = maxValue;
+    for (int n = 0; n < N; ++n) {
+      ws.transExp[m * N + n] = ws.transExpT[n * N + m] =
+          exp(trans[m * N + n] - maxValue);
+    }
+  }
+}
+
 } // namespace
 
 namespace w2l {
@@ -60,40 +162,46 @@ void FullConnectionCriterion<Float>::forward(
   WorkspacePtrs<Float> ws(workspace, B, T, N);
   CriterionUtils<Float>::computeScale(B, T, N, scaleMode, targetSize, ws.scale);
 
-#pragma omp parallel for num_threads(B)
+  const bool split = splitOverStates(B, N);
+  const double minSum = minRowSum(N);
+  computeTransExp(N, trans, ws);
+
+#pragma omp parallel for num_threads(B) if (!split)
   for (int b = 0; b < B; ++b) {
+    auto* alphaExp = &ws.alphaExp[b * N];
+
     for (int n = 0; n < N; ++n) {
       int k = b * T * N + n;
       ws.alpha[k] = input[k];
     }
 
-    for (int t = 1; t <= T; ++t) {
-      for (int m = 0; m < N; ++m) {
-        const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
-        const auto* inputCur = &input[b * T * N + t * N];
-        auto* transBuf = &ws.transBuf[b * N * N + m * N];
-        auto* alphaCur = &ws.alpha[b * T * N + t * N];
-
-        double maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          double val = transBuf[n] =
-              alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          maxValue = val > maxValue ? val : maxValue;
-        }
+    for (int t = 1; t < T; ++t) {
+      const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
+      const auto* inputCur = &input[b * T * N + t * N];
+      auto* alphaCur = &ws.alpha[b * T * N + t * N];
 
-        double sumValue = 0;
-        for (int n = 0; n < N; ++n) {
-          sumValue += exp(transBuf[n] - maxValue);
-        }
+      double alphaMax = expShifted(alphaExp, alphaPrev, N);
 
-        if (t == T) {
-          loss[b] = ws.scale[b] * (log(sumValue) + maxValue);
-          break;
+#pragma omp parallel for if (split)
+      for (int m = 0; m < N; ++m) {
+        double sumValue = dot(&ws.transExp[m * N], alphaExp, N);
+        if (sumValue >= minSum) {
+          alphaCur[m] = log(sumValue) + alphaMax + ws.transMax[m] + inputCur[m];
+        } else {
+          auto* transBuf = &ws.transBuf[b * N * N + m * N];
+          alphaCur[m] =
+              logSumExp(transBuf, alphaPrev, &trans[m * N], N) + inputCur[m];
         }
-
-        alphaCur[m] = log(sumValue) + maxValue + inputCur[m];
       }
     }
+
+    const auto* alphaLast = &ws.alpha[b * T * N + (T - 1) * N];
+    double alphaMax = expShifted(alphaExp, alphaLast, N);
+    double sumValue = 0;
+    for (int n = 0; n < N; ++n) {
+      sumValue += alphaExp[n];
+    }
+    loss[b] = ws.scale[b] * (log(sumValue) + alphaMax);
   }
 }
 
@@ -113,51 +221,74 @@ void FullConnectionCriterion<Float>::backward(
   setZero(ws.alphaGrad, B * T * N);
   setZero(ws.transBatchGrad, B * N * N);
 
-#pragma omp parallel for num_threads(B)
+  const bool split = splitOverStates(B, N);
+  const double minSum = minRowSum(N);
+  computeTransExp(N, trans, ws);
+
+#pragma omp parallel for num_threads(B) if (!split)
   for (int b = 0; b < B; ++b) {
-    for (int t = T; t > 0; --t) {
-      for (int m = 0; m < N; ++m) {
-        const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
-        const auto* alphaCurGrad = &ws.alphaGrad[b * T * N + t * N];
-        auto* alphaPrevGrad = &ws.alphaGrad[b * T * N + (t - 1) * N];
-        auto* transBuf = &ws.transBuf[b * N * N + m * N];
-        auto* transBatchGrad = &ws.transBatchGrad[b * N * N + m * N];
+    auto* alphaExp = &ws.alphaExp[b * N];
+    auto* rowWeight = &ws.rowWeight[b * N];
+    auto* rowExact = &ws.rowExact[b * N];
 
-        double maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          double val = transBuf[n] =
-              alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          maxValue = val > maxValue ? val : maxValue;
-        }
+    {
+      const auto* alphaLast = &ws.alpha[b * T * N + (T - 1) * N];
+      auto* alphaLastGrad = &ws.alphaGrad[b * T * N + (T - 1) * N];
 
-        double sumValue = 0;
-        for (int n = 0; n < N; ++n) {
-          transBuf[n] = exp(transBuf[n] - maxValue);
-          sumValue += transBuf[n];
-        }
+      expShifted(alphaExp, alphaLast, N);
+      double sumValue = 0;
+      for (int n = 0; n < N; ++n) {
+        sumValue += alphaExp[n];
+      }
+      for (int n = 0; n < N; ++n) {
+        alphaLastGrad[n] = alphaExp[n] / sumValue;
+      }
+    }
+
+    for (int t = T - 1; t > 0; --t) {
+      const auto* alphaPrev = &ws.alpha[b * T * N + (t - 1) * N];
+      const auto* alphaCurGrad = &ws.alphaGrad[b * T * N + t * N];
+      auto* alphaPrevGrad = &ws.alphaGrad[b * T * N + (t - 1) * N];
+
+      expShifted(alphaExp, alphaPrev, N);
+
+      // d alpha_t[m] / d (alpha_{t-1}[n] + trans[m][n]) is
+      // alphaExp[n] * transExp[m][n] / sum_m, so row m of the gradient is
+      // rowWeight[m] * transExp[m] * alphaExp
+#pragma omp parallel for if (split)
+      for (int m = 0; m < N; ++m) {
+        auto* transBatchGrad = &ws.transBatchGrad[b * N * N + m * N];
+        double sumValue = dot(&ws.transExp[m * N], alphaExp, N);
 
-        if (t == T) {
+        if (sumValue >= minSum) {
+          rowWeight[m] = alphaCurGrad[m] / sumValue;
+          rowExact[m] = 0;
+          addScaledProduct(
+              transBatchGrad, rowWeight[m], &ws.transExp[m * N], alphaExp, N);
+        } else {
+          auto* transBuf = &ws.transBuf[b * N * N + m * N];
+          logSumExp(transBuf, alphaPrev, &trans[m * N], N);
           for (int n = 0; n < N; ++n) {
-            alphaPrevGrad[n] = transBuf[n] / sumValue;
+            transBuf[n] *= alphaCurGrad[m];
+            transBatchGrad[n] += transBuf[n];
           }
-          break;
-        }
-
-        for (int n = 0; n < N; ++n) {
-          transBuf[n] = transBuf[n] / sumValue * alphaCurGrad[m];
-          transBatchGrad[n] += transBuf[n];
+          rowWeight[m] = 0;
+          rowExact[m] = 1;
         }
       }
 
-      if (t == T) {
-        continue;
+#pragma omp parallel for if (split)
+      for (int n = 0; n < N; ++n) {
+        alphaPrevGrad[n] +=
+            alphaExp[n] * dot(&ws.transExpT[n * N], rowWeight, N);
       }
 
       for (int m = 0; m < N; ++m) {
-        auto* alphaPrevGrad = &ws.alphaGrad[b * T * N + (t - 1) * N];
-
-        for (int n = 0; n < N; ++n) {
-          alphaPrevGrad[m] += ws.transBuf[b * N * N + n * N + m];
+        if (rowExact[m]) {
+          const auto* transBuf = &ws.transBuf[b * N * N + m * N];
+          for (int n = 0; n < N; ++n) {
+            alphaPrevGrad[n] += transBuf[n];
+          }
         }
       }
     }
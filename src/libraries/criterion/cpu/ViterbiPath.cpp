@@ -9,82 +9,193 @@
 #include "libraries/criterion/cpu/ViterbiPath.h"
 
 #include <cmath>
+#include <cstdint>
 
 #include "libraries/common/Workspace.h"
+#include "libraries/criterion/cpu/CriterionUtils.h"
+
+/*
+ * Each frame computes, for every state m, the max and argmax over n of
+ * alpha[n] + trans[m][n]. Rather than reducing along n per m, the loops are
+ * interchanged: for each n, a contiguous pass over m (through the transposed
+ * transitions) updates running maxima with a compare and two blends, which
+ * vectorizes cleanly. Visiting n in increasing order with a strict `>` picks
+ * the same (first) argmax as a scalar scan.
+ */
 
 namespace {
 
+// Backpointers fit in 16 bits for up to this many classes
+constexpr int kMaxCompactN = 65536;
+
+// States per task when a frame is split across threads
+constexpr int kSplitChunk = 64;
+
 template <class Float>
 struct WorkspacePtrs {
   explicit WorkspacePtrs(void* workspace, int B, int T, int N) {
     w2l::Workspace<> ws(workspace);
     ws.request(&alpha, B, 2, N);
-    ws.request(&beta, B, T, N);
+    ws.request(&transT, N, N);
+    ws.request(&maxIndex, B, N);
+    if (N <= kMaxCompactN) {
+      ws.request(&betaCompact, B, T, N);
+    } else {
+      ws.request(&beta, B, T, N);
+    }
     requiredSize = ws.requiredSize();
   }
 
   Float* alpha;
-  int* beta;
+  Float* transT;
+  int* maxIndex;
+  int* beta = nullptr;
+  uint16_t* betaCompact = nullptr;
   size_t requiredSize;
 };
 
-} // namespace
+template <class Float>
+inline void maxPlusImpl(
+    int N,
+    int mBegin,
+    int mEnd,
+    const Float* alphaPrev,
+    const Float* transT,
+    Float* maxValue,
+    int* maxIndex) {
+  for (int m = mBegin; m < mEnd; ++m) {
+    maxValue[m] = -INFINITY;
+    maxIndex[m] = 0;
+  }
+  for (int n = 0; n < N; ++n) {
+    const Float alphaN = alphaPrev[n];
+    const Float* transRow = &transT[n * N];
+#pragma omp simd
+    for (int m = mBegin; m < mEnd; ++m) {
+      Float val = alphaN + transRow[m];
+      bool better = val > maxValue[m];
+      maxValue[m] = better ? val : maxValue[m];
+      maxIndex[m] = better ? n : maxIndex[m];
+    }
+  }
+}
 
-namespace w2l {
-namespace cpu {
+W2L_VECTOR_CLONES
+void maxPlus(
+    int N,
+    int mBegin,
+    int mEnd,
+    const float* alphaPrev,
+    const float* transT,
+    float* maxValue,
+    int* maxIndex) {
+  maxPlusImpl(N, mBegin, mEnd, alphaPrev, transT, maxValue, maxIndex);
+}
 
-template <class Float>
-size_t ViterbiPath<Float>::getWorkspaceSize(int B, int T, int N) {
-  return WorkspacePtrs<Float>(nullptr, B, T, N).requiredSize;
+W2L_VECTOR_CLONES
+void maxPlus(
+    int N,
+    int mBegin,
+    int mEnd,
+    const double* alphaPrev,
+    const double* transT,
+    double* maxValue,
+    int* maxIndex) {
+  maxPlusImpl(N, mBegin, mEnd, alphaPrev, transT, maxValue, maxIndex);
 }
 
-template <class Float>
-void ViterbiPath<Float>::compute(
+template <class Float, class Index>
+void computePath(
     int B,
     int T,
     int N,
     const Float* input,
-    const Float* trans,
     int* _path,
-    void* workspace) {
-  WorkspacePtrs<Float> ws(workspace, B, T, N);
+    const WorkspacePtrs<Float>& ws,
+    Index* beta) {
+  const bool split = w2l::cpu::splitOverStates(B, N);
 
-#pragma omp parallel for num_threads(B)
+#pragma omp parallel for num_threads(B) if (!split)
   for (int b = 0; b < B; ++b) {
+    auto* maxIndex = &ws.maxIndex[b * N];
+
     for (int n = 0; n < N; ++n) {
       ws.alpha[b * 2 * N + n] = input[b * T * N + n];
     }
 
-    for (int t = 1; t <= T; ++t) {
+    for (int t = 1; t < T; ++t) {
       const auto* alphaPrev = &ws.alpha[b * 2 * N + ((t - 1) % 2) * N];
       const auto* inputCur = &input[b * T * N + t * N];
       auto* alphaCur = &ws.alpha[b * 2 * N + (t % 2) * N];
-      auto* betaCur = &ws.beta[b * T * N + t * N];
-
-      for (int m = 0; m < N; ++m) {
-        int maxIndex = -1;
-        Float maxValue = -INFINITY;
-        for (int n = 0; n < N; ++n) {
-          Float val = alphaPrev[n] + (t == T ? 0 : trans[m * N + n]);
-          if (val > maxValue) {
-            maxIndex = n;
-            maxValue = val;
-          }
+      auto* betaCur = &beta[b * T * N + t * N];
+
+      // Only enter a parallel region when actually splitting the frame
+      if (split) {
+#pragma omp parallel for
+        for (int m = 0; m < N; m += kSplitChunk) {
+          int mEnd = m + kSplitChunk < N ? m + kSplitChunk : N;
+          maxPlus(N, m, mEnd, alphaPrev, ws.transT, alphaCur, maxIndex);
         }
+      } else {
+        maxPlus(N, 0, N, alphaPrev, ws.transT, alphaCur, maxIndex);
+      }
 
-        if (t == T) {
-          auto* path = &_path[b * T];
-          path[T - 1] = maxIndex;
-          for (int s = T - 1; s > 0; --s) {
-            path[s - 1] = ws.beta[b * T * N + s * N + path[s]];
-          }
-          break;
-        }
+      for (int m = 0; m < N; ++m) {
+        alphaCur[m] += inputCur[m];
+        betaCur[m] = maxIndex[m];
+      }
+    }
 
-        alphaCur[m] = maxValue + inputCur[m];
-        betaCur[m] = maxIndex;
+    const auto* alphaLast = &ws.alpha[b * 2 * N + ((T - 1) % 2) * N];
+    int lastIndex = 0;
+    for (int n = 1; n < N; ++n) {
+      if (alphaLast[n] > alphaLast[lastIndex]) {
+        lastIndex = n;
       }
     }
+
+    auto* path = &_path[b * T];
+    path[T - 1] = lastIndex;
+    for (int s = T - 1; s > 0; --s) {
+      path[s - 1] = beta[b * T * N + s * N + path[s]];
+    }
+  }
+}
+
+} // namespace
+
+namespace w2l {
+namespace cpu {
+
+template <class Float>
+size_t ViterbiPath<Float>::getWorkspaceSize(int B, int T, int N) {
+  return WorkspacePtrs<Float>(nullptr, B, T, N).requiredSize;
+}
+
+template <class Float>
+void ViterbiPath<Float>::compute(
+    int B,
+    int T,
+    int N,
+    const Float* input,
+    const Float* trans,
+    int* path,
+    void* workspace) {
+  if (T <= 0) {
+    return; // Empty paths, and no last frame to backtrack from
+  }
+  WorkspacePtrs<Float> ws(workspace, B, T, N);
+
+  for (int m = 0; m < N; ++m) {
+    for (int n = 0; n < N; ++n) {
+      ws.transT[n * N + m] = trans[m * N + n];
+    }
+  }
+
+  if (ws.betaCompact) {
+    computePath(B, T, N, input, path, ws, ws.betaCompact);
+  } else {
+    computePath(B, T, N, input, path, ws, ws.beta);
   }
 }
 
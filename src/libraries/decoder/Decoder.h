@@ -68,6 +68,15 @@ class Decoder {
   /* Get all the final hypothesis */
   virtual std::vector<DecodeResult> getAllFinalHypothesis() const = 0;
 
+  /* Change the options for the next utterances, e.g. in a sweep */
+  void setOptions(const DecoderOptions& opt) {
+    opt_ = opt;
+  }
+
+  const DecoderOptions& getOptions() const {
+    return opt_;
+  }
+
  protected:
   DecoderOptions opt_;
 };
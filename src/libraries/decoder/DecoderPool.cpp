@@ -0,0 +1,168 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/decoder/DecoderPool.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace w2l {
+
+DecoderPool::DecoderPool(int nWorkers, const DecoderFactory& decoderFactory)
+    : nQueued_(0), stop_(false) {
+  if (nWorkers < 1) {
+    throw std::invalid_argument(
+        "[DecoderPool] Invalid number of workers: " + std::to_string(nWorkers));
+  }
+  for (int i = 0; i < nWorkers; i++) {
+    queues_.emplace_back(new TaskQueue());
+  }
+
+  // Wait for every decoder to be built, so that failures surface here
+  std::vector<std::promise<void>> ready(nWorkers);
+  for (int i = 0; i < nWorkers; i++) {
+    workers_.emplace_back(
+        &DecoderPool::run,
+        this,
+        i,
+        std::cref(decoderFactory),
+        std::ref(ready[i]));
+  }
+  std::exception_ptr error;
+  for (auto& workerReady : ready) {
+    try {
+      workerReady.get_future().get();
+    } catch (...) {
+      if (!error) {
+        error = std::current_exception();
+      }
+    }
+  }
+  if (error) {
+    shutdown();
+    std::rethrow_exception(error);
+  }
+}
+
+DecoderPool::~DecoderPool() {
+  shutdown();
+}
+
+void DecoderPool::shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(idleMutex_);
+    stop_ = true;
+  }
+  idle_.notify_all();
+  for (auto& worker : workers_) {
+    if (worker.joinable()) {
+      worker.join();
+    }
+  }
+}
+
+std::future<std::vector<DecodeResult>>
+DecoderPool::decode(const float* emissions, int T, int N) {
+  return enqueue(T, [emissions, T, N](Decoder& decoder) {
+    return decoder.decode(emissions, T, N);
+  });
+}
+
+void DecoderPool::push(int64_t cost, Task task) {
+  TaskQueue* target = queues_[0].get();
+  for (auto& queue : queues_) {
+    if (queue->cost < target->cost) {
+      target = queue.get();
+    }
+  }
+  {
+    std::lock_guard<std::mutex> lock(target->mutex);
+    target->tasks.emplace(cost, std::move(task));
+    target->cost += cost;
+  }
+  {
+    std::lock_guard<std::mutex> lock(idleMutex_);
+    ++nQueued_;
+  }
+  idle_.notify_one();
+}
+
+bool DecoderPool::popLongest(TaskQueue& queue, Task& task) {
+  std::lock_guard<std::mutex> lock(queue.mutex);
+  if (queue.tasks.empty()) {
+    return false;
+  }
+  auto longest = queue.tasks.begin();
+  task = std::move(longest->second);
+  queue.cost -= longest->first;
+  queue.tasks.erase(longest);
+  return true;
+}
+
+bool DecoderPool::pop(int workerId, Task& task) {
+  // Own queue first
+  if (popLongest(*queues_[workerId], task)) {
+    return true;
+  }
+
+  // Then steal the longest task left in the others
+  TaskQueue* victim = nullptr;
+  int64_t longestCost = 0;
+  for (auto& queue : queues_) {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    if (!queue->tasks.empty() &&
+        (!victim || queue->tasks.begin()->first > longestCost)) {
+      victim = queue.get();
+      longestCost = queue->tasks.begin()->first;
+    }
+  }
+  // Another worker may have emptied the victim since: the caller retries
+  return victim && popLongest(*victim, task);
+}
+
+void DecoderPool::run(
+    int workerId,
+    const DecoderFactory& decoderFactory,
+    std::promise<void>& ready) {
+  std::unique_ptr<Decoder> decoder;
+  try {
+    decoder = decoderFactory(workerId);
+    if (!decoder) {
+      throw std::runtime_error(
+          "[DecoderPool] No decoder built for worker " +
+          std::to_string(workerId));
+    }
+    ready.set_value();
+  } catch (...) {
+    ready.set_exception(std::current_exception());
+    return;
+  }
+
+  Task task;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(idleMutex_);
+      idle_.wait(lock, [this] { return stop_ || nQueued_ > 0; });
+      if (nQueued_ == 0) {
+        return; // Stopped and nothing left to run
+      }
+      --nQueued_;
+    }
+    // The task claimed above is in one of the queues, though another worker
+    // may take it first while we scan: there is then another one left, as
+    // tasks are queued before being counted in `nQueued_` and workers only pop
+    // what they claimed. The spin is thus bounded by concurrent pops.
+    while (!pop(workerId, task)) {
+      std::this_thread::yield();
+    }
+    task(*decoder);
+    task = nullptr;
+  }
+}
+
+} // namespace w2l
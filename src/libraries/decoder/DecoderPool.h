@@ -0,0 +1,116 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "libraries/decoder/Decoder.h"
+
+namespace w2l {
+
+/**
+ * DecoderPool decodes many utterances in parallel with one decoder per worker
+ * thread. Decoders are built by a factory, called once in each worker thread
+ * before it starts, so that per-thread resources (GPU device, ConvLM, LM
+ * caches) can be set up there. The immutable parts (FlatTrie, KenLM) are
+ * usually shared by all the decoders.
+ *
+ * Tasks are scheduled longest-first: each worker owns a queue ordered by
+ * decreasing cost (e.g. number of frames), new tasks go to the least loaded
+ * queue, and a worker whose queue is empty steals the longest task left in
+ * the others. One long utterance thus never holds back a whole slice of the
+ * data set. Results come back through futures.
+ *
+ * The destructor waits for all the queued tasks to finish.
+ */
+class DecoderPool {
+ public:
+  using DecoderFactory = std::function<std::unique_ptr<Decoder>(int workerId)>;
+
+  /* Throws whatever the factory throws for any of the workers */
+  DecoderPool(int nWorkers, const DecoderFactory& decoderFactory);
+
+  ~DecoderPool();
+
+  DecoderPool(const DecoderPool&) = delete;
+  DecoderPool& operator=(const DecoderPool&) = delete;
+
+  int nWorkers() const {
+    return workers_.size();
+  }
+
+  /**
+   * Decode T x N emissions offline. `emissions` is not copied and must stay
+   * alive until the future is ready.
+   */
+  std::future<std::vector<DecodeResult>>
+  decode(const float* emissions, int T, int N);
+
+  /**
+   * Run `fn(Decoder&)` on one of the workers. Tasks with larger `cost` are
+   * picked first.
+   */
+  template <class Fn>
+  auto enqueue(int64_t cost, Fn&& fn)
+      -> std::future<decltype(fn(std::declval<Decoder&>()))>;
+
+ private:
+  using Task = std::function<void(Decoder&)>;
+
+  struct TaskQueue {
+    std::mutex mutex;
+    std::multimap<int64_t, Task, std::greater<int64_t>> tasks;
+    std::atomic<int64_t> cost{0}; // Total cost of the queued tasks
+  };
+
+  std::vector<std::thread> workers_;
+  std::vector<std::unique_ptr<TaskQueue>> queues_;
+
+  // Workers sleep on `idle_` when there is nothing left to run or steal
+  std::mutex idleMutex_;
+  std::condition_variable idle_;
+  int64_t nQueued_; // Tasks in the queues not yet claimed by a worker
+  bool stop_;
+
+  void shutdown();
+
+  void push(int64_t cost, Task task);
+
+  // Take the longest task of `queue`, if any
+  bool popLongest(TaskQueue& queue, Task& task);
+
+  bool pop(int workerId, Task& task);
+
+  void run(
+      int workerId,
+      const DecoderFactory& decoderFactory,
+      std::promise<void>& ready);
+};
+
+template <class Fn>
+auto DecoderPool::enqueue(int64_t cost, Fn&& fn)
+    -> std::future<decltype(fn(std::declval<Decoder&>()))> {
+  using Result = decltype(fn(std::declval<Decoder&>()));
+  auto task = std::make_shared<std::packaged_task<Result(Decoder&)>>(
+      std::forward<Fn>(fn));
+  auto result = task->get_future();
+  push(cost, [task](Decoder& decoder) { (*task)(decoder); });
+  return result;
+}
+
+} // namespace w2l
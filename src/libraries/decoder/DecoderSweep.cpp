@@ -0,0 +1,224 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/decoder/DecoderSweep.h"
+
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+struct SweptOption {
+  const char* name;
+  bool integral;
+  void (*set)(DecoderOptions& opt, double value);
+};
+
+const std::vector<SweptOption> kSweptOptions = {
+    {"lmweight",
+     false,
+     [](DecoderOptions& opt, double value) { opt.lmWeight = value; }},
+    {"wordscore",
+     false,
+     [](DecoderOptions& opt, double value) { opt.wordScore = value; }},
+    {"unkweight",
+     false,
+     [](DecoderOptions& opt, double value) { opt.unkScore = value; }},
+    {"silweight",
+     false,
+     [](DecoderOptions& opt, double value) { opt.silWeight = value; }},
+    {"beamthreshold",
+     false,
+     [](DecoderOptions& opt, double value) { opt.beamThreshold = value; }},
+    {"beamsize",
+     true,
+     [](DecoderOptions& opt, double value) { opt.beamSize = value; }},
+    {"beamsizetoken",
+     true,
+     [](DecoderOptions& opt, double value) { opt.beamSizeToken = value; }},
+    {"blankskipthreshold",
+     false,
+     [](DecoderOptions& opt, double value) {
+       opt.blankSkipThreshold = value;
+     }},
+    {"tokenmargin",
+     false,
+     [](DecoderOptions& opt, double value) { opt.tokenMargin = value; }},
+};
+
+// Values of one swept option: a list, or the bounds of a range
+struct SweptValues {
+  const SweptOption* option;
+  std::vector<double> values;
+  bool range;
+};
+
+double parseValue(const std::string& str, const std::string& name) {
+  size_t end = 0;
+  double value = 0;
+  try {
+    value = std::stod(str, &end);
+  } catch (const std::exception&) {
+    end = 0;
+  }
+  if (str.empty() || end != str.size()) {
+    throw std::invalid_argument(
+        "[DecoderSweep] Invalid value of " + name + ": '" + str + "'");
+  }
+  return value;
+}
+
+std::vector<std::string> splitOn(char delim, const std::string& str) {
+  std::vector<std::string> parts;
+  std::stringstream ss(str);
+  std::string part;
+  while (std::getline(ss, part, delim)) {
+    parts.push_back(part);
+  }
+  if (str.empty() || str.back() == delim) {
+    parts.emplace_back();
+  }
+  return parts;
+}
+
+SweptValues parseSweptValues(const std::string& item) {
+  auto eq = item.find('=');
+  if (eq == std::string::npos) {
+    throw std::invalid_argument(
+        "[DecoderSweep] Expected 'name=values', got '" + item + "'");
+  }
+  std::string name = item.substr(0, eq);
+  std::string values = item.substr(eq + 1);
+
+  SweptValues swept;
+  swept.option = nullptr;
+  for (const auto& option : kSweptOptions) {
+    if (name == option.name) {
+      swept.option = &option;
+    }
+  }
+  if (!swept.option) {
+    throw std::invalid_argument(
+        "[DecoderSweep] Unknown decoder option: '" + name + "'");
+  }
+
+  auto dots = values.find("..");
+  swept.range = dots != std::string::npos;
+  if (swept.range) {
+    swept.values = {parseValue(values.substr(0, dots), name),
+                    parseValue(values.substr(dots + 2), name)};
+    if (swept.values[0] > swept.values[1]) {
+      throw std::invalid_argument(
+          "[DecoderSweep] Empty range of " + name + ": " + values);
+    }
+  } else {
+    for (const auto& value : splitOn(':', values)) {
+      swept.values.push_back(parseValue(value, name));
+    }
+  }
+  if (swept.option->integral) {
+    for (auto& value : swept.values) {
+      value = std::round(value);
+    }
+  }
+  return swept;
+}
+
+} // namespace
+
+std::string DecoderSweep::describe(int config) const {
+  std::ostringstream ss;
+  for (int i = 0; i < names.size(); i++) {
+    ss << (i > 0 ? " " : "") << names[i] << "=" << values[config][i];
+  }
+  return ss.str();
+}
+
+DecoderSweep parseDecoderSweep(
+    const std::string& spec,
+    const DecoderOptions& base,
+    int nRandom,
+    unsigned int seed) {
+  if (nRandom < 0) {
+    throw std::invalid_argument(
+        "[DecoderSweep] Invalid number of random configurations: " +
+        std::to_string(nRandom));
+  }
+
+  DecoderSweep sweep;
+  std::vector<SweptValues> swept;
+  for (const auto& item : splitOn(',', spec)) {
+    swept.push_back(parseSweptValues(item));
+    const std::string name = swept.back().option->name;
+    for (const auto& other : sweep.names) {
+      if (other == name) {
+        throw std::invalid_argument(
+            "[DecoderSweep] Option swept twice: " + name);
+      }
+    }
+    if (swept.back().range && nRandom == 0) {
+      throw std::invalid_argument(
+          "[DecoderSweep] Range of " + name +
+          " can only be swept with random configurations");
+    }
+    sweep.names.push_back(name);
+  }
+
+  if (nRandom == 0) {
+    // Grid: count in a mixed radix, one digit per option
+    std::vector<int> digits(swept.size(), 0);
+    while (true) {
+      std::vector<double> values(swept.size());
+      for (int i = 0; i < swept.size(); i++) {
+        values[i] = swept[i].values[digits[i]];
+      }
+      sweep.values.push_back(std::move(values));
+      int i = static_cast<int>(swept.size()) - 1;
+      while (i >= 0 && ++digits[i] == swept[i].values.size()) {
+        digits[i--] = 0;
+      }
+      if (i < 0) {
+        break;
+      }
+    }
+  } else {
+    std::mt19937 rng(seed);
+    for (int c = 0; c < nRandom; c++) {
+      std::vector<double> values(swept.size());
+      for (int i = 0; i < swept.size(); i++) {
+        const auto& bounds = swept[i].values;
+        if (!swept[i].range) {
+          std::uniform_int_distribution<size_t> pick(0, bounds.size() - 1);
+          values[i] = bounds[pick(rng)];
+        } else if (swept[i].option->integral) {
+          std::uniform_int_distribution<long> draw(bounds[0], bounds[1]);
+          values[i] = draw(rng);
+        } else {
+          std::uniform_real_distribution<double> draw(bounds[0], bounds[1]);
+          values[i] = draw(rng);
+        }
+      }
+      sweep.values.push_back(std::move(values));
+    }
+  }
+
+  for (const auto& values : sweep.values) {
+    DecoderOptions opt = base;
+    for (int i = 0; i < swept.size(); i++) {
+      swept[i].option->set(opt, values[i]);
+    }
+    sweep.options.push_back(opt);
+  }
+  return sweep;
+}
+
+} // namespace w2l
@@ -0,0 +1,54 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "libraries/decoder/Utils.h"
+
+namespace w2l {
+
+/**
+ * Configurations of a decoder hyper-parameter sweep. Decoders don't derive
+ * any state from their options, so a single decoder per thread can run all
+ * the configurations, switching with Decoder::setOptions() between
+ * utterances while sharing the trie and the LM.
+ */
+struct DecoderSweep {
+  // Names of the swept options, in the order of the spec
+  std::vector<std::string> names;
+  // Values of the swept options, for each configuration
+  std::vector<std::vector<double>> values;
+  std::vector<DecoderOptions> options;
+
+  /* Swept values of configuration `config`, as `name=value` pairs */
+  std::string describe(int config) const;
+};
+
+/**
+ * Builds a sweep from `spec`, a comma-separated list of `name=values`. `name`
+ * is an option named after the flag setting it: lmweight, wordscore,
+ * unkweight, silweight, beamthreshold, beamsize, beamsizetoken,
+ * blankskipthreshold or tokenmargin. `values` is either a colon-separated
+ * list (`lmweight=1:1.5:2`) or a range (`lmweight=1..3`).
+ *
+ * With `nRandom` = 0, the sweep is the grid of all the combinations of the
+ * listed values, the last option varying fastest, and ranges are rejected.
+ * Otherwise, it's made of `nRandom` configurations drawing each option
+ * uniformly from its list or range with a generator seeded by `seed`.
+ * Options missing from `spec` keep their value in `base`.
+ */
+DecoderSweep parseDecoderSweep(
+    const std::string& spec,
+    const DecoderOptions& base,
+    int nRandom = 0,
+    unsigned int seed = 0);
+
+} // namespace w2l
@@ -0,0 +1,340 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include "libraries/decoder/FlatTrie.h"
+
+namespace w2l {
+
+/**
+ * Binary image layout (native byte order). Every section starts at an offset
+ * aligned to 8 bytes:
+ *   FlatTrieHeader
+ *   int32   tokens[nNodes]
+ *   float   maxScores[nNodes]
+ *   int32   childOffsets[nNodes + 1]
+ *   int32   labelOffsets[nNodes + 1]
+ *   int32   labels[nLabels]
+ *   float   scores[nLabels]
+ *   int64   wordOffsets[nWords + 1]
+ *   char    wordChars[wordOffsets[nWords]]
+ */
+namespace {
+
+constexpr char kFlatTrieMagic[8] = {'W', '2', 'L', 'T', 'R', 'I', 'E', '\0'};
+constexpr uint32_t kFlatTrieVersion = 2;
+
+struct FlatTrieHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t headerSize;
+  int64_t nNodes;
+  int64_t nLabels;
+  int64_t nWords;
+  int64_t nWordChars;
+  uint64_t fingerprint;
+};
+
+size_t alignSection(size_t offset) {
+  return (offset + 7) & ~static_cast<size_t>(7);
+}
+
+template <typename T>
+void appendSection(std::string& image, const T* data, size_t count) {
+  image.resize(alignSection(image.size()), '\0');
+  image.append(reinterpret_cast<const char*>(data), count * sizeof(T));
+}
+
+template <typename T>
+const T*
+readSection(const char* image, size_t size, size_t& offset, size_t count) {
+  offset = alignSection(offset);
+  if (offset > size || count > (size - offset) / sizeof(T)) {
+    throw std::runtime_error("[FlatTrie] Truncated trie image");
+  }
+  auto section = reinterpret_cast<const T*>(image + offset);
+  offset += count * sizeof(T);
+  return section;
+}
+
+std::shared_ptr<const void> makeImage(
+    const std::vector<int>& tokens,
+    const std::vector<float>& maxScores,
+    const std::vector<int>& childOffsets,
+    const std::vector<int>& labelOffsets,
+    const std::vector<int>& labels,
+    const std::vector<float>& scores,
+    const std::vector<int64_t>& wordOffsets,
+    const std::string& wordChars,
+    uint64_t fingerprint,
+    size_t& size) {
+  FlatTrieHeader header;
+  std::memcpy(header.magic, kFlatTrieMagic, sizeof(kFlatTrieMagic));
+  header.version = kFlatTrieVersion;
+  header.headerSize = sizeof(FlatTrieHeader);
+  header.nNodes = tokens.size();
+  header.nLabels = labels.size();
+  header.nWords = wordOffsets.size() - 1;
+  header.nWordChars = wordChars.size();
+  header.fingerprint = fingerprint;
+
+  auto image = std::make_shared<std::string>();
+  appendSection(*image, reinterpret_cast<const char*>(&header), sizeof(header));
+  appendSection(*image, tokens.data(), tokens.size());
+  appendSection(*image, maxScores.data(), maxScores.size());
+  appendSection(*image, childOffsets.data(), childOffsets.size());
+  appendSection(*image, labelOffsets.data(), labelOffsets.size());
+  appendSection(*image, labels.data(), labels.size());
+  appendSection(*image, scores.data(), scores.size());
+  appendSection(*image, wordOffsets.data(), wordOffsets.size());
+  appendSection(*image, wordChars.data(), wordChars.size());
+  size = image->size();
+  // std::string storage is suitably aligned for all the sections
+  return std::shared_ptr<const void>(image, image->data());
+}
+
+template <typename T>
+void checkOffsets(const T* offsets, int64_t count, T first, T last) {
+  if (offsets[0] != first || offsets[count] != last) {
+    throw std::runtime_error("[FlatTrie] Corrupted trie image");
+  }
+  for (int64_t i = 0; i < count; ++i) {
+    if (offsets[i] > offsets[i + 1]) {
+      throw std::runtime_error("[FlatTrie] Corrupted trie image");
+    }
+  }
+}
+
+} // namespace
+
+FlatTrie::FlatTrie(const Trie& trie) {
+  // Breadth-first traversal: children of a node are numbered consecutively,
+  // in increasing token order, right after the children of previous nodes.
+  std::vector<const TrieNode*> nodes{trie.getRoot()};
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    std::vector<std::pair<int, const TrieNode*>> children;
+    children.reserve(nodes[i]->children.size());
+    for (const auto& child : nodes[i]->children) {
+      children.emplace_back(child.first, child.second.get());
+    }
+    std::sort(children.begin(), children.end());
+    for (const auto& child : children) {
+      nodes.push_back(child.second);
+    }
+  }
+
+  int nNodes = nodes.size();
+  std::vector<int> tokens(nNodes), childOffsets(nNodes + 1),
+      labelOffsets(nNodes + 1), labels;
+  std::vector<float> maxScores(nNodes), scores;
+  childOffsets[0] = 1;
+  labelOffsets[0] = 0;
+  for (int i = 0; i < nNodes; ++i) {
+    const TrieNode* node = nodes[i];
+    tokens[i] = node->idx;
+    maxScores[i] = node->maxScore;
+    childOffsets[i + 1] = childOffsets[i] + node->children.size();
+    labelOffsets[i + 1] = labelOffsets[i] + node->labels.size();
+    labels.insert(labels.end(), node->labels.begin(), node->labels.end());
+    scores.insert(scores.end(), node->scores.begin(), node->scores.end());
+  }
+
+  size_t size;
+  auto image = makeImage(
+      tokens,
+      maxScores,
+      childOffsets,
+      labelOffsets,
+      labels,
+      scores,
+      {0},
+      "",
+      0,
+      size);
+  setImage(std::move(image), size);
+}
+
+void FlatTrie::setImage(std::shared_ptr<const void> storage, size_t size) {
+  storage_ = std::move(storage);
+  auto image = static_cast<const char*>(storage_.get());
+
+  size_t offset = 0;
+  auto header = readSection<FlatTrieHeader>(image, size, offset, 1);
+  if (std::memcmp(header->magic, kFlatTrieMagic, sizeof(kFlatTrieMagic)) !=
+      0) {
+    throw std::runtime_error("[FlatTrie] Invalid trie image");
+  }
+  if (header->version != kFlatTrieVersion ||
+      header->headerSize != sizeof(FlatTrieHeader)) {
+    throw std::runtime_error(
+        "[FlatTrie] Unsupported trie image version: " +
+        std::to_string(header->version));
+  }
+  // Sections are sized after the header: check it before trusting it
+  const int64_t kMaxCount = std::numeric_limits<int>::max() - 1;
+  if (header->nNodes < 1 || header->nNodes > kMaxCount ||
+      header->nLabels < 0 || header->nLabels > kMaxCount ||
+      header->nWords < 0 || header->nWords > kMaxCount ||
+      header->nWordChars < 0) {
+    throw std::runtime_error("[FlatTrie] Corrupted trie image");
+  }
+  nNodes_ = header->nNodes;
+  nLabels_ = header->nLabels;
+  nWords_ = header->nWords;
+  fingerprint_ = header->fingerprint;
+  tokens_ = readSection<int>(image, size, offset, nNodes_);
+  maxScores_ = readSection<float>(image, size, offset, nNodes_);
+  childOffsets_ = readSection<int>(image, size, offset, nNodes_ + 1);
+  labelOffsets_ = readSection<int>(image, size, offset, nNodes_ + 1);
+  labels_ = readSection<int>(image, size, offset, nLabels_);
+  scores_ = readSection<float>(image, size, offset, nLabels_);
+  wordOffsets_ = readSection<int64_t>(image, size, offset, nWords_ + 1);
+  wordChars_ = readSection<char>(image, size, offset, header->nWordChars);
+
+  // Decoders index the arrays with the offsets without checking them. In a
+  // breadth-first numbering, the children of a node follow it and the last
+  // range ends with the last node.
+  checkOffsets(childOffsets_, nNodes_, 1, nNodes_);
+  for (int i = 0; i < nNodes_; ++i) {
+    int begin = childOffsets_[i], end = childOffsets_[i + 1];
+    if (begin <= i && begin != end) {
+      throw std::runtime_error("[FlatTrie] Corrupted trie image");
+    }
+    // getChild() bisects the tokens of the children
+    for (int child = begin; child < end; ++child) {
+      if (tokens_[child] < 0 ||
+          (child > begin && tokens_[child] <= tokens_[child - 1])) {
+        throw std::runtime_error("[FlatTrie] Corrupted trie image");
+      }
+    }
+  }
+  checkOffsets(labelOffsets_, nNodes_, 0, nLabels_);
+  checkOffsets(
+      wordOffsets_, nWords_, static_cast<int64_t>(0), header->nWordChars);
+  for (int i = 0; i < nLabels_; ++i) {
+    if (labels_[i] < 0 || (nWords_ > 0 && labels_[i] >= nWords_)) {
+      throw std::runtime_error("[FlatTrie] Corrupted trie image");
+    }
+  }
+}
+
+void FlatTrie::save(
+    const std::string& path,
+    const std::vector<std::string>& words,
+    uint64_t fingerprint) const {
+  std::vector<int64_t> wordOffsets{0};
+  std::string wordChars;
+  for (const auto& word : words) {
+    wordChars += word;
+    wordOffsets.push_back(wordChars.size());
+  }
+
+  size_t size;
+  auto image = makeImage(
+      std::vector<int>(tokens_, tokens_ + nNodes_),
+      std::vector<float>(maxScores_, maxScores_ + nNodes_),
+      std::vector<int>(childOffsets_, childOffsets_ + nNodes_ + 1),
+      std::vector<int>(labelOffsets_, labelOffsets_ + nNodes_ + 1),
+      std::vector<int>(labels_, labels_ + nLabels_),
+      std::vector<float>(scores_, scores_ + nLabels_),
+      wordOffsets,
+      wordChars,
+      fingerprint,
+      size);
+
+  // Readers only ever map a complete image: it is written next to `path` and
+  // renamed over it, which is atomic within a file system
+  std::string tmpPath = path + ".XXXXXX";
+  int fd = mkstemp(&tmpPath[0]);
+  if (fd < 0) {
+    throw std::runtime_error("[FlatTrie] Cannot create " + tmpPath);
+  }
+  close(fd);
+  std::ofstream file(tmpPath, std::ios::binary | std::ios::out);
+  file.write(static_cast<const char*>(image.get()), size);
+  file.close();
+  if (!file) {
+    unlink(tmpPath.c_str());
+    throw std::runtime_error("[FlatTrie] Failed writing " + tmpPath);
+  }
+  // mkstemp() creates the file readable by its owner only
+  chmod(tmpPath.c_str(), 0644);
+  if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+    unlink(tmpPath.c_str());
+    throw std::runtime_error("[FlatTrie] Cannot rename " + tmpPath);
+  }
+}
+
+FlatTriePtr FlatTrie::load(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("[FlatTrie] Cannot open " + path);
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    throw std::runtime_error("[FlatTrie] Cannot stat " + path);
+  }
+  size_t size = st.st_size;
+  void* addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error("[FlatTrie] Cannot mmap " + path);
+  }
+
+  std::shared_ptr<FlatTrie> trie(new FlatTrie());
+  auto unmap = [size](const void* ptr) {
+    munmap(const_cast<void*>(ptr), size);
+  };
+  trie->setImage(std::shared_ptr<const void>(addr, unmap), size);
+  return trie;
+}
+
+std::vector<std::string> FlatTrie::getWords() const {
+  std::vector<std::string> words(nWords_);
+  for (int i = 0; i < nWords_; ++i) {
+    words[i].assign(
+        wordChars_ + wordOffsets_[i], wordOffsets_[i + 1] - wordOffsets_[i]);
+  }
+  return words;
+}
+
+int FlatTrie::getChild(int node, int token) const {
+  auto begin = tokens_ + childOffsets_[node];
+  auto end = tokens_ + childOffsets_[node + 1];
+  auto it = std::lower_bound(begin, end, token);
+  if (it == end || *it != token) {
+    return -1;
+  }
+  return it - tokens_;
+}
+
+int FlatTrie::search(const std::vector<int>& indices) const {
+  int node = getRoot();
+  for (auto idx : indices) {
+    node = getChild(node, idx);
+    if (node < 0) {
+      return -1;
+    }
+  }
+  return node;
+}
+
+} // namespace w2l
@@ -0,0 +1,144 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "libraries/decoder/Trie.h"
+
+namespace w2l {
+
+class FlatTrie;
+using FlatTriePtr = std::shared_ptr<const FlatTrie>;
+
+/**
+ * FlatTrie is the compiled, read-only form of a (smeared) Trie used by the
+ * decoders. Nodes are numbered in breadth-first order, starting from the root
+ * (node 0), and stored in parallel arrays:
+ *  - the children of a node form a contiguous range of node indices
+ *    [childBegin(node), childEnd(node)), sorted by token;
+ *  - the labels of a node form a contiguous range
+ *    [labelBegin(node), labelEnd(node)) of `labels_` and `scores_`.
+ * Walking the trie is then a matter of index arithmetic over a few flat
+ * arrays instead of chasing hash map buckets and shared pointers.
+ *
+ * The arrays live in a single binary image (see FlatTrie.cpp for the layout),
+ * which is either built in memory from a Trie or memory-mapped from a file
+ * written by `save()`. A mapped trie is ready to use right away and its pages
+ * are shared by all the processes decoding with the same file.
+ */
+class FlatTrie {
+ public:
+  explicit FlatTrie(const Trie& trie);
+
+  /**
+   * Write the binary image of the trie to `path`. The word list (usually the
+   * entries of the word dictionary, ordered by index) is stored along with
+   * the trie so that labels can be mapped back to words after loading.
+   * `fingerprint` identifies the inputs the trie was built from (lexicon,
+   * tokens, LM, smearing...), so that users of the image can detect a stale
+   * one. The image is written to a temporary file renamed to `path`, which
+   * readers never see partially written.
+   */
+  void save(
+      const std::string& path,
+      const std::vector<std::string>& words,
+      uint64_t fingerprint = 0) const;
+
+  /* Memory-map a binary image written by `save()`, after validating it */
+  static FlatTriePtr load(const std::string& path);
+
+  /* Words stored in the image (empty unless loaded from a file) */
+  std::vector<std::string> getWords() const;
+
+  /* Fingerprint stored in the image (0 unless loaded from a file) */
+  uint64_t getFingerprint() const {
+    return fingerprint_;
+  }
+
+  /* Return the index of the root node */
+  int getRoot() const {
+    return 0;
+  }
+
+  int getNumNodes() const {
+    return nNodes_;
+  }
+
+  /* Return the child of `node` reached with `token`, or -1 if there is none */
+  int getChild(int node, int token) const;
+
+  /* Return the node spelled by `indices`, or -1 if there is none */
+  int search(const std::vector<int>& indices) const;
+
+  int childBegin(int node) const {
+    return childOffsets_[node];
+  }
+
+  int childEnd(int node) const {
+    return childOffsets_[node + 1];
+  }
+
+  bool hasChildren(int node) const {
+    return childOffsets_[node] != childOffsets_[node + 1];
+  }
+
+  /* Token (`TrieNode::idx`) of the edge leading to `node` */
+  int getToken(int node) const {
+    return tokens_[node];
+  }
+
+  /* Smeared score of `node` (`TrieNode::maxScore`) */
+  float getMaxScore(int node) const {
+    return maxScores_[node];
+  }
+
+  int labelBegin(int node) const {
+    return labelOffsets_[node];
+  }
+
+  int labelEnd(int node) const {
+    return labelOffsets_[node + 1];
+  }
+
+  int getLabel(int i) const {
+    return labels_[i];
+  }
+
+  float getScore(int i) const {
+    return scores_[i];
+  }
+
+ private:
+  FlatTrie() = default;
+
+  // Parse the binary image held by `storage` and point the arrays into it
+  void setImage(std::shared_ptr<const void> storage, size_t size);
+
+  // Owner of the binary image: heap memory or a mapped file
+  std::shared_ptr<const void> storage_;
+
+  int nNodes_;
+  int nLabels_;
+  int nWords_;
+  uint64_t fingerprint_;
+  const int* tokens_;
+  const float* maxScores_;
+  const int* childOffsets_; // size nNodes_ + 1
+  const int* labelOffsets_; // size nNodes_ + 1
+  const int* labels_;
+  const float* scores_;
+  const int64_t* wordOffsets_; // size nWords_ + 1
+  const char* wordChars_;
+};
+
+} // namespace w2l
@@ -23,11 +23,12 @@ void LexiconDecoder::candidatesReset() {
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
+  lmQueries_.clear();
 }
 
 void LexiconDecoder::candidatesAdd(
     const LMStatePtr& lmState,
-    const TrieNode* lex,
+    const int lex,
     const LexiconDecoderState* parent,
     const double score,
     const int token,
@@ -58,9 +59,32 @@ void LexiconDecoder::candidatesStore(
   storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, returnSorted);
 }
 
+void LexiconDecoder::extendWithBlank(
+    const int frame,
+    const float blankScore,
+    const bool afterBlankFrame) {
+  if (afterBlankFrame) {
+    propagateBlank(hyp_[frame], hyp_[frame + 1], blankScore);
+    return;
+  }
+  candidatesReset();
+  for (const LexiconDecoderState& prevHyp : hyp_[frame]) {
+    candidatesAdd(
+        prevHyp.lmState,
+        prevHyp.lex,
+        &prevHyp,
+        prevHyp.score + blankScore,
+        blank_,
+        -1,
+        true // prevBlank
+    );
+  }
+  candidatesStore(hyp_[frame + 1], false);
+  updateLMCache(lm_, hyp_[frame + 1]);
+}
+
 void LexiconDecoder::decodeBegin() {
-  hyp_.clear();
-  hyp_.emplace(0, std::vector<LexiconDecoderState>());
+  resetHypothesis(hyp_);
 
   /* note: the lm reset itself with :start() */
   hyp_[0].emplace_back(
@@ -70,6 +94,7 @@ void LexiconDecoder::decodeBegin() {
 }
 
 void LexiconDecoder::decodeEnd() {
+  extendHypothesis(hyp_, nDecodedFrames_ - nPrunedFrames_ + 2);
   candidatesReset();
   bool hasNiceEnding = false;
   for (const LexiconDecoderState& prevHyp :
@@ -81,7 +106,7 @@ void LexiconDecoder::decodeEnd() {
   }
   for (const LexiconDecoderState& prevHyp :
        hyp_[nDecodedFrames_ - nPrunedFrames_]) {
-    const TrieNode* prevLex = prevHyp.lex;
+    const int prevLex = prevHyp.lex;
     const LMStatePtr& prevLmState = prevHyp.lmState;
 
     if (!hasNiceEnding || prevHyp.lex == lexicon_->getRoot()) {
@@ -108,7 +133,7 @@ std::vector<DecodeResult> LexiconDecoder::getAllFinalHypothesis() const {
     return std::vector<DecodeResult>{};
   }
 
-  return getAllHypothesis(hyp_.find(finalFrame)->second, finalFrame);
+  return getAllHypothesis(hyp_[finalFrame], finalFrame);
 }
 
 DecodeResult LexiconDecoder::getBestHypothesis(int lookBack) const {
@@ -117,13 +142,13 @@ DecodeResult LexiconDecoder::getBestHypothesis(int lookBack) const {
   }
 
   const LexiconDecoderState* bestNode = findBestAncestor(
-      hyp_.find(nDecodedFrames_ - nPrunedFrames_)->second, lookBack);
+      hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
   return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
 }
 
 int LexiconDecoder::nHypothesis() const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
-  return hyp_.find(finalFrame)->second.size();
+  return hyp_[finalFrame].size();
 }
 
 int LexiconDecoder::nDecodedFramesInBuffer() const {
@@ -137,7 +162,7 @@ void LexiconDecoder::prune(int lookBack) {
 
   /* (1) Find the last emitted word in the best path */
   const LexiconDecoderState* bestNode = findBestAncestor(
-      hyp_.find(nDecodedFrames_ - nPrunedFrames_)->second, lookBack);
+      hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
   if (!bestNode) {
     return; // Not enough decoded frames to prune
   }
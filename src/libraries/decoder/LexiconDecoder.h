@@ -11,6 +11,7 @@
 #include <unordered_map>
 
 #include "libraries/decoder/Decoder.h"
+#include "libraries/decoder/FlatTrie.h"
 #include "libraries/decoder/Trie.h"
 #include "libraries/lm/LM.h"
 
@@ -20,7 +21,7 @@ namespace w2l {
  */
 struct LexiconDecoderState {
   LMStatePtr lmState; // Language model state
-  const TrieNode* lex; // Trie node in the lexicon
+  int lex; // Index of the trie node in the lexicon
   const LexiconDecoderState* parent; // Parent hypothesis
   double score; // Score so far
   int token; // Label of token
@@ -29,7 +30,7 @@ struct LexiconDecoderState {
 
   LexiconDecoderState(
       const LMStatePtr& lmState,
-      const TrieNode* lex,
+      const int lex,
       const LexiconDecoderState* parent,
       const double score,
       const int token,
@@ -45,7 +46,7 @@ struct LexiconDecoderState {
 
   LexiconDecoderState()
       : lmState(nullptr),
-        lex(nullptr),
+        lex(-1),
         parent(nullptr),
         score(0),
         token(-1),
@@ -73,6 +74,10 @@ struct LexiconDecoderState {
  * score of the transcription W. Note that the lexicon is used to limit the
  * search space and all candidate words are generated from it if unkScore is
  * -inf, otherwise <UNK> will be generated for OOVs.
+ *
+ * The lexicon is walked through its compiled form (FlatTrie). It can be given
+ * either directly, so that several decoders share it, or as a Trie which is
+ * then compiled for this decoder only.
  */
 class LexiconDecoder : public Decoder {
  public:
@@ -84,6 +89,23 @@ class LexiconDecoder : public Decoder {
       const int blank,
       const int unk,
       const std::vector<float>& transitions)
+      : LexiconDecoder(
+            opt,
+            std::make_shared<FlatTrie>(*lexicon),
+            lm,
+            sil,
+            blank,
+            unk,
+            transitions) {}
+
+  LexiconDecoder(
+      const DecoderOptions& opt,
+      const FlatTriePtr& lexicon,
+      const LMPtr& lm,
+      const int sil,
+      const int blank,
+      const int unk,
+      const std::vector<float>& transitions)
       : Decoder(opt),
         lexicon_(lexicon),
         lm_(lm),
@@ -107,7 +129,7 @@ class LexiconDecoder : public Decoder {
   std::vector<DecodeResult> getAllFinalHypothesis() const override;
 
  protected:
-  TriePtr lexicon_;
+  FlatTriePtr lexicon_;
   LMPtr lm_;
   std::vector<float> transitions_;
 
@@ -119,9 +141,15 @@ class LexiconDecoder : public Decoder {
   // so instead of moving around objects, we only need to sort pointers
   std::vector<LexiconDecoderState*> candidatePtrs_;
 
+  // Recombines the candidates of the current frame
+  CandidateMerger<LexiconDecoderState> merger_;
+
   // Best candidate score of current frame
   double candidatesBestScore_;
 
+  // Candidates of current frame waiting for their LM score
+  LMQueryBatch<LexiconDecoderState> lmQueries_;
+
   // Index of silence label
   int sil_;
 
@@ -132,7 +160,7 @@ class LexiconDecoder : public Decoder {
   int unk_;
 
   // Vector of hypothesis for all the frames so far
-  std::unordered_map<int, std::vector<LexiconDecoderState>> hyp_;
+  HypothesisBuffer<LexiconDecoderState> hyp_;
 
   // These 2 variables are used for online decoding, for hypothesis pruning
   int nDecodedFrames_; // Total number of decoded frames.
@@ -144,7 +172,7 @@ class LexiconDecoder : public Decoder {
   // Add a new candidate to the buffer
   void candidatesAdd(
       const LMStatePtr& lmState,
-      const TrieNode* lex,
+      const int lex,
       const LexiconDecoderState* parent,
       const double score,
       const int token,
@@ -159,6 +187,12 @@ class LexiconDecoder : public Decoder {
 
   // Merge hypothesis getting into same state from different path
   virtual void mergeCandidates() = 0;
+
+  // Extend the hypotheses of `frame` with a blank only, into the next frame
+  void extendWithBlank(
+      const int frame,
+      const float blankScore,
+      const bool afterBlankFrame);
 };
 
 } // namespace w2l
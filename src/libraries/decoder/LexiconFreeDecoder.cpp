@@ -22,35 +22,18 @@ void LexiconFreeDecoder::candidatesReset() {
   candidatesBestScore_ = kNegativeInfinity;
   candidates_.clear();
   candidatePtrs_.clear();
+  lmQueries_.clear();
 }
 
 void LexiconFreeDecoder::mergeCandidates() {
-  auto compareNodesShortList = [&](const LexiconFreeDecoderState* node1,
-                                   const LexiconFreeDecoderState* node2) {
-    int lmCmp = lm_->compareState(node1->lmState, node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else { /* same LmState */
-      return node1->score > node2->score;
-    }
+  auto hashNode = [&](const LexiconFreeDecoderState* node) {
+    return lm_->stateHash(node->lmState);
   };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (lm_->compareState(
-            candidatePtrs_[i]->lmState,
-            candidatePtrs_[nHypAfterMerging - 1]->lmState)) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  auto equalNodes = [&](const LexiconFreeDecoderState* node1,
+                        const LexiconFreeDecoderState* node2) {
+    return lm_->compareState(node1->lmState, node2->lmState) == 0;
+  };
+  merger_.merge(candidatePtrs_, hashNode, equalNodes, opt_.logAdd);
 }
 
 void LexiconFreeDecoder::candidatesAdd(
@@ -85,8 +68,7 @@ void LexiconFreeDecoder::candidatesStore(
 }
 
 void LexiconFreeDecoder::decodeBegin() {
-  hyp_.clear();
-  hyp_.emplace(0, std::vector<LexiconFreeDecoderState>());
+  resetHypothesis(hyp_);
 
   /* note: the lm reset itself with :start() */
   hyp_[0].emplace_back(lm_->start(0), nullptr, 0.0, sil_);
@@ -97,20 +79,37 @@ void LexiconFreeDecoder::decodeBegin() {
 void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
   int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
-  if (hyp_.size() < startFrame + T + 2) {
-    for (int i = hyp_.size(); i < startFrame + T + 2; i++) {
-      hyp_.emplace(i, std::vector<LexiconFreeDecoderState>());
-    }
-  }
+  extendHypothesis(hyp_, startFrame + T + 2);
 
   // Looping over all the frames
+  bool afterBlankFrame = false;
   for (int t = 0; t < T; t++) {
+    // Frames confidently emitting blank only extend hypotheses with blank
+    if (opt_.criterionType == CriterionType::CTC &&
+        isBlankFrame(emissions + t * N, N, blank_, opt_.blankSkipThreshold)) {
+      extendWithBlank(
+          startFrame + t, emissions[t * N + blank_], afterBlankFrame);
+      afterBlankFrame = true;
+      continue;
+    }
+    afterBlankFrame = false;
+
+    // Tokens of the frame worth trying
+    const float minEmission =
+        tokenPruningThreshold(emissions + t * N, N, opt_.tokenMargin);
+    frameTokens_.clear();
+    for (int n = 0; n < N; n++) {
+      if (emissions[t * N + n] >= minEmission) {
+        frameTokens_.push_back(n);
+      }
+    }
+
     candidatesReset();
     for (const LexiconFreeDecoderState& prevHyp : hyp_[startFrame + t]) {
       const LMStatePtr& prevLmState = prevHyp.lmState;
 
       const int prevIdx = prevHyp.token;
-      for (int n = 0; n < N; n++) {
+      for (const int n : frameTokens_) {
         double score = prevHyp.score + emissions[t * N + n];
         if (nDecodedFrames_ + t > 0 &&
             opt_.criterionType == CriterionType::ASG) {
@@ -127,16 +126,16 @@ void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
         if ((opt_.criterionType == CriterionType::ASG && n != prevIdx) ||
             (opt_.criterionType == CriterionType::CTC && n != blank_ &&
              (n != prevIdx || prevHyp.prevBlank))) {
-          auto lmScoreReturn = lm_->score(prevLmState, n);
-          score += lmScoreReturn.second * opt_.lmWeight;
-
-          candidatesAdd(
-              lmScoreReturn.first,
-              &prevHyp,
-              score,
+          lmQueries_.add(
+              prevLmState,
               n,
-              false // prevBlank
-          );
+              LexiconFreeDecoderState(
+                  nullptr,
+                  &prevHyp,
+                  score,
+                  n,
+                  false // prevBlank
+                  ));
         } else if (opt_.criterionType == CriterionType::CTC && n == blank_) {
           candidatesAdd(
               prevLmState,
@@ -157,13 +156,48 @@ void LexiconFreeDecoder::decodeStep(const float* emissions, int T, int N) {
       }
     }
 
+    // Score all the new tokens of this frame at once
+    lmQueries_.score(lm_);
+    for (int i = 0; i < lmQueries_.size(); i++) {
+      const LexiconFreeDecoderState& candidate = lmQueries_.candidates[i];
+      candidatesAdd(
+          candidate.lmState,
+          candidate.parent,
+          candidate.score + lmQueries_.outScores[i] * opt_.lmWeight,
+          candidate.token,
+          candidate.prevBlank);
+    }
+
     candidatesStore(hyp_[startFrame + t + 1], false);
     updateLMCache(lm_, hyp_[startFrame + t + 1]);
   }
   nDecodedFrames_ += T;
 }
 
+void LexiconFreeDecoder::extendWithBlank(
+    const int frame,
+    const float blankScore,
+    const bool afterBlankFrame) {
+  if (afterBlankFrame) {
+    propagateBlank(hyp_[frame], hyp_[frame + 1], blankScore);
+    return;
+  }
+  candidatesReset();
+  for (const LexiconFreeDecoderState& prevHyp : hyp_[frame]) {
+    candidatesAdd(
+        prevHyp.lmState,
+        &prevHyp,
+        prevHyp.score + blankScore,
+        blank_,
+        true // prevBlank
+    );
+  }
+  candidatesStore(hyp_[frame + 1], false);
+  updateLMCache(lm_, hyp_[frame + 1]);
+}
+
 void LexiconFreeDecoder::decodeEnd() {
+  extendHypothesis(hyp_, nDecodedFrames_ - nPrunedFrames_ + 2);
   candidatesReset();
   for (const LexiconFreeDecoderState& prevHyp :
        hyp_[nDecodedFrames_ - nPrunedFrames_]) {
@@ -185,20 +219,20 @@ void LexiconFreeDecoder::decodeEnd() {
 
 std::vector<DecodeResult> LexiconFreeDecoder::getAllFinalHypothesis() const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
-  return getAllHypothesis(hyp_.find(finalFrame)->second, finalFrame);
+  return getAllHypothesis(hyp_[finalFrame], finalFrame);
 }
 
 DecodeResult LexiconFreeDecoder::getBestHypothesis(int lookBack) const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
   const LexiconFreeDecoderState* bestNode =
-      findBestAncestor(hyp_.find(finalFrame)->second, lookBack);
+      findBestAncestor(hyp_[finalFrame], lookBack);
 
   return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
 }
 
 int LexiconFreeDecoder::nHypothesis() const {
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
-  return hyp_.find(finalFrame)->second.size();
+  return hyp_[finalFrame].size();
 }
 
 int LexiconFreeDecoder::nDecodedFramesInBuffer() const {
@@ -213,7 +247,7 @@ void LexiconFreeDecoder::prune(int lookBack) {
   /* (1) Find the last emitted word in the best path */
   int finalFrame = nDecodedFrames_ - nPrunedFrames_;
   const LexiconFreeDecoderState* bestNode =
-      findBestAncestor(hyp_.find(finalFrame)->second, lookBack);
+      findBestAncestor(hyp_[finalFrame], lookBack);
   if (!bestNode) {
     return; // Not enough decoded frames to prune
   }
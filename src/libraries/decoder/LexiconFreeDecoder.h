@@ -106,9 +106,18 @@ class LexiconFreeDecoder : public Decoder {
   // so instead of moving around objects, we only need to sort pointers
   std::vector<LexiconFreeDecoderState*> candidatePtrs_;
 
+  // Recombines the candidates of the current frame
+  CandidateMerger<LexiconFreeDecoderState> merger_;
+
   // Best candidate score of current frame
   double candidatesBestScore_;
 
+  // Tokens tried in the current frame
+  std::vector<int> frameTokens_;
+
+  // Candidates of current frame waiting for their LM score
+  LMQueryBatch<LexiconFreeDecoderState> lmQueries_;
+
   // Index of silence label
   int sil_;
 
@@ -116,7 +125,7 @@ class LexiconFreeDecoder : public Decoder {
   int blank_;
 
   // Vector of hypothesis for all the frames so far
-  std::unordered_map<int, std::vector<LexiconFreeDecoderState>> hyp_;
+  HypothesisBuffer<LexiconFreeDecoderState> hyp_;
 
   // These 2 variables are used for online decoding, for hypothesis pruning
   int nDecodedFrames_; // Total number of decoded frames.
@@ -141,6 +150,12 @@ class LexiconFreeDecoder : public Decoder {
 
   // Merge hypothesis getting into same state from different path
   void mergeCandidates();
+
+  // Extend the hypotheses of `frame` with a blank only, into the next frame
+  void extendWithBlank(
+      const int frame,
+      const float blankScore,
+      const bool afterBlankFrame);
 };
 
 } // namespace w2l
@@ -14,6 +14,7 @@
 #include <cmath>
 #include <functional>
 #include <iostream>
+#include <stdexcept>
 
 #include "libraries/decoder/Seq2SeqDecoder.h"
 
@@ -26,32 +27,14 @@ void Seq2SeqDecoder::candidatesReset() {
 }
 
 void Seq2SeqDecoder::mergeCandidates() {
-  auto compareNodesShortList = [&](const Seq2SeqDecoderState* node1,
-                                   const Seq2SeqDecoderState* node2) {
-    int lmCmp = lm_->compareState(node1->lmState, node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else { /* same LmState */
-      return node1->score > node2->score;
-    }
+  auto hashNode = [&](const Seq2SeqDecoderState* node) {
+    return lm_->stateHash(node->lmState);
   };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (lm_->compareState(
-            candidatePtrs_[i]->lmState,
-            candidatePtrs_[nHypAfterMerging - 1]->lmState)) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  auto equalNodes = [&](const Seq2SeqDecoderState* node1,
+                        const Seq2SeqDecoderState* node2) {
+    return lm_->compareState(node1->lmState, node2->lmState) == 0;
+  };
+  merger_.merge(candidatePtrs_, hashNode, equalNodes, opt_.logAdd);
 }
 
 void Seq2SeqDecoder::candidatesAdd(
@@ -85,27 +68,83 @@ void Seq2SeqDecoder::candidatesStore(
   storeTopCandidates(nextHyp, candidatePtrs_, opt_.beamSize, isSort);
 }
 
-void Seq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
-  // Extend hyp_ buffer
-  if (hyp_.size() < maxOutputLength_ + 2) {
-    for (int i = hyp_.size(); i < maxOutputLength_ + 2; i++) {
-      hyp_.emplace(i, std::vector<Seq2SeqDecoderState>());
-    }
-  }
+void Seq2SeqDecoder::decodeBegin() {
+  resetHypothesis(hyp_);
+  extendHypothesis(hyp_, maxOutputLength_ + 2);
 
   // Start from here.
-  hyp_[0].clear();
   hyp_[0].emplace_back(lm_->start(0), nullptr, 0.0, -1, nullptr);
+  completedCandidates_.clear();
+  emissions_.clear();
+  nEmissionFrames_ = 0;
+  nTokens_ = 0;
+  nDecodedFrames_ = 0;
+  nPrunedFrames_ = 0;
+  finished_ = false;
+}
+
+void Seq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
+  if (nEmissionFrames_ > 0 && N != nTokens_) {
+    throw std::invalid_argument(
+        "[Seq2SeqDecoder] Emission size changed from " +
+        std::to_string(nTokens_) + " to " + std::to_string(N));
+  }
+  nTokens_ = N;
+  emissions_.insert(emissions_.end(), emissions, emissions + T * N);
+  nEmissionFrames_ += T;
+
+  if (framesPerStep_ > 0) {
+    int nSteps = std::min(nEmissionFrames_ / framesPerStep_, maxOutputLength_);
+    decodeOutputSteps(nSteps - nDecodedFrames_);
+  }
+}
+
+void Seq2SeqDecoder::decodeEnd() {
+  decodeOutputSteps(maxOutputLength_ - nDecodedFrames_);
+
+  auto compare = [](const Seq2SeqDecoderState& n1,
+                    const Seq2SeqDecoderState& n2) {
+    return n1.score > n2.score;
+  };
+  if (completedCandidates_.size() < opt_.beamSize) {
+    std::sort(
+        completedCandidates_.begin(), completedCandidates_.end(), compare);
+  }
+
+  auto& finalHyp = hyp_[finalFrame()];
+  if (completedCandidates_.size() > 0) {
+    finalHyp.resize(completedCandidates_.size());
+    for (int i = 0; i < completedCandidates_.size(); i++) {
+      finalHyp[i] = std::move(completedCandidates_[i]);
+    }
+  } else {
+    std::cout << "[WARNING] No completed candidates.\n";
+    int t = nDecodedFrames_ - nPrunedFrames_;
+    while (t > 0 && hyp_[t].empty()) {
+      --t;
+    }
+    finalHyp.resize(hyp_[t].size());
+    for (int i = 0; i < hyp_[t].size(); i++) {
+      finalHyp[i] = std::move(hyp_[t][i]);
+    }
+  }
+  finished_ = true;
+}
 
+void Seq2SeqDecoder::decodeOutputSteps(int nSteps) {
   auto compare = [](const Seq2SeqDecoderState& n1,
                     const Seq2SeqDecoderState& n2) {
     return n1.score > n2.score;
   };
-  completedCandidates_.resize(0);
 
-  // Decode frame by frame
-  int t = 0;
-  for (; t < maxOutputLength_; t++) {
+  // Attend to the frames received so far. The buffer only grows, so the AM can
+  // tell from (emissions, T) whether its encoded input is still up to date.
+  const int T = nEmissionFrames_;
+  const int N = nTokens_;
+
+  // Decode step by step
+  for (int step = 0; step < nSteps; step++) {
+    const int t = nDecodedFrames_ - nPrunedFrames_;
     candidatesReset();
 
     // Batch forwarding
@@ -135,8 +174,9 @@ void Seq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
     std::vector<std::vector<float>> amScores;
     std::vector<AMStatePtr> outStates;
 
+    int amStep = nDecodedFrames_;
     std::tie(amScores, outStates) =
-        amUpdateFunc_(emissions, N, T, rawY_, rawPrevStates_, t);
+        amUpdateFunc_(emissions_.data(), N, T, rawY_, rawPrevStates_, amStep);
 
     // Generate new hypothesis
     for (int hypo = 0, validHypo = 0; hypo < hyp_[t].size(); hypo++) {
@@ -189,6 +229,7 @@ void Seq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
     }
     candidatesStore(hyp_[t + 1], true);
     updateLMCache(lm_, hyp_[t + 1]);
+    ++nDecodedFrames_;
 
     // Sort completed candidates if necessary
     if (completedCandidates_.size() >= opt_.beamSize) {
@@ -200,45 +241,75 @@ void Seq2SeqDecoder::decodeStep(const float* emissions, int T, int N) {
       completedCandidates_.resize(opt_.beamSize);
     }
   } // End of decoding
+}
 
-  if (completedCandidates_.size() < opt_.beamSize) {
-    std::sort(
-        completedCandidates_.begin(), completedCandidates_.end(), compare);
+std::vector<DecodeResult> Seq2SeqDecoder::getAllFinalHypothesis() const {
+  if (!finished_) {
+    return std::vector<DecodeResult>{};
   }
+  return getAllHypothesis(hyp_[finalFrame()], finalFrame() + 1);
+}
 
-  if (completedCandidates_.size() > 0) {
-    hyp_[maxOutputLength_ + 1].resize(completedCandidates_.size());
-    for (int i = 0; i < completedCandidates_.size(); i++) {
-      hyp_[maxOutputLength_ + 1][i] = std::move(completedCandidates_[i]);
-    }
-  } else {
-    std::cout << "[WARNING] No completed candidates.\n";
-    while (t > 0 && hyp_[t].empty()) {
-      --t;
-    }
-    hyp_[maxOutputLength_ + 1].resize(hyp_[t].size());
-    for (int i = 0; i < hyp_[t].size(); i++) {
-      hyp_[maxOutputLength_ + 1][i] = std::move(hyp_[t][i]);
-    }
+DecodeResult Seq2SeqDecoder::getBestHypothesis(int lookBack) const {
+  if (finished_) {
+    return getHypothesis(hyp_[finalFrame()].data(), finalFrame() + 1);
+  }
+  if (nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return DecodeResult();
   }
-}
 
-std::vector<DecodeResult> Seq2SeqDecoder::getAllFinalHypothesis() const {
-  return getAllHypothesis(hyp_.find(maxOutputLength_ + 1)->second, hyp_.size());
+  const Seq2SeqDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  return getHypothesis(bestNode, nDecodedFrames_ - nPrunedFrames_ - lookBack);
 }
 
-DecodeResult Seq2SeqDecoder::getBestHypothesis(int /* unused */) const {
-  return getHypothesis(
-      hyp_.find(maxOutputLength_ + 1)->second.data(), hyp_.size());
-}
+void Seq2SeqDecoder::prune(int lookBack) {
+  if (finished_ || nDecodedFrames_ - nPrunedFrames_ - lookBack < 1) {
+    return; // Not enough decoded frames to prune
+  }
+
+  /* (1) Find the last emitted word in the best path */
+  const Seq2SeqDecoderState* bestNode =
+      findBestAncestor(hyp_[nDecodedFrames_ - nPrunedFrames_], lookBack);
+  if (!bestNode) {
+    return; // Not enough decoded frames to prune
+  }
+
+  int startFrame = nDecodedFrames_ - nPrunedFrames_ - lookBack;
+  if (startFrame < 1) {
+    return; // Not enough decoded frames to prune
+  }
+
+  /* (2) Cut the completed hypotheses at the same frame as those of the beam:
+   * they can't point into the frames about to be recycled, and their scores
+   * are normalized with the same offset. */
+  const int lastFrame = nDecodedFrames_ - nPrunedFrames_;
+  double largestScore = hyp_[lastFrame].front().score;
+  for (const auto& hyp : hyp_[lastFrame]) {
+    largestScore = std::max(largestScore, hyp.score);
+  }
+  std::less<const Seq2SeqDecoderState*> before;
+  for (auto& completed : completedCandidates_) {
+    bool kept = false;
+    for (int t = startFrame; t <= lastFrame && !kept; t++) {
+      const auto& frame = hyp_[t];
+      kept = !frame.empty() && !before(completed.parent, frame.data()) &&
+          before(completed.parent, frame.data() + frame.size());
+    }
+    if (!kept) {
+      completed.parent = nullptr;
+    }
+    completed.score -= largestScore;
+  }
+
+  /* (3) Move things from back of hyp_ to front and normalize scores */
+  pruneAndNormalize(hyp_, startFrame, lookBack);
 
-void Seq2SeqDecoder::prune(int /* unused */) {
-  return;
+  nPrunedFrames_ = nDecodedFrames_ - lookBack;
 }
 
 int Seq2SeqDecoder::nDecodedFramesInBuffer() const {
-  /* unused function */
-  return -1;
+  return nDecodedFrames_ - nPrunedFrames_ + 1;
 }
 
 } // namespace w2l
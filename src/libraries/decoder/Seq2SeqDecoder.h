@@ -57,6 +57,10 @@ struct Seq2SeqDecoderState {
   int getWord() const {
     return -1;
   }
+
+  bool isComplete() const {
+    return true;
+  }
 };
 
 /**
@@ -68,8 +72,21 @@ struct Seq2SeqDecoderState {
  * where P_{lm}(W) is the language model score. Note that the transcription is
  * made up of word-pieces, no real `word` is included.
  *
- * TODO: Doesn't support online decoding now.
+ * Here a "frame" of the hypothesis buffer is an output step, not an input
+ * frame. Emissions given to decodeStep() are buffered and the whole search
+ * runs in decodeEnd(), unless online decoding is enabled with a positive
+ * `framesPerStep`: each decodeStep() then advances the beam by one output step
+ * per `framesPerStep` input frames received so far, attending to those frames
+ * only. As offline, hypotheses may end with eos at any step, and those which
+ * ended while more input was to come compete with the others in decodeEnd().
+ * Partial results are available with getBestHypothesis(lookBack) and the
+ * buffer can be pruned with prune(lookBack), as for LexiconDecoder. Pruning
+ * also drops the history of the completed hypotheses before the pruned frame.
  *
+ * Limitation: amUpdateFunc always receives the whole buffer of input frames,
+ * which the AM of buildAmUpdateFunction() copies to the device again whenever
+ * it grew. An utterance received in many small chunks thus costs O(T^2) in
+ * copies, on top of the attention over all the frames at every output step.
  */
 class Seq2SeqDecoder : public Decoder {
  public:
@@ -80,17 +97,23 @@ class Seq2SeqDecoder : public Decoder {
       AMUpdateFunc amUpdateFunc,
       const int maxOutputLength,
       const float hardSelection,
-      const float softSelection)
+      const float softSelection,
+      const int framesPerStep = 0)
       : Decoder(opt),
         lm_(lm),
         eos_(eos),
         amUpdateFunc_(amUpdateFunc),
         maxOutputLength_(maxOutputLength),
         hardSelection_(hardSelection),
-        softSelection_(softSelection) {}
+        softSelection_(softSelection),
+        framesPerStep_(framesPerStep) {}
+
+  void decodeBegin() override;
 
   void decodeStep(const float* emissions, int T, int N) override;
 
+  void decodeEnd() override;
+
   void prune(int lookBack = 0) override;
 
   int nDecodedFramesInBuffer() const override;
@@ -108,12 +131,24 @@ class Seq2SeqDecoder : public Decoder {
   int maxOutputLength_;
   float hardSelection_;
   float softSelection_;
+  int framesPerStep_;
+
+  // Input frames received so far
+  std::vector<float> emissions_;
+  int nEmissionFrames_;
+  int nTokens_;
+
+  // These 2 variables are used for online decoding, for hypothesis pruning
+  int nDecodedFrames_; // Total number of decoded output steps.
+  int nPrunedFrames_; // Total number of pruned output steps from hyp_.
+  bool finished_; // If final hypothesis are in `hyp_`
 
   std::vector<Seq2SeqDecoderState> candidates_;
   std::vector<Seq2SeqDecoderState*> candidatePtrs_;
+  CandidateMerger<Seq2SeqDecoderState> merger_;
   double candidatesBestScore_;
 
-  std::unordered_map<int, std::vector<Seq2SeqDecoderState>> hyp_;
+  HypothesisBuffer<Seq2SeqDecoderState> hyp_;
 
   std::vector<Seq2SeqDecoderState> completedCandidates_;
 
@@ -131,6 +166,14 @@ class Seq2SeqDecoder : public Decoder {
       const bool isSort);
 
   void mergeCandidates();
+
+  // Run up to `nSteps` output steps
+  void decodeOutputSteps(int nSteps);
+
+  // Index in `hyp_` of the final hypothesis
+  int finalFrame() const {
+    return maxOutputLength_ + 1 - nPrunedFrames_;
+  }
 };
 
 } // namespace w2l
@@ -20,55 +20,50 @@
 namespace w2l {
 
 void TokenLMDecoder::mergeCandidates() {
-  auto compareNodesShortList = [&](const LexiconDecoderState* node1,
-                                   const LexiconDecoderState* node2) {
-    int lmCmp = lm_->compareState(node1->lmState, node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else { /* same LmState */
-      return node1->score > node2->score;
-    }
+  auto hashNode = [&](const LexiconDecoderState* node) {
+    return lm_->stateHash(node->lmState);
   };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (lm_->compareState(
-            candidatePtrs_[i]->lmState,
-            candidatePtrs_[nHypAfterMerging - 1]->lmState)) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  auto equalNodes = [&](const LexiconDecoderState* node1,
+                        const LexiconDecoderState* node2) {
+    return lm_->compareState(node1->lmState, node2->lmState) == 0;
+  };
+  merger_.merge(candidatePtrs_, hashNode, equalNodes, opt_.logAdd);
 }
 
 void TokenLMDecoder::decodeStep(const float* emissions, int T, int N) {
   int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
-  if (hyp_.size() < startFrame + T + 2) {
-    for (int i = hyp_.size(); i < startFrame + T + 2; i++) {
-      hyp_.emplace(i, std::vector<LexiconDecoderState>());
-    }
-  }
+  extendHypothesis(hyp_, startFrame + T + 2);
 
   // Looping over all the frames
+  bool afterBlankFrame = false;
   for (int t = 0; t < T; t++) {
+    // Frames confidently emitting blank only extend hypotheses with blank
+    if (opt_.criterionType == CriterionType::CTC &&
+        isBlankFrame(emissions + t * N, N, blank_, opt_.blankSkipThreshold)) {
+      extendWithBlank(
+          startFrame + t, emissions[t * N + blank_], afterBlankFrame);
+      afterBlankFrame = true;
+      continue;
+    }
+    afterBlankFrame = false;
+
+    const float minEmission =
+        tokenPruningThreshold(emissions + t * N, N, opt_.tokenMargin);
     candidatesReset();
     for (const LexiconDecoderState& prevHyp : hyp_[startFrame + t]) {
       const LMStatePtr& prevLmState = prevHyp.lmState;
-      const TrieNode* prevLex = prevHyp.lex;
-      const int prevIdx = prevLex->idx;
+      const int prevLex = prevHyp.lex;
+      const int prevIdx = lexicon_->getToken(prevLex);
 
       /* (1) Try children */
-      for (auto& child : prevLex->children) {
-        int n = child.first;
-        const TrieNode* lex = child.second.get();
+      for (int lex = lexicon_->childBegin(prevLex);
+           lex < lexicon_->childEnd(prevLex);
+           ++lex) {
+        int n = lexicon_->getToken(lex);
+        if (emissions[t * N + n] < minEmission) {
+          continue;
+        }
         double score = prevHyp.score + emissions[t * N + n];
         if (nDecodedFrames_ + t > 0 &&
             opt_.criterionType == CriterionType::ASG) {
@@ -78,50 +73,18 @@ void TokenLMDecoder::decodeStep(const float* emissions, int T, int N) {
           score += opt_.silWeight;
         }
 
-        auto lmScoreReturn = lm_->score(prevLmState, n);
-        score += lmScoreReturn.second * opt_.lmWeight;
-
-        // We eat-up a new token
-        if (opt_.criterionType != CriterionType::CTC || prevHyp.prevBlank ||
-            n != prevIdx) {
-          if (!lex->children.empty()) {
-            candidatesAdd(
-                lmScoreReturn.first,
+        lmQueries_.add(
+            prevLmState,
+            n,
+            LexiconDecoderState(
+                nullptr,
                 lex,
                 &prevHyp,
                 score,
                 n,
                 -1,
                 false // prevBlank
-            );
-          }
-        }
-
-        // If we got a true word
-        for (auto label : lex->labels) {
-          candidatesAdd(
-              lmScoreReturn.first,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.wordScore,
-              n,
-              label,
-              false // prevBlank
-          );
-        }
-
-        // If we got an unknown word and we want to emit
-        if (lex->labels.empty() && (opt_.unkScore > kNegativeInfinity)) {
-          candidatesAdd(
-              lmScoreReturn.first,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.unkScore,
-              n,
-              unk_,
-              false // prevBlank
-          );
-        }
+                ));
       }
 
       /* (2) Try same lexicon node */
@@ -163,6 +126,63 @@ void TokenLMDecoder::decodeStep(const float* emissions, int T, int N) {
       }
     }
 
+    // Score the tokens proposed in this frame at once, then extend words
+    lmQueries_.score(lm_);
+    for (int k = 0; k < lmQueries_.size(); k++) {
+      const LexiconDecoderState& candidate = lmQueries_.candidates[k];
+      const LexiconDecoderState& prevHyp = *candidate.parent;
+      const int prevIdx = lexicon_->getToken(prevHyp.lex);
+      const int lex = candidate.lex;
+      const int n = candidate.token;
+      double score =
+          candidate.score + lmQueries_.outScores[k] * opt_.lmWeight;
+
+      // We eat-up a new token
+      if (opt_.criterionType != CriterionType::CTC || prevHyp.prevBlank ||
+          n != prevIdx) {
+        if (lexicon_->hasChildren(lex)) {
+          candidatesAdd(
+              candidate.lmState,
+              lex,
+              &prevHyp,
+              score,
+              n,
+              -1,
+              false // prevBlank
+          );
+        }
+      }
+
+      // If we got a true word
+      for (int i = lexicon_->labelBegin(lex); i < lexicon_->labelEnd(lex);
+           ++i) {
+        int label = lexicon_->getLabel(i);
+        candidatesAdd(
+            candidate.lmState,
+            lexicon_->getRoot(),
+            &prevHyp,
+            score + opt_.wordScore,
+            n,
+            label,
+            false // prevBlank
+        );
+      }
+
+      // If we got an unknown word and we want to emit
+      if (lexicon_->labelBegin(lex) == lexicon_->labelEnd(lex) &&
+          (opt_.unkScore > kNegativeInfinity)) {
+        candidatesAdd(
+            candidate.lmState,
+            lexicon_->getRoot(),
+            &prevHyp,
+            score + opt_.unkScore,
+            n,
+            unk_,
+            false // prevBlank
+        );
+      }
+    }
+
     candidatesStore(hyp_[startFrame + t + 1], false);
     updateLMCache(lm_, hyp_[startFrame + t + 1]);
   }
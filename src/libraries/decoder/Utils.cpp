@@ -21,4 +21,34 @@ bool isValidCandidate(
   return score >= bestScore - beamThreshold;
 }
 
+bool isBlankFrame(
+    const float* emissions,
+    const int N,
+    const int blank,
+    const float threshold) {
+  if (threshold <= 0 || blank < 0) {
+    return false;
+  }
+  float maxScore = emissions[0];
+  for (int n = 1; n < N; n++) {
+    maxScore = std::max(maxScore, emissions[n]);
+  }
+  // Emissions may not be normalized
+  double sum = 0;
+  for (int n = 0; n < N; n++) {
+    sum += std::exp(emissions[n] - maxScore);
+  }
+  return std::exp(emissions[blank] - maxScore) > threshold * sum;
+}
+
+float tokenPruningThreshold(
+    const float* emissions,
+    const int N,
+    const float margin) {
+  if (margin <= 0) {
+    return kNegativeInfinity;
+  }
+  return *std::max_element(emissions, emissions + N) - margin;
+}
+
 } // namespace w2l
@@ -8,9 +8,11 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <algorithm>
 #include <cmath>
-#include <unordered_map>
+#include <limits>
+#include <utility>
 #include <vector>
 
 #include "libraries/lm/LM.h"
@@ -32,6 +34,12 @@ struct DecoderOptions {
   bool logAdd; // If or not use logadd when merging hypothesis
   float silWeight; // Silence is golden
   CriterionType criterionType; // CTC or ASG
+  // CTC frames where blank has a larger posterior only extend hypotheses with
+  // blank (0 to disable)
+  float blankSkipThreshold;
+  // Tokens whose emission is lower than the best one of the frame by more
+  // than this margin are not tried (0 to disable)
+  float tokenMargin;
 
   DecoderOptions(
       const int beamSize,
@@ -42,7 +50,9 @@ struct DecoderOptions {
       const float unkScore,
       const bool logAdd,
       const float silWeight,
-      const CriterionType criterionType)
+      const CriterionType criterionType,
+      const float blankSkipThreshold = 0,
+      const float tokenMargin = 0)
       : beamSize(beamSize),
         beamSizeToken(beamSizeToken),
         beamThreshold(beamThreshold),
@@ -51,9 +61,11 @@ struct DecoderOptions {
         unkScore(unkScore),
         logAdd(logAdd),
         silWeight(silWeight),
-        criterionType(criterionType) {}
+        criterionType(criterionType),
+        blankSkipThreshold(blankSkipThreshold),
+        tokenMargin(tokenMargin) {}
 
-  DecoderOptions() {}
+  DecoderOptions() : blankSkipThreshold(0), tokenMargin(0) {}
 };
 
 struct DecodeResult {
@@ -84,6 +96,102 @@ bool isValidCandidate(
     const double score,
     const double beamThreshold);
 
+/**
+ * Returns whether the posterior of `blank` in the `N` emissions of a CTC frame
+ * is above `threshold` (never if `threshold` is 0).
+ */
+bool isBlankFrame(
+    const float* emissions,
+    const int N,
+    const int blank,
+    const float threshold);
+
+/**
+ * Returns the emission below which the tokens of a frame are not tried, that
+ * is `margin` below its best one (-infinity if `margin` is 0).
+ */
+float tokenPruningThreshold(
+    const float* emissions,
+    const int N,
+    const float margin);
+
+inline size_t hashCombine(size_t seed, size_t value) {
+  return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+/**
+ * CandidateMerger recombines the candidates of a frame which reach the same
+ * decoder state through different paths: the best scoring one is kept and
+ * the scores of the others are merged into it (see mergeStates()). Candidates
+ * are looked up by hash in an open-addressed table sized for the frame, so
+ * that `equal`, which usually compares LM states, only runs on hash matches
+ * and merging is linear in the number of candidates. Merged candidates keep
+ * the order in which their state is first seen. Buffers keep their storage
+ * across frames.
+ */
+template <class DecoderState>
+class CandidateMerger {
+ public:
+  /**
+   * `hash(node)` and `equal(node1, node2)` define the decoder state:
+   * candidates which are equal must have the same hash.
+   */
+  template <class Hash, class Equal>
+  void merge(
+      std::vector<DecoderState*>& candidatePtrs,
+      const Hash& hash,
+      const Equal& equal,
+      const bool logAdd) {
+    const int nCandidates = candidatePtrs.size();
+    int shift = 63;
+    while ((uint64_t(1) << (64 - shift)) < 2 * uint64_t(nCandidates)) {
+      shift--;
+    }
+    const size_t mask = (uint64_t(1) << (64 - shift)) - 1;
+    table_.assign(mask + 1, -1);
+    hashes_.resize(nCandidates);
+    bestScores_.resize(nCandidates);
+
+    int nHypAfterMerging = 0;
+    for (int i = 0; i < nCandidates; i++) {
+      DecoderState* node = candidatePtrs[i];
+      const size_t nodeHash = hash(node);
+      // Fibonacci hashing spreads the high bits of the hash over the table
+      size_t slot =
+          (static_cast<uint64_t>(nodeHash) * 0x9e3779b97f4a7c15ULL) >> shift;
+      while (true) {
+        const int merged = table_[slot];
+        if (merged < 0) {
+          table_[slot] = nHypAfterMerging;
+          hashes_[nHypAfterMerging] = nodeHash;
+          bestScores_[nHypAfterMerging] = node->score;
+          candidatePtrs[nHypAfterMerging++] = node;
+          break;
+        }
+        if (hashes_[merged] == nodeHash && equal(candidatePtrs[merged], node)) {
+          // The best path of a state gives its parent and token
+          if (node->score > bestScores_[merged]) {
+            bestScores_[merged] = node->score;
+            std::swap(candidatePtrs[merged], node);
+          }
+          mergeStates(candidatePtrs[merged], node, logAdd);
+          break;
+        }
+        slot = (slot + 1) & mask;
+      }
+    }
+    candidatePtrs.resize(nHypAfterMerging);
+  }
+
+ private:
+  // Index in the merged candidates of each slot, -1 if empty
+  std::vector<int> table_;
+  // Hash of each merged candidate
+  std::vector<size_t> hashes_;
+  // Score of the best path merged into each merged candidate
+  std::vector<double> bestScores_;
+};
+
 template <class DecoderState>
 void pruneCandidates(
     std::vector<DecoderState*>& candidatePtrs,
@@ -209,12 +317,40 @@ const DecoderState* findBestAncestor(
   return bestNode;
 }
 
+/**
+ * The hypothesis buffer of a decoder is indexed by frame. Frames are never
+ * deallocated: clearing a frame keeps its storage around so that it can be
+ * reused by later frames and utterances. This only covers the hypotheses
+ * themselves: the LM states they hold are still LMStatePtr, allocated by the
+ * LM and reference counted by every hypothesis and candidate sharing them.
+ */
+template <class DecoderState>
+using HypothesisBuffer = std::vector<std::vector<DecoderState>>;
+
+template <class DecoderState>
+void resetHypothesis(HypothesisBuffer<DecoderState>& hypothesis) {
+  for (auto& frame : hypothesis) {
+    frame.clear();
+  }
+  if (hypothesis.empty()) {
+    hypothesis.resize(1);
+  }
+}
+
+template <class DecoderState>
+void extendHypothesis(HypothesisBuffer<DecoderState>& hypothesis, int size) {
+  if (hypothesis.size() < size) {
+    hypothesis.resize(size);
+  }
+}
+
 template <class DecoderState>
 void pruneAndNormalize(
-    std::unordered_map<int, std::vector<DecoderState>>& hypothesis,
+    HypothesisBuffer<DecoderState>& hypothesis,
     const int startFrame,
     const int lookBack) {
-  // (1) Move things from back of hypothesis to front.
+  // (1) Move things from back of hypothesis to front. Swapping only exchanges
+  // the frame storage, so the frames left behind are recycled in O(1).
   for (int i = 0; i <= lookBack; i++) {
     std::swap(hypothesis[i], hypothesis[i + startFrame]);
   }
@@ -238,6 +374,24 @@ void pruneAndNormalize(
   }
 }
 
+/**
+ * Extends each hypothesis with a blank of emission `blankScore`, for a frame
+ * following one where hypotheses were only extended with blank: they all end
+ * with a blank already, so none of them merge and their LM states don't
+ * change.
+ */
+template <class DecoderState>
+void propagateBlank(
+    const std::vector<DecoderState>& prevHyp,
+    std::vector<DecoderState>& nextHyp,
+    const double blankScore) {
+  nextHyp.assign(prevHyp.begin(), prevHyp.end());
+  for (int i = 0; i < nextHyp.size(); i++) {
+    nextHyp[i].parent = &prevHyp[i];
+    nextHyp[i].score += blankScore;
+  }
+}
+
 template <class DecoderState>
 void updateLMCache(const LMPtr& lm, std::vector<DecoderState>& hypothesis) {
   // For ConvLM update cache
@@ -248,4 +402,47 @@ void updateLMCache(const LMPtr& lm, std::vector<DecoderState>& hypothesis) {
   lm->updateCache(states);
 }
 
+/**
+ * LMQueryBatch gathers the language model queries issued while proposing the
+ * candidates of one frame, so that they are scored by a single call to
+ * LM::scoreBatch(). Each query comes with the candidate it completes, whose
+ * LM state is filled in once the batch is scored. Buffers keep their storage
+ * across frames.
+ */
+template <class DecoderState>
+struct LMQueryBatch {
+  std::vector<LMStatePtr> states;
+  std::vector<int> tokens;
+  std::vector<DecoderState> candidates;
+  std::vector<LMStatePtr> outStates;
+  std::vector<float> outScores;
+
+  void clear() {
+    states.clear();
+    tokens.clear();
+    candidates.clear();
+    outStates.clear();
+    outScores.clear();
+  }
+
+  void add(const LMStatePtr& state, int token, DecoderState&& candidate) {
+    states.push_back(state);
+    tokens.push_back(token);
+    candidates.push_back(std::move(candidate));
+  }
+
+  int size() const {
+    return candidates.size();
+  }
+
+  void score(const LMPtr& lm) {
+    if (!candidates.empty()) {
+      lm->scoreBatch(states, tokens, outStates, outScores);
+    }
+    for (int i = 0; i < candidates.size(); i++) {
+      candidates[i].lmState = std::move(outStates[i]);
+    }
+  }
+};
+
 } // namespace w2l
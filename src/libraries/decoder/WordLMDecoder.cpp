@@ -13,7 +13,6 @@
 #include <algorithm>
 #include <cmath>
 #include <functional>
-#include <numeric>
 #include <unordered_map>
 
 #include "libraries/decoder/WordLMDecoder.h"
@@ -21,66 +20,55 @@
 namespace w2l {
 
 void WordLMDecoder::mergeCandidates() {
-  auto compareNodesShortList = [&](const LexiconDecoderState* node1,
-                                   const LexiconDecoderState* node2) {
-    int lmCmp = lm_->compareState(node1->lmState, node2->lmState);
-    if (lmCmp != 0) {
-      return lmCmp > 0;
-    } else if (node1->lex != node2->lex) {
-      /* same LmState */
-      return node1->lex > node2->lex;
-    } else if (node1->word != node2->word) {
-      return node1->word > node2->word;
-    } else if (node1->token != node2->token) {
-      return node1->token > node2->token;
-    } else if (node1->prevBlank != node2->prevBlank) {
-      return node1->prevBlank > node2->prevBlank;
-    } else {
-      /* same LmState, same lex */
-      return node1->score > node2->score;
-    }
+  auto hashNode = [&](const LexiconDecoderState* node) {
+    size_t hash = lm_->stateHash(node->lmState);
+    hash = hashCombine(hash, node->lex);
+    hash = hashCombine(hash, node->word);
+    hash = hashCombine(hash, node->token);
+    return hashCombine(hash, node->prevBlank);
   };
-  std::sort(
-      candidatePtrs_.begin(), candidatePtrs_.end(), compareNodesShortList);
-
-  int nHypAfterMerging = 1;
-  for (int i = 1; i < candidatePtrs_.size(); i++) {
-    if (lm_->compareState(
-            candidatePtrs_[i]->lmState,
-            candidatePtrs_[nHypAfterMerging - 1]->lmState) ||
-        candidatePtrs_[i]->lex != candidatePtrs_[nHypAfterMerging - 1]->lex ||
-        candidatePtrs_[i]->word != candidatePtrs_[nHypAfterMerging - 1]->word ||
-        candidatePtrs_[i]->token !=
-            candidatePtrs_[nHypAfterMerging - 1]->token ||
-        candidatePtrs_[i]->prevBlank !=
-            candidatePtrs_[nHypAfterMerging - 1]->prevBlank) {
-      candidatePtrs_[nHypAfterMerging] = candidatePtrs_[i];
-      nHypAfterMerging++;
-    } else {
-      mergeStates(
-          candidatePtrs_[nHypAfterMerging - 1], candidatePtrs_[i], opt_.logAdd);
-    }
-  }
-
-  candidatePtrs_.resize(nHypAfterMerging);
+  auto equalNodes = [&](const LexiconDecoderState* node1,
+                        const LexiconDecoderState* node2) {
+    return node1->lex == node2->lex && node1->word == node2->word &&
+        node1->token == node2->token && node1->prevBlank == node2->prevBlank &&
+        lm_->compareState(node1->lmState, node2->lmState) == 0;
+  };
+  merger_.merge(candidatePtrs_, hashNode, equalNodes, opt_.logAdd);
 }
 
 void WordLMDecoder::decodeStep(const float* emissions, int T, int N) {
   int startFrame = nDecodedFrames_ - nPrunedFrames_;
   // Extend hyp_ buffer
-  if (hyp_.size() < startFrame + T + 2) {
-    for (int i = hyp_.size(); i < startFrame + T + 2; i++) {
-      hyp_.emplace(i, std::vector<LexiconDecoderState>());
-    }
-  }
+  extendHypothesis(hyp_, startFrame + T + 2);
 
-  std::vector<size_t> idx(N);
+  std::vector<size_t> idx;
+  idx.reserve(N);
+  bool afterBlankFrame = false;
   for (int t = 0; t < T; t++) {
-    std::iota(idx.begin(), idx.end(), 0);
-    if (N > opt_.beamSizeToken) {
+    // Frames confidently emitting blank only extend hypotheses with blank
+    if (opt_.criterionType == CriterionType::CTC &&
+        isBlankFrame(emissions + t * N, N, blank_, opt_.blankSkipThreshold)) {
+      extendWithBlank(
+          startFrame + t, emissions[t * N + blank_], afterBlankFrame);
+      afterBlankFrame = true;
+      continue;
+    }
+    afterBlankFrame = false;
+
+    // Tokens of the frame worth trying, only the best ones are sorted
+    const float minEmission =
+        tokenPruningThreshold(emissions + t * N, N, opt_.tokenMargin);
+    idx.clear();
+    for (int n = 0; n < N; n++) {
+      if (emissions[t * N + n] >= minEmission) {
+        idx.push_back(n);
+      }
+    }
+    const int nTokens = std::min<int>(opt_.beamSizeToken, idx.size());
+    if (idx.size() > nTokens) {
       std::partial_sort(
           idx.begin(),
-          idx.begin() + opt_.beamSizeToken,
+          idx.begin() + nTokens,
           idx.end(),
           [&t, &N, &emissions](const size_t& l, const size_t& r) {
             return emissions[t * N + l] > emissions[t * N + r];
@@ -89,20 +77,20 @@ void WordLMDecoder::decodeStep(const float* emissions, int T, int N) {
 
     candidatesReset();
     for (const LexiconDecoderState& prevHyp : hyp_[startFrame + t]) {
-      const TrieNode* prevLex = prevHyp.lex;
+      const int prevLex = prevHyp.lex;
       const int prevIdx = prevHyp.token;
-      const float lexMaxScore =
-          prevLex == lexicon_->getRoot() ? 0 : prevLex->maxScore;
+      const float lexMaxScore = prevLex == lexicon_->getRoot()
+          ? 0
+          : lexicon_->getMaxScore(prevLex);
       const LMStatePtr& prevLmState = prevHyp.lmState;
 
       /* (1) Try children */
-      for (int r = 0; r < std::min(opt_.beamSizeToken, N); ++r) {
+      for (int r = 0; r < nTokens; ++r) {
         int n = idx[r];
-        auto iter = prevLex->children.find(n);
-        if (iter == prevLex->children.end()) {
+        const int lex = lexicon_->getChild(prevLex, n);
+        if (lex < 0) {
           continue;
         }
-        const TrieNodePtr& lex = iter->second;
         double score = prevHyp.score + emissions[t * N + n];
         if (nDecodedFrames_ + t > 0 &&
             opt_.criterionType == CriterionType::ASG) {
@@ -115,12 +103,13 @@ void WordLMDecoder::decodeStep(const float* emissions, int T, int N) {
         // We eat-up a new token
         if (opt_.criterionType != CriterionType::CTC || prevHyp.prevBlank ||
             n != prevIdx) {
-          if (!lex->children.empty()) {
+          if (lexicon_->hasChildren(lex)) {
             candidatesAdd(
                 prevLmState,
-                lex.get(),
+                lex,
                 &prevHyp,
-                score + opt_.lmWeight * (lex->maxScore - lexMaxScore),
+                score +
+                    opt_.lmWeight * (lexicon_->getMaxScore(lex) - lexMaxScore),
                 n,
                 -1,
                 false // prevBlank
@@ -129,33 +118,38 @@ void WordLMDecoder::decodeStep(const float* emissions, int T, int N) {
         }
 
         // If we got a true word
-        for (auto label : lex->labels) {
-          auto lmScoreReturn = lm_->score(prevLmState, label);
-          candidatesAdd(
-              lmScoreReturn.first,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.lmWeight * (lmScoreReturn.second - lexMaxScore) +
-                  opt_.wordScore,
-              n,
+        for (int i = lexicon_->labelBegin(lex); i < lexicon_->labelEnd(lex);
+             ++i) {
+          int label = lexicon_->getLabel(i);
+          lmQueries_.add(
+              prevLmState,
               label,
-              false // prevBlank
-          );
+              LexiconDecoderState(
+                  nullptr,
+                  lexicon_->getRoot(),
+                  &prevHyp,
+                  score - opt_.lmWeight * lexMaxScore + opt_.wordScore,
+                  n,
+                  label,
+                  false // prevBlank
+                  ));
         }
 
         // If we got an unknown word
-        if (lex->labels.empty() && (opt_.unkScore > kNegativeInfinity)) {
-          auto lmScoreReturn = lm_->score(prevLmState, unk_);
-          candidatesAdd(
-              lmScoreReturn.first,
-              lexicon_->getRoot(),
-              &prevHyp,
-              score + opt_.lmWeight * (lmScoreReturn.second - lexMaxScore) +
-                  opt_.unkScore,
-              n,
+        if (lexicon_->labelBegin(lex) == lexicon_->labelEnd(lex) &&
+            (opt_.unkScore > kNegativeInfinity)) {
+          lmQueries_.add(
+              prevLmState,
               unk_,
-              false // prevBlank
-          );
+              LexiconDecoderState(
+                  nullptr,
+                  lexicon_->getRoot(),
+                  &prevHyp,
+                  score - opt_.lmWeight * lexMaxScore + opt_.unkScore,
+                  n,
+                  unk_,
+                  false // prevBlank
+                  ));
         }
       }
 
@@ -199,6 +193,20 @@ void WordLMDecoder::decodeStep(const float* emissions, int T, int N) {
       // finish proposing
     }
 
+    /* Score all the words completed in this frame at once */
+    lmQueries_.score(lm_);
+    for (int i = 0; i < lmQueries_.size(); i++) {
+      const LexiconDecoderState& candidate = lmQueries_.candidates[i];
+      candidatesAdd(
+          candidate.lmState,
+          candidate.lex,
+          candidate.parent,
+          candidate.score + opt_.lmWeight * lmQueries_.outScores[i],
+          candidate.token,
+          candidate.word,
+          candidate.prevBlank);
+    }
+
     candidatesStore(hyp_[startFrame + t + 1], false);
     updateLMCache(lm_, hyp_[startFrame + t + 1]);
   }
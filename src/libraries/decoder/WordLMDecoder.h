@@ -18,15 +18,7 @@ namespace w2l {
 
 class WordLMDecoder : public LexiconDecoder {
  public:
-  WordLMDecoder(
-      const DecoderOptions& opt,
-      const TriePtr& lexicon,
-      const LMPtr& lm,
-      const int sil,
-      const int blank,
-      const int unk,
-      const std::vector<float>& transitions)
-      : LexiconDecoder(opt, lexicon, lm, sil, blank, unk, transitions) {}
+  using LexiconDecoder::LexiconDecoder;
 
   void decodeStep(const float* emissions, int T, int N) override;
 
@@ -72,18 +72,13 @@ std::vector<T> Derivatives<T>::computeDerivative(
     int64_t windowlen,
     int64_t numfeat) const {
   int64_t numframes = input.size() / numfeat;
-  std::vector<T> output(input.size(), 0.0);
-  T denominator = (windowlen * (windowlen + 1) * (2 * windowlen + 1)) / 3.0;
-  for (size_t i = 0; i < numframes; ++i) {
-    for (size_t j = 0; j < numfeat; ++j) {
-      size_t curIdx = i * numfeat + j;
-      for (size_t d = 1; d <= windowlen; ++d) {
-        output[curIdx] += d *
-            (input[curIdx + std::min((numframes - i - 1), d) * numfeat] -
-             input[curIdx - std::min(i, d) * numfeat]);
-      }
-      output[curIdx] /= denominator;
-    }
+  std::vector<T> output(input.size());
+  auto frame = [&input, numfeat](int64_t k) {
+    return input.data() + k * numfeat;
+  };
+  for (int64_t i = 0; i < numframes; ++i) {
+    computeFrameDerivative(
+        frame, i, numframes, windowlen, numfeat, output.data() + i * numfeat);
   }
   return output;
 }
@@ -9,6 +9,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <algorithm>
 #include <vector>
 
 namespace w2l {
@@ -25,6 +26,37 @@ class Derivatives {
 
   std::vector<T> apply(const std::vector<T>& input, int64_t numfeat) const;
 
+  int64_t deltaWindow() const {
+    return deltaWindow_;
+  }
+
+  int64_t accWindow() const {
+    return accWindow_;
+  }
+
+  // Computes the derivative of frame `i` of an utterance of `numframes` frames
+  // into `output`, exactly as apply() does. `frame(k)` returns the features of
+  // frame k; only frames within `windowlen` of `i` are accessed.
+  template <typename FrameFn>
+  void computeFrameDerivative(
+      FrameFn frame,
+      int64_t i,
+      int64_t numframes,
+      int64_t windowlen,
+      int64_t numfeat,
+      T* output) const {
+    T denominator = (windowlen * (windowlen + 1) * (2 * windowlen + 1)) / 3.0;
+    for (int64_t j = 0; j < numfeat; ++j) {
+      T sum = 0.0;
+      for (int64_t d = 1; d <= windowlen; ++d) {
+        sum += d *
+            (frame(i + std::min(numframes - i - 1, d))[j] -
+             frame(i - std::min(i, d))[j]);
+      }
+      output[j] = sum / denominator;
+    }
+  }
+
  private:
   int64_t deltaWindow_; // delta derivatives lag size
   int64_t accWindow_; // acceleration derivatives lag size
@@ -26,6 +26,7 @@ std::vector<T> Dither<T>::apply(const std::vector<T>& input) {
 template <typename T>
 void Dither<T>::applyInPlace(std::vector<T>& input) {
   std::uniform_real_distribution<T> distribution(0.0, 1.0);
+  std::lock_guard<std::mutex> lock(rngMutex_);
   for (auto& i : input) {
     i += ditherVal_ * distribution(rng_);
   }
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <mutex>
 #include <random>
 #include <vector>
 
@@ -19,6 +20,9 @@ namespace w2l {
 // Similar to HTK, positive value of `q` causes the same noise signal to be
 // added everytime and with negative value of `q`, noise is random and the same
 // file may produce slightly different results in different trials
+//
+// Calls may be made concurrently; they take turns drawing from the same RNG,
+// so the noise sequence is shared as if the calls were made one at a time.
 
 template <typename T>
 class Dither {
@@ -32,5 +36,6 @@ class Dither {
  private:
   T ditherVal_;
   std::mt19937 rng_; // Standard mersenne_twister_engine
+  std::mutex rngMutex_; // Guards `rng_`
 };
 } // namespace w2l
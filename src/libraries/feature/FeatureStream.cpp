@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "FeatureStream.h"
+
+#include <algorithm>
+
+namespace w2l {
+
+template <typename T>
+FeatureStream<T>::FeatureStream(PowerSpectrum<T>& featurizer)
+    : featurizer_(featurizer) {
+  auto params = featurizer_.getFeatureParams();
+  frameSize_ = params.numFrameSizeSamples();
+  frameStride_ = params.numFrameStrideSamples();
+  numFeat_ = featurizer_.numFrameFeatures();
+  auto derivatives = featurizer_.frameDerivatives();
+  // Same conditions as in Derivatives::apply
+  deltaWindow_ = 0;
+  accWindow_ = 0;
+  if (derivatives && derivatives->deltaWindow() > 0) {
+    deltaWindow_ = derivatives->deltaWindow();
+    accWindow_ = std::max<int64_t>(derivatives->accWindow(), 0);
+  }
+  reset();
+}
+
+template <typename T>
+std::vector<T> FeatureStream<T>::push(const std::vector<T>& input) {
+  samples_.insert(samples_.end(), input.begin(), input.end());
+  if (samples_.size() < frameSize_) {
+    return {};
+  }
+  int64_t nFrames = 1 + (samples_.size() - frameSize_) / frameStride_;
+  // Same as frameSignal
+  T scale = 32768.0;
+  std::vector<T> frames(nFrames * frameSize_);
+  for (size_t f = 0; f < nFrames; ++f) {
+    for (size_t i = 0; i < frameSize_; ++i) {
+      frames[f * frameSize_ + i] = scale * samples_[f * frameStride_ + i];
+    }
+  }
+  samples_.erase(samples_.begin(), samples_.begin() + nFrames * frameStride_);
+
+  auto feat = featurizer_.frameFeatures(frames);
+  features_.insert(features_.end(), feat.begin(), feat.end());
+  numFrames_ += nFrames;
+  return flush(numFrames_, false);
+}
+
+template <typename T>
+std::vector<T> FeatureStream<T>::finish() {
+  auto output = flush(numFrames_, true);
+  reset();
+  return output;
+}
+
+template <typename T>
+void FeatureStream<T>::reset() {
+  samples_.clear();
+  numFrames_ = 0;
+  featuresStart_ = 0;
+  features_.clear();
+  numDeltas_ = 0;
+  deltasStart_ = 0;
+  deltas_.clear();
+  numAccs_ = 0;
+  accs_.clear();
+  numOutput_ = 0;
+}
+
+template <typename T>
+int64_t FeatureStream<T>::outputFeatSz() const {
+  return numFeat_ *
+      (1 + (deltaWindow_ > 0 ? 1 : 0) + (accWindow_ > 0 ? 1 : 0));
+}
+
+template <typename T>
+std::vector<T> FeatureStream<T>::flush(int64_t numframes, bool final) {
+  auto derivatives = featurizer_.frameDerivatives();
+  int64_t numReady = numframes;
+  if (deltaWindow_ > 0) {
+    // Before the end, the delta of frame i is final once frame i + W is known
+    int64_t numDeltas =
+        final ? numframes : std::max<int64_t>(numframes - deltaWindow_, 0);
+    auto feature = [this](int64_t k) {
+      return features_.data() + (k - featuresStart_) * numFeat_;
+    };
+    deltas_.resize((numDeltas - deltasStart_) * numFeat_);
+    for (int64_t i = numDeltas_; i < numDeltas; ++i) {
+      derivatives->computeFrameDerivative(
+          feature,
+          i,
+          numframes,
+          deltaWindow_,
+          numFeat_,
+          deltas_.data() + (i - deltasStart_) * numFeat_);
+    }
+    numDeltas_ = std::max(numDeltas_, numDeltas);
+    numReady = numDeltas_;
+  }
+  if (accWindow_ > 0) {
+    int64_t numAccs =
+        final ? numframes : std::max<int64_t>(numDeltas_ - accWindow_, 0);
+    auto delta = [this](int64_t k) {
+      return deltas_.data() + (k - deltasStart_) * numFeat_;
+    };
+    accs_.resize((numAccs - numOutput_) * numFeat_);
+    for (int64_t i = numAccs_; i < numAccs; ++i) {
+      derivatives->computeFrameDerivative(
+          delta,
+          i,
+          numframes,
+          accWindow_,
+          numFeat_,
+          accs_.data() + (i - numOutput_) * numFeat_);
+    }
+    numAccs_ = std::max(numAccs_, numAccs);
+    numReady = numAccs_;
+  }
+
+  // Same layout as Derivatives::apply
+  int64_t featSz = outputFeatSz();
+  std::vector<T> output((numReady - numOutput_) * featSz);
+  for (int64_t i = numOutput_; i < numReady; ++i) {
+    auto out = output.data() + (i - numOutput_) * featSz;
+    auto begin = features_.data() + (i - featuresStart_) * numFeat_;
+    out = std::copy(begin, begin + numFeat_, out);
+    if (deltaWindow_ > 0) {
+      begin = deltas_.data() + (i - deltasStart_) * numFeat_;
+      out = std::copy(begin, begin + numFeat_, out);
+    }
+    if (accWindow_ > 0) {
+      begin = accs_.data() + (i - numOutput_) * numFeat_;
+      std::copy(begin, begin + numFeat_, out);
+    }
+  }
+  accs_.clear();
+  numOutput_ = numReady;
+  trim();
+  return output;
+}
+
+template <typename T>
+void FeatureStream<T>::trim() {
+  // Deltas still to compute look back `deltaWindow_` frames, accelerations
+  // `accWindow_` deltas
+  int64_t keepFeatures =
+      std::min(numOutput_, std::max<int64_t>(numDeltas_ - deltaWindow_, 0));
+  if (deltaWindow_ <= 0) {
+    keepFeatures = numOutput_;
+  }
+  features_.erase(
+      features_.begin(),
+      features_.begin() + (keepFeatures - featuresStart_) * numFeat_);
+  featuresStart_ = keepFeatures;
+
+  int64_t keepDeltas =
+      std::min(numOutput_, std::max<int64_t>(numAccs_ - accWindow_, 0));
+  if (accWindow_ <= 0) {
+    keepDeltas = numOutput_;
+  }
+  keepDeltas = std::min(keepDeltas, numDeltas_);
+  deltas_.erase(
+      deltas_.begin(),
+      deltas_.begin() + (keepDeltas - deltasStart_) * numFeat_);
+  deltasStart_ = keepDeltas;
+}
+
+template class FeatureStream<float>;
+template class FeatureStream<double>;
+} // namespace w2l
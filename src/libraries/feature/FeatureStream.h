@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "PowerSpectrum.h"
+
+namespace w2l {
+
+// Computes the features of a speech signal which arrives in chunks of
+// arbitrary size. Concatenating the outputs of push() and finish() gives
+// exactly what `featurizer.apply()` returns for the whole signal.
+//
+// Samples which do not yet fill a frame are kept until the next push().
+// Features of a frame are returned as soon as they no longer depend on frames
+// to come: with derivatives this holds back `deltaWindow + accWindow` frames,
+// which finish() returns using the end-of-utterance padding of apply().
+//
+// Dither draws from the featurizer's RNG, so results are identical to apply()
+// with dither only if the featurizer is used by this stream alone.
+//
+// Example :
+//   Mfcc<float> mfcc(params);
+//   FeatureStream<float> stream(mfcc);
+//   while (...) {
+//     auto feat = stream.push(chunk); // Col Major : FEAT X NEWFRAMES
+//   }
+//   auto feat = stream.finish();
+template <typename T>
+class FeatureStream {
+ public:
+  // featurizer - PowerSpectrum, Mfsc or Mfcc; must outlive the stream
+  explicit FeatureStream(PowerSpectrum<T>& featurizer);
+
+  // input - next chunk of speech signal (T)
+  // Returns - Features of the frames completed by this chunk
+  //   (Col Major : FEAT X NEWFRAMES)
+  std::vector<T> push(const std::vector<T>& input);
+
+  // Returns - Features of the remaining frames (Col Major : FEAT X NEWFRAMES)
+  // The stream is reset and can be used for the next utterance.
+  std::vector<T> finish();
+
+  // Drops any buffered samples and frames
+  void reset();
+
+  // Number of features per frame in the output
+  int64_t outputFeatSz() const;
+
+ private:
+  PowerSpectrum<T>& featurizer_;
+  int64_t frameSize_;
+  int64_t frameStride_;
+  int64_t numFeat_; // features per frame before derivatives
+  int64_t deltaWindow_; // 0 if no derivatives are computed
+  int64_t accWindow_; // 0 if no acceleration is computed
+
+  // Samples not yet consumed by a frame
+  std::vector<T> samples_;
+
+  // Frames computed so far; `features_` holds those from `featuresStart_`
+  int64_t numFrames_;
+  int64_t featuresStart_;
+  std::vector<T> features_;
+
+  // Deltas computed so far; `deltas_` holds those from `deltasStart_`
+  int64_t numDeltas_;
+  int64_t deltasStart_;
+  std::vector<T> deltas_;
+
+  // Accelerations computed so far; only kept until the frame is output
+  int64_t numAccs_;
+  std::vector<T> accs_;
+
+  int64_t numOutput_;
+
+  // Computes derivatives and outputs the frames which are ready, given that
+  // the utterance has `numframes` frames (or more, if not at its end)
+  std::vector<T> flush(int64_t numframes, bool final);
+
+  // Drops the features and deltas which are no longer needed
+  void trim();
+};
+} // namespace w2l
@@ -9,6 +9,7 @@
 #include "Mfcc.h"
 
 #include <cstddef>
+#include <stdexcept>
 
 #include "SpeechUtils.h"
 
@@ -29,7 +30,12 @@ std::vector<T> Mfcc<T>::apply(const std::vector<T>& input) {
   if (frames.empty()) {
     return {};
   }
+  auto cep = frameFeatures(frames);
+  return derivatives_.apply(cep, numFrameFeatures());
+}
 
+template <typename T>
+std::vector<T> Mfcc<T>::frameFeatures(std::vector<T>& frames) {
   int64_t nSamples = this->featParams_.numFrameSizeSamples();
   int64_t nFrames = frames.size() / nSamples;
 
@@ -59,7 +65,17 @@ std::vector<T> Mfcc<T>::apply(const std::vector<T>& input) {
       cep[f * nFeat] = energy[f];
     }
   }
-  return derivatives_.apply(cep, nFeat);
+  return cep;
+}
+
+template <typename T>
+int64_t Mfcc<T>::numFrameFeatures() const {
+  return this->featParams_.numCepstralCoeffs;
+}
+
+template <typename T>
+const Derivatives<T>* Mfcc<T>::frameDerivatives() const {
+  return &derivatives_;
 }
 
 template <typename T>
@@ -63,6 +63,12 @@ class Mfcc : public Mfsc<T> {
 
   int64_t outputSize(int64_t inputSz) override;
 
+  std::vector<T> frameFeatures(std::vector<T>& frames) override;
+
+  int64_t numFrameFeatures() const override;
+
+  const Derivatives<T>* frameDerivatives() const override;
+
  private:
   // The following classes are defined in the order they are applied
   Dct<T> dct_;
@@ -11,6 +11,7 @@
 #include <algorithm>
 #include <cstddef>
 #include <numeric>
+#include <stdexcept>
 
 #include "SpeechUtils.h"
 
@@ -36,7 +37,13 @@ std::vector<T> Mfsc<T>::apply(const std::vector<T>& input) {
   if (frames.empty()) {
     return {};
   }
+  auto mfscFeat = frameFeatures(frames);
+  // Derivatives will not be computed if windowsize < 0
+  return derivatives_.apply(mfscFeat, numFrameFeatures());
+}
 
+template <typename T>
+std::vector<T> Mfsc<T>::frameFeatures(std::vector<T>& frames) {
   int64_t nSamples = this->featParams_.numFrameSizeSamples();
   int64_t nFrames = frames.size() / nSamples;
 
@@ -72,10 +79,19 @@ std::vector<T> Mfsc<T>::apply(const std::vector<T>& input) {
           newMfscFeat.data() + start + f + 1);
     }
     std::swap(mfscFeat, newMfscFeat);
-    ++numFeat;
   }
-  // Derivatives will not be computed if windowsize < 0
-  return derivatives_.apply(mfscFeat, numFeat);
+  return mfscFeat;
+}
+
+template <typename T>
+int64_t Mfsc<T>::numFrameFeatures() const {
+  return this->featParams_.numFilterbankChans +
+      (this->featParams_.useEnergy ? 1 : 0);
+}
+
+template <typename T>
+const Derivatives<T>* Mfsc<T>::frameDerivatives() const {
+  return &derivatives_;
 }
 
 template <typename T>
@@ -31,6 +31,12 @@ class Mfsc : public PowerSpectrum<T> {
 
   int64_t outputSize(int64_t inputSz) override;
 
+  std::vector<T> frameFeatures(std::vector<T>& frames) override;
+
+  int64_t numFrameFeatures() const override;
+
+  const Derivatives<T>* frameDerivatives() const override;
+
  protected:
   // Helper function which takes input as signal after dividing the signal into
   // frames. Main purpose of this function is to reuse it in MFCC code
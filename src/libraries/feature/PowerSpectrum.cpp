@@ -10,12 +10,49 @@
 
 #include <algorithm>
 #include <cstddef>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <stdexcept>
 #include <unordered_map>
 
 #include "SpeechUtils.h"
 
 namespace w2l {
 
+namespace {
+
+// FFTW planner routines (unlike fftw_execute*) are not thread-safe
+std::mutex& fftwPlannerMutex() {
+  static std::mutex mtx;
+  return mtx;
+}
+
+struct FftwDeleter {
+  void operator()(void* ptr) const {
+    fftw_free(ptr);
+  }
+};
+
+// fftw_malloc'ed buffers have the SIMD alignment required to run a plan on
+// arrays other than the ones it was created with
+using FftwRealBuffer = std::unique_ptr<double[], FftwDeleter>;
+using FftwComplexBuffer = std::unique_ptr<fftw_complex[], FftwDeleter>;
+
+fftw_plan planManyR2C(int n, int howmany, unsigned flags) {
+  int K = n / 2 + 1;
+  FftwRealBuffer in(fftw_alloc_real(n * howmany));
+  FftwComplexBuffer out(fftw_alloc_complex(K * howmany));
+  std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+  return fftw_plan_many_dft_r2c(
+      1, &n, howmany, in.get(), nullptr, 1, n, out.get(), nullptr, 1, K, flags);
+}
+
+} // namespace
+
+template <typename T>
+constexpr int64_t PowerSpectrum<T>::kFftBatchSz;
+
 template <typename T>
 PowerSpectrum<T>::PowerSpectrum(const FeatureParams& params)
     : featParams_(params),
@@ -23,11 +60,8 @@ PowerSpectrum<T>::PowerSpectrum(const FeatureParams& params)
       preEmphasis_(params.preemCoef, params.numFrameSizeSamples()),
       windowing_(params.numFrameSizeSamples(), params.windowType) {
   validatePowSpecParams();
-  auto nFFt = featParams_.nFft();
-  inFftBuf_.resize(nFFt, 0.0);
-  outFftBuf_.resize(2 * nFFt);
-  fftPlan_ = fftw_plan_dft_r2c_1d(
-      nFFt, inFftBuf_.data(), (fftw_complex*)outFftBuf_.data(), FFTW_MEASURE);
+  auto nFft = featParams_.nFft();
+  fftBatchPlan_ = planManyR2C(nFft, kFftBatchSz, FFTW_MEASURE);
 }
 
 template <typename T>
@@ -39,11 +73,26 @@ std::vector<T> PowerSpectrum<T>::apply(const std::vector<T>& input) {
   return powSpectrumImpl(frames);
 }
 
+template <typename T>
+std::vector<T> PowerSpectrum<T>::frameFeatures(std::vector<T>& frames) {
+  return powSpectrumImpl(frames);
+}
+
+template <typename T>
+int64_t PowerSpectrum<T>::numFrameFeatures() const {
+  return featParams_.powSpecFeatSz();
+}
+
+template <typename T>
+const Derivatives<T>* PowerSpectrum<T>::frameDerivatives() const {
+  return nullptr;
+}
+
 template <typename T>
 std::vector<T> PowerSpectrum<T>::powSpectrumImpl(std::vector<T>& frames) {
   int64_t nSamples = featParams_.numFrameSizeSamples();
   int64_t nFrames = frames.size() / nSamples;
-  int64_t nFft = featParams_.nFft();
+  int nFft = featParams_.nFft();
   int64_t K = featParams_.filterFreqResponseLen();
 
   if (featParams_.ditherVal != 0.0) {
@@ -63,26 +112,29 @@ std::vector<T> PowerSpectrum<T>::powSpectrumImpl(std::vector<T>& frames) {
   }
   windowing_.applyInPlace(frames);
   std::vector<T> dft(K * nFrames);
-  for (size_t f = 0; f < nFrames; ++f) {
-    auto begin = frames.data() + f * nSamples;
-    {
-      std::lock_guard<std::mutex> lock(fftMutex_);
-      std::copy(begin, begin + nSamples, inFftBuf_.data());
-      std::fill(outFftBuf_.begin(), outFftBuf_.end(), 0.0);
-      fftw_execute(fftPlan_);
-
-      // Copy stuff to the redundant part
-      for (size_t i = K; i < nFft; ++i) {
-        outFftBuf_[2 * i] = outFftBuf_[2 * nFft - 2 * i];
-        outFftBuf_[2 * i + 1] = -outFftBuf_[2 * nFft - 2 * i + 1];
-      }
+  // Per-call buffers: the zero padding beyond nSamples is written once since
+  // out-of-place r2c transforms leave their input untouched
+  FftwRealBuffer inFftBuf(fftw_alloc_real(kFftBatchSz * nFft));
+  FftwComplexBuffer outFftBuf(fftw_alloc_complex(kFftBatchSz * K));
+  std::fill(inFftBuf.get(), inFftBuf.get() + kFftBatchSz * nFft, 0.0);
+  for (int64_t f = 0; f < nFrames;) {
+    // Stale frames left in the tail of a partial batch are transformed too,
+    // but their output is ignored
+    int64_t nCurFrames = std::min(nFrames - f, kFftBatchSz);
+    for (int64_t j = 0; j < nCurFrames; ++j) {
+      auto begin = frames.data() + (f + j) * nSamples;
+      std::copy(begin, begin + nSamples, inFftBuf.get() + j * nFft);
+    }
+    fftw_execute_dft_r2c(fftBatchPlan_, inFftBuf.get(), outFftBuf.get());
 
+    for (int64_t j = 0; j < nCurFrames; ++j) {
+      auto out = outFftBuf.get() + j * K;
+      auto dftOut = dft.data() + (f + j) * K;
       for (size_t i = 0; i < K; ++i) {
-        dft[f * K + i] = std::sqrt(
-            outFftBuf_[2 * i] * outFftBuf_[2 * i] +
-            outFftBuf_[2 * i + 1] * outFftBuf_[2 * i + 1]);
+        dftOut[i] = std::sqrt(out[i][0] * out[i][0] + out[i][1] * out[i][1]);
       }
     }
+    f += nCurFrames;
   }
   return dft;
 }
@@ -142,7 +194,8 @@ void PowerSpectrum<T>::validatePowSpecParams() const {
 
 template <typename T>
 PowerSpectrum<T>::~PowerSpectrum() {
-  fftw_destroy_plan(fftPlan_);
+  std::lock_guard<std::mutex> lock(fftwPlannerMutex());
+  fftw_destroy_plan(fftBatchPlan_);
 }
 
 template class PowerSpectrum<float>;
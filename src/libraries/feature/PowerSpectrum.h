@@ -8,10 +8,9 @@
 
 #pragma once
 
-#include <mutex>
-
 #include <fftw3.h>
 
+#include "Derivatives.h"
 #include "Dither.h"
 #include "FeatureParams.h"
 #include "PreEmphasis.h"
@@ -20,11 +19,18 @@
 namespace w2l {
 
 // Computes Power Spectrum features for a speech signal.
+// FFT plans are created once and executed with FFTW's new-array interface on
+// buffers owned by each call, so `apply` and `batchApply` are safe to run
+// concurrently from several threads. Only dithering (`ditherVal` != 0) takes
+// a lock, as the calls share its RNG.
 template <typename T>
 class PowerSpectrum {
  public:
   explicit PowerSpectrum(const FeatureParams& params);
 
+  PowerSpectrum(const PowerSpectrum&) = delete;
+  PowerSpectrum& operator=(const PowerSpectrum&) = delete;
+
   virtual ~PowerSpectrum();
 
   // input - input speech signal (T)
@@ -39,6 +45,20 @@ class PowerSpectrum {
 
   FeatureParams getFeatureParams() const;
 
+  // apply() computes, for the frames cut by `frameSignal`, features of each
+  // frame on its own (frameFeatures()) followed by derivatives across frames
+  // (frameDerivatives(), if any). FeatureStream relies on this split.
+
+  // frames - signal frames from `frameSignal`, used as scratch space
+  // Returns - Features of each frame (Col Major : FEAT X FRAMESZ)
+  virtual std::vector<T> frameFeatures(std::vector<T>& frames);
+
+  // Number of features per frame returned by frameFeatures()
+  virtual int64_t numFrameFeatures() const;
+
+  // Derivatives appended to frameFeatures() by apply(), or nullptr
+  virtual const Derivatives<T>* frameDerivatives() const;
+
  protected:
   FeatureParams featParams_;
 
@@ -54,8 +74,12 @@ class PowerSpectrum {
   PreEmphasis<T> preEmphasis_;
   Windowing<T> windowing_;
 
-  fftw_plan fftPlan_;
-  std::vector<double> inFftBuf_, outFftBuf_;
-  std::mutex fftMutex_;
+  // Number of frames transformed by one execution of `fftBatchPlan_`
+  static constexpr int64_t kFftBatchSz = 32;
+
+  // Transforms `kFftBatchSz` frames at once. All frames go through it, the
+  // last batch being padded, so the FFT of a frame does not depend on how the
+  // signal is split into calls (as FeatureStream does).
+  fftw_plan fftBatchPlan_;
 };
 } // namespace w2l
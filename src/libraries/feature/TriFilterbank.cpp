@@ -51,12 +51,74 @@ TriFilterbank<T>::TriFilterbank(
       H_[i * numFilters_ + j] = std::max(std::min(hislope, loslope), minH);
     }
   }
+
+  filterStart_.resize(numFilters_);
+  filterOffset_.resize(numFilters_ + 1);
+  for (int64_t j = 0; j < numFilters_; ++j) {
+    int64_t start = 0, end = 0;
+    for (int64_t i = 0; i < filterLen_; ++i) {
+      if (H_[i * numFilters_ + j] > minH) {
+        start = (end == 0) ? i : start;
+        end = i + 1;
+      }
+    }
+    filterStart_[j] = start;
+    filterOffset_[j] = filterWeights_.size();
+    for (int64_t i = start; i < end; ++i) {
+      filterWeights_.push_back(H_[i * numFilters_ + j]);
+    }
+  }
+  filterOffset_[numFilters_] = filterWeights_.size();
 }
 
 template <typename T>
 std::vector<T> TriFilterbank<T>::apply(
     const std::vector<T>& input,
     T melfloor /* = 0.0 */) const {
+  if (input.empty() || input.size() % filterLen_ != 0) {
+    throw std::invalid_argument(
+        "TriFilterbank: input size must be a multiple of filterlen");
+  }
+  int64_t nFrames = input.size() / filterLen_;
+  std::vector<T> output(nFrames * numFilters_);
+  // Filters only span a few bins, so a single frame gives a short dependent
+  // chain of multiply-adds per filter. Interleaving a block of frames keeps
+  // several independent accumulators in flight.
+  constexpr int64_t kBlock = 8;
+  for (int64_t f0 = 0; f0 < nFrames; f0 += kBlock) {
+    int64_t nBlock = std::min(kBlock, nFrames - f0);
+    const T* frames = input.data() + f0 * filterLen_;
+    T* out = output.data() + f0 * numFilters_;
+    for (int64_t j = 0; j < numFilters_; ++j) {
+      const T* bins = frames + filterStart_[j];
+      const T* weights = filterWeights_.data() + filterOffset_[j];
+      int64_t len = filterOffset_[j + 1] - filterOffset_[j];
+      T sum[kBlock] = {};
+      if (nBlock == kBlock) {
+        for (int64_t i = 0; i < len; ++i) {
+          for (int64_t b = 0; b < kBlock; ++b) {
+            sum[b] += weights[i] * bins[b * filterLen_ + i];
+          }
+        }
+      } else {
+        for (int64_t b = 0; b < nBlock; ++b) {
+          for (int64_t i = 0; i < len; ++i) {
+            sum[b] += weights[i] * bins[b * filterLen_ + i];
+          }
+        }
+      }
+      for (int64_t b = 0; b < nBlock; ++b) {
+        out[b * numFilters_ + j] = std::max(sum[b], melfloor);
+      }
+    }
+  }
+  return output;
+}
+
+template <typename T>
+std::vector<T> TriFilterbank<T>::applyDense(
+    const std::vector<T>& input,
+    T melfloor /* = 0.0 */) const {
   std::vector<T> output = cblasGemm(input, H_, numFilters_, filterLen_);
   std::transform(
       output.begin(), output.end(), output.begin(), [melfloor](T n) -> T {
@@ -26,8 +26,13 @@ class TriFilterbank {
       int64_t highfreq = -1,
       FrequencyScale freqscale = FrequencyScale::MEL);
 
+  // Applies the filters on their non-zero bins only
   std::vector<T> apply(const std::vector<T>& input, T melfloor = 0.0) const;
 
+  // Reference implementation of apply() as a dense GEMM with filterbank()
+  std::vector<T> applyDense(const std::vector<T>& input, T melfloor = 0.0)
+      const;
+
   // Returns triangular filterbank matrix
   std::vector<T> filterbank() const;
 
@@ -39,6 +44,11 @@ class TriFilterbank {
   int64_t highFreq_; // higher cutoff frequency (Hz)
   FrequencyScale freqScale_; // frequency warp type Ex. FrequencyScale::MEL
   std::vector<T> H_; // (numFilters_ x filterLen_) triangular filterbank matrix
+  // Filter j covers bins [filterStart_[j], filterStart_[j] + its length) with
+  // weights filterWeights_[filterOffset_[j] .. filterOffset_[j + 1])
+  std::vector<int64_t> filterStart_;
+  std::vector<int64_t> filterOffset_;
+  std::vector<T> filterWeights_;
 
   T hertzToWarpedScale(T hz, FrequencyScale freqscale) const;
   T warpedToHertzScale(T wrp, FrequencyScale freqscale) const;
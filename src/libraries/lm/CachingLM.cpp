@@ -0,0 +1,177 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/lm/CachingLM.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace w2l {
+
+constexpr int CachingLM::kMaxProbe;
+
+CachingLM::CachingLM(const LMPtr& lm, int cacheSize) : lm_(lm) {
+  if (!lm_) {
+    throw std::invalid_argument("[CachingLM] No language model to cache");
+  }
+  if (cacheSize < 1) {
+    throw std::invalid_argument(
+        "[CachingLM] Invalid cache size: " + std::to_string(cacheSize));
+  }
+  size_t tableSize = 1;
+  while (tableSize < static_cast<size_t>(cacheSize)) {
+    tableSize <<= 1;
+  }
+  table_.resize(tableSize);
+  mask_ = tableSize - 1;
+}
+
+LMStatePtr CachingLM::start(bool startWithNothing) {
+  // Entries are keyed by content: they stay valid for the next sentences
+  return lm_->start(startWithNothing);
+}
+
+size_t CachingLM::slot(size_t stateHash, int usrTokenIdx) const {
+  size_t hash =
+      stateHash ^ (static_cast<size_t>(usrTokenIdx) * 0x9e3779b97f4a7c15ULL);
+  hash ^= hash >> 29;
+  return hash & mask_;
+}
+
+const CachingLM::Entry* CachingLM::find(
+    const LMStatePtr& state,
+    size_t stateHash,
+    int usrTokenIdx) const {
+  size_t idx = slot(stateHash, usrTokenIdx);
+  for (int i = 0; i < kMaxProbe; i++, idx = (idx + 1) & mask_) {
+    const Entry& entry = table_[idx];
+    if (!entry.state) {
+      return nullptr;
+    }
+    if (entry.stateHash == stateHash && entry.token == usrTokenIdx &&
+        (entry.state == state || lm_->compareState(entry.state, state) == 0)) {
+      return &entry;
+    }
+  }
+  return nullptr;
+}
+
+void CachingLM::insert(
+    const LMStatePtr& state,
+    size_t stateHash,
+    int usrTokenIdx,
+    const LMStatePtr& outState,
+    float score) {
+  size_t home = slot(stateHash, usrTokenIdx);
+  size_t idx = home;
+  for (int i = 0; i < kMaxProbe; i++, idx = (idx + 1) & mask_) {
+    if (!table_[idx].state) {
+      break;
+    }
+  }
+  if (table_[idx].state) {
+    // All the probed slots are taken: evict the entry at home
+    idx = home;
+  }
+  Entry& entry = table_[idx];
+  entry.state = state;
+  entry.stateHash = stateHash;
+  entry.token = usrTokenIdx;
+  entry.outState = outState;
+  entry.score = score;
+}
+
+std::pair<LMStatePtr, float> CachingLM::score(
+    const LMStatePtr& state,
+    const int usrTokenIdx) {
+  size_t stateHash = lm_->stateHash(state);
+  const Entry* entry = find(state, stateHash, usrTokenIdx);
+  if (entry) {
+    ++stats_.hits;
+    return std::make_pair(entry->outState, entry->score);
+  }
+  ++stats_.misses;
+  auto lmScoreReturn = lm_->score(state, usrTokenIdx);
+  insert(
+      state,
+      stateHash,
+      usrTokenIdx,
+      lmScoreReturn.first,
+      lmScoreReturn.second);
+  return lmScoreReturn;
+}
+
+void CachingLM::scoreBatch(
+    const std::vector<LMStatePtr>& states,
+    const std::vector<int>& usrTokenIdx,
+    std::vector<LMStatePtr>& outStates,
+    std::vector<float>& outScores) {
+  if (states.size() != usrTokenIdx.size()) {
+    throw std::invalid_argument(
+        "[CachingLM] Number of states and tokens mismatch in batch query");
+  }
+  outStates.resize(states.size());
+  outScores.resize(states.size());
+
+  // Answer what we can from the cache and forward the rest as one batch
+  missIdx_.clear();
+  missHashes_.clear();
+  missStates_.clear();
+  missTokens_.clear();
+  for (int i = 0; i < states.size(); i++) {
+    size_t stateHash = lm_->stateHash(states[i]);
+    const Entry* entry = find(states[i], stateHash, usrTokenIdx[i]);
+    if (entry) {
+      outStates[i] = entry->outState;
+      outScores[i] = entry->score;
+    } else {
+      missIdx_.push_back(i);
+      missHashes_.push_back(stateHash);
+      missStates_.push_back(states[i]);
+      missTokens_.push_back(usrTokenIdx[i]);
+    }
+  }
+  stats_.hits += states.size() - missIdx_.size();
+  stats_.misses += missIdx_.size();
+  if (missIdx_.empty()) {
+    return;
+  }
+
+  lm_->scoreBatch(missStates_, missTokens_, missOutStates_, missOutScores_);
+  for (int i = 0; i < missIdx_.size(); i++) {
+    insert(
+        missStates_[i],
+        missHashes_[i],
+        missTokens_[i],
+        missOutStates_[i],
+        missOutScores_[i]);
+    outStates[missIdx_[i]] = std::move(missOutStates_[i]);
+    outScores[missIdx_[i]] = missOutScores_[i];
+  }
+  missStates_.clear();
+  missOutStates_.clear();
+}
+
+std::pair<LMStatePtr, float> CachingLM::finish(const LMStatePtr& state) {
+  return lm_->finish(state);
+}
+
+int CachingLM::compareState(const LMStatePtr& state1, const LMStatePtr& state2)
+    const {
+  return lm_->compareState(state1, state2);
+}
+
+size_t CachingLM::stateHash(const LMStatePtr& state) const {
+  return lm_->stateHash(state);
+}
+
+void CachingLM::updateCache(std::vector<LMStatePtr> states) {
+  lm_->updateCache(std::move(states));
+}
+
+} // namespace w2l
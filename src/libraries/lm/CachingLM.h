@@ -0,0 +1,104 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "libraries/lm/LM.h"
+
+namespace w2l {
+
+/**
+ * CachingLM memoizes the queries made to another language model. During
+ * decoding, many hypotheses share an LM state and differ only by their
+ * alignment, so the same (state, token) pair is scored over and over across
+ * frames. Cached queries return the previous output state and score after a
+ * hash probe, without calling the underlying LM.
+ *
+ * The cache is a bounded open-addressed table keyed by state content
+ * (stateHash() and compareState() of the wrapped LM) and token, as in
+ * SharedCachingLM: hypotheses which reach the same state through different
+ * paths share its queries, and entries stay valid for the next sentences.
+ * Like the decoders, a CachingLM is not thread-safe: use one per decoding
+ * thread, all wrapping the same underlying LM.
+ */
+class CachingLM : public LM {
+ public:
+  using CacheStats = LMCacheStats;
+
+  /* `cacheSize` is rounded up to a power of two */
+  CachingLM(const LMPtr& lm, int cacheSize);
+
+  LMStatePtr start(bool startWithNothing) override;
+
+  std::pair<LMStatePtr, float> score(
+      const LMStatePtr& state,
+      const int usrTokenIdx) override;
+
+  void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& outScores) override;
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
+
+  int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
+      const override;
+
+  size_t stateHash(const LMStatePtr& state) const override;
+
+  void updateCache(std::vector<LMStatePtr> states) override;
+
+  /* Counters since construction (not reset by start()) */
+  CacheStats getStats() const {
+    return stats_;
+  }
+
+ private:
+  struct Entry {
+    LMStatePtr state; // Input state, nullptr for empty slots
+    size_t stateHash;
+    int token;
+    LMStatePtr outState;
+    float score;
+  };
+
+  // Slots probed before giving up on a lookup or evicting on an insertion
+  static constexpr int kMaxProbe = 4;
+
+  LMPtr lm_;
+  std::vector<Entry> table_;
+  size_t mask_;
+  CacheStats stats_;
+
+  // Scratch buffers for the queries of a batch missing from the cache
+  std::vector<int> missIdx_;
+  std::vector<size_t> missHashes_;
+  std::vector<LMStatePtr> missStates_;
+  std::vector<int> missTokens_;
+  std::vector<LMStatePtr> missOutStates_;
+  std::vector<float> missOutScores_;
+
+  size_t slot(size_t stateHash, int usrTokenIdx) const;
+
+  const Entry*
+  find(const LMStatePtr& state, size_t stateHash, int usrTokenIdx) const;
+
+  void insert(
+      const LMStatePtr& state,
+      size_t stateHash,
+      int usrTokenIdx,
+      const LMStatePtr& outState,
+      float score);
+};
+
+using CachingLMPtr = std::shared_ptr<CachingLM>;
+
+} // namespace w2l
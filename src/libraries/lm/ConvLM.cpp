@@ -9,9 +9,12 @@
 
 #include "libraries/lm/ConvLM.h"
 
+#include <algorithm>
 #include <cmath>
 #include <cstring>
 #include <iostream>
+#include <numeric>
+#include <unordered_set>
 
 namespace w2l {
 
@@ -20,15 +23,23 @@ ConvLM::ConvLM(
     const std::string& tokenVocabPath,
     const Dictionary& usrTknDict,
     int lmMemory,
-    int beamSize,
-    int historySize)
+    int cacheSize,
+    int historySize,
+    int cacheTopK)
     : lmMemory_(lmMemory),
-      beamSize_(beamSize),
+      cacheSize_(cacheSize),
+      clockHand_(0),
+      epoch_(0),
       getConvLmScoreFunc_(getConvLmScoreFunc),
       maxHistorySize_(historySize) {
   if (historySize < 1) {
     throw std::invalid_argument("[ConvLM] History size is too small.");
   }
+  if (cacheSize < 1 || cacheTopK < 0) {
+    throw std::invalid_argument(
+        "[ConvLM] Invalid cache size " + std::to_string(cacheSize) +
+        " or top k " + std::to_string(cacheTopK));
+  }
 
   /* Load token vocabulary */
   // Note: fairseq vocab should start with:
@@ -48,14 +59,35 @@ ConvLM::ConvLM(
   }
 
   /* Refresh cache */
-  cacheIndices_.reserve(beamSize_);
-  cache_.resize(beamSize_, std::vector<float>(vocabSize_));
-  slot_.reserve(beamSize_);
-  batchedTokens_.resize(beamSize_ * maxHistorySize_);
+  cacheTopK_ = cacheTopK < vocabSize_ ? cacheTopK : 0;
+  int rowSize = cacheTopK_ > 0 ? cacheTopK_ : vocabSize_;
+  cacheIndices_.reserve(cacheSize_);
+  cacheEntries_.resize(cacheSize_);
+  cacheScores_.resize(static_cast<size_t>(cacheSize_) * rowSize);
+  if (cacheTopK_ > 0) {
+    cacheTokens_.resize(static_cast<size_t>(cacheSize_) * cacheTopK_);
+    cacheRestScores_.resize(cacheSize_);
+    topTokens_.resize(vocabSize_);
+  }
+  batchedTokens_.resize(cacheSize_ * maxHistorySize_);
+}
+
+void ConvLM::setIncrementalScoreFunc(
+    const GetConvLmIncrementalScoreFunc& getConvLmIncrementalScoreFunc) {
+  getConvLmIncrementalScoreFunc_ = getConvLmIncrementalScoreFunc;
 }
 
 LMStatePtr ConvLM::start(bool startWithNothing) {
-  cacheIndices_.clear();
+  // Cached distributions stay valid, but the states of the previous sentence
+  // won't be extended anymore
+  for (auto& weakState : activeStates_) {
+    auto state = weakState.lock();
+    if (state) {
+      getRawState(state)->activations = nullptr;
+    }
+  }
+  activeStates_.clear();
+  ++epoch_;
   auto outState = std::make_shared<ConvLMState>(1);
   if (!startWithNothing) {
     outState->length = 1;
@@ -74,8 +106,9 @@ std::pair<LMStatePtr, float> ConvLM::scoreWithLmIdx(
   int inStateLength = inState->length;
   std::shared_ptr<ConvLMState> outState;
 
-  // Prepare output state
-  if (inStateLength == maxHistorySize_) {
+  // Prepare output state. Incremental scoring sees the whole history, which
+  // thus keys the cache.
+  if (inStateLength == maxHistorySize_ && !getConvLmIncrementalScoreFunc_) {
     outState = std::make_shared<ConvLMState>(maxHistorySize_);
     std::copy(
         inState->tokens.begin() + 1,
@@ -98,31 +131,29 @@ std::pair<LMStatePtr, float> ConvLM::scoreWithLmIdx(
         "[ConvLM] Invalid query word: " + std::to_string(tokenIdx));
   }
 
-  if (cacheIndices_.find(inState) != cacheIndices_.end()) {
-    // Cache hit
-    auto cacheInd = cacheIndices_[inState];
-    if (cacheInd < 0 || cacheInd >= beamSize_) {
-      throw std::logic_error(
-          "[ConvLM] Invalid cache access: " + std::to_string(cacheInd));
+  int row = findCached(state);
+  if (row >= 0) {
+    auto& entry = cacheEntries_[row];
+    if (entry.fresh) {
+      // Computed ahead of this query, by scoreBatch() or updateCache()
+      entry.fresh = false;
+      ++stats_.misses;
+    } else {
+      ++stats_.hits;
     }
-    score = cache_[cacheInd][tokenIdx];
   } else {
-    // Cache miss
-    if (cacheIndices_.size() == beamSize_) {
-      cacheIndices_.clear();
-    }
-    int newIdx = cacheIndices_.size();
-    cacheIndices_[inState] = newIdx;
-
-    std::vector<int> lastTokenPositions = {inState->length - 1};
-    cache_[newIdx] =
-        getConvLmScoreFunc_(inState->tokens, lastTokenPositions, -1, 1)[0];
-    score = cache_[newIdx][tokenIdx];
+    // Rows pinned by the current batch may go, they are recomputed if needed
+    ++epoch_;
+    row = insertCached(state, computeProbs({state}, inState->length)[0]);
+    cacheEntries_[row].fresh = false;
+    ++stats_.misses;
   }
+  score = cachedScore(row, tokenIdx);
   if (std::isnan(score) || !std::isfinite(score)) {
     throw std::runtime_error(
         "[ConvLM] Bad scoring from ConvLM: " + std::to_string(score));
   }
+  outState->prevActivations = inState->activations;
   return std::make_pair(std::move(outState), score);
 }
 
@@ -133,106 +164,408 @@ std::pair<LMStatePtr, float> ConvLM::score(
     throw std::out_of_range(
         "[KenLM] Invalid user token index: " + std::to_string(usrTokenIdx));
   }
+  if (findCached(state) >= 0) {
+    computeActivations({state});
+  }
   return scoreWithLmIdx(state, usrToLmIdxMap_[usrTokenIdx]);
 }
 
+void ConvLM::scoreBatch(
+    const std::vector<LMStatePtr>& states,
+    const std::vector<int>& usrTokenIdx,
+    std::vector<LMStatePtr>& outStates,
+    std::vector<float>& outScores) {
+  if (states.size() != usrTokenIdx.size()) {
+    throw std::invalid_argument(
+        "[ConvLM] Number of states and tokens mismatch in batch query");
+  }
+
+  // Gather the contexts missing from the cache, so that they go through the
+  // network together instead of one forward per miss in scoreWithLmIdx()
+  // The rows found or inserted here stay cached until the end of the batch
+  ++epoch_;
+  std::vector<LMStatePtr> missing;
+  std::unordered_set<ConvLMState*> seen;
+  int longestHistory = -1;
+  for (const auto& state : states) {
+    auto rawState = getRawState(state);
+    if (!seen.insert(rawState).second) {
+      continue;
+    }
+    if (findCached(state) < 0) {
+      missing.push_back(state);
+      longestHistory = std::max(longestHistory, rawState->length);
+    }
+  }
+
+  if (missing.empty() || seen.size() <= cacheSize_) {
+    if (!missing.empty()) {
+      cacheStates(missing, longestHistory);
+    }
+    // All the distributions are cached now
+    computeActivations(states);
+  }
+
+  LM::scoreBatch(states, usrTokenIdx, outStates, outScores);
+}
+
 std::pair<LMStatePtr, float> ConvLM::finish(const LMStatePtr& state) {
   return scoreWithLmIdx(state, vocab_.getIndex(kLmEosToken));
 }
 
 void ConvLM::updateCache(std::vector<LMStatePtr> states) {
   int longestHistory = -1, nStates = states.size();
-  if (nStates > beamSize_) {
+  if (nStates > cacheSize_) {
     throw std::invalid_argument(
         "[ConvLM] Cache size too small (consider larger than beam size).");
   }
 
-  // Refresh cache, store LM states that did not changed
-  slot_.clear();
-  slot_.resize(beamSize_, nullptr);
+  releaseActivations(states);
+
+  // Run the network on the states which are not cached yet
+  ++epoch_;
+  std::vector<LMStatePtr> missing;
   for (const auto& state : states) {
-    auto state_ = getRawState(state);
-    if (cacheIndices_.find(state_) != cacheIndices_.end()) {
-      slot_[cacheIndices_[state_]] = state_;
-    } else if (state_->length > longestHistory) {
-      // prepare intest history only for those which should be predicted
-      longestHistory = state_->length;
+    if (findCached(state) < 0) {
+      missing.push_back(state);
+      longestHistory = std::max(longestHistory, getRawState(state)->length);
     }
   }
-  cacheIndices_.clear();
-  int cacheSize = 0;
-  for (int i = 0; i < beamSize_; i++) {
-    if (!slot_[i]) {
+  if (longestHistory <= 0) {
+    return;
+  }
+  cacheStates(missing, longestHistory);
+}
+
+void ConvLM::releaseActivations(const std::vector<LMStatePtr>& states) {
+  if (activeStates_.empty()) {
+    return;
+  }
+  // Only the states of the beam will be extended
+  std::unordered_set<ConvLMState*> beam;
+  for (const auto& state : states) {
+    beam.insert(getRawState(state));
+  }
+  int nActive = 0;
+  for (auto& weakState : activeStates_) {
+    auto state = weakState.lock();
+    if (!state) {
       continue;
     }
-    cache_[cacheSize] = cache_[i];
-    cacheIndices_[slot_[i]] = cacheSize;
-    ++cacheSize;
+    auto rawState = getRawState(state);
+    if (beam.find(rawState) == beam.end()) {
+      rawState->activations = nullptr;
+    } else {
+      activeStates_[nActive++] = std::move(weakState);
+    }
   }
+  activeStates_.resize(nActive);
+}
+
+void ConvLM::cacheStates(
+    const std::vector<LMStatePtr>& states,
+    int longestHistory) {
+  int nStates = states.size();
 
   // Determine batchsize
-  if (longestHistory <= 0) {
-    return;
-  }
   // batchSize * longestHistory = cacheSize;
-  int maxBatchSize = lmMemory_ / longestHistory;
+  int maxBatchSize = std::max(lmMemory_ / longestHistory, 1);
   if (maxBatchSize > nStates) {
     maxBatchSize = nStates;
   }
 
   // Run batch forward
   int batchStart = 0;
+  std::vector<LMStatePtr> batchStates;
+  std::unordered_multimap<size_t, int> batchHashes;
   while (batchStart < nStates) {
-    // Select batch
-    int nBatchStates = 0;
-    std::vector<int> lastTokenPositions;
-    for (int i = batchStart; (nBatchStates < maxBatchSize) && (i < nStates);
+    // Select batch, once per history
+    batchStates.clear();
+    batchHashes.clear();
+    for (int i = batchStart;
+         (batchStates.size() < maxBatchSize) && (i < nStates);
          i++, batchStart++) {
-      auto state = getRawState(states[i]);
-      if (cacheIndices_.find(state) != cacheIndices_.end()) {
+      if (findCached(states[i]) >= 0) {
         continue;
       }
-      cacheIndices_[state] = cacheSize + nBatchStates;
-      int start = nBatchStates * longestHistory;
-
-      for (int j = 0; j < state->length; j++) {
-        batchedTokens_[start + j] = state->tokens[j];
+      size_t hash = stateHash(states[i]);
+      auto range = batchHashes.equal_range(hash);
+      bool duplicate = false;
+      for (auto it = range.first; it != range.second && !duplicate; ++it) {
+        duplicate = compareState(batchStates[it->second], states[i]) == 0;
       }
-      start += state->length;
-      for (int j = 0; j < longestHistory - state->length; j++) {
-        batchedTokens_[start + j] = vocab_.getIndex(kLmPadToken);
+      if (!duplicate) {
+        batchHashes.emplace(hash, batchStates.size());
+        batchStates.push_back(states[i]);
       }
-      lastTokenPositions.push_back(state->length - 1);
-      ++nBatchStates;
     }
-    if (nBatchStates == 0 && batchStart >= nStates) {
+    if (batchStates.empty()) {
       // if all states were skipped
       break;
     }
 
     // Feed forward
-    if (nBatchStates < 1 || longestHistory < 1) {
+    auto batchedProb = computeProbs(batchStates, longestHistory);
+
+    // Place probabilities in cache
+    for (int i = 0; i < batchStates.size(); i++) {
+      insertCached(batchStates[i], batchedProb[i]);
+    }
+  }
+}
+
+std::vector<std::vector<float>> ConvLM::computeProbs(
+    const std::vector<LMStatePtr>& states,
+    int longestHistory) {
+  int nStates = states.size();
+  std::vector<std::vector<float>> probs(nStates);
+  // Histories are longer than `historySize` when scoring incrementally
+  size_t batchedSize =
+      static_cast<size_t>(nStates) * std::max(longestHistory, 0);
+  if (batchedTokens_.size() < batchedSize) {
+    batchedTokens_.resize(batchedSize);
+  }
+
+  // States whose parent activations are known only need their last token
+  // to go through the network
+  std::vector<int> incrementalIdx;
+  std::vector<std::shared_ptr<void>> prevActivations;
+  std::vector<int> lastTokens;
+  std::vector<int> lastTokenPositions;
+  int nBatchStates = 0;
+  for (int i = 0; i < nStates; i++) {
+    auto state = getRawState(states[i]);
+    if (getConvLmIncrementalScoreFunc_ &&
+        (state->prevActivations || state->length == 1)) {
+      incrementalIdx.push_back(i);
+      prevActivations.push_back(state->prevActivations);
+      lastTokens.push_back(state->tokens[state->length - 1]);
+      continue;
+    }
+    int start = nBatchStates * longestHistory;
+    for (int j = 0; j < state->length; j++) {
+      batchedTokens_[start + j] = state->tokens[j];
+    }
+    start += state->length;
+    for (int j = 0; j < longestHistory - state->length; j++) {
+      batchedTokens_[start + j] = vocab_.getIndex(kLmPadToken);
+    }
+    lastTokenPositions.push_back(state->length - 1);
+    ++nBatchStates;
+  }
+
+  if (!incrementalIdx.empty()) {
+    std::vector<std::shared_ptr<void>> activations;
+    auto incrementalProb = getConvLmIncrementalScoreFunc_(
+        prevActivations, lastTokens, activations);
+    for (int k = 0; k < incrementalIdx.size(); k++) {
+      auto state = getRawState(states[incrementalIdx[k]]);
+      state->activations = std::move(activations[k]);
+      state->prevActivations = nullptr;
+      activeStates_.emplace_back(states[incrementalIdx[k]]);
+      probs[incrementalIdx[k]] = std::move(incrementalProb[k]);
+    }
+  }
+
+  if (nBatchStates > 0) {
+    if (longestHistory < 1) {
       throw std::logic_error(
           "[ConvLM] Invalid batch: [" + std::to_string(nBatchStates) + " x " +
           std::to_string(longestHistory) + "]");
     }
     auto batchedProb = getConvLmScoreFunc_(
         batchedTokens_, lastTokenPositions, longestHistory, nBatchStates);
+    for (int i = 0, k = 0; i < nStates; i++) {
+      if (probs[i].empty()) {
+        probs[i] = std::move(batchedProb[k++]);
+      }
+    }
+  }
+  return probs;
+}
 
-    // Place probabilities in cache
-    for (int i = 0; i < nBatchStates; i++, cacheSize++) {
-      if (batchedProb[i].size() != vocabSize_) {
-        throw std::logic_error(
-            "[ConvLM] Batch probability size " +
-            std::to_string(batchedProb[i].size()) +
-            " mismatch with vocab size " + std::to_string(vocabSize_));
+void ConvLM::computeActivations(const std::vector<LMStatePtr>& states) {
+  if (!getConvLmIncrementalScoreFunc_) {
+    return;
+  }
+  // States with the same history share their activations
+  std::vector<LMStatePtr> batchStates;
+  std::vector<size_t> batchHashes;
+  std::unordered_multimap<size_t, int> batchIndices;
+  std::vector<int> batchIdx(states.size(), -1);
+  for (int i = 0; i < states.size(); i++) {
+    auto rawState = getRawState(states[i]);
+    if (rawState->activations ||
+        (!rawState->prevActivations && rawState->length != 1)) {
+      continue;
+    }
+    size_t hash = stateHash(states[i]);
+    auto range = batchIndices.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (compareState(batchStates[it->second], states[i]) == 0) {
+        batchIdx[i] = it->second;
+        break;
       }
-      std::memcpy(
-          cache_[cacheSize].data(),
-          batchedProb[i].data(),
-          vocabSize_ * sizeof(float));
     }
+    if (batchIdx[i] < 0) {
+      batchIdx[i] = batchStates.size();
+      batchIndices.emplace(hash, batchStates.size());
+      batchStates.push_back(states[i]);
+      batchHashes.push_back(hash);
+    }
+  }
+  if (batchStates.empty()) {
+    return;
+  }
+
+  // The distributions are cached already, only the activations are needed
+  std::vector<std::shared_ptr<void>> prevActivations;
+  std::vector<int> lastTokens;
+  for (const auto& state : batchStates) {
+    auto rawState = getRawState(state);
+    prevActivations.push_back(rawState->prevActivations);
+    lastTokens.push_back(rawState->tokens[rawState->length - 1]);
+  }
+  std::vector<std::shared_ptr<void>> activations;
+  getConvLmIncrementalScoreFunc_(prevActivations, lastTokens, activations);
+  for (int i = 0; i < states.size(); i++) {
+    if (batchIdx[i] < 0) {
+      continue;
+    }
+    auto rawState = getRawState(states[i]);
+    rawState->activations = activations[batchIdx[i]];
+    rawState->prevActivations = nullptr;
+    activeStates_.emplace_back(states[i]);
+  }
+
+  // Let the states reaching the same histories later share them
+  for (int i = 0; i < batchStates.size(); i++) {
+    auto it = cacheIndices_.find(batchHashes[i]);
+    if (it == cacheIndices_.end()) {
+      continue;
+    }
+    auto& entry = cacheEntries_[it->second];
+    if (!getRawState(entry.state)->activations &&
+        compareState(entry.state, batchStates[i]) == 0) {
+      entry.state = batchStates[i];
+    }
+  }
+}
+
+int ConvLM::findCached(const LMStatePtr& state) {
+  auto it = cacheIndices_.find(stateHash(state));
+  if (it == cacheIndices_.end()) {
+    return -1;
+  }
+  auto& entry = cacheEntries_[it->second];
+  if (compareState(entry.state, state) != 0) {
+    return -1;
+  }
+  entry.referenced = true;
+  entry.epoch = epoch_;
+
+  // The row may come from another state with the same history: share its
+  // activations, if still held, to extend this one incrementally too.
+  // Otherwise, the state keeps the activations of its parent to compute its
+  // own once it is extended (see computeActivations()).
+  auto rawState = getRawState(state);
+  if (getConvLmIncrementalScoreFunc_ && !rawState->activations) {
+    auto cachedState = getRawState(entry.state);
+    if (cachedState->activations) {
+      rawState->activations = cachedState->activations;
+      rawState->prevActivations = nullptr;
+      activeStates_.emplace_back(state);
+    }
+  }
+  return it->second;
+}
+
+int ConvLM::insertCached(
+    const LMStatePtr& state,
+    const std::vector<float>& probs) {
+  if (probs.size() != vocabSize_) {
+    throw std::logic_error(
+        "[ConvLM] Batch probability size " + std::to_string(probs.size()) +
+        " mismatch with vocab size " + std::to_string(vocabSize_));
+  }
+  size_t hash = stateHash(state);
+  int row;
+  auto it = cacheIndices_.find(hash);
+  if (it != cacheIndices_.end()) {
+    // Another history with the same hash
+    row = it->second;
+  } else {
+    row = evictCached();
+    cacheIndices_[hash] = row;
+  }
+  auto& entry = cacheEntries_[row];
+  entry.state = state;
+  entry.hash = hash;
+  entry.referenced = true;
+  entry.fresh = true;
+  entry.epoch = epoch_;
+
+  if (cacheTopK_ == 0) {
+    std::memcpy(
+        cacheScores_.data() + static_cast<size_t>(row) * vocabSize_,
+        probs.data(),
+        vocabSize_ * sizeof(float));
+    return row;
+  }
+  // Keep the most likely tokens sorted by index for lookups
+  std::iota(topTokens_.begin(), topTokens_.end(), 0);
+  std::nth_element(
+      topTokens_.begin(),
+      topTokens_.begin() + cacheTopK_,
+      topTokens_.end(),
+      [&probs](int a, int b) { return probs[a] > probs[b]; });
+  std::sort(topTokens_.begin(), topTokens_.begin() + cacheTopK_);
+  size_t offset = static_cast<size_t>(row) * cacheTopK_;
+  double topMass = 0;
+  for (int i = 0; i < cacheTopK_; i++) {
+    cacheTokens_[offset + i] = topTokens_[i];
+    cacheScores_[offset + i] = probs[topTokens_[i]];
+    topMass += std::exp(probs[topTokens_[i]]);
+  }
+  cacheRestScores_[row] = std::log(
+      std::max(1.0 - topMass, 1e-10) / (vocabSize_ - cacheTopK_));
+  return row;
+}
+
+int ConvLM::evictCached() {
+  // Rows needed by the current batch are skipped, unless all of them are
+  for (int step = 0;; step++) {
+    int row = clockHand_;
+    clockHand_ = (clockHand_ + 1) % cacheSize_;
+    auto& entry = cacheEntries_[row];
+    if (!entry.state) {
+      return row;
+    }
+    bool force = step >= 2 * cacheSize_;
+    if (!force && entry.epoch == epoch_) {
+      continue;
+    }
+    if (!force && entry.referenced) {
+      entry.referenced = false;
+      continue;
+    }
+    cacheIndices_.erase(entry.hash);
+    entry.state = nullptr;
+    return row;
+  }
+}
+
+float ConvLM::cachedScore(int row, int tokenIdx) const {
+  if (cacheTopK_ == 0) {
+    return cacheScores_[static_cast<size_t>(row) * vocabSize_ + tokenIdx];
   }
+  auto begin = cacheTokens_.begin() + static_cast<size_t>(row) * cacheTopK_;
+  auto end = begin + cacheTopK_;
+  auto it = std::lower_bound(begin, end, tokenIdx);
+  if (it != end && *it == tokenIdx) {
+    return cacheScores_[it - cacheTokens_.begin()];
+  }
+  return cacheRestScores_[row];
 }
 
 int ConvLM::compareState(const LMStatePtr& state1, const LMStatePtr& state2)
@@ -251,6 +584,16 @@ int ConvLM::compareState(const LMStatePtr& state1, const LMStatePtr& state2)
       inState1->length * sizeof(int));
 }
 
+size_t ConvLM::stateHash(const LMStatePtr& state) const {
+  auto inState = getRawState(state);
+  size_t hash = inState->length;
+  for (int i = 0; i < inState->length; i++) {
+    hash ^= inState->tokens[i] + 0x9e3779b97f4a7c15ULL + (hash << 6) +
+        (hash >> 2);
+  }
+  return hash;
+}
+
 ConvLMState* ConvLM::getRawState(const LMStatePtr& state) {
   return static_cast<ConvLMState*>(state.get());
 }
@@ -19,24 +19,52 @@ namespace w2l {
 using GetConvLmScoreFunc = std::function<std::vector<std::vector<
     float>>(const std::vector<int>&, const std::vector<int>&, int, int)>;
 
+/**
+ * Scores the token following each history given the activations of the
+ * history without its last token (nullptr for an empty one) and that token.
+ * Returns the distributions and sets the activations of the histories.
+ */
+using GetConvLmIncrementalScoreFunc =
+    std::function<std::vector<std::vector<float>>(
+        const std::vector<std::shared_ptr<void>>&,
+        const std::vector<int>&,
+        std::vector<std::shared_ptr<void>>&)>;
+
 struct ConvLMState {
   std::vector<int> tokens;
   int length;
+  // Network activations of the history, from which the states extending it
+  // are scored incrementally. Released once the state leaves the beam.
+  std::shared_ptr<void> activations;
+  // Activations of the parent state, until this state has its own
+  std::shared_ptr<void> prevActivations;
 
   ConvLMState() : length(0) {}
   explicit ConvLMState(int size)
       : tokens(std::vector<int>(size)), length(size) {}
 };
 
+/**
+ * ConvLM caches the distribution following each history it scores, keyed by
+ * the history itself so that hypotheses reaching the same history through
+ * different paths share it. Distributions are stored in a slab of `cacheSize`
+ * rows which is reused across sentences, and evicted with the CLOCK policy
+ * (rows used since the hand last passed get a second chance). With
+ * `cacheTopK` > 0, rows only keep the k most likely tokens and the other
+ * tokens share the remaining probability mass uniformly.
+ */
 class ConvLM : public LM {
  public:
+  using CacheStats = LMCacheStats;
+
   ConvLM(
       const GetConvLmScoreFunc& getConvLmScoreFunc,
       const std::string& tokenVocabPath,
       const Dictionary& usrTknDict,
       int lmMemory = 10000,
-      int beamSize = 2500,
-      int historySize = 49);
+      int cacheSize = 2500,
+      int historySize = 49,
+      int cacheTopK = 0);
 
   LMStatePtr start(bool startWithNothing) override;
 
@@ -44,24 +72,67 @@ class ConvLM : public LM {
       const LMStatePtr& state,
       const int usrTokenIdx) override;
 
+  void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& outScores) override;
+
   std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
 
   int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
       const override;
 
+  size_t stateHash(const LMStatePtr& state) const override;
+
   void updateCache(std::vector<LMStatePtr> states) override;
 
+  /**
+   * Scores states from the activations of their parent when possible rather
+   * than running the network on their whole history. The history is not
+   * truncated to `historySize` tokens then: states, and thus the cache, are
+   * keyed by the whole history which the activations encode.
+   */
+  void setIncrementalScoreFunc(
+      const GetConvLmIncrementalScoreFunc& getConvLmIncrementalScoreFunc);
+
+  /**
+   * Counters since construction. A query hits the cache if the distribution
+   * it reads was already read by an earlier query.
+   */
+  CacheStats getStats() const {
+    return stats_;
+  }
+
  private:
+  struct CacheEntry {
+    LMStatePtr state; // History of the row, nullptr for free rows
+    size_t hash;
+    bool referenced; // Used since the clock hand last passed
+    bool fresh; // Not read by any query yet
+    int64_t epoch; // Last batch which needs the row, can't evict it
+  };
+
   // This cache is also not thread-safe!
   int lmMemory_;
-  int beamSize_;
-  std::unordered_map<ConvLMState*, int> cacheIndices_;
-  std::vector<std::vector<float>> cache_;
-  std::vector<ConvLMState*> slot_;
+  int cacheSize_;
+  int cacheTopK_;
+  std::unordered_map<size_t, int> cacheIndices_; // History hash to row
+  std::vector<CacheEntry> cacheEntries_;
+  std::vector<float> cacheScores_; // cacheSize_ rows of scores
+  std::vector<int> cacheTokens_; // Sorted tokens of the rows with top k
+  std::vector<float> cacheRestScores_; // Score of the tokens out of top k
+  int clockHand_;
+  int64_t epoch_;
+  CacheStats stats_;
   std::vector<int> batchedTokens_;
+  std::vector<int> topTokens_;
 
   Dictionary vocab_;
   GetConvLmScoreFunc getConvLmScoreFunc_;
+  GetConvLmIncrementalScoreFunc getConvLmIncrementalScoreFunc_;
+  // States holding activations
+  std::vector<std::weak_ptr<void>> activeStates_;
 
   int vocabSize_;
   int maxHistorySize_;
@@ -71,6 +142,35 @@ class ConvLM : public LM {
   std::pair<LMStatePtr, float> scoreWithLmIdx(
       const LMStatePtr& state,
       const int tokenIdx);
+
+  // Returns the row of the history of `state`, or -1. The row can't be
+  // evicted until the next batch.
+  int findCached(const LMStatePtr& state);
+
+  // Stores the distribution following `state`, returns its row
+  int insertCached(const LMStatePtr& state, const std::vector<float>& probs);
+
+  // Returns a row free for insertion
+  int evictCached();
+
+  float cachedScore(int row, int tokenIdx) const;
+
+  // Run the network on the states missing from the cache and cache their
+  // distributions
+  void cacheStates(const std::vector<LMStatePtr>& states, int longestHistory);
+
+  // Returns the distributions of the tokens following `states`
+  std::vector<std::vector<float>> computeProbs(
+      const std::vector<LMStatePtr>& states,
+      int longestHistory);
+
+  // Computes the activations of the `states` to be extended which have none,
+  // from those of their parent, when scoring incrementally. This is needed
+  // when their distribution was cached before their activations were known.
+  void computeActivations(const std::vector<LMStatePtr>& states);
+
+  // Drops the activations of the states which are not in `states`
+  void releaseActivations(const std::vector<LMStatePtr>& states);
 };
 
 } // namespace w2l
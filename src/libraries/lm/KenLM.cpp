@@ -8,6 +8,8 @@
 
 #include "libraries/lm/KenLM.h"
 
+#include <algorithm>
+#include <numeric>
 #include <stdexcept>
 
 #include <lm/model.hh>
@@ -59,6 +61,54 @@ std::pair<LMStatePtr, float> KenLM::score(
   return std::make_pair(std::move(outState), score);
 }
 
+void KenLM::scoreBatch(
+    const std::vector<LMStatePtr>& states,
+    const std::vector<int>& usrTokenIdx,
+    std::vector<LMStatePtr>& outStates,
+    std::vector<float>& outScores) {
+  if (states.size() != usrTokenIdx.size()) {
+    throw std::invalid_argument(
+        "[KenLM] Number of states and tokens mismatch in batch query");
+  }
+  const int nQueries = states.size();
+  outStates.resize(nQueries);
+  outScores.resize(nQueries);
+
+  // Visit the queries grouped by context. Hypotheses sharing an LM state
+  // often complete the same word in the same frame: such duplicates are
+  // scored once and share their output state, and the lookups for one
+  // context run back to back while its n-gram entries are still in cache.
+  std::vector<int> order(nQueries);
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&](int i, int j) {
+    if (states[i] != states[j]) {
+      return states[i] < states[j];
+    }
+    return usrTokenIdx[i] < usrTokenIdx[j];
+  });
+
+  for (int k = 0; k < nQueries; k++) {
+    const int i = order[k];
+    const int usrToken = usrTokenIdx[i];
+    if (k > 0) {
+      const int prev = order[k - 1];
+      if (states[prev] == states[i] && usrTokenIdx[prev] == usrToken) {
+        outStates[i] = outStates[prev];
+        outScores[i] = outScores[prev];
+        continue;
+      }
+    }
+    if (usrToken < 0 || usrToken >= usrToLmIdxMap_.size()) {
+      throw std::runtime_error(
+          "[KenLM] Invalid user token index: " + std::to_string(usrToken));
+    }
+    auto outState = std::make_shared<KenLMState>();
+    outScores[i] = model_->BaseScore(
+        getRawState(states[i]), usrToLmIdxMap_[usrToken], outState.get());
+    outStates[i] = std::move(outState);
+  }
+}
+
 std::pair<LMStatePtr, float> KenLM::finish(const LMStatePtr& state) {
   auto inState = getRawState(state);
   auto outState = std::make_shared<KenLMState>();
@@ -77,6 +127,11 @@ int KenLM::compareState(const LMStatePtr& state1, const LMStatePtr& state2)
   return inState1->Compare(*inState2);
 }
 
+size_t KenLM::stateHash(const LMStatePtr& state) const {
+  // Hashes the same words as State::Compare() compares
+  return lm::ngram::hash_value(*getRawState(state));
+}
+
 KenLMState* KenLM::getRawState(const LMStatePtr& state) {
   return static_cast<KenLMState*>(state.get());
 }
@@ -43,11 +43,19 @@ class KenLM : public LM {
       const LMStatePtr& state,
       const int usrTokenIdx) override;
 
+  void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& outScores) override;
+
   std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
 
   int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
       const override;
 
+  size_t stateHash(const LMStatePtr& state) const override;
+
  private:
   std::shared_ptr<lm::base::Model> model_;
   const lm::base::Vocabulary* vocab_;
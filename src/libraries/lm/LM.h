@@ -8,7 +8,9 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <unordered_map>
 #include <utility>
 #include <vector>
@@ -19,6 +21,21 @@ namespace w2l {
  */
 using LMStatePtr = std::shared_ptr<void>;
 
+/**
+ * Hit and miss counters of the caches kept by language models.
+ */
+struct LMCacheStats {
+  int64_t hits;
+  int64_t misses;
+
+  LMCacheStats() : hits(0), misses(0) {}
+
+  double hitRate() const {
+    return hits + misses > 0 ? static_cast<double>(hits) / (hits + misses)
+                             : 0.0;
+  }
+};
+
 /**
  * LM is a thin wrapper for laguage models. We abstrct several common methods
  * here which can be shared for KenLM, ConvLM, RNNLM, etc.
@@ -36,6 +53,31 @@ class LM {
       const LMStatePtr& state,
       const int usrTokenIdx) = 0;
 
+  /**
+   * Query the language model for a batch of (state, token) pairs at once.
+   * `outStates` and `outScores` are resized to the number of queries and
+   * filled in query order. Decoders gather all the queries of a frame into
+   * one call, so that implementations can share lookups between queries or
+   * batch network evaluations. By default, each query goes through score().
+   */
+  virtual void scoreBatch(
+      const std::vector<LMStatePtr>& states,
+      const std::vector<int>& usrTokenIdx,
+      std::vector<LMStatePtr>& outStates,
+      std::vector<float>& outScores) {
+    if (states.size() != usrTokenIdx.size()) {
+      throw std::invalid_argument(
+          "[LM] Number of states and tokens mismatch in batch query");
+    }
+    outStates.resize(states.size());
+    outScores.resize(states.size());
+    for (size_t i = 0; i < states.size(); i++) {
+      auto lmScoreReturn = score(states[i], usrTokenIdx[i]);
+      outStates[i] = std::move(lmScoreReturn.first);
+      outScores[i] = lmScoreReturn.second;
+    }
+  }
+
   /* Query the language model and finish decoding. */
   virtual std::pair<LMStatePtr, float> finish(const LMStatePtr& state) = 0;
 
@@ -43,6 +85,13 @@ class LM {
   virtual int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
       const = 0;
 
+  /**
+   * Hash a language model state. States for which compareState() returns 0
+   * must have the same hash: decoders use it to find hypotheses to merge
+   * without comparing all pairs of states.
+   */
+  virtual size_t stateHash(const LMStatePtr& state) const = 0;
+
   /* Update LM caches (optional) given a bunch of new states generated */
   virtual void updateCache(std::vector<LMStatePtr> stateIdices) {}
 
@@ -0,0 +1,122 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "libraries/lm/SharedCachingLM.h"
+
+#include <stdexcept>
+#include <string>
+
+namespace w2l {
+
+constexpr int SharedCachingLM::kMaxProbe;
+constexpr int SharedCachingLM::kNumShards;
+
+SharedCachingLM::SharedCachingLM(const LMPtr& lm, int cacheSize) : lm_(lm) {
+  if (!lm_) {
+    throw std::invalid_argument(
+        "[SharedCachingLM] No language model to cache");
+  }
+  if (cacheSize < 1) {
+    throw std::invalid_argument(
+        "[SharedCachingLM] Invalid cache size: " + std::to_string(cacheSize));
+  }
+  size_t tableSize = 1;
+  while (tableSize * kNumShards < static_cast<size_t>(cacheSize)) {
+    tableSize <<= 1;
+  }
+  mask_ = tableSize - 1;
+  for (int i = 0; i < kNumShards; i++) {
+    shards_.emplace_back(new Shard());
+    shards_.back()->table.resize(tableSize);
+  }
+}
+
+LMStatePtr SharedCachingLM::start(bool startWithNothing) {
+  // Entries are keyed by content: they stay valid for the next sentences
+  return lm_->start(startWithNothing);
+}
+
+std::pair<LMStatePtr, float> SharedCachingLM::score(
+    const LMStatePtr& state,
+    const int usrTokenIdx) {
+  size_t stateHash = lm_->stateHash(state);
+  size_t hash =
+      stateHash ^ (static_cast<size_t>(usrTokenIdx) * 0x9e3779b97f4a7c15ULL);
+  hash ^= hash >> 29;
+  Shard& shard = *shards_[hash % kNumShards];
+  size_t home = (hash / kNumShards) & mask_;
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    size_t idx = home;
+    for (int i = 0; i < kMaxProbe; i++, idx = (idx + 1) & mask_) {
+      const Entry& entry = shard.table[idx];
+      if (!entry.state) {
+        break;
+      }
+      if (entry.stateHash == stateHash && entry.token == usrTokenIdx &&
+          lm_->compareState(entry.state, state) == 0) {
+        ++shard.stats.hits;
+        return std::make_pair(entry.outState, entry.score);
+      }
+    }
+    ++shard.stats.misses;
+  }
+
+  // Threads missing the same query concurrently both score it
+  auto lmScoreReturn = lm_->score(state, usrTokenIdx);
+
+  std::lock_guard<std::mutex> lock(shard.mutex);
+  size_t idx = home;
+  for (int i = 0; i < kMaxProbe; i++, idx = (idx + 1) & mask_) {
+    if (!shard.table[idx].state) {
+      break;
+    }
+  }
+  if (shard.table[idx].state) {
+    // All the probed slots are taken: evict the entry at home
+    idx = home;
+  }
+  Entry& entry = shard.table[idx];
+  entry.state = state;
+  entry.stateHash = stateHash;
+  entry.token = usrTokenIdx;
+  entry.outState = lmScoreReturn.first;
+  entry.score = lmScoreReturn.second;
+  return lmScoreReturn;
+}
+
+std::pair<LMStatePtr, float> SharedCachingLM::finish(const LMStatePtr& state) {
+  return lm_->finish(state);
+}
+
+int SharedCachingLM::compareState(
+    const LMStatePtr& state1,
+    const LMStatePtr& state2) const {
+  return lm_->compareState(state1, state2);
+}
+
+size_t SharedCachingLM::stateHash(const LMStatePtr& state) const {
+  return lm_->stateHash(state);
+}
+
+void SharedCachingLM::updateCache(std::vector<LMStatePtr> states) {
+  lm_->updateCache(std::move(states));
+}
+
+SharedCachingLM::CacheStats SharedCachingLM::getStats() const {
+  CacheStats stats;
+  for (const auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    stats.hits += shard->stats.hits;
+    stats.misses += shard->stats.misses;
+  }
+  return stats;
+}
+
+} // namespace w2l
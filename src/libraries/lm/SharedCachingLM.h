@@ -0,0 +1,81 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+
+#include "libraries/lm/LM.h"
+
+namespace w2l {
+
+/**
+ * SharedCachingLM memoizes the queries made to another language model for
+ * several decoders running in parallel, e.g. the configurations of a
+ * hyper-parameter sweep decoding the same utterances. Unlike CachingLM, it is
+ * keyed by state content (stateHash() and compareState() of the wrapped LM)
+ * rather than identity, so that decoders share the queries of the states
+ * they reach independently, and it is kept across sentences.
+ *
+ * The cache is split into shards, each a bounded open-addressed table behind
+ * its own mutex. The wrapped LM is called outside of the locks and must be
+ * thread-safe (KenLM, ZeroLM); ConvLM keeps a cache per decoding thread.
+ */
+class SharedCachingLM : public LM {
+ public:
+  using CacheStats = LMCacheStats;
+
+  /* `cacheSize` is rounded up to a power of two per shard */
+  SharedCachingLM(const LMPtr& lm, int cacheSize);
+
+  LMStatePtr start(bool startWithNothing) override;
+
+  std::pair<LMStatePtr, float> score(
+      const LMStatePtr& state,
+      const int usrTokenIdx) override;
+
+  std::pair<LMStatePtr, float> finish(const LMStatePtr& state) override;
+
+  int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
+      const override;
+
+  size_t stateHash(const LMStatePtr& state) const override;
+
+  void updateCache(std::vector<LMStatePtr> states) override;
+
+  /* Counters of all the threads since construction */
+  CacheStats getStats() const;
+
+ private:
+  struct Entry {
+    LMStatePtr state; // Input state, nullptr for empty slots
+    size_t stateHash;
+    int token;
+    LMStatePtr outState;
+    float score;
+  };
+
+  struct Shard {
+    std::mutex mutex;
+    std::vector<Entry> table;
+    CacheStats stats;
+  };
+
+  // Slots probed before giving up on a lookup or evicting on an insertion
+  static constexpr int kMaxProbe = 4;
+  static constexpr int kNumShards = 64;
+
+  LMPtr lm_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+  size_t mask_; // Of the table of each shard
+};
+
+using SharedCachingLMPtr = std::shared_ptr<SharedCachingLM>;
+
+} // namespace w2l
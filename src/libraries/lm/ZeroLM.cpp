@@ -8,6 +8,7 @@
 
 #include "libraries/lm/ZeroLM.h"
 
+#include <functional>
 #include <stdexcept>
 
 namespace w2l {
@@ -36,6 +37,10 @@ int ZeroLM::compareState(const LMStatePtr& state1, const LMStatePtr& state2)
   return inState1->token < inState2->token ? -1 : 1;
 }
 
+size_t ZeroLM::stateHash(const LMStatePtr& state) const {
+  return std::hash<int>()(getRawState(state)->token);
+}
+
 ZeroLMState* ZeroLM::getRawState(const LMStatePtr& state) {
   return static_cast<ZeroLMState*>(state.get());
 }
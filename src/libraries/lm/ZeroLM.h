@@ -35,6 +35,8 @@ class ZeroLM : public LM {
   int compareState(const LMStatePtr& state1, const LMStatePtr& state2)
       const override;
 
+  size_t stateHash(const LMStatePtr& state) const override;
+
  private:
   static ZeroLMState* getRawState(const LMStatePtr& state);
 };
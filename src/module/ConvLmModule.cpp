@@ -8,6 +8,10 @@
 
 #include "module/ConvLmModule.h"
 
+#include <algorithm>
+#include <array>
+#include <map>
+#include <random>
 #include <string>
 
 #include "common/FlashlightUtils.h"
@@ -15,6 +19,214 @@
 using namespace fl;
 
 namespace w2l {
+
+namespace {
+
+// Frames of the probe input, more than any module may look back at
+constexpr int kProbeFrames = 61;
+// Batch size of the probe input, distinct from the other dimensions
+constexpr int kProbeBatch = 7;
+// Tokens of the probe input are in [0, kProbeTokens), valid for any vocabulary
+constexpr int kProbeTokens = 4;
+
+struct ConvLmActivations {
+  int length; // Number of tokens in the history
+  // Inputs of each module for the last min(length, lookBack) frames
+  std::vector<af::array> inputs;
+};
+
+struct ConvLmLayout {
+  std::vector<std::shared_ptr<fl::Module>> modules;
+  // Time and batch dimensions of the input of each module, then of the output
+  std::vector<int> timeDims;
+  std::vector<int> batchDims;
+  // Number of previous frames each module looks at
+  std::vector<int> lookBack;
+  int maxLookBack;
+};
+
+// Returns the only dimension of size `size`, or -1
+int findDim(const af::dim4& dims, dim_t size) {
+  int found = -1;
+  for (int d = 0; d < 4; d++) {
+    if (dims[d] == size) {
+      if (found >= 0) {
+        return -1;
+      }
+      found = d;
+    }
+  }
+  return found;
+}
+
+std::array<af::seq, 4> spanAll() {
+  return {af::span, af::span, af::span, af::span};
+}
+
+// Returns `in` with dimension `dim` moved to the front (or the back)
+af::array moveDim(const af::array& in, int dim, bool toFront) {
+  std::vector<unsigned> order;
+  for (unsigned d = 0; d < 4; d++) {
+    if (d != dim) {
+      order.push_back(d);
+    }
+  }
+  order.insert(toFront ? order.begin() : order.end(), dim);
+  return af::reorder(in, order[0], order[1], order[2], order[3]);
+}
+
+ConvLmLayout measureLayout(std::shared_ptr<fl::Module> network) {
+  auto sequential = std::dynamic_pointer_cast<fl::Sequential>(network);
+  if (!sequential) {
+    throw std::invalid_argument(
+        "[ConvLM] Incremental scoring needs a Sequential network");
+  }
+  ConvLmLayout layout;
+  layout.modules = sequential->modules();
+  layout.maxLookBack = 0;
+
+  std::mt19937 gen(0);
+  std::vector<int> tokens(kProbeFrames * kProbeBatch);
+  for (auto& token : tokens) {
+    token = gen() % kProbeTokens;
+  }
+  af::array x(kProbeFrames, kProbeBatch, tokens.data());
+  for (const auto& module : layout.modules) {
+    int timeDim = findDim(x.dims(), kProbeFrames);
+    int batchDim = findDim(x.dims(), kProbeBatch);
+    if (timeDim < 0 || batchDim < 0) {
+      throw std::invalid_argument(
+          "[ConvLM] Cannot find the time and batch dimensions of the input "
+          "of " +
+          module->prettyString());
+    }
+    layout.timeDims.push_back(timeDim);
+    layout.batchDims.push_back(batchDim);
+
+    // Which output frames change with one input frame
+    const int frame = kProbeFrames / 2;
+    auto sel = spanAll();
+    sel[timeDim] = af::seq(frame, frame);
+    af::array perturbed = x.copy();
+    af::array values = x(sel[0], sel[1], sel[2], sel[3]);
+    if (x.isinteger()) {
+      perturbed(sel[0], sel[1], sel[2], sel[3]) =
+          af::rem(values + 1, kProbeTokens).as(x.type());
+    } else {
+      perturbed(sel[0], sel[1], sel[2], sel[3]) =
+          values + af::randn(values.dims(), values.type());
+    }
+    auto out = module->forward({fl::input(x)}).front().array();
+    auto outPerturbed = module->forward({fl::input(perturbed)}).front().array();
+    int outTimeDim = findDim(out.dims(), kProbeFrames);
+    if (outTimeDim < 0) {
+      throw std::invalid_argument(
+          "[ConvLM] Number of frames changed by " + module->prettyString());
+    }
+    auto diff = moveDim(
+        af::abs(out.as(f32) - outPerturbed.as(f32)),
+        outTimeDim,
+        /* toFront = */ true);
+    diff = af::moddims(diff, kProbeFrames, diff.elements() / kProbeFrames);
+    auto changes = afToVector<float>(af::max(diff, 1));
+    float tolerance = 1e-4 * (1 + af::max<float>(af::abs(out.as(f32))));
+    int lastChanged = frame;
+    for (int t = 0; t < kProbeFrames; t++) {
+      if (changes[t] > tolerance) {
+        if (t < frame) {
+          throw std::invalid_argument(
+              "[ConvLM] Module is not causal: " + module->prettyString());
+        }
+        lastChanged = t;
+      }
+    }
+    if (lastChanged == kProbeFrames - 1) {
+      throw std::invalid_argument(
+          "[ConvLM] Module looks back too far: " + module->prettyString());
+    }
+    layout.lookBack.push_back(lastChanged - frame);
+    layout.maxLookBack = std::max(layout.maxLookBack, lastChanged - frame);
+    x = out;
+  }
+  int timeDim = findDim(x.dims(), kProbeFrames);
+  int batchDim = findDim(x.dims(), kProbeBatch);
+  if (timeDim < 0 || batchDim < 0) {
+    throw std::invalid_argument(
+        "[ConvLM] Cannot find the time and batch dimensions of the output");
+  }
+  layout.timeDims.push_back(timeDim);
+  layout.batchDims.push_back(batchDim);
+  return layout;
+}
+
+// Scores queries whose histories keep the same number of frames
+void scoreIncrementally(
+    const ConvLmLayout& layout,
+    const std::vector<int>& queries,
+    const std::vector<std::shared_ptr<void>>& prevActivations,
+    const std::vector<int>& tokens,
+    std::vector<std::shared_ptr<void>>& activations,
+    std::vector<std::vector<float>>& scores) {
+  const int batchSize = queries.size();
+  std::vector<const ConvLmActivations*> prev(batchSize);
+  std::vector<std::shared_ptr<ConvLmActivations>> next(batchSize);
+  std::vector<int> batchTokens(batchSize);
+  for (int b = 0; b < batchSize; b++) {
+    prev[b] = static_cast<const ConvLmActivations*>(
+        prevActivations[queries[b]].get());
+    next[b] = std::make_shared<ConvLmActivations>();
+    next[b]->length = (prev[b] ? prev[b]->length : 0) + 1;
+    next[b]->inputs.resize(layout.modules.size());
+    batchTokens[b] = tokens[queries[b]];
+  }
+  const int prevLength = next[0]->length - 1;
+
+  af::array x(1, batchSize, batchTokens.data());
+  for (int m = 0; m < layout.modules.size(); m++) {
+    const int timeDim = layout.timeDims[m];
+    const int batchDim = layout.batchDims[m];
+    const int nPast = std::min(prevLength, layout.lookBack[m]);
+    // The module runs on the frames it looks at, the last one being new
+    af::array window = x;
+    if (nPast > 0) {
+      auto dims = x.dims();
+      dims[timeDim] = nPast;
+      af::array past(dims, x.type());
+      for (int b = 0; b < batchSize; b++) {
+        auto sel = spanAll();
+        sel[batchDim] = af::seq(b, b);
+        past(sel[0], sel[1], sel[2], sel[3]) = prev[b]->inputs[m];
+      }
+      window = af::join(timeDim, past, x);
+    }
+    const int nKeep = std::min(nPast + 1, layout.lookBack[m]);
+    for (int b = 0; nKeep > 0 && b < batchSize; b++) {
+      auto sel = spanAll();
+      sel[timeDim] = af::seq(nPast + 1 - nKeep, nPast);
+      sel[batchDim] = af::seq(b, b);
+      next[b]->inputs[m] = window(sel[0], sel[1], sel[2], sel[3]);
+    }
+    auto out = layout.modules[m]->forward({fl::input(window)}).front().array();
+    auto sel = spanAll();
+    sel[layout.timeDims[m + 1]] = af::seq(nPast, nPast);
+    x = out(sel[0], sel[1], sel[2], sel[3]);
+  }
+
+  if (af::anyTrue<bool>(af::isNaN(x))) {
+    throw std::runtime_error("[ConvLM] Encountered NaNs in propagation");
+  }
+  auto values = afToVector<float>(
+      moveDim(x, layout.batchDims.back(), /* toFront = */ false));
+  const int vocabSize = values.size() / batchSize;
+  for (int b = 0; b < batchSize; b++) {
+    scores[queries[b]].assign(
+        values.begin() + b * vocabSize, values.begin() + (b + 1) * vocabSize);
+    activations[queries[b]] = next[b];
+  }
+}
+
+} // namespace
+
 GetConvLmScoreFunc buildGetConvLmScoreFunction(
     std::shared_ptr<fl::Module> network) {
   auto getConvLmScoreFunc = [network](
@@ -59,4 +271,41 @@ GetConvLmScoreFunc buildGetConvLmScoreFunction(
 
   return getConvLmScoreFunc;
 }
+
+GetConvLmIncrementalScoreFunc buildGetConvLmIncrementalScoreFunction(
+    std::shared_ptr<fl::Module> network) {
+  auto layout = std::make_shared<ConvLmLayout>(measureLayout(network));
+  auto getConvLmIncrementalScoreFunc =
+      [network, layout](
+          const std::vector<std::shared_ptr<void>>& prevActivations,
+          const std::vector<int>& tokens,
+          std::vector<std::shared_ptr<void>>& activations) {
+        if (prevActivations.size() != tokens.size()) {
+          throw std::invalid_argument(
+              "[ConvLM] Number of histories and tokens mismatch");
+        }
+        std::vector<std::vector<float>> scores(tokens.size());
+        activations.assign(tokens.size(), nullptr);
+        // Histories longer than any module looks back at are alike
+        std::map<int, std::vector<int>> groups;
+        for (int i = 0; i < tokens.size(); i++) {
+          auto prev =
+              static_cast<const ConvLmActivations*>(prevActivations[i].get());
+          int length = prev ? prev->length : 0;
+          groups[std::min(length, layout->maxLookBack)].push_back(i);
+        }
+        for (const auto& group : groups) {
+          scoreIncrementally(
+              *layout,
+              group.second,
+              prevActivations,
+              tokens,
+              activations,
+              scores);
+        }
+        return scores;
+      };
+
+  return getConvLmIncrementalScoreFunc;
+}
 } // namespace w2l
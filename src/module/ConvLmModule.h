@@ -19,4 +19,24 @@ using GetConvLmScoreFunc = std::function<std::vector<std::vector<
 GetConvLmScoreFunc buildGetConvLmScoreFunction(
     std::shared_ptr<fl::Module> network);
 
+using GetConvLmIncrementalScoreFunc =
+    std::function<std::vector<std::vector<float>>(
+        const std::vector<std::shared_ptr<void>>&,
+        const std::vector<int>&,
+        std::vector<std::shared_ptr<void>>&)>;
+
+/**
+ * Scores one new token per history, running each module of `network` (a
+ * Sequential) on the few frames it needs instead of the whole history. The
+ * activations of a history keep, for each module, its inputs for the last
+ * frames of the history that the module looks back at.
+ *
+ * The time and batch dimensions of each module input and how far back each
+ * module looks are measured on a random input when building the function,
+ * which throws std::invalid_argument if they can't be determined or if a
+ * module is not causal.
+ */
+GetConvLmIncrementalScoreFunc buildGetConvLmIncrementalScoreFunction(
+    std::shared_ptr<fl::Module> network);
+
 } // namespace w2l
@@ -70,6 +70,61 @@ TEST(W2lModuleTest, Serialization) {
   ASSERT_TRUE(allClose(outputl, output));
 }
 
+TEST(W2lModuleTest, ConvLmIncrementalScore) {
+  int nchannel = 8, nvocab = 6;
+  auto model = std::make_shared<Sequential>();
+  model->add(std::make_shared<Embedding>(nchannel, nvocab));
+  model->add(std::make_shared<Reorder>(1, 3, 0, 2));
+  for (int kernel : {3, 4}) {
+    model->add(std::make_shared<AsymmetricConv1D>(
+        nchannel, 2 * nchannel, kernel, 1, -1, 0));
+    model->add(std::make_shared<GatedLinearUnit>(2));
+  }
+  model->add(std::make_shared<Reorder>(2, 0, 3, 1));
+  model->add(std::make_shared<Linear>(nchannel, nvocab));
+  model->add(std::make_shared<LogSoftmax>(0));
+  model->eval();
+
+  auto getScore = buildGetConvLmScoreFunction(model);
+  auto getIncrementalScore = buildGetConvLmIncrementalScoreFunction(model);
+
+  // Two histories extended together, the second one starting later
+  std::vector<int> tokens = {1, 4, 5, 0, 3, 3, 2, 4, 1, 0};
+  const int delay = 3;
+  std::vector<std::shared_ptr<void>> activations(2);
+  for (int t = 0; t < tokens.size(); t++) {
+    std::vector<std::shared_ptr<void>> prevActivations = {activations[0]};
+    std::vector<int> lastTokens = {tokens[t]};
+    if (t >= delay) {
+      prevActivations.push_back(activations[1]);
+      lastTokens.push_back(tokens[t - delay]);
+    }
+    auto scores =
+        getIncrementalScore(prevActivations, lastTokens, activations);
+    ASSERT_EQ(scores.size(), lastTokens.size());
+    for (int b = 0; b < scores.size(); b++) {
+      int length = t + 1 - b * delay;
+      std::vector<int> history(tokens.begin(), tokens.begin() + length);
+      auto expected = getScore(history, {length - 1}, -1, 1)[0];
+      ASSERT_EQ(scores[b].size(), nvocab);
+      for (int i = 0; i < nvocab; i++) {
+        ASSERT_NEAR(scores[b][i], expected[i], 1e-4);
+      }
+    }
+    activations.resize(2);
+  }
+
+  // Non causal networks are rejected
+  auto nonCausal = std::make_shared<Sequential>();
+  nonCausal->add(std::make_shared<Embedding>(nchannel, nvocab));
+  nonCausal->add(std::make_shared<Reorder>(1, 3, 0, 2));
+  nonCausal->add(std::make_shared<AsymmetricConv1D>(
+      nchannel, nchannel, 3, 1, -1, 0.5));
+  ASSERT_THROW(
+      buildGetConvLmIncrementalScoreFunction(nonCausal),
+      std::invalid_argument);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
 
@@ -10,6 +10,7 @@
 
 #include "data/W2lBlobsDataset.h"
 #include "data/W2lListFilesDataset.h"
+#include "data/W2lPackedDataset.h"
 #include "runtime/Data.h"
 
 #ifdef W2L_BUILD_FB_DEPENDENCIES
@@ -27,6 +28,8 @@ std::shared_ptr<W2lDataset> createDataset(
     int worldSize /* = 1 */,
     bool fallback2Ltr /* = true */,
     bool skipUnk /* = true */) {
+  LOG_IF(FATAL, FLAGS_blobdata && FLAGS_packeddata)
+      << "-blobdata and -packeddata are mutually exclusive";
   std::shared_ptr<W2lDataset> ds;
   if (FLAGS_everstoredb) {
 #ifdef W2L_BUILD_FB_DEPENDENCIES
@@ -57,6 +60,17 @@ std::shared_ptr<W2lDataset> createDataset(
         fallback2Ltr,
         skipUnk,
         FLAGS_datadir);
+  } else if (FLAGS_packeddata) {
+    ds = std::make_shared<W2lPackedDataset>(
+        path,
+        dicts,
+        lexicon,
+        batchSize,
+        worldRank,
+        worldSize,
+        fallback2Ltr,
+        skipUnk,
+        FLAGS_datadir);
   } else {
     ds = std::make_shared<W2lListFilesDataset>(
         path,
@@ -0,0 +1,406 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include "runtime/EmissionStore.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace w2l {
+
+namespace {
+
+constexpr const char kEmissionMagic[] = "W2LEMIS1";
+constexpr const char kIndexMagic[] = "W2LEMIDX";
+constexpr int64_t kMagicSize = 8;
+constexpr int64_t kHeaderSize = kMagicSize + sizeof(int32_t);
+constexpr int64_t kTrailerSize = sizeof(int64_t) + kMagicSize;
+
+int64_t alignUp(int64_t size) {
+  return (size + 7) & ~int64_t(7);
+}
+
+// Size of the record of an utterance with T frames, before alignment
+int64_t recordSize(EmissionType type, int64_t T, int64_t N) {
+  switch (type) {
+    case EmissionType::FLOAT32:
+      return T * N * sizeof(float);
+    case EmissionType::FLOAT16:
+      return T * N * sizeof(uint16_t);
+    case EmissionType::UINT8:
+      return T * 2 * sizeof(float) + T * N;
+  }
+  throw std::invalid_argument("invalid emission type");
+}
+
+// IEEE 754 half precision, rounding to nearest even
+uint16_t floatToHalf(float value) {
+  uint32_t x;
+  memcpy(&x, &value, sizeof(x));
+  uint16_t sign = (x >> 16) & 0x8000;
+  uint32_t absx = x & 0x7fffffff;
+  if (absx >= 0x7f800000) {
+    // inf, nan
+    return sign | 0x7c00 | (absx > 0x7f800000 ? 0x200 : 0);
+  }
+  if (absx >= 0x477ff000) {
+    // rounds to 65536 or more
+    return sign | 0x7c00;
+  }
+  if (absx < 0x38800000) {
+    // subnormal: multiples of 2^-24
+    float f;
+    memcpy(&f, &absx, sizeof(f));
+    return sign | static_cast<uint16_t>(std::nearbyint(f * 16777216.0f));
+  }
+  uint32_t half = (absx >> 13) - (112 << 10);
+  uint32_t rest = absx & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    ++half;
+  }
+  return sign | half;
+}
+
+float halfToFloat(uint16_t h) {
+  uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    float f = std::ldexp(static_cast<float>(mantissa), -24);
+    return sign ? -f : f;
+  }
+  uint32_t x = (exponent == 31)
+      ? (sign | 0x7f800000 | (mantissa << 13))
+      : (sign | ((exponent + 112) << 23) | (mantissa << 13));
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+template <typename T>
+void appendPod(std::string& buf, const T& value) {
+  buf.append(reinterpret_cast<const char*>(&value), sizeof(T));
+}
+
+void appendString(std::string& buf, const std::string& str) {
+  appendPod<int64_t>(buf, str.size());
+  buf.append(str);
+}
+
+template <typename T>
+void appendVector(std::string& buf, const std::vector<T>& vec) {
+  appendPod<int64_t>(buf, vec.size());
+  buf.append(
+      reinterpret_cast<const char*>(vec.data()), vec.size() * sizeof(T));
+}
+
+// Reads the index of an emission file, throwing on truncated data
+class IndexParser {
+ public:
+  IndexParser(const char* begin, const char* end, const std::string& path)
+      : cur_(begin), end_(end), path_(path) {}
+
+  template <typename T>
+  T pod() {
+    T value;
+    memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string string() {
+    auto size = length(1);
+    return std::string(take(size), size);
+  }
+
+  template <typename T>
+  std::vector<T> vector() {
+    auto size = length(sizeof(T));
+    std::vector<T> vec(size);
+    if (size > 0) {
+      memcpy(vec.data(), take(size * sizeof(T)), size * sizeof(T));
+    }
+    return vec;
+  }
+
+  // Reads the length of a sequence of elements of `elementSize` bytes
+  int64_t length(int64_t elementSize) {
+    auto size = pod<int64_t>();
+    if (size < 0 || size > (end_ - cur_) / elementSize) {
+      fail();
+    }
+    return size;
+  }
+
+ private:
+  const char* cur_;
+  const char* end_;
+  const std::string& path_;
+
+  const char* take(int64_t size) {
+    if (size > end_ - cur_) {
+      fail();
+    }
+    auto data = cur_;
+    cur_ += size;
+    return data;
+  }
+
+  [[noreturn]] void fail() {
+    throw std::runtime_error("EmissionReader: invalid index in " + path_);
+  }
+};
+
+} // namespace
+
+EmissionType emissionTypeFromString(const std::string& type) {
+  if (type == "f32") {
+    return EmissionType::FLOAT32;
+  } else if (type == "f16") {
+    return EmissionType::FLOAT16;
+  } else if (type == "u8") {
+    return EmissionType::UINT8;
+  }
+  throw std::invalid_argument("invalid emission type '" + type + "'");
+}
+
+EmissionWriter::EmissionWriter(const std::string& path, EmissionType type)
+    : path_(path), type_(type), offset_(0), N_(-1) {
+  file_.open(path_, std::ios::binary | std::ios::trunc);
+  if (!file_.is_open()) {
+    throw std::runtime_error("EmissionWriter: could not open file " + path_);
+  }
+  int32_t typeId = static_cast<int32_t>(type_);
+  write(kEmissionMagic, kMagicSize);
+  write(&typeId, sizeof(typeId));
+  std::vector<char> padding(alignUp(kHeaderSize) - kHeaderSize, 0);
+  write(padding.data(), padding.size());
+}
+
+void EmissionWriter::add(
+    const std::string& sampleId,
+    const float* emission,
+    int64_t T,
+    int64_t N,
+    const std::vector<int>& tokenTarget,
+    const std::vector<std::string>& wordTarget) {
+  if (T < 0 || N <= 0 || (N_ >= 0 && N != N_)) {
+    throw std::invalid_argument("EmissionWriter: invalid emission dims");
+  }
+  N_ = N;
+  infos_.push_back({sampleId, offset_, T, tokenTarget, wordTarget});
+
+  int64_t numel = T * N;
+  std::vector<char> record(alignUp(recordSize(type_, T, N)), 0);
+  if (type_ == EmissionType::FLOAT32) {
+    if (numel > 0) {
+      memcpy(record.data(), emission, numel * sizeof(float));
+    }
+  } else if (type_ == EmissionType::FLOAT16) {
+    auto out = reinterpret_cast<uint16_t*>(record.data());
+    for (int64_t i = 0; i < numel; ++i) {
+      out[i] = floatToHalf(emission[i]);
+    }
+  } else {
+    auto ranges = reinterpret_cast<float*>(record.data());
+    auto out =
+        reinterpret_cast<uint8_t*>(record.data()) + T * 2 * sizeof(float);
+    for (int64_t t = 0; t < T; ++t) {
+      const float* frame = emission + t * N;
+      // The range covers the finite values, others are clamped into it
+      // (NaN to its min). Computed in double, as max - min may overflow.
+      double min = std::numeric_limits<double>::infinity();
+      double max = -min;
+      for (int64_t n = 0; n < N; ++n) {
+        if (std::isfinite(frame[n])) {
+          min = std::min<double>(min, frame[n]);
+          max = std::max<double>(max, frame[n]);
+        }
+      }
+      if (min > max) {
+        min = max = std::numeric_limits<float>::lowest();
+      }
+      float step = (max - min) / 255.0;
+      ranges[2 * t] = min;
+      ranges[2 * t + 1] = step;
+      for (int64_t n = 0; n < N; ++n) {
+        double code = (step > 0.0f) ? std::round((frame[n] - min) / step) : 0;
+        out[t * N + n] = (code > 0.0)
+            ? static_cast<uint8_t>(std::min(255.0, code))
+            : 0; // also NaN
+      }
+    }
+  }
+  write(record.data(), record.size());
+}
+
+void EmissionWriter::close(
+    const std::vector<float>& transition,
+    const std::string& gflags) {
+  int64_t indexOffset = offset_;
+  std::string index;
+  appendPod<int64_t>(index, std::max<int64_t>(N_, 0));
+  appendPod<int64_t>(index, infos_.size());
+  for (const auto& info : infos_) {
+    appendString(index, info.sampleId);
+    appendPod<int64_t>(index, info.offset);
+    appendPod<int64_t>(index, info.T);
+    appendVector(index, info.tokenTarget);
+    appendPod<int64_t>(index, info.wordTarget.size());
+    for (const auto& word : info.wordTarget) {
+      appendString(index, word);
+    }
+  }
+  appendVector(index, transition);
+  appendString(index, gflags);
+  appendPod<int64_t>(index, indexOffset);
+  index.append(kIndexMagic, kMagicSize);
+  write(index.data(), index.size());
+  file_.close();
+  if (!file_) {
+    throw std::runtime_error("EmissionWriter: write failed for " + path_);
+  }
+}
+
+void EmissionWriter::write(const void* data, int64_t size) {
+  file_.write(static_cast<const char*>(data), size);
+  if (!file_) {
+    throw std::runtime_error("EmissionWriter: write failed for " + path_);
+  }
+  offset_ += size;
+}
+
+EmissionReader::EmissionReader(const std::string& path)
+    : path_(path), data_(nullptr), size_(0) {
+  int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fd >= 0 && fstat(fd, &st) == 0 && st.st_size > 0) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  std::string reason = strerror(errno);
+  if (fd >= 0) {
+    ::close(fd);
+  }
+  if (addr == MAP_FAILED) {
+    throw std::runtime_error(
+        "EmissionReader: could not map file " + path_ + ": " + reason);
+  }
+  data_ = static_cast<const char*>(addr);
+  size_ = st.st_size;
+
+  try {
+    int64_t size = size_;
+    if (size < alignUp(kHeaderSize) + kTrailerSize ||
+        memcmp(data_, kEmissionMagic, kMagicSize) != 0 ||
+        memcmp(data_ + size - kMagicSize, kIndexMagic, kMagicSize) != 0) {
+      throw std::runtime_error(
+          "EmissionReader: " + path_ + " is not a complete emission file");
+    }
+    int32_t typeId;
+    memcpy(&typeId, data_ + kMagicSize, sizeof(typeId));
+    if (typeId < 0 || typeId > static_cast<int32_t>(EmissionType::UINT8)) {
+      throw std::runtime_error("EmissionReader: invalid type in " + path_);
+    }
+    type_ = static_cast<EmissionType>(typeId);
+    int64_t indexOffset;
+    memcpy(&indexOffset, data_ + size - kTrailerSize, sizeof(indexOffset));
+    if (indexOffset < alignUp(kHeaderSize) ||
+        indexOffset > size - kTrailerSize) {
+      throw std::runtime_error("EmissionReader: invalid index in " + path_);
+    }
+
+    IndexParser parser(data_ + indexOffset, data_ + size - kTrailerSize, path_);
+    N_ = parser.pod<int64_t>();
+    auto numSamples = parser.length(1);
+    infos_.resize(numSamples);
+    for (auto& info : infos_) {
+      info.sampleId = parser.string();
+      info.offset = parser.pod<int64_t>();
+      info.T = parser.pod<int64_t>();
+      info.tokenTarget = parser.vector<int>();
+      info.wordTarget.resize(parser.length(1));
+      for (auto& word : info.wordTarget) {
+        word = parser.string();
+      }
+      if (info.offset < alignUp(kHeaderSize) || info.offset % 8 != 0 ||
+          info.T < 0 || N_ < 0 ||
+          (info.T > 0 && N_ > (indexOffset - info.offset) / info.T) ||
+          info.offset + recordSize(type_, info.T, N_) > indexOffset) {
+        throw std::runtime_error(
+            "EmissionReader: utterance " + info.sampleId +
+            " is out of bounds in " + path_);
+      }
+    }
+    transition_ = parser.vector<float>();
+    gflags_ = parser.string();
+  } catch (...) {
+    munmap(const_cast<char*>(data_), size_);
+    throw;
+  }
+  for (int64_t i = 0; i < size(); ++i) {
+    ids_.emplace(infos_[i].sampleId, i);
+  }
+}
+
+EmissionReader::~EmissionReader() {
+  munmap(const_cast<char*>(data_), size_);
+}
+
+bool EmissionReader::isEmissionFile(const std::string& path) {
+  std::ifstream file(path, std::ios::binary);
+  char magic[kMagicSize];
+  return file.read(magic, kMagicSize) &&
+      memcmp(magic, kEmissionMagic, kMagicSize) == 0;
+}
+
+int64_t EmissionReader::find(const std::string& sampleId) const {
+  auto it = ids_.find(sampleId);
+  return it == ids_.end() ? -1 : it->second;
+}
+
+std::vector<float> EmissionReader::emission(int64_t idx) const {
+  const auto& info = infos_.at(idx);
+  int64_t T = info.T;
+  std::vector<float> out(T * N_);
+  const char* record = data_ + info.offset;
+  if (type_ == EmissionType::FLOAT32) {
+    if (!out.empty()) {
+      memcpy(out.data(), record, out.size() * sizeof(float));
+    }
+  } else if (type_ == EmissionType::FLOAT16) {
+    auto in = reinterpret_cast<const uint16_t*>(record);
+    for (size_t i = 0; i < out.size(); ++i) {
+      out[i] = halfToFloat(in[i]);
+    }
+  } else {
+    auto ranges = reinterpret_cast<const float*>(record);
+    auto in = reinterpret_cast<const uint8_t*>(record) + T * 2 * sizeof(float);
+    for (int64_t t = 0; t < T; ++t) {
+      float min = ranges[2 * t];
+      float step = ranges[2 * t + 1];
+      for (int64_t n = 0; n < N_; ++n) {
+        // The top code may round slightly above the float range
+        out[t * N_ + n] = std::min<double>(
+            double(min) + in[t * N_ + n] * double(step),
+            std::numeric_limits<float>::max());
+      }
+    }
+  }
+  return out;
+}
+
+} // namespace w2l
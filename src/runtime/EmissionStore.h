@@ -0,0 +1,135 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace w2l {
+
+// Emission files hold the emissions of a data set, written one utterance at a
+// time by Test and read back with random access by Decode, so that neither
+// needs all of them in memory. Layout (native endianness):
+//  - header: "W2LEMIS1", then the int32 storage type;
+//  - one record per utterance, 8-byte aligned: its T X N emissions (N
+//    fastest) stored as
+//      FLOAT32 - floats;
+//      FLOAT16 - IEEE half floats;
+//      UINT8 - per frame the float min and step of its finite values, then
+//        for each value round((x - min) / step) as uint8, where non-finite
+//        values are clamped to [0, 255] (-inf and NaN to 0, +inf to 255);
+//  - the index: N, then for each utterance its id, offset, T, token and word
+//    targets, then the transition params and gflags;
+//  - trailer: int64 offset of the index, then "W2LEMIDX".
+// The index is only written by `close()`, so an interrupted Test leaves an
+// invalid file behind.
+
+enum class EmissionType { FLOAT32 = 0, FLOAT16 = 1, UINT8 = 2 };
+
+// Parses f32, f16 or u8
+EmissionType emissionTypeFromString(const std::string& type);
+
+struct EmissionInfo {
+  std::string sampleId;
+  int64_t offset;
+  int64_t T;
+  std::vector<int> tokenTarget;
+  std::vector<std::string> wordTarget;
+};
+
+class EmissionWriter {
+ public:
+  EmissionWriter(const std::string& path, EmissionType type);
+
+  EmissionWriter(const EmissionWriter&) = delete;
+  EmissionWriter& operator=(const EmissionWriter&) = delete;
+
+  // emission - T X N (Col Major), N must be the same for all utterances
+  void add(
+      const std::string& sampleId,
+      const float* emission,
+      int64_t T,
+      int64_t N,
+      const std::vector<int>& tokenTarget,
+      const std::vector<std::string>& wordTarget);
+
+  // Writes the index
+  void close(const std::vector<float>& transition, const std::string& gflags);
+
+ private:
+  std::string path_;
+  EmissionType type_;
+  std::ofstream file_;
+  int64_t offset_;
+  int64_t N_;
+  std::vector<EmissionInfo> infos_;
+
+  void write(const void* data, int64_t size);
+};
+
+class EmissionReader {
+ public:
+  explicit EmissionReader(const std::string& path);
+
+  EmissionReader(const EmissionReader&) = delete;
+  EmissionReader& operator=(const EmissionReader&) = delete;
+
+  ~EmissionReader();
+
+  // True if `path` starts like an emission file
+  static bool isEmissionFile(const std::string& path);
+
+  int64_t size() const {
+    return infos_.size();
+  }
+
+  EmissionType type() const {
+    return type_;
+  }
+
+  int64_t N() const {
+    return N_;
+  }
+
+  const EmissionInfo& info(int64_t idx) const {
+    return infos_.at(idx);
+  }
+
+  // Returns the index of utterance `sampleId`, or -1 if there is none
+  int64_t find(const std::string& sampleId) const;
+
+  // Returns - emissions of utterance `idx`, converted to float, T X N (Col
+  //   Major). Thread-safe.
+  std::vector<float> emission(int64_t idx) const;
+
+  const std::vector<float>& transition() const {
+    return transition_;
+  }
+
+  const std::string& gflags() const {
+    return gflags_;
+  }
+
+ private:
+  std::string path_;
+  EmissionType type_;
+  int64_t N_;
+  std::vector<EmissionInfo> infos_;
+  std::unordered_map<std::string, int64_t> ids_;
+  std::vector<float> transition_;
+  std::string gflags_;
+  // Read-only mapping of the file
+  const char* data_;
+  size_t size_;
+};
+
+} // namespace w2l
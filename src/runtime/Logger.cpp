@@ -48,6 +48,8 @@ std::pair<std::string, std::string> getStatus(
       format("%02d:%02d:%02d", (rt / 60 / 60), (rt / 60) % 60, rt % 60));
   insertItem("bch(ms)", format("%.2f", meters.timer.value() * 1000));
   insertItem("smp(ms)", format("%.2f", meters.sampletimer.value() * 1000));
+  insertItem("stall(ms)", format("%.2f", meters.loadstall.value()[0]));
+  insertItem("pfq", format("%.2f", meters.prefetchdepth.value()[0]));
   insertItem("fwd(ms)", format("%.2f", meters.fwdtimer.value() * 1000));
   insertItem(
       "crit-fwd(ms)", format("%.2f", meters.critfwdtimer.value() * 1000));
@@ -72,8 +74,15 @@ std::pair<std::string, std::string> getStatus(
   insertItem("avg-isz", format("%03d", isztotal / numsamples));
   insertItem("avg-tsz", format("%03d", tsztotal / numsamples));
   insertItem("max-tsz", format("%03d", tszmax));
+  auto paddedisztotal = stats[5];
+  auto unpaddedisztotal = stats[6];
+  insertItem(
+      "pad-eff(%)",
+      paddedisztotal > 0
+          ? format("%5.2f", 100.0 * unpaddedisztotal / paddedisztotal)
+          : "n/a");
 
-  double audioProcSec = isztotal * FLAGS_batchsize;
+  double audioProcSec = paddedisztotal;
   if (FLAGS_pow || FLAGS_mfcc || FLAGS_mfsc) {
     audioProcSec = audioProcSec * FLAGS_framestridems / 1000.0;
   } else {
@@ -165,6 +174,8 @@ void allreduceSet(SpeechStatMeter& mtr, af::array& val) {
   stats.maxInputSz_ = valVec[2] / denom;
   stats.maxTargetSz_ = valVec[3] / denom;
   stats.numSamples_ = valVec[4];
+  stats.totalPaddedInputSz_ = valVec[5];
+  stats.totalUnpaddedInputSz_ = valVec[6];
   mtr.add(stats);
 }
 
@@ -191,6 +202,8 @@ void syncMeter<TrainMeters>(TrainMeters& mtrs) {
   syncMeter(mtrs.critfwdtimer);
   syncMeter(mtrs.bwdtimer);
   syncMeter(mtrs.optimtimer);
+  syncMeter(mtrs.loadstall);
+  syncMeter(mtrs.prefetchdepth);
   syncMeter(mtrs.train.tknEdit);
   syncMeter(mtrs.train.wrdEdit);
   syncMeter(mtrs.train.loss);
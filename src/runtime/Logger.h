@@ -30,6 +30,8 @@ struct TrainMeters {
   fl::TimeMeter critfwdtimer{true};
   fl::TimeMeter bwdtimer{true}; // includes network + criterion time
   fl::TimeMeter optimtimer{true};
+  fl::AverageValueMeter loadstall; // ms per batch waiting for the dataset
+  fl::AverageValueMeter prefetchdepth; // batches queued when one is requested
 
   DatasetMeters train;
   std::map<std::string, DatasetMeters> valid;
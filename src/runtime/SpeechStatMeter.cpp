@@ -19,6 +19,23 @@ void SpeechStatMeter::reset() {
 }
 
 void SpeechStatMeter::add(const af::array& input, const af::array& target) {
+  addBatch(input, target, input.dims(0) * input.dims(3));
+}
+
+void SpeechStatMeter::add(
+    const af::array& input,
+    const af::array& target,
+    const af::array& inputSizes) {
+  int64_t unpaddedInputSz = inputSizes.isempty()
+      ? 0
+      : static_cast<int64_t>(af::sum<double>(inputSizes));
+  addBatch(input, target, unpaddedInputSz);
+}
+
+void SpeechStatMeter::addBatch(
+    const af::array& input,
+    const af::array& target,
+    int64_t unpaddedInputSz) {
   int64_t curInputSz = input.dims(0);
   int64_t curTargetSz = target.dims(0);
 
@@ -29,6 +46,9 @@ void SpeechStatMeter::add(const af::array& input, const af::array& target) {
   stats_.maxTargetSz_ = std::max(stats_.maxTargetSz_, curTargetSz);
 
   stats_.numSamples_ += 1;
+
+  stats_.totalPaddedInputSz_ += curInputSz * input.dims(3);
+  stats_.totalUnpaddedInputSz_ += unpaddedInputSz;
 }
 
 void SpeechStatMeter::add(const SpeechStats& stats) {
@@ -39,6 +59,8 @@ void SpeechStatMeter::add(const SpeechStats& stats) {
   stats_.maxTargetSz_ = std::max(stats_.maxTargetSz_, stats.maxTargetSz_);
 
   stats_.numSamples_ += stats.numSamples_;
+  stats_.totalPaddedInputSz_ += stats.totalPaddedInputSz_;
+  stats_.totalUnpaddedInputSz_ += stats.totalUnpaddedInputSz_;
 }
 
 std::vector<int64_t> SpeechStatMeter::value() {
@@ -55,15 +77,19 @@ void SpeechStats::reset() {
   maxInputSz_ = 0;
   maxTargetSz_ = 0;
   numSamples_ = 0;
+  totalPaddedInputSz_ = 0;
+  totalUnpaddedInputSz_ = 0;
 }
 
 std::vector<int64_t> SpeechStats::toArray() {
-  std::vector<int64_t> arr(5);
+  std::vector<int64_t> arr(7);
   arr[0] = totalInputSz_;
   arr[1] = totalTargetSz_;
   arr[2] = maxInputSz_;
   arr[3] = maxTargetSz_;
   arr[4] = numSamples_;
+  arr[5] = totalPaddedInputSz_;
+  arr[6] = totalUnpaddedInputSz_;
   return arr;
 }
 
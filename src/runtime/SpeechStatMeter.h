@@ -18,6 +18,8 @@ struct SpeechStats {
   int64_t maxInputSz_;
   int64_t maxTargetSz_;
   int64_t numSamples_;
+  int64_t totalPaddedInputSz_; // padded input size times batch size
+  int64_t totalUnpaddedInputSz_; // sum of the input sizes before padding
 
   SpeechStats();
   void reset();
@@ -28,11 +30,21 @@ class SpeechStatMeter {
  public:
   SpeechStatMeter();
   void add(const af::array& input, const af::array& target);
+  // inputSizes - input size of each sample in the batch before padding
+  void add(
+      const af::array& input,
+      const af::array& target,
+      const af::array& inputSizes);
   void add(const SpeechStats& stats);
   std::vector<int64_t> value();
   void reset();
 
  private:
   SpeechStats stats_;
+
+  void addBatch(
+      const af::array& input,
+      const af::array& target,
+      int64_t unpaddedInputSz);
 };
 } // namespace w2l
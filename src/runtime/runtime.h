@@ -10,6 +10,7 @@
 
 #include "runtime/Data.h"
 #include "runtime/Distributed.h"
+#include "runtime/EmissionStore.h"
 #include "runtime/Helpers.h"
 #include "runtime/Logger.h"
 #include "runtime/Optimizer.h"
@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+#include <stdlib.h>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "runtime/EmissionStore.h"
+
+using namespace w2l;
+
+namespace {
+
+std::string getTmpPath(const std::string& key) {
+  const char* user = getenv("USER");
+  std::string userstr = "unknown";
+  if (user != nullptr) {
+    userstr = std::string(user);
+  }
+  return "/tmp/" + userstr + "_test_emission_" + key + ".bin";
+}
+
+std::vector<float> randomEmission(int64_t T, int64_t N, int seed) {
+  std::mt19937 gen(seed);
+  std::normal_distribution<float> dist(0.0f, 5.0f);
+  std::vector<float> emission(T * N);
+  for (auto& x : emission) {
+    x = dist(gen);
+  }
+  return emission;
+}
+
+// Writes utterances of 0, 1, ..., numSamples - 1 frames
+void writeStore(const std::string& path, EmissionType type, int numSamples) {
+  EmissionWriter writer(path, type);
+  for (int i = 0; i < numSamples; ++i) {
+    auto emission = randomEmission(i, 7, i);
+    writer.add(
+        "utt" + std::to_string(i),
+        emission.data(),
+        i,
+        7,
+        std::vector<int>(i, i),
+        std::vector<std::string>(i % 3, "w" + std::to_string(i)));
+  }
+  writer.close({1.0f, -2.0f, 3.5f}, "--flag=1\n");
+}
+
+float maxAbsError(const std::vector<float>& a, const std::vector<float>& b) {
+  float err = 0.0f;
+  for (size_t i = 0; i < a.size(); ++i) {
+    err = std::max(err, std::abs(a[i] - b[i]));
+  }
+  return err;
+}
+
+} // namespace
+
+TEST(EmissionStoreTest, RoundTrip) {
+  const int numSamples = 20;
+  for (auto type :
+       {EmissionType::FLOAT32, EmissionType::FLOAT16, EmissionType::UINT8}) {
+    auto path = getTmpPath(std::to_string(static_cast<int>(type)));
+    writeStore(path, type, numSamples);
+    ASSERT_TRUE(EmissionReader::isEmissionFile(path));
+
+    EmissionReader reader(path);
+    ASSERT_EQ(reader.size(), numSamples);
+    ASSERT_EQ(reader.type(), type);
+    ASSERT_EQ(reader.N(), 7);
+    ASSERT_EQ(reader.transition(), std::vector<float>({1.0f, -2.0f, 3.5f}));
+    ASSERT_EQ(reader.gflags(), "--flag=1\n");
+    ASSERT_EQ(reader.find("utt13"), 13);
+    ASSERT_EQ(reader.find("missing"), -1);
+    // Read out of order
+    for (int i = numSamples - 1; i >= 0; --i) {
+      const auto& info = reader.info(i);
+      ASSERT_EQ(info.sampleId, "utt" + std::to_string(i));
+      ASSERT_EQ(info.T, i);
+      ASSERT_EQ(info.tokenTarget, std::vector<int>(i, i));
+      ASSERT_EQ(
+          info.wordTarget,
+          std::vector<std::string>(i % 3, "w" + std::to_string(i)));
+
+      auto expected = randomEmission(i, 7, i);
+      auto emission = reader.emission(i);
+      ASSERT_EQ(emission.size(), expected.size());
+      if (type == EmissionType::FLOAT32) {
+        ASSERT_EQ(emission, expected);
+      } else if (type == EmissionType::FLOAT16) {
+        // 11 bits of precision, |x| < 32
+        ASSERT_LE(maxAbsError(emission, expected), 32.0f / 2048);
+      } else {
+        // Half a step of a per frame range below 100
+        ASSERT_LE(maxAbsError(emission, expected), 100.0f / 255 / 2);
+      }
+    }
+  }
+}
+
+TEST(EmissionStoreTest, Float16) {
+  auto path = getTmpPath("f16");
+  std::vector<float> values = {0.0f,
+                               -0.0f,
+                               1.0f,
+                               -2.5f,
+                               65504.0f,
+                               65519.0f,
+                               65520.0f,
+                               1e10f,
+                               6.1035156e-05f, // smallest normal
+                               5.9604645e-08f, // smallest subnormal
+                               2.9802322e-08f, // half of it, ties to zero
+                               1.0009766f, // 1 + 2^-10
+                               1.0004883f, // 1 + 2^-11, ties to even
+                               1.0014648f}; // 1 + 3 * 2^-11, ties to even
+  std::vector<float> expected = {0.0f,
+                                 -0.0f,
+                                 1.0f,
+                                 -2.5f,
+                                 65504.0f,
+                                 65504.0f,
+                                 INFINITY,
+                                 INFINITY,
+                                 6.1035156e-05f,
+                                 5.9604645e-08f,
+                                 0.0f,
+                                 1.0009766f,
+                                 1.0f,
+                                 1.0019531f};
+  {
+    EmissionWriter writer(path, EmissionType::FLOAT16);
+    writer.add("a", values.data(), values.size(), 1, {}, {});
+    writer.close({}, "");
+  }
+  EmissionReader reader(path);
+  ASSERT_EQ(reader.emission(0), expected);
+  ASSERT_TRUE(std::signbit(reader.emission(0)[1]));
+}
+
+TEST(EmissionStoreTest, Uint8NonFinite) {
+  auto path = getTmpPath("u8");
+  const float inf = std::numeric_limits<float>::infinity();
+  const float big = std::numeric_limits<float>::max();
+  // T X N = 4 X 3 (N fastest)
+  std::vector<float> values = {-inf, -1.0f, -3.0f, // -inf in a frame
+                               -big, big, 0.0f, // range overflowing floats
+                               -inf, -inf, -inf, // no finite value
+                               NAN, inf, 2.0f};
+  {
+    EmissionWriter writer(path, EmissionType::UINT8);
+    writer.add("a", values.data(), 4, 3, {}, {});
+    writer.close({}, "");
+  }
+  EmissionReader reader(path);
+  auto emission = reader.emission(0);
+  ASSERT_EQ(emission.size(), values.size());
+  for (auto x : emission) {
+    ASSERT_TRUE(std::isfinite(x));
+  }
+  // Non-finite values are clamped to the range of the finite ones
+  ASSERT_EQ(emission[0], -3.0f);
+  ASSERT_NEAR(emission[1], -1.0f, 2.0f / 255 / 2);
+  ASSERT_EQ(emission[2], -3.0f);
+  ASSERT_EQ(emission[3], -big);
+  ASSERT_EQ(emission[4], big);
+  ASSERT_LE(std::abs(emission[5]), big / 255);
+  ASSERT_EQ(emission[6], std::numeric_limits<float>::lowest());
+  ASSERT_EQ(emission[9], 2.0f);
+  ASSERT_EQ(emission[10], 2.0f);
+  ASSERT_EQ(emission[11], 2.0f);
+}
+
+TEST(EmissionStoreTest, ConcurrentReads) {
+  auto path = getTmpPath("concurrent");
+  writeStore(path, EmissionType::FLOAT32, 50);
+  EmissionReader reader(path);
+  std::vector<std::thread> threads;
+  std::vector<int> errors(4, 0);
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&reader, &errors, t]() {
+      for (int i = t; i < reader.size(); i += 4) {
+        if (reader.emission(i) != randomEmission(i, 7, i)) {
+          ++errors[t];
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  ASSERT_EQ(errors, std::vector<int>(4, 0));
+}
+
+TEST(EmissionStoreTest, InvalidFiles) {
+  auto path = getTmpPath("invalid");
+  {
+    // No index
+    EmissionWriter writer(path, EmissionType::FLOAT32);
+    auto emission = randomEmission(3, 2, 0);
+    writer.add("a", emission.data(), 3, 2, {}, {});
+  }
+  ASSERT_TRUE(EmissionReader::isEmissionFile(path));
+  ASSERT_THROW(EmissionReader reader(path), std::runtime_error);
+
+  {
+    std::ofstream file(path, std::ios::trunc);
+    file << "not an emission file";
+  }
+  ASSERT_FALSE(EmissionReader::isEmissionFile(path));
+  ASSERT_THROW(EmissionReader reader(path), std::runtime_error);
+  ASSERT_FALSE(EmissionReader::isEmissionFile(getTmpPath("missing")));
+
+  ASSERT_EQ(emissionTypeFromString("u8"), EmissionType::UINT8);
+  ASSERT_THROW(emissionTypeFromString("f64"), std::invalid_argument);
+}
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
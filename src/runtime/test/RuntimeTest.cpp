@@ -97,6 +97,21 @@ TEST(RuntimeTest, SpeechStatMeter) {
   ASSERT_EQ(stats2[2], 5.0);
   ASSERT_EQ(stats2[3], 6.0);
   ASSERT_EQ(stats2[4], 2.0);
+  ASSERT_EQ(stats2[5], 8.0);
+  ASSERT_EQ(stats2[6], 8.0);
+
+  // Batch of 3 samples padded to 4 frames
+  std::array<int, 3> inputSizes{4, 2, 1};
+  meter.reset();
+  meter.add(
+      af::constant(0, 4, 1, 1, 3),
+      af::array(6, b.data()),
+      af::array(3, inputSizes.data()));
+  auto stats3 = meter.value();
+  ASSERT_EQ(stats3[0], 4.0);
+  ASSERT_EQ(stats3[4], 1.0);
+  ASSERT_EQ(stats3[5], 12.0);
+  ASSERT_EQ(stats3[6], 7.0);
 }
 
 int main(int argc, char** argv) {
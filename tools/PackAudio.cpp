@@ -0,0 +1,92 @@
+/**
+ * Copyright (c) Facebook, Inc. and its affiliates.
+ * All rights reserved.
+ *
+ * This source code is licensed under the BSD-style license found in the
+ * LICENSE file in the root directory of this source tree.
+ */
+
+// Packs the audio of list files into a packed audio dataset (see
+// data/PackedAudio.h), to be used for training / testing with -packeddata.
+//
+// Example :
+//   PackAudio -datadir=/data -lists=train-clean-100.lst,train-clean-360.lst \
+//     -packpath=/data/train.packed -packtype=int16 -samplerate=16000
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+
+#include "common/Defines.h"
+#include "common/Utils.h"
+#include "data/PackedAudio.h"
+#include "data/Sound.h"
+
+DEFINE_string(lists, "", "comma-separated list files to pack");
+DEFINE_string(packpath, "", "path of the packed dataset index to write");
+DEFINE_string(packtype, "int16", "type of the packed samples: int16, float32");
+DEFINE_int64(shardsize, 1024, "maximum size of a shard (MB)");
+
+using namespace w2l;
+
+int main(int argc, char** argv) {
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  gflags::SetUsageMessage(
+      "Usage: PackAudio -lists=<list files> -packpath=<output index>");
+  gflags::ParseCommandLineFlags(&argc, &argv, false);
+  if (FLAGS_lists.empty() || FLAGS_packpath.empty()) {
+    LOG(FATAL) << gflags::ProgramUsage();
+  }
+  if (FLAGS_packtype != "int16" && FLAGS_packtype != "float32") {
+    LOG(FATAL) << "Invalid -packtype " << FLAGS_packtype;
+  }
+  auto type = (FLAGS_packtype == "int16") ? PackedAudioType::INT16
+                                          : PackedAudioType::FLOAT32;
+
+  PackedAudioWriter writer(
+      FLAGS_packpath,
+      type,
+      FLAGS_samplerate,
+      FLAGS_channels,
+      FLAGS_shardsize << 20);
+  int64_t numSamples = 0;
+  for (const auto& list : split(',', FLAGS_lists)) {
+    auto listPath = pathsConcat(FLAGS_datadir, trim(list));
+    std::ifstream infile(listPath);
+    LOG_IF(FATAL, !infile) << "Could not read file '" << listPath << "'";
+
+    // [utterance id] [audio file (full path)] [audio length] [word transcripts]
+    std::string line;
+    while (std::getline(infile, line)) {
+      auto tokens = splitOnWhitespace(line, true);
+      LOG_IF(FATAL, tokens.size() < 3) << "Cannot parse " << line;
+      const auto& audioFile = tokens[1];
+      std::vector<std::string> transcript(tokens.begin() + 3, tokens.end());
+
+      // The tree has no resampler: audio must already be at -samplerate
+      auto info = loadSoundInfo(audioFile);
+      LOG_IF(FATAL, info.samplerate != FLAGS_samplerate)
+          << "Sample rate of " << audioFile << " is " << info.samplerate
+          << ", expected " << FLAGS_samplerate;
+      LOG_IF(FATAL, info.channels != FLAGS_channels)
+          << "Number of channels of " << audioFile << " is " << info.channels
+          << ", expected " << FLAGS_channels;
+
+      if (type == PackedAudioType::INT16) {
+        writer.add(tokens[0], loadSound<short>(audioFile), transcript);
+      } else {
+        writer.add(tokens[0], loadSound<float>(audioFile), transcript);
+      }
+      if (++numSamples % 10000 == 0) {
+        LOG(INFO) << "Packed " << numSamples << " files";
+      }
+    }
+  }
+  writer.close();
+  LOG(INFO) << "Packed " << numSamples << " files into " << FLAGS_packpath;
+  return 0;
+}